@@ -1451,6 +1451,27 @@ typedef struct S3AbortMultipartUploadHandler
 
 } S3AbortMultipartUploadHandler;
 
+// WINSCP
+/**
+ * This callback is made by S3_delete_objects for each object that failed to
+ * be deleted, and unless in quiet mode, also for each deleted object (with
+ * NULL errorCode and errorMessage).
+ **/
+typedef S3Status (S3DeleteObjectsResultCallback)(const char *key,
+                                                 const char *errorCode,
+                                                 const char *errorMessage,
+                                                 void *callbackData);
+
+typedef struct S3DeleteObjectsHandler
+{
+    /**
+     * responseHandler provides the properties and complete callback
+     **/
+    S3ResponseHandler responseHandler;
+
+    S3DeleteObjectsResultCallback *resultCallback;
+} S3DeleteObjectsHandler;
+
 /** **************************************************************************
  * General Library Functions
  ************************************************************************** **/
@@ -1703,6 +1724,11 @@ void S3_set_request_context_response_data_callback(S3RequestContext *requestCont
                                                    void * responseDataCallbackData);
 
 void S3_set_request_context_requester_pays(S3RequestContext *requestContext, int requesterPays);
+
+// Keep the neon session (and its connection) of the last request,
+// and reuse it by the next request to the same server.
+// The context must not be used by more threads at the same time then.
+void S3_set_request_context_keep_session(S3RequestContext *requestContext, int keepSession);
 #else
 /**
  * Runs the S3RequestContext until all requests within it have completed,
@@ -2259,6 +2285,31 @@ void S3_delete_object(const S3BucketContext *bucketContext, const char *key,
                       const S3ResponseHandler *handler, void *callbackData);
 
 
+// WINSCP
+/**
+ * Deletes multiple objects from S3 with one request (POST ?delete).
+ *
+ * @param bucketContext gives the bucket and associated parameters for this
+ *        request
+ * @param keysCount is the number of keys, S3 allows at most 1000
+ * @param keys are the keys of the objects to delete
+ * @param quiet if nonzero, the resultCallback is made for the failed objects
+ *        only
+ * @param requestContext gives the S3RequestContext to perform the request in
+ * @param timeoutMs if not 0 contains total request timeout in milliseconds
+ * @param handler gives the callbacks to call as the request is processed and
+ *        completed
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this request
+ **/
+void S3_delete_objects(const S3BucketContext *bucketContext,
+                       int keysCount, const char **keys, int quiet,
+                       S3RequestContext *requestContext,
+                       int timeoutMs,
+                       const S3DeleteObjectsHandler *handler,
+                       void *callbackData);
+
+
 /** **************************************************************************
  * Access Control List Functions
  ************************************************************************** **/
@@ -53,6 +53,11 @@ struct S3RequestContext
     S3ResponseDataCallback *responseDataCallback;
     void *responseDataCallbackData;
     int requesterPays;
+    // session kept between requests (and its connection with it),
+    // when enabled by S3_set_request_context_keep_session
+    int keepSession;
+    ne_session_s *session;
+    char *sessionKey;
 #else
     CURLM *curlm;
     S3CurlMode curl_mode;
@@ -32,8 +32,12 @@
 
 #include <stdlib.h>
 #include <string.h>
+#ifndef __APPLE__
+    #include <openssl/md5.h>
+#endif
 #include "libs3.h"
 #include "request.h"
+#include "simplexml.h" // WINSCP
 
 
 // put object ----------------------------------------------------------------
@@ -401,3 +405,324 @@ void S3_delete_object(const S3BucketContext *bucketContext, const char *key,
     // Perform the request
     request_perform(&params, requestContext);
 }
+
+
+// delete objects ------------------------------------------------------------
+// WINSCP
+
+#ifndef __APPLE__
+// Defined in bucket_metadata.c
+void generate_content_md5(const char* data, int size,
+                          char* retBuffer, int retBufferSize);
+#endif
+
+typedef struct DeleteObjectsData
+{
+    SimpleXml simpleXml;
+
+    S3ResponsePropertiesCallback *responsePropertiesCallback;
+    S3DeleteObjectsResultCallback *resultCallback;
+    S3ResponseCompleteCallback *responseCompleteCallback;
+    void *callbackData;
+
+    char *xmlDocument;
+    int xmlDocumentLen;
+    int xmlDocumentBytesWritten;
+
+    string_buffer(key, 1024);
+    string_buffer(code, 256);
+    string_buffer(message, 1024);
+} DeleteObjectsData;
+
+
+// Appends XML-escaped str to buffer (if not NULL), returns the length
+static int deleteObjectsAppendEscaped(char *buffer, const char *str)
+{
+    int len = 0;
+    for (; *str; str++) {
+        const char *entity;
+        switch (*str) {
+        case '&': entity = "&amp;"; break;
+        case '<': entity = "&lt;"; break;
+        case '>': entity = "&gt;"; break;
+        case '"': entity = "&quot;"; break;
+        case '\'': entity = "&apos;"; break;
+        default: entity = 0; break;
+        }
+        if (entity) {
+            int entityLen = strlen(entity);
+            if (buffer) {
+                memcpy(&(buffer[len]), entity, entityLen);
+            }
+            len += entityLen;
+        }
+        else {
+            if (buffer) {
+                buffer[len] = *str;
+            }
+            len++;
+        }
+    }
+    return len;
+}
+
+
+static char *generateDeleteObjectsXmlDocument(int keysCount,
+                                              const char **keys, int quiet,
+                                              int *xmlDocumentLenReturn)
+{
+    static const char header[] = "<Delete>";
+    static const char quietElement[] = "<Quiet>true</Quiet>";
+    static const char objectStart[] = "<Object><Key>";
+    static const char objectEnd[] = "</Key></Object>";
+    static const char footer[] = "</Delete>";
+
+    int len = (sizeof(header) - 1) + (sizeof(footer) - 1);
+    if (quiet) {
+        len += sizeof(quietElement) - 1;
+    }
+    int i;
+    for (i = 0; i < keysCount; i++) {
+        len += (sizeof(objectStart) - 1) + (sizeof(objectEnd) - 1) +
+            deleteObjectsAppendEscaped(0, keys[i]);
+    }
+
+    char *xmlDocument = (char *) malloc(len + 1);
+    if (!xmlDocument) {
+        return 0;
+    }
+
+    char *p = xmlDocument;
+#define append_literal(literal)                                     \
+    do {                                                            \
+        memcpy(p, literal, sizeof(literal) - 1);                    \
+        p += sizeof(literal) - 1;                                   \
+    } while (0)
+
+    append_literal(header);
+    if (quiet) {
+        append_literal(quietElement);
+    }
+    for (i = 0; i < keysCount; i++) {
+        append_literal(objectStart);
+        p += deleteObjectsAppendEscaped(p, keys[i]);
+        append_literal(objectEnd);
+    }
+    append_literal(footer);
+    *p = '\0';
+
+#undef append_literal
+
+    *xmlDocumentLenReturn = len;
+    return xmlDocument;
+}
+
+
+static S3Status deleteObjectsXmlCallback(const char *elementPath,
+                                         const char *data, int dataLen,
+                                         void *callbackData)
+{
+    DeleteObjectsData *doData = (DeleteObjectsData *) callbackData;
+
+    int fit;
+
+    if (data) {
+        if (!strcmp(elementPath, "DeleteResult/Deleted/Key") ||
+            !strcmp(elementPath, "DeleteResult/Error/Key")) {
+            string_buffer_append(doData->key, data, dataLen, fit);
+        }
+        else if (!strcmp(elementPath, "DeleteResult/Error/Code")) {
+            string_buffer_append(doData->code, data, dataLen, fit);
+        }
+        else if (!strcmp(elementPath, "DeleteResult/Error/Message")) {
+            string_buffer_append(doData->message, data, dataLen, fit);
+        }
+    }
+    else {
+        S3Status status = S3StatusOK;
+        if (!strcmp(elementPath, "DeleteResult/Deleted")) {
+            status = (*(doData->resultCallback))
+                (doData->key, 0, 0, doData->callbackData);
+        }
+        else if (!strcmp(elementPath, "DeleteResult/Error")) {
+            status = (*(doData->resultCallback))
+                (doData->key, doData->code, doData->message,
+                 doData->callbackData);
+        }
+        else {
+            return S3StatusOK;
+        }
+        string_buffer_initialize(doData->key);
+        string_buffer_initialize(doData->code);
+        string_buffer_initialize(doData->message);
+        return status;
+    }
+
+    (void) fit;
+
+    return S3StatusOK;
+}
+
+
+static S3Status deleteObjectsPropertiesCallback
+    (const S3ResponseProperties *responseProperties, void *callbackData)
+{
+    DeleteObjectsData *doData = (DeleteObjectsData *) callbackData;
+
+    if (doData->responsePropertiesCallback) {
+        return (*(doData->responsePropertiesCallback))
+            (responseProperties, doData->callbackData);
+    }
+    return S3StatusOK;
+}
+
+
+static int deleteObjectsToS3Callback(int bufferSize, char *buffer,
+                                     void *callbackData)
+{
+    DeleteObjectsData *doData = (DeleteObjectsData *) callbackData;
+
+    int remaining = (doData->xmlDocumentLen -
+                     doData->xmlDocumentBytesWritten);
+
+    int toCopy = bufferSize > remaining ? remaining : bufferSize;
+
+    if (!toCopy) {
+        return 0;
+    }
+
+    memcpy(buffer, &(doData->xmlDocument
+                     [doData->xmlDocumentBytesWritten]), toCopy);
+
+    doData->xmlDocumentBytesWritten += toCopy;
+
+    return toCopy;
+}
+
+
+static S3Status deleteObjectsFromS3Callback(int bufferSize,
+                                            const char *buffer,
+                                            void *callbackData)
+{
+    DeleteObjectsData *doData = (DeleteObjectsData *) callbackData;
+
+    return simplexml_add(&(doData->simpleXml), buffer, bufferSize);
+}
+
+
+static void deleteObjectsCompleteCallback(S3Status requestStatus,
+                                          const S3ErrorDetails *s3ErrorDetails,
+                                          void *callbackData)
+{
+    DeleteObjectsData *doData = (DeleteObjectsData *) callbackData;
+
+    (*(doData->responseCompleteCallback))
+        (requestStatus, s3ErrorDetails, doData->callbackData);
+
+    simplexml_deinitialize(&(doData->simpleXml));
+
+    free(doData->xmlDocument);
+    free(doData);
+}
+
+
+void S3_delete_objects(const S3BucketContext *bucketContext,
+                       int keysCount, const char **keys, int quiet,
+                       S3RequestContext *requestContext,
+                       int timeoutMs,
+                       const S3DeleteObjectsHandler *handler,
+                       void *callbackData)
+{
+#ifdef __APPLE__
+    // Content-MD5 is mandatory for this request, see S3_set_lifecycle
+    (*(handler->responseHandler.completeCallback))
+        (S3StatusNotSupported, 0, callbackData);
+    return;
+#else
+    char md5Base64[MD5_DIGEST_LENGTH * 2];
+
+    DeleteObjectsData *doData =
+        (DeleteObjectsData *) malloc(sizeof(DeleteObjectsData));
+    if (!doData) {
+        (*(handler->responseHandler.completeCallback))
+            (S3StatusOutOfMemory, 0, callbackData);
+        return;
+    }
+
+    doData->xmlDocument =
+        generateDeleteObjectsXmlDocument(keysCount, keys, quiet,
+                                         &(doData->xmlDocumentLen));
+    if (!doData->xmlDocument) {
+        free(doData);
+        (*(handler->responseHandler.completeCallback))
+            (S3StatusOutOfMemory, 0, callbackData);
+        return;
+    }
+    doData->xmlDocumentBytesWritten = 0;
+
+    simplexml_initialize(&(doData->simpleXml), &deleteObjectsXmlCallback,
+                         doData);
+
+    doData->responsePropertiesCallback =
+        handler->responseHandler.propertiesCallback;
+    doData->resultCallback = handler->resultCallback;
+    doData->responseCompleteCallback =
+        handler->responseHandler.completeCallback;
+    doData->callbackData = callbackData;
+
+    string_buffer_initialize(doData->key);
+    string_buffer_initialize(doData->code);
+    string_buffer_initialize(doData->message);
+
+    generate_content_md5(doData->xmlDocument, doData->xmlDocumentLen,
+                         md5Base64, sizeof (md5Base64));
+
+    // Set up S3PutProperties
+    S3PutProperties properties =
+    {
+        0,                                       // contentType
+        md5Base64,                               // md5
+        0,                                       // cacheControl
+        0,                                       // contentDispositionFilename
+        0,                                       // contentEncoding
+       -1,                                       // expires
+        (S3CannedAcl)0,                          // cannedAcl
+        0,                                       // metaDataCount
+        0,                                       // metaData
+        0                                        // useServerSideEncryption
+    };
+
+    // Set up the RequestParams
+    RequestParams params =
+    {
+        HttpRequestTypePOST,                          // httpRequestType
+        { bucketContext->hostName,                    // hostName
+          bucketContext->bucketName,                  // bucketName
+          bucketContext->protocol,                    // protocol
+          bucketContext->uriStyle,                    // uriStyle
+          bucketContext->accessKeyId,                 // accessKeyId
+          bucketContext->secretAccessKey,             // secretAccessKey
+          bucketContext->securityToken,               // securityToken
+          bucketContext->authRegion },                // authRegion
+        0,                                            // key
+        0,                                            // queryParams
+        "delete",                                     // subResource
+        0,                                            // copySourceBucketName
+        0,                                            // copySourceKey
+        0,                                            // getConditions
+        0,                                            // startByte
+        0,                                            // byteCount
+        &properties,                                  // putProperties
+        &deleteObjectsPropertiesCallback,             // propertiesCallback
+        &deleteObjectsToS3Callback,                   // toS3Callback
+        doData->xmlDocumentLen,                       // toS3CallbackTotalSize
+        &deleteObjectsFromS3Callback,                 // fromS3Callback
+        &deleteObjectsCompleteCallback,               // completeCallback
+        doData,                                       // callbackData
+        timeoutMs                                     // timeoutMs
+    };
+
+    // Perform the request
+    request_perform(&params, requestContext);
+#endif
+}
@@ -1197,10 +1197,34 @@ static S3Status setup_neon(Request *request,
     {
       port = ne_uri_defaultport(uri.scheme);
     }
-    request->NeonSession = ne_session_create(uri.scheme, uri.host, port);
-    if (request->requestContext->sessionCallback != NULL)
+    S3RequestContext *context = request->requestContext;
+    char sessionKey[S3_MAX_HOSTNAME_SIZE + 64];
+    snprintf(sessionKey, sizeof(sessionKey), "%s://%s:%d", uri.scheme, uri.host, port);
+    if ((context->session != NULL) &&
+        (!context->keepSession || (strcmp(context->sessionKey, sessionKey) != 0)))
     {
-        request->requestContext->sessionCallback(request->NeonSession, request->requestContext->sessionCallbackData);
+        ne_session_destroy(context->session);
+        context->session = NULL;
+        free(context->sessionKey);
+        context->sessionKey = NULL;
+    }
+
+    if (context->session != NULL)
+    {
+        request->NeonSession = context->session;
+    }
+    else
+    {
+        request->NeonSession = ne_session_create(uri.scheme, uri.host, port);
+        if (context->sessionCallback != NULL)
+        {
+            context->sessionCallback(request->NeonSession, context->sessionCallbackData);
+        }
+        if (context->keepSession)
+        {
+            context->session = request->NeonSession;
+            context->sessionKey = strdup(sessionKey);
+        }
     }
 
     char method[64];
@@ -1337,7 +1361,11 @@ static S3Status setup_neon(Request *request,
 static void request_deinitialize(Request *request)
 {
     ne_request_destroy(request->NeonRequest);
-    ne_session_destroy(request->NeonSession);
+    // WINSCP (the kept session is owned by the context)
+    if (request->NeonSession != request->requestContext->session)
+    {
+        ne_session_destroy(request->NeonSession);
+    }
 
     error_parser_deinitialize(&(request->errorParser));
 }
@@ -1766,6 +1794,13 @@ void request_finish(Request *request, NeonCode code)
         (request->status, &errorDetails, // WINSCP
          request->callbackData);
 
+    // WINSCP (do not reuse a connection that a failed request may have left in an unknown state)
+    if ((request->status != S3StatusOK) &&
+        (request->NeonSession == request->requestContext->session))
+    {
+        ne_close_connection(request->NeonSession);
+    }
+
     request_release(request);
     } // WINSCP
 }
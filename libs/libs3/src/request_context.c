@@ -104,6 +104,11 @@ void S3_destroy_request_context(S3RequestContext *requestContext)
 
     if (requestContext->curl_mode == S3CurlModeMultiPerform)
         curl_multi_cleanup(requestContext->curlm);
+#else
+    if (requestContext->session != NULL) {
+        ne_session_destroy(requestContext->session);
+    }
+    free(requestContext->sessionKey);
 #endif
 
     free(requestContext);
@@ -141,6 +146,11 @@ void S3_set_request_context_requester_pays(S3RequestContext *requestContext, int
     requestContext->requesterPays = requesterPays;
 }
 
+void S3_set_request_context_keep_session(S3RequestContext *requestContext, int keepSession)
+{
+    requestContext->keepSession = keepSession;
+}
+
 #else
 
 S3Status S3_runall_request_context(S3RequestContext *requestContext)
@@ -14,6 +14,7 @@
 #include "Security.h"
 #include "FileMasks.h"
 #include "CopyParam.h"
+#include "FileOperationProgress.h"
 #include <shlobj.h>
 #include <System.IOUtils.hpp>
 #include <System.StrUtils.hpp>
@@ -44,6 +45,7 @@ const UnicodeString DirectoryStatisticsCacheKey(L"DirectoryStatisticsCache");
 const UnicodeString SshHostCAsKey(L"SshHostCAs");
 const UnicodeString CDCacheKey(L"CDCache");
 const UnicodeString BannersKey(L"Banners");
+const UnicodeString MultipartUploadsStorageKey(L"MultipartUploads");
 //---------------------------------------------------------------------------
 const UnicodeString OpensshFolderName(L".ssh");
 const UnicodeString OpensshAuthorizedKeysFileName(L"authorized_keys");
@@ -179,6 +181,8 @@ __fastcall TConfiguration::TConfiguration()
   FDefaultCollectUsage = IsUWP();
   FScripting = false;
   FSshHostCAList.reset(new TSshHostCAList());
+  // Root of the speed limits, shared by all transfers of all sessions
+  FBandwidthLimiter.reset(new TBandwidthLimiter(NULL));
 
   UnicodeString RandomSeedPath;
   if (!GetEnvironmentVariable(L"APPDATA").IsEmpty())
@@ -246,6 +250,8 @@ void __fastcall TConfiguration::Default()
   FScriptProgressFileNameLimit = 25;
   FQueueTransfersLimit = 2;
   FParallelTransferThreshold = -1; // default (currently off), 0 = explicitly off
+  FGlobalCPSLimit = 0;
+  FBandwidthLimiter->SetLimit(FGlobalCPSLimit);
   FKeyVersion = 0;
   FSshHostCAList->Default();
   RefreshPuttySshHostCAList();
@@ -389,6 +395,7 @@ UnicodeString __fastcall TConfiguration::PropertyToKey(const UnicodeString & Pro
     KEY(Integer,  ScriptProgressFileNameLimit); \
     KEY(Integer,  QueueTransfersLimit); \
     KEY(Integer,  ParallelTransferThreshold); \
+    KEY(Integer,  GlobalCPSLimit); \
     KEY(Integer,  KeyVersion); \
     KEY(Bool,     SshHostCAsFromPuTTY); \
     KEY(Integer,  HttpsCertificateValidation); \
@@ -712,6 +719,7 @@ void __fastcall TConfiguration::CopyData(THierarchicalStorage * Source,
 
     CopyAllStringsInSubKey(Source, Target, BannersKey);
     CopyAllStringsInSubKey(Source, Target, LastFingerprintsStorageKey);
+    CopyAllStringsInSubKey(Source, Target, MultipartUploadsStorageKey);
 
     Target->CloseSubKey();
     Source->CloseSubKey();
@@ -863,6 +871,45 @@ UnicodeString __fastcall TConfiguration::LastFingerprint(const UnicodeString & S
   return Result;
 }
 //---------------------------------------------------------------------------
+void __fastcall TConfiguration::RememberMultipartUpload(const UnicodeString & UploadKey, const UnicodeString & Upload)
+{
+  std::unique_ptr<THierarchicalStorage> Storage(CreateConfigStorage());
+  Storage->AccessMode = smReadWrite;
+
+  if (Storage->OpenSubKey(ConfigurationSubKey, true) &&
+      Storage->OpenSubKey(MultipartUploadsStorageKey, true))
+  {
+    Storage->WriteString(UploadKey, Upload);
+  }
+}
+//---------------------------------------------------------------------------
+UnicodeString __fastcall TConfiguration::RememberedMultipartUpload(const UnicodeString & UploadKey)
+{
+  UnicodeString Result;
+
+  std::unique_ptr<THierarchicalStorage> Storage(CreateConfigStorage());
+  Storage->AccessMode = smRead;
+
+  if (Storage->OpenSubKey(ConfigurationSubKey, false) &&
+      Storage->OpenSubKey(MultipartUploadsStorageKey, false))
+  {
+    Result = Storage->ReadString(UploadKey, L"");
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+void __fastcall TConfiguration::ForgetMultipartUpload(const UnicodeString & UploadKey)
+{
+  std::unique_ptr<THierarchicalStorage> Storage(CreateConfigStorage());
+  Storage->AccessMode = smReadWrite;
+
+  if (Storage->OpenSubKey(ConfigurationSubKey, false) &&
+      Storage->OpenSubKey(MultipartUploadsStorageKey, false))
+  {
+    Storage->DeleteValue(UploadKey);
+  }
+}
+//---------------------------------------------------------------------------
 void __fastcall TConfiguration::Changed()
 {
   TNotifyEvent AOnChange = NULL;
@@ -994,6 +1041,7 @@ TStrings * TConfiguration::GetCaches()
   Result->Add(TPath::Combine(ConfigurationSubKey, CDCacheKey));
   Result->Add(TPath::Combine(ConfigurationSubKey, BannersKey));
   Result->Add(TPath::Combine(ConfigurationSubKey, LastFingerprintsStorageKey));
+  // MultipartUploadsStorageKey is not a cache, without it the kept uploads could be neither resumed nor aborted
   return Result.release();
 }
 //---------------------------------------------------------------------------
@@ -2304,6 +2352,16 @@ void TConfiguration::SetQueueTransfersLimit(int value)
   SET_CONFIG_PROPERTY(QueueTransfersLimit);
 }
 //---------------------------------------------------------------------------
+void TConfiguration::SetGlobalCPSLimit(int value)
+{
+  SET_CONFIG_PROPERTY_EX(GlobalCPSLimit, FBandwidthLimiter->SetLimit(value));
+}
+//---------------------------------------------------------------------------
+TBandwidthLimiter * TConfiguration::GetBandwidthLimiter()
+{
+  return FBandwidthLimiter.get();
+}
+//---------------------------------------------------------------------------
 const TSshHostCAList * TConfiguration::GetSshHostCAList()
 {
   return FSshHostCAList.get();
@@ -20,6 +20,7 @@ enum TAutoSwitch { asOn, asOff, asAuto }; // Has to match PuTTY FORCE_ON, FORCE_
 //---------------------------------------------------------------------------
 class TStoredSessionList;
 class TCopyParamType;
+class TBandwidthLimiter;
 //---------------------------------------------------------------------------
 class TSshHostCA
 {
@@ -119,6 +120,8 @@ private:
   int FKeyVersion;
   int FQueueTransfersLimit;
   int FParallelTransferThreshold;
+  int FGlobalCPSLimit;
+  std::unique_ptr<TBandwidthLimiter> FBandwidthLimiter;
   UnicodeString FCertificateStorage;
   UnicodeString FAWSMetadataService;
   UnicodeString FChecksumCommands;
@@ -201,6 +204,8 @@ private:
   void SetLocalPortNumberMin(int value);
   void SetLocalPortNumberMax(int value);
   void SetQueueTransfersLimit(int value);
+  void SetGlobalCPSLimit(int value);
+  TBandwidthLimiter * GetBandwidthLimiter();
   const TSshHostCAList * GetSshHostCAList();
   void SetSshHostCAList(const TSshHostCAList * value);
   const TSshHostCAList * GetPuttySshHostCAList();
@@ -305,6 +310,9 @@ public:
   void __fastcall SetBannerParams(const UnicodeString & SessionKey, unsigned int Params);
   void __fastcall RememberLastFingerprint(const UnicodeString & SiteKey, const UnicodeString & FingerprintType, const UnicodeString & Fingerprint);
   UnicodeString __fastcall LastFingerprint(const UnicodeString & SiteKey, const UnicodeString & FingerprintType);
+  void __fastcall RememberMultipartUpload(const UnicodeString & UploadKey, const UnicodeString & Upload);
+  UnicodeString __fastcall RememberedMultipartUpload(const UnicodeString & UploadKey);
+  void __fastcall ForgetMultipartUpload(const UnicodeString & UploadKey);
   THierarchicalStorage * CreateConfigStorage();
   THierarchicalStorage * CreateConfigRegistryStorage();
   virtual THierarchicalStorage * CreateScpStorage(bool & SessionList);
@@ -397,6 +405,8 @@ public:
   __property int ScriptProgressFileNameLimit = { read = FScriptProgressFileNameLimit, write = FScriptProgressFileNameLimit };
   __property int QueueTransfersLimit = { read = FQueueTransfersLimit, write = SetQueueTransfersLimit };
   __property int ParallelTransferThreshold = { read = FParallelTransferThreshold, write = FParallelTransferThreshold };
+  __property int GlobalCPSLimit = { read = FGlobalCPSLimit, write = SetGlobalCPSLimit };
+  __property TBandwidthLimiter * BandwidthLimiter = { read = GetBandwidthLimiter };
   __property int KeyVersion = { read = FKeyVersion, write = FKeyVersion };
   __property TSshHostCAList * SshHostCAList = { read = GetSshHostCAList, write = SetSshHostCAList };
   __property TSshHostCAList * PuttySshHostCAList = { read = GetPuttySshHostCAList };
@@ -318,6 +318,7 @@ void __fastcall TFileMasks::Clear()
   for (size_t Index = 0; Index < LENOF(FMasks); Index++)
   {
     Clear(FMasks[Index]);
+    FMaskIndexes[Index] = TMaskIndex();
   }
 }
 //---------------------------------------------------------------------------
@@ -334,98 +335,143 @@ void __fastcall TFileMasks::Clear(TMasks & Masks)
   Masks.clear();
 }
 //---------------------------------------------------------------------------
-bool __fastcall TFileMasks::MatchesMasks(
-  const UnicodeString & FileName, bool Local, bool Directory,
-  const UnicodeString & Path, const TParams * Params, const TMasks & Masks, bool Recurse)
+bool TFileMasks::MatchesMask(
+  const TMask & Mask, const UnicodeString & FileName, bool Local, const UnicodeString & Path, const TParams * Params,
+  bool FileNameMatched)
 {
-  bool Result = false;
+  Masks::TMask * DirectoryMask = Local ? Mask.LocalDirectoryMask : Mask.RemoteDirectoryMask;
+  bool Result =
+    MatchesMaskMask(Mask.DirectoryMaskKind, DirectoryMask, Path) &&
+    (FileNameMatched || MatchesMaskMask(Mask.FileNameMaskKind, Mask.FileNameMask, FileName));
 
-  TMasks::const_iterator I = Masks.begin();
-  while (!Result && (I != Masks.end()))
+  if (Result)
   {
-    const TMask & Mask = *I;
-    Masks::TMask * DirectoryMask = Local ? Mask.LocalDirectoryMask : Mask.RemoteDirectoryMask;
-    Result =
-      MatchesMaskMask(Mask.DirectoryMaskKind, DirectoryMask, Path) &&
-      MatchesMaskMask(Mask.FileNameMaskKind, Mask.FileNameMask, FileName);
+    bool HasSize = (Params != NULL);
 
-    if (Result)
+    switch (Mask.HighSizeMask)
     {
-      bool HasSize = (Params != NULL);
+      case TMask::None:
+        Result = true;
+        break;
+
+      case TMask::Open:
+        Result = HasSize && (Params->Size < Mask.HighSize);
+        break;
+
+      case TMask::Close:
+        Result = HasSize && (Params->Size <= Mask.HighSize);
+        break;
+    }
 
-      switch (Mask.HighSizeMask)
+    if (Result)
+    {
+      switch (Mask.LowSizeMask)
       {
         case TMask::None:
           Result = true;
           break;
 
         case TMask::Open:
-          Result = HasSize && (Params->Size < Mask.HighSize);
+          Result = HasSize && (Params->Size > Mask.LowSize);
           break;
 
         case TMask::Close:
-          Result = HasSize && (Params->Size <= Mask.HighSize);
+          Result = HasSize && (Params->Size >= Mask.LowSize);
           break;
       }
+    }
 
-      if (Result)
+    bool HasModification = (Params != NULL);
+
+    if (Result)
+    {
+      switch (Mask.HighModificationMask)
       {
-        switch (Mask.LowSizeMask)
-        {
-          case TMask::None:
-            Result = true;
-            break;
+        case TMask::None:
+          Result = true;
+          break;
 
-          case TMask::Open:
-            Result = HasSize && (Params->Size > Mask.LowSize);
-            break;
+        case TMask::Open:
+          Result = HasModification && (Params->Modification < Mask.HighModification);
+          break;
 
-          case TMask::Close:
-            Result = HasSize && (Params->Size >= Mask.LowSize);
-            break;
-        }
+        case TMask::Close:
+          Result = HasModification && (Params->Modification <= Mask.HighModification);
+          break;
       }
+    }
 
-      bool HasModification = (Params != NULL);
-
-      if (Result)
+    if (Result)
+    {
+      switch (Mask.LowModificationMask)
       {
-        switch (Mask.HighModificationMask)
-        {
-          case TMask::None:
-            Result = true;
-            break;
+        case TMask::None:
+          Result = true;
+          break;
 
-          case TMask::Open:
-            Result = HasModification && (Params->Modification < Mask.HighModification);
-            break;
+        case TMask::Open:
+          Result = HasModification && (Params->Modification > Mask.LowModification);
+          break;
 
-          case TMask::Close:
-            Result = HasModification && (Params->Modification <= Mask.HighModification);
-            break;
-        }
+        case TMask::Close:
+          Result = HasModification && (Params->Modification >= Mask.LowModification);
+          break;
       }
+    }
+  }
 
-      if (Result)
-      {
-        switch (Mask.LowModificationMask)
-        {
-          case TMask::None:
-            Result = true;
-            break;
+  return Result;
+}
+//---------------------------------------------------------------------------
+bool TFileMasks::MatchesMaskBucket(
+  const TMaskBuckets & Buckets, const UnicodeString & Key, const UnicodeString & FileName, bool Local,
+  const UnicodeString & Path, const TParams * Params, const TMasks & Masks)
+{
+  bool Result = false;
+  TMaskBuckets::const_iterator Bucket = Buckets.find(Key);
+  if (Bucket != Buckets.end())
+  {
+    // The file name part of the masks in the bucket matches by definition
+    TMaskIndexes::const_iterator I = Bucket->second.begin();
+    while (!Result && (I != Bucket->second.end()))
+    {
+      Result = MatchesMask(Masks[*I], FileName, Local, Path, Params, true);
+      I++;
+    }
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+bool __fastcall TFileMasks::MatchesMasks(
+  const UnicodeString & FileName, bool Local, bool Directory,
+  const UnicodeString & Path, const TParams * Params, const TMasks & Masks, const TMaskIndex & Index, bool Recurse)
+{
+  bool Result = false;
 
-          case TMask::Open:
-            Result = HasModification && (Params->Modification > Mask.LowModification);
-            break;
+  TMaskIndexes::const_iterator I = Index.Others.begin();
+  while (!Result && (I != Index.Others.end()))
+  {
+    Result = MatchesMask(Masks[*I], FileName, Local, Path, Params, false);
+    I++;
+  }
 
-          case TMask::Close:
-            Result = HasModification && (Params->Modification >= Mask.LowModification);
-            break;
-        }
+  if (!Result && (!Index.Names.empty() || !Index.Extensions.empty()))
+  {
+    // Masks::TMask matches case-insensitively
+    UnicodeString Key = AnsiUpperCase(FileName);
+    Result = MatchesMaskBucket(Index.Names, Key, FileName, Local, Path, Params, Masks);
+
+    if (!Index.Extensions.empty())
+    {
+      // "*.ext" matches when the name ends with ".ext", try each suffix starting with a dot
+      int P = Key.Pos(L".");
+      while (!Result && (P > 0))
+      {
+        UnicodeString Extension = Key.SubString(P, Key.Length() - P + 1);
+        Result = MatchesMaskBucket(Index.Extensions, Extension, FileName, Local, Path, Params, Masks);
+        P = PosEx(L".", Key, P + 1);
       }
     }
-
-    I++;
   }
 
   if (!Result && Directory && !IsUnixRootPath(Path) && Recurse)
@@ -436,7 +482,7 @@ bool __fastcall TFileMasks::MatchesMasks(
     // Currently it includes Size/Time only, what is not used for directories.
     // So it depends on future use. Possibly we should make a copy
     // and pass on only relevant fields.
-    Result = MatchesMasks(ParentFileName, Local, true, ParentPath, Params, Masks, Recurse);
+    Result = MatchesMasks(ParentFileName, Local, true, ParentPath, Params, Masks, Index, Recurse);
   }
 
   return Result;
@@ -447,10 +493,12 @@ bool TFileMasks::DoMatches(
   bool RecurseInclude, bool & ImplicitMatch) const
 {
   bool ImplicitIncludeMatch = (FAllDirsAreImplicitlyIncluded && Directory) || FMasks[MASK_INDEX(Directory, true)].empty();
-  bool ExplicitIncludeMatch = MatchesMasks(FileName, Local, Directory, Path, Params, FMasks[MASK_INDEX(Directory, true)], RecurseInclude);
+  bool ExplicitIncludeMatch = MatchesMasks(FileName, Local, Directory, Path, Params, FMasks[MASK_INDEX(Directory, true)],
+    FMaskIndexes[MASK_INDEX(Directory, true)], RecurseInclude);
   bool Result =
     (ImplicitIncludeMatch || ExplicitIncludeMatch) &&
-    !MatchesMasks(FileName, Local, Directory, Path, Params, FMasks[MASK_INDEX(Directory, false)], false);
+    !MatchesMasks(FileName, Local, Directory, Path, Params, FMasks[MASK_INDEX(Directory, false)],
+      FMaskIndexes[MASK_INDEX(Directory, false)], false);
   ImplicitMatch =
     Result && ImplicitIncludeMatch && !ExplicitIncludeMatch &&
     ((Directory && FNoImplicitMatchWithDirExcludeMask) || FMasks[MASK_INDEX(Directory, false)].empty());
@@ -583,6 +631,7 @@ void __fastcall TFileMasks::CreateMask(
   Mask.HighModificationMask = TMask::None;
   Mask.LowModificationMask = TMask::None;
 
+  UnicodeString FileNameMaskStr;
   wchar_t NextPartDelimiter = L'\0';
   int NextPartFrom = 1;
   while (NextPartFrom <= MaskStr.Length())
@@ -718,19 +767,49 @@ void __fastcall TFileMasks::CreateMask(
         {
           Mask.LocalDirectoryMask = DoCreateMaskMask(LocalDirectoryMaskStr);
         }
+        FileNameMaskStr = PartStr.SubString(D + 1, PartStr.Length() - D);
         CreateMaskMask(
-          PartStr.SubString(D + 1, PartStr.Length() - D),
-          PartStart + D, PartEnd, true,
+          FileNameMaskStr, PartStart + D, PartEnd, true,
           Mask.FileNameMaskKind, Mask.FileNameMask);
       }
       else
       {
+        FileNameMaskStr = PartStr;
         CreateMaskMask(PartStr, PartStart, PartEnd, true, Mask.FileNameMaskKind, Mask.FileNameMask);
       }
     }
   }
 
-  FMasks[MASK_INDEX(Directory, Include)].push_back(Mask);
+  int Index = MASK_INDEX(Directory, Include);
+  FMasks[Index].push_back(Mask);
+  IndexMask(FMasks[Index], FMaskIndexes[Index], FileNameMaskStr);
+}
+//---------------------------------------------------------------------------
+void TFileMasks::IndexMask(const TMasks & Masks, TMaskIndex & Index, const UnicodeString & FileNameMaskStr)
+{
+  size_t MaskIndex = Masks.size() - 1;
+  const TMask & Mask = Masks[MaskIndex];
+  const UnicodeString Wildcards = L"*?[";
+  const UnicodeString ExtensionPrefix = L"*.";
+  if (Mask.FileNameMaskKind != TMask::TKind::Regular)
+  {
+    Index.Others.push_back(MaskIndex);
+  }
+  else if (FileNameMaskStr.LastDelimiter(Wildcards) == 0)
+  {
+    Index.Names[AnsiUpperCase(FileNameMaskStr)].push_back(MaskIndex);
+  }
+  else if (StartsStr(ExtensionPrefix, FileNameMaskStr) &&
+           (FileNameMaskStr.Length() > ExtensionPrefix.Length()) &&
+           (FileNameMaskStr.LastDelimiter(Wildcards) == 1))
+  {
+    // Keep the dot in the key, to match the suffixes looked up in MatchesMasks
+    Index.Extensions[AnsiUpperCase(FileNameMaskStr.SubString(2, FileNameMaskStr.Length() - 1))].push_back(MaskIndex);
+  }
+  else
+  {
+    Index.Others.push_back(MaskIndex);
+  }
 }
 //---------------------------------------------------------------------------
 TStrings * __fastcall TFileMasks::GetMasksStr(int Index) const
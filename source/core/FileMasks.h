@@ -3,6 +3,7 @@
 #define FileMasksH
 //---------------------------------------------------------------------------
 #include <vector>
+#include <map>
 #include <Masks.hpp>
 //---------------------------------------------------------------------------
 class EFileMasksException : public Exception
@@ -104,6 +105,19 @@ private:
 
   typedef std::vector<TMask> TMasks;
   TMasks FMasks[4];
+
+  // Masks whose file name part is a plain name or a "*.ext" pattern are bucketed
+  // by the upper-cased name or extension, so that large lists of such masks
+  // do not need to be walked mask by mask. The rest is matched one by one.
+  typedef std::vector<size_t> TMaskIndexes;
+  typedef std::map<UnicodeString, TMaskIndexes> TMaskBuckets;
+  struct TMaskIndex
+  {
+    TMaskBuckets Names;
+    TMaskBuckets Extensions;
+    TMaskIndexes Others;
+  };
+  TMaskIndex FMaskIndexes[4];
   mutable TStrings * FMasksStr[4];
 
   void __fastcall SetStr(const UnicodeString value, bool SingleMask);
@@ -122,7 +136,14 @@ private:
   static void __fastcall TrimEx(UnicodeString & Str, int & Start, int & End);
   static bool __fastcall MatchesMasks(
     const UnicodeString & FileName, bool Local, bool Directory,
-    const UnicodeString & Path, const TParams * Params, const TMasks & Masks, bool Recurse);
+    const UnicodeString & Path, const TParams * Params, const TMasks & Masks, const TMaskIndex & Index, bool Recurse);
+  static bool MatchesMask(
+    const TMask & Mask, const UnicodeString & FileName, bool Local, const UnicodeString & Path, const TParams * Params,
+    bool FileNameMatched);
+  static bool MatchesMaskBucket(
+    const TMaskBuckets & Buckets, const UnicodeString & Key, const UnicodeString & FileName, bool Local,
+    const UnicodeString & Path, const TParams * Params, const TMasks & Masks);
+  static void IndexMask(const TMasks & Masks, TMaskIndex & Index, const UnicodeString & FileNameMaskStr);
   static inline bool MatchesMaskMask(TMask::TKind MaskKind, Masks::TMask * MaskMask, const UnicodeString & Str);
   static Masks::TMask * DoCreateMaskMask(const UnicodeString & Str);
   void __fastcall ThrowError(int Start, int End);
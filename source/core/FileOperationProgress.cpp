@@ -8,6 +8,10 @@
 #include "Interface.h"
 //---------------------------------------------------------------------------
 #define TRANSFER_BUF_SIZE 32768
+// How much the bucket can hold, i.e. the longest burst
+const unsigned int BandwidthBurstMSecs = 250;
+// Do not release less than this worth of bytes, to avoid flooding the connection with tiny packets
+const unsigned int BandwidthMinChunkMSecs = 10;
 //---------------------------------------------------------------------------
 TFileOperationStatistics::TFileOperationStatistics()
 {
@@ -15,6 +19,126 @@ TFileOperationStatistics::TFileOperationStatistics()
 }
 //---------------------------------------------------------------------------
 //---------------------------------------------------------------------------
+TBandwidthLimiter::TBandwidthLimiter(TBandwidthLimiter * Parent)
+{
+  FSection = new TCriticalSection();
+  FParent = Parent;
+  FLimit = 0;
+  FTokens = 0;
+  FLastTicks = GetTickCount();
+}
+//---------------------------------------------------------------------------
+TBandwidthLimiter::~TBandwidthLimiter()
+{
+  delete FSection;
+}
+//---------------------------------------------------------------------------
+void TBandwidthLimiter::SetParent(TBandwidthLimiter * Parent)
+{
+  DebugAssert(Parent != this);
+  FParent = Parent;
+}
+//---------------------------------------------------------------------------
+void TBandwidthLimiter::SetLimit(unsigned long Limit)
+{
+  // Unguarded check, as this is called for every block
+  if (FLimit != Limit)
+  {
+    TGuard Guard(FSection);
+    FLimit = Limit;
+    // Start with an empty bucket, so that the change does not allow a burst
+    FTokens = 0;
+    FLastTicks = GetTickCount();
+  }
+}
+//---------------------------------------------------------------------------
+unsigned long TBandwidthLimiter::GetLimit()
+{
+  return FLimit;
+}
+//---------------------------------------------------------------------------
+void TBandwidthLimiter::Refill(unsigned int Ticks)
+{
+  // unsigned arithmetics handles the ticks wrap after 49.7 days
+  unsigned int Elapsed = Ticks - FLastTicks;
+  FLastTicks = Ticks;
+  // bytes per second * milliseconds = thousandths of a byte
+  __int64 Capacity = static_cast<__int64>(FLimit) * BandwidthBurstMSecs;
+  FTokens = std::min(FTokens + static_cast<__int64>(FLimit) * Elapsed, Capacity);
+}
+//---------------------------------------------------------------------------
+void TBandwidthLimiter::Check(unsigned int Ticks, unsigned long Size, unsigned long & Result, unsigned int & Wait)
+{
+  TGuard Guard(FSection);
+  if (FLimit > 0)
+  {
+    Refill(Ticks);
+
+    __int64 MinChunk = std::max(static_cast<__int64>(FLimit) * BandwidthMinChunkMSecs / MSecsPerSec, 1LL);
+    MinChunk = std::min(MinChunk, static_cast<__int64>(Size));
+    __int64 Tokens = FTokens / MSecsPerSec;
+    if (Tokens < MinChunk)
+    {
+      Result = 0;
+      __int64 Missing = (MinChunk * MSecsPerSec) - FTokens;
+      unsigned int ChunkWait = static_cast<unsigned int>((Missing + FLimit - 1) / FLimit);
+      Wait = std::max(Wait, ChunkWait);
+    }
+    else if (Tokens < Result)
+    {
+      Result = static_cast<unsigned long>(Tokens);
+    }
+  }
+}
+//---------------------------------------------------------------------------
+unsigned long TBandwidthLimiter::Available(unsigned long Size, unsigned int MaxWait)
+{
+  unsigned int Start = GetTickCount();
+  unsigned long Result;
+  while (true)
+  {
+    unsigned int Ticks = GetTickCount();
+    unsigned int Wait = 0;
+    Result = Size;
+    for (TBandwidthLimiter * Limiter = this; Limiter != NULL; Limiter = Limiter->FParent)
+    {
+      Limiter->Check(Ticks, Size, Result, Wait);
+    }
+
+    unsigned int Waited = Ticks - Start;
+    if ((Result > 0) || (Size == 0) || (Waited >= MaxWait))
+    {
+      break;
+    }
+
+    SleepEx(std::min(Wait, MaxWait - Waited), true);
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+void TBandwidthLimiter::Consume(unsigned long Size)
+{
+  for (TBandwidthLimiter * Limiter = this; Limiter != NULL; Limiter = Limiter->FParent)
+  {
+    if (Limiter->FLimit > 0)
+    {
+      TGuard Guard(Limiter->FSection);
+      Limiter->FTokens -= static_cast<__int64>(Size) * MSecsPerSec;
+    }
+  }
+}
+//---------------------------------------------------------------------------
+unsigned long TBandwidthLimiter::Acquire(unsigned long Size, unsigned int MaxWait)
+{
+  unsigned long Result = Available(Size, MaxWait);
+  if (Result > 0)
+  {
+    Consume(Result);
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+//---------------------------------------------------------------------------
 TFileOperationProgressType::TPersistence::TPersistence()
 {
   FStatistics = NULL;
@@ -76,12 +200,14 @@ __fastcall TFileOperationProgressType::~TFileOperationProgressType()
   DebugAssert(!Suspended || FReset);
   SAFE_DESTROY(FSection);
   SAFE_DESTROY(FUserSelectionsSection);
+  SAFE_DESTROY(FBandwidthLimiter);
 }
 //---------------------------------------------------------------------------
 void __fastcall TFileOperationProgressType::Init()
 {
   FSection = new TCriticalSection();
   FUserSelectionsSection = new TCriticalSection();
+  FBandwidthLimiter = new TBandwidthLimiter(Configuration->BandwidthLimiter);
   FRestored = false;
   FPersistence.Side = osCurrent; // = undefined value
 }
@@ -90,6 +216,7 @@ void __fastcall TFileOperationProgressType::Assign(const TFileOperationProgressT
 {
   TValueRestorer<TCriticalSection *> SectionRestorer(FSection);
   TValueRestorer<TCriticalSection *> UserSelectionsSectionRestorer(FUserSelectionsSection);
+  TValueRestorer<TBandwidthLimiter *> BandwidthLimiterRestorer(FBandwidthLimiter);
   TGuard Guard(FSection);
   TGuard OtherGuard(Other.FSection);
 
@@ -150,7 +277,6 @@ void __fastcall TFileOperationProgressType::ClearTransfer()
   FSkippedSize = 0;
   FTransferredSize = 0;
   FTransferringFile = false;
-  FLastSecond = 0;
 }
 //---------------------------------------------------------------------------
 void __fastcall TFileOperationProgressType::Start(TFileOperation AOperation,
@@ -332,12 +458,16 @@ void __fastcall TFileOperationProgressType::Finish(UnicodeString FileName,
 }
 //---------------------------------------------------------------------------
 void __fastcall TFileOperationProgressType::Succeeded(int Count)
+{
+  Succeeded(FTransferredSize - FSkippedSize, Count);
+}
+//---------------------------------------------------------------------------
+void __fastcall TFileOperationProgressType::Succeeded(__int64 Transferred, int Count)
 {
   if (FPersistence.Statistics != NULL)
   {
     if (IsTransfer())
     {
-      __int64 Transferred = FTransferredSize - FSkippedSize;
       if (Side == osLocal)
       {
         FPersistence.Statistics->FilesUploaded += Count;
@@ -434,41 +564,22 @@ unsigned long __fastcall TFileOperationProgressType::AdjustToCPSLimit(
 {
   SetSpeedCounters();
 
-  // CPSLimit reader is guarded, we cannot block whole method as it can last long.
-  if (CPSLimit > 0)
-  {
-    // we must not return 0, hence, if we reach zero,
-    // we wait until the next second
-    do
+  unsigned long Result = Size;
+  if (Size > 0)
+  {
+    TBandwidthLimiter * Limiter = GetBandwidthLimiter();
+    // CPSLimit reader is guarded, we cannot block whole method as it can last long.
+    Limiter->SetLimit(CPSLimit);
+    // we must not return 0, hence, if nothing is available,
+    // we wait until the buckets fill up
+    while ((Result = Limiter->Acquire(Size, 100)) == 0)
     {
-      unsigned int Second = (GetTickCount() / MSecsPerSec);
-
-      if (Second != FLastSecond)
-      {
-        FRemainingCPS = CPSLimit;
-        FLastSecond = Second;
-      }
-
-      if (FRemainingCPS == 0)
-      {
-        SleepEx(100, true);
-        DoProgress();
-      }
-    }
-    while ((CPSLimit > 0) && (FRemainingCPS == 0));
-
-    // CPSLimit may have been dropped in DoProgress
-    if (CPSLimit > 0)
-    {
-      if (FRemainingCPS < Size)
-      {
-        Size = FRemainingCPS;
-      }
-
-      FRemainingCPS -= Size;
+      DoProgress();
+      // CPSLimit may have been changed in DoProgress
+      Limiter->SetLimit(CPSLimit);
     }
   }
-  return Size;
+  return Result;
 }
 //---------------------------------------------------------------------------
 // Use in SCP protocol only
@@ -598,6 +709,17 @@ unsigned long __fastcall TFileOperationProgressType::GetCPSLimit()
   return Result;
 }
 //---------------------------------------------------------------------------
+TBandwidthLimiter * __fastcall TFileOperationProgressType::GetBandwidthLimiter()
+{
+  // Parallel transfers of one operation share the operation limit
+  return (FParent != NULL) ? FParent->GetBandwidthLimiter() : FBandwidthLimiter;
+}
+//---------------------------------------------------------------------------
+void __fastcall TFileOperationProgressType::SetBandwidthLimiterParent(TBandwidthLimiter * Parent)
+{
+  FBandwidthLimiter->SetParent(Parent);
+}
+//---------------------------------------------------------------------------
 void __fastcall TFileOperationProgressType::SetCPSLimit(unsigned long ACPSLimit)
 {
   if (FParent != NULL)
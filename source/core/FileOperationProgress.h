@@ -33,6 +33,40 @@ public:
   __int64 TotalDownloaded;
 };
 //---------------------------------------------------------------------------
+// Token bucket with millisecond refill. The limiters form a hierarchy
+// (all transfers -> session -> operation), bytes are available only when
+// all limiters up the chain have them. Zero limit means unlimited.
+class TBandwidthLimiter
+{
+public:
+  TBandwidthLimiter(TBandwidthLimiter * Parent);
+  ~TBandwidthLimiter();
+
+  void SetParent(TBandwidthLimiter * Parent);
+  void SetLimit(unsigned long Limit);
+  unsigned long GetLimit();
+
+  // How many of Size bytes can be transferred now, waiting up to MaxWait
+  // milliseconds for the bucket to fill. Does not consume anything.
+  unsigned long Available(unsigned long Size, unsigned int MaxWait);
+  // Account bytes actually transferred
+  void Consume(unsigned long Size);
+  // Available + Consume
+  unsigned long Acquire(unsigned long Size, unsigned int MaxWait);
+
+private:
+  TCriticalSection * FSection;
+  TBandwidthLimiter * FParent;
+  unsigned long FLimit;
+  // in thousandths of a byte, can go negative, when more than available
+  // was consumed by concurrent transfers
+  __int64 FTokens;
+  unsigned int FLastTicks;
+
+  void Refill(unsigned int Ticks);
+  void Check(unsigned int Ticks, unsigned long Size, unsigned long & Result, unsigned int & Wait);
+};
+//---------------------------------------------------------------------------
 class TFileOperationProgressType
 {
 public:
@@ -93,8 +127,7 @@ private:
   TFileOperationProgressEvent FOnProgress;
   TFileOperationFinished FOnFinished;
   bool FReset;
-  unsigned int FLastSecond;
-  unsigned long FRemainingCPS;
+  TBandwidthLimiter * FBandwidthLimiter;
   TOnceDoneOperation FInitialOnceDoneOperation;
   TPersistence FPersistence;
   TCriticalSection * FSection;
@@ -104,6 +137,7 @@ private:
   __int64 __fastcall GetOperationTransferred() const;
   __int64 __fastcall GetTotalSize();
   unsigned long __fastcall GetCPSLimit();
+  TBandwidthLimiter * __fastcall GetBandwidthLimiter();
   TBatchOverwrite __fastcall GetBatchOverwrite();
   bool __fastcall GetSkipToAll();
   TDateTime __fastcall GetStartTime() const { return FPersistence.StartTime; };
@@ -116,7 +150,6 @@ protected:
   void __fastcall AddTransferredToTotals(__int64 ASize);
   void __fastcall AddSkipped(__int64 ASize);
   void __fastcall AddTotalSize(__int64 ASize);
-  void __fastcall RollbackTransferFromTotals(__int64 ATransferredSize, __int64 ASkippedSize);
   unsigned int __fastcall GetCPS();
   void __fastcall Init();
   static bool __fastcall PassCancelToParent(TCancelStatus ACancel);
@@ -158,6 +191,8 @@ public:
   __property TBatchOverwrite BatchOverwrite = { read = GetBatchOverwrite };
   __property bool SkipToAll = { read = GetSkipToAll };
   __property unsigned long CPSLimit = { read = GetCPSLimit };
+  // For transfers that cannot throttle via ThrottleToCPSLimit (from worker threads)
+  __property TBandwidthLimiter * BandwidthLimiter = { read = GetBandwidthLimiter };
 
   __property bool TotalSizeSet = { read = FTotalSizeSet };
 
@@ -179,6 +214,7 @@ public:
   void __fastcall Finish(UnicodeString FileName, bool Success,
     TOnceDoneOperation & OnceDoneOperation);
   void __fastcall Succeeded(int Count = 1);
+  void __fastcall Succeeded(__int64 Transferred, int Count);
   void __fastcall Progress();
   unsigned long __fastcall LocalBlockSize();
   bool __fastcall IsLocallyDone();
@@ -197,6 +233,7 @@ public:
   void __fastcall SetTransferSize(__int64 ASize);
   void __fastcall ChangeTransferSize(__int64 ASize);
   void __fastcall RollbackTransfer();
+  void __fastcall RollbackTransferFromTotals(__int64 ATransferredSize, __int64 ASkippedSize);
   void __fastcall SetTotalSize(__int64 ASize);
   void __fastcall Start(TFileOperation AOperation, TOperationSide ASide, int ACount);
   void __fastcall Start(TFileOperation AOperation,
@@ -222,6 +259,7 @@ public:
   void __fastcall SetCancelAtLeast(TCancelStatus ACancel);
   bool __fastcall ClearCancelFile();
   void __fastcall SetCPSLimit(unsigned long ACPSLimit);
+  void __fastcall SetBandwidthLimiterParent(TBandwidthLimiter * Parent);
   void __fastcall SetBatchOverwrite(TBatchOverwrite ABatchOverwrite);
   void __fastcall SetSkipToAll();
   UnicodeString __fastcall GetLogStr(bool Done);
@@ -14,14 +14,15 @@ struct TSpaceAvailable;
 class TFileOperationProgressType;
 class TRemoteProperties;
 struct TLocalFileHandle;
+struct TPendingSource;
 //---------------------------------------------------------------------------
 enum TFSCommand { fsNull = 0, fsVarValue, fsLastLine, fsFirstLine,
   fsCurrentDirectory, fsChangeDirectory, fsListDirectory, fsListCurrentDirectory,
   fsListFile, fsLookupUsersGroups, fsCopyToRemote, fsCopyToLocal, fsDeleteFile,
   fsRenameFile, fsCreateDirectory, fsChangeMode, fsChangeGroup, fsChangeOwner,
   fsHomeDirectory, fsUnset, fsUnalias, fsCreateLink, fsCopyFile,
-  fsAnyCommand, fsLang, fsReadSymlink, fsChangeProperties, fsMoveFile,
-  fsLock };
+  fsAnyCommand, fsLang, fsListDirectoryRecursive, fsReadSymlink, fsChangeProperties,
+  fsMoveFile, fsLock };
 //---------------------------------------------------------------------------
 const int dfNoRecursive = 0x01;
 const int dfAlternative = 0x02;
@@ -37,6 +38,7 @@ public:
   virtual bool __fastcall GetActive() = 0;
   virtual void __fastcall CollectUsage() = 0;
   virtual void __fastcall Idle() = 0;
+  virtual void __fastcall IdleWait(unsigned int MSec) { Sleep(MSec); };
   virtual UnicodeString __fastcall AbsolutePath(UnicodeString Path, bool Local) = 0;
   virtual void __fastcall AnyCommand(const UnicodeString Command,
     TCaptureOutputEvent OutputEvent) = 0;
@@ -61,6 +63,9 @@ public:
     TOnceDoneOperation & OnceDoneOperation) = 0;
   virtual void __fastcall TransferOnDirectory(
     const UnicodeString & Directory, const TCopyParamType * CopyParam, int Params) {};
+  virtual void __fastcall TransferFinished(TFileOperationProgressType * OperationProgress) {};
+  virtual bool __fastcall IsSourcePending() { return false; };
+  virtual void __fastcall DeferSourceDone(TPendingSource * Pending) {};
   virtual void __fastcall Source(
     TLocalFileHandle & Handle, const UnicodeString & TargetDir, UnicodeString & DestFileName,
     const TCopyParamType * CopyParam, int Params,
@@ -87,6 +92,8 @@ public:
   virtual void __fastcall LookupUsersGroups() = 0;
   virtual void __fastcall ReadCurrentDirectory() = 0;
   virtual void __fastcall ReadDirectory(TRemoteFileList * FileList) = 0;
+  virtual void __fastcall ReadAheadDirectories(TRemoteFileList * FileList, bool UseCache) {};
+  virtual void __fastcall ReadAheadDone(const UnicodeString & Directory) {};
   virtual void __fastcall ReadFile(const UnicodeString FileName,
     TRemoteFile *& File) = 0;
   virtual void __fastcall ReadSymlink(TRemoteFile * SymLinkFile,
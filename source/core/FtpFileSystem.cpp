@@ -67,6 +67,8 @@ protected:
   virtual std::wstring GetClientString();
   virtual void SetupSsl(ssl_st * Ssl);
   virtual std::wstring CustomReason(int Err);
+  virtual __int64 SpeedLimitAvailable(__int64 Size);
+  virtual void SpeedLimitUsed(__int64 Size);
 
 private:
   TFTPFileSystem * FFileSystem;
@@ -168,6 +170,19 @@ std::wstring TFileZillaImpl::GetClientString()
   return std::wstring(SshVersionString().c_str());
 }
 //---------------------------------------------------------------------------
+__int64 TFileZillaImpl::SpeedLimitAvailable(__int64 Size)
+{
+  // Size is at most a buffer size, so it fits
+  unsigned long ASize = static_cast<unsigned long>(Size);
+  // FileZilla waits 100 ms with its own limit too
+  return FFileSystem->FTerminal->GetBandwidthLimiter()->Available(ASize, 100);
+}
+//---------------------------------------------------------------------------
+void TFileZillaImpl::SpeedLimitUsed(__int64 Size)
+{
+  FFileSystem->FTerminal->GetBandwidthLimiter()->Consume(static_cast<unsigned long>(Size));
+}
+//---------------------------------------------------------------------------
 void TFileZillaImpl::SetupSsl(ssl_st * Ssl)
 {
   TSessionData * SessionData = FFileSystem->FTerminal->SessionData;
@@ -1990,6 +2005,7 @@ bool __fastcall TFTPFileSystem::IsCapable(int Capability) const
     case fcResumeSupport:
     case fcChangePassword:
     case fcParallelFileTransfers:
+    case fcParallelFileUploads:
       return false;
 
     default:
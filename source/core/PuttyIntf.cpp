@@ -19,6 +19,8 @@ bool SaveRandomSeed;
 bool HadRandomSeed;
 char appname_[50];
 const char *const appname = appname_;
+// Connection sharing stays off, until the upstream session can service its downstreams on its own.
+// Now their channels would move only when the upstream session is idle-serviced by its owner.
 extern const bool share_can_be_downstream = false;
 extern const bool share_can_be_upstream = false;
 THierarchicalStorage * PuttyStorage = NULL;
@@ -112,22 +114,29 @@ TSecureShell * GetSeatSecureShell(Seat * seat)
 //---------------------------------------------------------------------------
 TSecureShell * GetSecureShell(Plug * plug, bool & pfwd)
 {
-  if (!is_ssh(plug) && !is_pfwd(plug))
+  if (!is_ssh(plug) && !is_pfwd(plug) && !is_ssh_share(plug))
   {
-    // If it is not SSH/PFwd plug, then it must be Proxy plug.
+    // If it is not SSH/PFwd/sharing plug, then it must be Proxy plug.
     // Get SSH/PFwd plug which it wraps.
     ProxySocket * AProxySocket = get_proxy_plug_socket(plug);
     plug = AProxySocket->plug;
   }
 
-  pfwd = is_pfwd(plug);
   Seat * seat;
-  if (pfwd)
+  // Connections of downstreams to our shared connection are handled like port forwardings
+  if (is_ssh_share(plug))
   {
+    pfwd = true;
+    seat = get_ssh_share_seat(plug);
+  }
+  else if (is_pfwd(plug))
+  {
+    pfwd = true;
     seat = get_pfwd_seat(plug);
   }
   else
   {
+    pfwd = false;
     seat = get_ssh_seat(plug);
   }
   DebugAssert(seat != NULL);
@@ -1169,7 +1178,8 @@ UnicodeString CalculateFileChecksum(TStream * Stream, const UnicodeString & Alg)
   ssh_hash * Hash = ssh_hash_new(HashAlg);
   try
   {
-    const int BlockSize = 32 * 1024;
+    // Large reads, the hashing itself is fast (particularly with SHA-NI)
+    const int BlockSize = 1024 * 1024;
     TFileBuffer Buffer;
     DWORD Read;
     do
@@ -1463,7 +1473,13 @@ TStrings * SshMacList()
 //---------------------------------------------------------------------------
 UnicodeString GetCipherName(const ssh_cipher * Cipher)
 {
-  return UnicodeString(UTF8String(Cipher->vt->text_name));
+  UnicodeString Result;
+  // NULL for downstreams of a shared connection
+  if (Cipher != NULL)
+  {
+    Result = UnicodeString(UTF8String(Cipher->vt->text_name));
+  }
+  return Result;
 }
 //---------------------------------------------------------------------------
 UnicodeString GetCompressorName(const ssh_compressor * Compressor)
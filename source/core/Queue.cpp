@@ -2180,7 +2180,7 @@ void __fastcall TTransferQueueItem::DoExecute(TTerminal * Terminal)
   }
   __finally
   {
-    FParallelOperation->WaitFor();
+    FParallelOperation->WaitFor(Terminal);
   }
 }
 //---------------------------------------------------------------------------
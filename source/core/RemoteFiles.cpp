@@ -18,6 +18,7 @@
 /* TODO 1 : Path class instead of UnicodeString (handle relativity...) */
 //---------------------------------------------------------------------------
 const UnicodeString PartialExt(L".filepart");
+const UnicodeString PartialMapExt(L".filepart.map");
 //---------------------------------------------------------------------------
 bool __fastcall IsUnixStyleWindowsPath(const UnicodeString & Path)
 {
@@ -495,17 +496,9 @@ int GetPartialFileExtLen(const UnicodeString & FileName)
   {
     Result = PartialExt.Length();
   }
-  else
+  else if (EndsText(PartialMapExt, FileName))
   {
-    int P = FileName.LastDelimiter(L".");
-    if ((P > 0) && (P < FileName.Length()))
-    {
-      if (IsNumber(MidStr(FileName, P + 1)) &&
-          EndsText(PartialExt, FileName.SubString(1, P - 1)))
-      {
-        Result = PartialExt.Length() + (FileName.Length() - P + 1);
-      }
-    }
+    Result = PartialMapExt.Length();
   }
   return Result;
 }
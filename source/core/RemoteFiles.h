@@ -13,6 +13,7 @@ enum TModificationFmt { mfNone, mfMDHM, mfYMDHM, mfMDY, mfFull };
 #define FILETYPE_SYMLINK L'L'
 #define FILETYPE_DIRECTORY L'D'
 extern const UnicodeString PartialExt;
+extern const UnicodeString PartialMapExt;
 //---------------------------------------------------------------------------
 class TTerminal;
 class TRights;
@@ -21,6 +21,8 @@
 #include <limits>
 #include "CoreMain.h"
 #include "Http.h"
+#include "Queue.h"
+#include "PuttyTools.h"
 #include <System.JSON.hpp>
 #include <System.DateUtils.hpp>
 //---------------------------------------------------------------------------
@@ -293,6 +295,8 @@ UnicodeString S3EnvSessionToken(const UnicodeString & Profile, UnicodeString * S
 //---------------------------------------------------------------------------
 const int TS3FileSystem::S3MinMultiPartChunkSize = 5 * 1024 * 1024;
 const int TS3FileSystem::S3MaxMultiPartChunks = 10000;
+const int TS3FileSystem::S3MaxDeleteObjectsKeys = 1000;
+const int TS3FileSystem::S3DeleteObjectsConcurrency = 4;
 //---------------------------------------------------------------------------
 TS3FileSystem::TS3FileSystem(TTerminal * ATerminal) :
   TCustomFileSystem(ATerminal),
@@ -318,6 +322,7 @@ void __fastcall TS3FileSystem::Open()
 {
 
   FTlsVersionStr = L"";
+  FVerifiedCertificateFingerprint = L"";
   FNeonSession = NULL;
   FCurrentDirectory = L"";
   FAuthRegion = DefaultStr(FTerminal->SessionData->S3DefaultRegion, S3LibDefaultRegion());
@@ -463,19 +468,25 @@ TS3FileSystem * TS3FileSystem::GetFileSystem(void * CallbackData)
 void TS3FileSystem::LibS3SessionCallback(ne_session_s * Session, void * CallbackData)
 {
   TS3FileSystem * FileSystem = static_cast<TS3FileSystem *>(CallbackData);
-  TSessionData * Data = FileSystem->FTerminal->SessionData;
+
+  FileSystem->SetupNeonSession(Session);
+
+  FileSystem->FNeonSession = Session;
+}
+//---------------------------------------------------------------------------
+void TS3FileSystem::SetupNeonSession(ne_session_s * Session)
+{
+  TSessionData * Data = FTerminal->SessionData;
 
   InitNeonSession(
     Session, Data->ProxyMethod, Data->ProxyHost, Data->ProxyPort,
-    Data->ProxyUsername, Data->ProxyPassword, FileSystem->FTerminal);
+    Data->ProxyUsername, Data->ProxyPassword, FTerminal);
 
-  SetNeonTlsInit(Session, FileSystem->InitSslSession, FileSystem->FTerminal);
+  SetNeonTlsInit(Session, InitSslSession, FTerminal);
 
   ne_set_session_flag(Session, SE_SESSFLAG_SNDBUF, Data->SendBuf);
 
   // Data->Timeout is propagated via timeoutMs parameter of functions like S3_list_service
-
-  FileSystem->FNeonSession = Session;
 }
 //------------------------------------------------------------------------------
 void TS3FileSystem::InitSslSession(ssl_st * Ssl, ne_session * /*Session*/)
@@ -499,6 +510,8 @@ bool TS3FileSystem::VerifyCertificate(TNeonCertificateData Data)
 
   if (Result)
   {
+    // Workers cannot prompt, they accept only this certificate
+    FVerifiedCertificateFingerprint = Data.FingerprintSHA256;
     CollectTLSSessionInfo();
   }
 
@@ -911,6 +924,8 @@ bool __fastcall TS3FileSystem::IsCapable(int Capability) const
     case fcLoadingAdditionalProperties:
     case fcAclChangingFiles:
     case fcMoveOverExistingFile:
+    case fcResumeSupport:
+    case fcParallelFileTransfers:
       return true;
 
     case fcPreservingTimestampUpload:
@@ -935,12 +950,12 @@ bool __fastcall TS3FileSystem::IsCapable(int Capability) const
     case fcRemoveCtrlZUpload:
     case fcRemoveBOMUpload:
     case fcPreservingTimestampDirs:
-    case fcResumeSupport:
     case fcChangePassword:
     case fcLocking:
     case fcTransferOut:
     case fcTransferIn:
-    case fcParallelFileTransfers:
+    // The parts cannot be written to their place in an object
+    case fcParallelFileUploads:
       return false;
 
     default:
@@ -1312,12 +1327,435 @@ void __fastcall TS3FileSystem::ReadFile(const UnicodeString FileName,
   }
 }
 //---------------------------------------------------------------------------
+struct TLibS3ListObjectKeysCallbackData : TLibS3CallbackData
+{
+  std::vector<UTF8String> * Keys;
+  UTF8String Prefix;
+  UTF8String NextMarker;
+  bool IsTruncated;
+};
+//---------------------------------------------------------------------------
+S3Status TS3FileSystem::LibS3ListObjectKeysCallback(
+  int IsTruncated, const char * NextMarker, int ContentsCount, const S3ListBucketContent * Contents,
+  int /*CommonPrefixesCount*/, const char ** /*CommonPrefixes*/, void * CallbackData)
+{
+  TLibS3ListObjectKeysCallbackData & Data = *static_cast<TLibS3ListObjectKeysCallbackData *>(CallbackData);
+
+  Data.IsTruncated = IsTruncated;
+  for (int Index = 0; Index < ContentsCount; Index++)
+  {
+    UTF8String Key(Contents[Index].key);
+    // The folder object itself is deleted by the caller
+    if (Key != Data.Prefix)
+    {
+      Data.Keys->push_back(Key);
+    }
+    // Without a delimiter, the server does not return the NextMarker, the last key is used instead
+    Data.NextMarker = Key;
+  }
+  if ((NextMarker != NULL) && (NextMarker[0] != '\0'))
+  {
+    Data.NextMarker = NextMarker;
+  }
+
+  return S3StatusOK;
+}
+//---------------------------------------------------------------------------
+void TS3FileSystem::ListObjectKeys(const TLibS3BucketContext & BucketContext, const UnicodeString & Prefix, TS3DeleteObjects & Delete)
+{
+  TLibS3ListObjectKeysCallbackData Data;
+  Data.Keys = &Delete.Keys;
+  Data.Prefix = UTF8String(Prefix);
+
+  S3ListBucketHandler ListBucketHandler = { CreateResponseHandler(), &LibS3ListObjectKeysCallback };
+
+  bool Continue;
+  do
+  {
+    RequestInit(Data);
+    Data.IsTruncated = false;
+
+    // No delimiter, so that we get the keys from all subfolders at once
+    S3_list_bucket(
+      &BucketContext, StrToS3(Prefix), Data.NextMarker.c_str(), NULL, 0, FRequestContext, FTimeout, &ListBucketHandler, &Data);
+    CheckLibS3Error(Data);
+
+    Continue = false;
+    if (Data.IsTruncated && !Data.NextMarker.IsEmpty())
+    {
+      bool Cancel = false;
+      FTerminal->DoReadDirectoryProgress(static_cast<int>(Delete.Keys.size()), false, Cancel);
+      if (Cancel)
+      {
+        Abort();
+      }
+      Continue = true;
+    }
+  }
+  while (Continue);
+}
+//---------------------------------------------------------------------------
+struct TS3DeleteObjectsBatch
+{
+  TS3DeleteObjectsBatch()
+  {
+    Done = false;
+    Status = (S3Status)-1;
+  }
+
+  // Range of TS3DeleteObjects::Keys
+  size_t Start;
+  size_t Count;
+  // Set by the worker before Done
+  typedef std::map<UTF8String, UnicodeString> TErrors;
+  TErrors Errors;
+  UnicodeString ErrorMessage;
+  // Guarded by TS3DeleteObjects::Section
+  bool Done;
+  S3Status Status;
+};
+//---------------------------------------------------------------------------
+struct TS3DeleteObjects
+{
+  TS3DeleteObjects()
+  {
+    Section.reset(new TCriticalSection());
+    BatchDoneEvent = CreateEvent(NULL, false, false, NULL);
+  }
+
+  ~TS3DeleteObjects()
+  {
+    CloseHandle(BatchDoneEvent);
+  }
+
+  UnicodeString BucketName;
+  S3BucketContext * BucketContext;
+  std::vector<UTF8String> Keys;
+  std::unique_ptr<TCriticalSection> Section;
+  HANDLE BatchDoneEvent;
+};
+//---------------------------------------------------------------------------
+class TS3DeleteObjectsWorker : public TSignalThread
+{
+public:
+  TS3DeleteObjectsWorker(TS3FileSystem * FileSystem, TS3DeleteObjects & Delete);
+  virtual __fastcall ~TS3DeleteObjectsWorker();
+
+  bool IsIdle();
+  void Delete(TS3DeleteObjectsBatch * Batch);
+
+protected:
+  virtual void __fastcall ProcessEvent();
+
+private:
+  TS3FileSystem * FFileSystem;
+  TS3DeleteObjects & FDelete;
+  S3RequestContext * FRequestContext;
+  TS3DeleteObjectsBatch * FBatch;
+};
+//---------------------------------------------------------------------------
+TS3DeleteObjectsWorker::TS3DeleteObjectsWorker(TS3FileSystem * FileSystem, TS3DeleteObjects & Delete) :
+  TSignalThread(false),
+  FFileSystem(FileSystem),
+  FDelete(Delete),
+  FBatch(NULL)
+{
+  FRequestContext = FileSystem->CreateWorkerRequestContext();
+}
+//---------------------------------------------------------------------------
+__fastcall TS3DeleteObjectsWorker::~TS3DeleteObjectsWorker()
+{
+  // The thread must not be using the context anymore
+  Close();
+  S3_destroy_request_context(FRequestContext);
+}
+//---------------------------------------------------------------------------
+bool TS3DeleteObjectsWorker::IsIdle()
+{
+  TGuard Guard(FDelete.Section.get());
+  return (FBatch == NULL);
+}
+//---------------------------------------------------------------------------
+void TS3DeleteObjectsWorker::Delete(TS3DeleteObjectsBatch * Batch)
+{
+  {
+    TGuard Guard(FDelete.Section.get());
+    DebugAssert(FBatch == NULL);
+    FBatch = Batch;
+  }
+  TriggerEvent();
+}
+//---------------------------------------------------------------------------
+void __fastcall TS3DeleteObjectsWorker::ProcessEvent()
+{
+  TS3DeleteObjectsBatch * Batch;
+  {
+    TGuard Guard(FDelete.Section.get());
+    Batch = FBatch;
+  }
+
+  if (Batch != NULL)
+  {
+    FFileSystem->DeleteObjectsBatch(FDelete, *Batch, FRequestContext);
+
+    {
+      TGuard Guard(FDelete.Section.get());
+      FBatch = NULL;
+    }
+    SetEvent(FDelete.BatchDoneEvent);
+  }
+}
+//---------------------------------------------------------------------------
+struct TLibS3DeleteObjectsCallbackData : TLibS3CallbackData
+{
+  TS3DeleteObjectsBatch * Batch;
+};
+//---------------------------------------------------------------------------
+S3Status TS3FileSystem::LibS3DeleteObjectsResultCallback(
+  const char * Key, const char * ErrorCode, const char * ErrorMessage, void * CallbackData)
+{
+  TLibS3DeleteObjectsCallbackData & Data = *static_cast<TLibS3DeleteObjectsCallbackData *>(CallbackData);
+
+  // In the quiet mode, we are called for the failed keys only
+  if (ErrorCode != NULL)
+  {
+    UnicodeString Error = StrFromS3(ErrorMessage);
+    if (Error.IsEmpty())
+    {
+      Error = StrFromS3(ErrorCode);
+    }
+    Data.Batch->Errors[UTF8String(Key)] = Error;
+  }
+
+  return S3StatusOK;
+}
+//---------------------------------------------------------------------------
+void TS3FileSystem::DeleteObjectsBatch(TS3DeleteObjects & Delete, TS3DeleteObjectsBatch & Batch, S3RequestContext * RequestContext)
+{
+  // Not using RequestInit, see UploadPart
+  TLibS3DeleteObjectsCallbackData Data;
+  Data.FileSystem = this;
+  Data.Batch = &Batch;
+
+  std::vector<const char *> Keys;
+  for (size_t Index = Batch.Start; Index < Batch.Start + Batch.Count; Index++)
+  {
+    Keys.push_back(Delete.Keys[Index].c_str());
+  }
+
+  S3DeleteObjectsHandler DeleteObjectsHandler = { CreateResponseHandler(), &LibS3DeleteObjectsResultCallback };
+  FTerminal->LogEvent(FORMAT(L"Deleting batch of %d objects", (static_cast<int>(Keys.size()))));
+  S3_delete_objects(
+    Delete.BucketContext, static_cast<int>(Keys.size()), &Keys[0], true, RequestContext, FTimeout, &DeleteObjectsHandler, &Data);
+
+  TGuard Guard(Delete.Section.get());
+  Batch.Status = Data.Status;
+  Batch.ErrorMessage = Data.ErrorMessage;
+  Batch.Done = true;
+}
+//---------------------------------------------------------------------------
+void TS3FileSystem::DeleteObjectsBatchDone(TS3DeleteObjects & Delete, TS3DeleteObjectsBatch & Batch, TStrings * FailedFileNames)
+{
+  bool BatchFailed = (Batch.Status != S3StatusOK);
+  if (BatchFailed)
+  {
+    UnicodeString Error = Batch.ErrorMessage;
+    if (Error.IsEmpty())
+    {
+      Error = S3_get_status_name(Batch.Status);
+    }
+    // Possibly the server does not support deleting multiple objects
+    FTerminal->LogEvent(FORMAT(L"Deleting batch of objects failed (%s), will delete them one by one", (Error)));
+  }
+
+  int Deleted = 0;
+  for (size_t Index = Batch.Start; Index < Batch.Start + Batch.Count; Index++)
+  {
+    const UTF8String & Key = Delete.Keys[Index];
+    UnicodeString FileName = UnixCombinePaths(L"/" + Delete.BucketName, StrFromS3(Key));
+    TS3DeleteObjectsBatch::TErrors::const_iterator I = Batch.Errors.find(Key);
+    if (BatchFailed)
+    {
+      FailedFileNames->Add(FileName);
+    }
+    else if (I != Batch.Errors.end())
+    {
+      FTerminal->LogEvent(FORMAT(L"Deleting \"%s\" failed (%s), will retry", (FileName, I->second)));
+      FailedFileNames->Add(FileName);
+    }
+    else
+    {
+      // Recorded as succeeded when destroyed
+      TRmSessionAction Action(FTerminal->ActionLog, FileName);
+      Deleted++;
+    }
+  }
+
+  TFileOperationProgressType * OperationProgress = FTerminal->OperationProgress;
+  if ((Deleted > 0) && (OperationProgress != NULL) && (OperationProgress->Operation == foDelete))
+  {
+    OperationProgress->Succeeded(Deleted);
+  }
+}
+//---------------------------------------------------------------------------
+void TS3FileSystem::DeleteDirectoryContents(const UnicodeString & FileName, int Params)
+{
+  UnicodeString BucketName, Key;
+  ParsePath(FileName, BucketName, Key);
+  UnicodeString Prefix = Key.IsEmpty() ? UnicodeString() : GetFolderKey(Key);
+
+  TLibS3BucketContext BucketContext = GetBucketContext(BucketName, Prefix);
+
+  TS3DeleteObjects Delete;
+  Delete.BucketName = BucketName;
+  Delete.BucketContext = &BucketContext;
+  ListObjectKeys(BucketContext, Prefix, Delete);
+
+  typedef std::list<TS3DeleteObjectsBatch *> TBatches;
+  TBatches Batches;
+  std::unique_ptr<TStrings> FailedFileNames(new TStringList());
+  try
+  {
+    for (size_t Start = 0; Start < Delete.Keys.size(); Start += S3MaxDeleteObjectsKeys)
+    {
+      TS3DeleteObjectsBatch * Batch = new TS3DeleteObjectsBatch();
+      Batch->Start = Start;
+      Batch->Count = std::min(Delete.Keys.size() - Start, static_cast<size_t>(S3MaxDeleteObjectsKeys));
+      Batches.push_back(Batch);
+    }
+
+    if (Batches.size() == 1)
+    {
+      // Not worth opening another connection
+      TS3DeleteObjectsBatch * Batch = Batches.front();
+      FResponse = L"";
+      DeleteObjectsBatch(Delete, *Batch, FRequestContext);
+      DeleteObjectsBatchDone(Delete, *Batch, FailedFileNames.get());
+    }
+    else if (Batches.size() > 1)
+    {
+      int Concurrency = std::min(S3DeleteObjectsConcurrency, static_cast<int>(Batches.size()));
+      FTerminal->LogEvent(
+        FORMAT(L"Deleting %d objects in %d batches, up to %d concurrently",
+          (static_cast<int>(Delete.Keys.size()), static_cast<int>(Batches.size()), Concurrency)));
+
+      // See UploadPart
+      FResponse = L"";
+
+      typedef std::vector<TS3DeleteObjectsWorker *> TWorkers;
+      TWorkers Workers;
+      try
+      {
+        for (int Index = 0; Index < Concurrency; Index++)
+        {
+          TS3DeleteObjectsWorker * Worker = new TS3DeleteObjectsWorker(this, Delete);
+          Workers.push_back(Worker);
+          Worker->Start();
+        }
+
+        TBatches::iterator NextBatch = Batches.begin();
+        TBatches RunningBatches;
+        while ((NextBatch != Batches.end()) || !RunningBatches.empty())
+        {
+          TWorkers::iterator WorkerI = Workers.begin();
+          while ((NextBatch != Batches.end()) && (WorkerI != Workers.end()))
+          {
+            TS3DeleteObjectsWorker * Worker = *WorkerI;
+            if (Worker->IsIdle())
+            {
+              Worker->Delete(*NextBatch);
+              RunningBatches.push_back(*NextBatch);
+              ++NextBatch;
+            }
+            ++WorkerI;
+          }
+
+          WaitForSingleObject(Delete.BatchDoneEvent, GUIUpdateInterval);
+
+          TBatches::iterator BatchI = RunningBatches.begin();
+          while (BatchI != RunningBatches.end())
+          {
+            TS3DeleteObjectsBatch * Batch = *BatchI;
+            bool Done;
+            {
+              TGuard Guard(Delete.Section.get());
+              Done = Batch->Done;
+            }
+
+            if (Done)
+            {
+              BatchI = RunningBatches.erase(BatchI);
+              DeleteObjectsBatchDone(Delete, *Batch, FailedFileNames.get());
+            }
+            else
+            {
+              ++BatchI;
+            }
+          }
+
+          TFileOperationProgressType * OperationProgress = FTerminal->OperationProgress;
+          if ((OperationProgress != NULL) && (OperationProgress->Cancel != csContinue))
+          {
+            Abort();
+          }
+        }
+      }
+      __finally
+      {
+        for (TWorkers::iterator I = Workers.begin(); I != Workers.end(); ++I)
+        {
+          (*I)->Terminate();
+        }
+        for (TWorkers::iterator I = Workers.begin(); I != Workers.end(); ++I)
+        {
+          delete *I;
+        }
+      }
+    }
+  }
+  __finally
+  {
+    for (TBatches::iterator I = Batches.begin(); I != Batches.end(); ++I)
+    {
+      delete *I;
+    }
+  }
+
+  // Using the standard path with the main connection, so that the errors are reported, retried and logged as usual.
+  // Only now, when no worker is running, see UploadPart.
+  for (int Index = 0; Index < FailedFileNames->Count; Index++)
+  {
+    UnicodeString FailedFileName = FailedFileNames->Strings[Index];
+    FTerminal->StartOperationWithFile(FailedFileName, foDelete);
+    FTerminal->DoDeleteFile(this, FailedFileName, NULL, Params);
+  }
+}
+//---------------------------------------------------------------------------
 void __fastcall TS3FileSystem::DeleteFile(const UnicodeString AFileName,
   const TRemoteFile * File, int Params, TRmSessionAction & Action)
 {
   UnicodeString FileName = AbsolutePath(AFileName, false);
 
-  bool Dir = FTerminal->DeleteContentsIfDirectory(FileName, File, Params, Action);
+  bool Dir;
+  // Contents of a recycled folder would be moved by TTerminal::DeleteFile, not deleted
+  if ((File != NULL) && File->IsDirectory && FTerminal->CanRecurseToDirectory(File) && FLAGCLEAR(Params, dfNoRecursive) &&
+      (FLAGSET(Params, dfForceDelete) || FTerminal->SessionData->RecycleBinPath.IsEmpty()))
+  {
+    try
+    {
+      DeleteDirectoryContents(FileName, Params);
+    }
+    catch (...)
+    {
+      Action.Cancel();
+      throw;
+    }
+    Dir = true;
+  }
+  else
+  {
+    Dir = FTerminal->DeleteContentsIfDirectory(FileName, File, Params, Action);
+  }
 
   UnicodeString BucketName, Key;
   ParsePath(FileName, BucketName, Key);
@@ -1990,57 +2428,692 @@ int TS3FileSystem::LibS3MultipartCommitPutObjectDataCallback(int BufferSize, cha
   return Result;
 }
 //---------------------------------------------------------------------------
-void __fastcall TS3FileSystem::Source(
-  TLocalFileHandle & Handle, const UnicodeString & TargetDir, UnicodeString & DestFileName,
-  const TCopyParamType * CopyParam, int Params,
-  TFileOperationProgressType * OperationProgress, unsigned int /*Flags*/,
-  TUploadSessionAction & Action, bool & /*ChildError*/)
+struct TS3UploadPart
 {
-  UnicodeString DestFullName = TargetDir + DestFileName;
-
-  TRemoteFile * RemoteFile = NULL;
-  try
+  TS3UploadPart()
   {
-    // Should not throw on non-existing file by purpose (mainly not to get an exception while debugging)
-    DoReadFile(DestFullName, RemoteFile);
+    Sent = 0;
+    Done = false;
+    Status = (S3Status)-1;
+    Reported = 0;
   }
-  catch (...)
+
+  int Number;
+  std::unique_ptr<TMemoryStream> Buffer;
+  // Guarded by TS3MultipartUpload::Section
+  __int64 Sent;
+  bool Done;
+  S3Status Status;
+  RawByteString ETag;
+  // Used by the main thread only
+  __int64 Reported;
+};
+//---------------------------------------------------------------------------
+struct TS3MultipartUpload
+{
+  TS3MultipartUpload()
   {
-    // Pointless, as there's no persistent connection.
-    if (!FTerminal->Active)
-    {
-      throw;
-    }
+    Section.reset(new TCriticalSection());
+    PartDoneEvent = CreateEvent(NULL, false, false, NULL);
   }
 
-  if (RemoteFile != NULL)
+  ~TS3MultipartUpload()
   {
-    TOverwriteFileParams FileParams;
-
-    FileParams.SourceSize = Handle.Size;
-    FileParams.SourceTimestamp = Handle.Modification;
-    FileParams.DestSize = RemoteFile->Size;
-    FileParams.DestTimestamp = TDateTime();
-    FileParams.DestPrecision = mfNone;
-    delete RemoteFile;
-
-    ConfirmOverwrite(Handle.FileName, DestFileName, OperationProgress, &FileParams, CopyParam, Params);
+    CloseHandle(PartDoneEvent);
   }
 
-  DestFullName = TargetDir + DestFileName;
-  // only now, we know the final destination
-  // (not really true as we do not support changing file name on overwrite dialog)
-  Action.Destination(DestFullName);
-
-  UnicodeString BucketName, Key;
-  ParsePath(DestFullName, BucketName, Key);
+  S3BucketContext * BucketContext;
+  UnicodeString Key;
+  S3PutProperties * PutProperties;
+  RawByteString UploadId;
+  int Parts;
+  int ChunkSize;
+  UnicodeString FileName;
+  TBandwidthLimiter * BandwidthLimiter;
+  std::unique_ptr<TCriticalSection> Section;
+  HANDLE PartDoneEvent;
+  std::vector<RawByteString> ETags;
+};
+//---------------------------------------------------------------------------
+class TS3UploadPartWorker : public TSignalThread
+{
+public:
+  TS3UploadPartWorker(TS3FileSystem * FileSystem, TS3MultipartUpload & Upload);
+  virtual __fastcall ~TS3UploadPartWorker();
 
-  if (Key.IsEmpty())
-  {
-    throw Exception(LoadStr(MISSING_TARGET_BUCKET));
-  }
+  bool IsIdle();
+  void Upload(TS3UploadPart * Part);
+  bool IsTerminated() { return FTerminated; }
 
-  TLibS3BucketContext BucketContext = GetBucketContext(BucketName, Key);
+protected:
+  virtual void __fastcall ProcessEvent();
+
+private:
+  TS3FileSystem * FFileSystem;
+  TS3MultipartUpload & FUpload;
+  S3RequestContext * FRequestContext;
+  TS3UploadPart * FPart;
+};
+//---------------------------------------------------------------------------
+TS3UploadPartWorker::TS3UploadPartWorker(TS3FileSystem * FileSystem, TS3MultipartUpload & Upload) :
+  TSignalThread(false),
+  FFileSystem(FileSystem),
+  FUpload(Upload),
+  FPart(NULL)
+{
+  FRequestContext = FileSystem->CreateWorkerRequestContext();
+}
+//---------------------------------------------------------------------------
+__fastcall TS3UploadPartWorker::~TS3UploadPartWorker()
+{
+  // The thread must not be using the context anymore
+  Close();
+  S3_destroy_request_context(FRequestContext);
+}
+//---------------------------------------------------------------------------
+bool TS3UploadPartWorker::IsIdle()
+{
+  TGuard Guard(FUpload.Section.get());
+  return (FPart == NULL);
+}
+//---------------------------------------------------------------------------
+void TS3UploadPartWorker::Upload(TS3UploadPart * Part)
+{
+  {
+    TGuard Guard(FUpload.Section.get());
+    DebugAssert(FPart == NULL);
+    FPart = Part;
+  }
+  TriggerEvent();
+}
+//---------------------------------------------------------------------------
+void __fastcall TS3UploadPartWorker::ProcessEvent()
+{
+  TS3UploadPart * Part;
+  {
+    TGuard Guard(FUpload.Section.get());
+    Part = FPart;
+  }
+
+  if (Part != NULL)
+  {
+    FFileSystem->UploadPart(FUpload, *Part, this, FRequestContext);
+
+    {
+      TGuard Guard(FUpload.Section.get());
+      FPart = NULL;
+    }
+    SetEvent(FUpload.PartDoneEvent);
+  }
+}
+//---------------------------------------------------------------------------
+struct TLibS3UploadPartCallbackData : TLibS3PutObjectDataCallbackData
+{
+  TS3MultipartUpload * Upload;
+  TS3UploadPart * Part;
+  TS3UploadPartWorker * Worker;
+};
+//---------------------------------------------------------------------------
+S3RequestContext * TS3FileSystem::CreateWorkerRequestContext()
+{
+  // Each worker has its own context, which keeps the neon session (and its connection)
+  // for all requests the worker makes
+  S3RequestContext * Result;
+  S3_create_request_context(&Result);
+  S3_set_request_context_session_callback(Result, LibS3WorkerSessionCallback, this);
+  S3_set_request_context_ssl_callback(Result, LibS3WorkerSslCallback, this);
+  S3_set_request_context_requester_pays(Result, FTerminal->SessionData->S3RequesterPays);
+  S3_set_request_context_keep_session(Result, true);
+  return Result;
+}
+//---------------------------------------------------------------------------
+void TS3FileSystem::LibS3WorkerSessionCallback(ne_session_s * Session, void * CallbackData)
+{
+  TS3FileSystem * FileSystem = static_cast<TS3FileSystem *>(CallbackData);
+
+  // FNeonSession belongs to the main thread
+  FileSystem->SetupNeonSession(Session);
+}
+//---------------------------------------------------------------------------
+int TS3FileSystem::LibS3WorkerSslCallback(int Failures, const ne_ssl_certificate_s * Certificate, void * CallbackData)
+{
+  TNeonCertificateData Data;
+  RetrieveNeonCertificateData(Failures, Certificate, Data);
+  TS3FileSystem * FileSystem = static_cast<TS3FileSystem *>(CallbackData);
+  // We cannot prompt from a worker thread. If the server presents a different certificate,
+  // the request fails and it is retried by the main thread, which verifies the certificate as usual.
+  bool Result =
+    !FileSystem->FVerifiedCertificateFingerprint.IsEmpty() &&
+    SameText(Data.FingerprintSHA256, FileSystem->FVerifiedCertificateFingerprint);
+  if (!Result)
+  {
+    FileSystem->FTerminal->LogEvent(FORMAT(L"Certificate %s was not verified by the main connection", (Data.FingerprintSHA256)));
+  }
+  return Result ? NE_OK : NE_ERROR;
+}
+//---------------------------------------------------------------------------
+int TS3FileSystem::LibS3UploadPartDataCallback(int BufferSize, char * Buffer, void * CallbackData)
+{
+  TLibS3UploadPartCallbackData & Data = *static_cast<TLibS3UploadPartCallbackData *>(CallbackData);
+
+  return Data.FileSystem->UploadPartData(BufferSize, Buffer, Data);
+}
+//---------------------------------------------------------------------------
+int TS3FileSystem::UploadPartData(int BufferSize, char * Buffer, TLibS3UploadPartCallbackData & Data)
+{
+  int Result = -1;
+
+  if (!Data.Worker->IsTerminated())
+  {
+    int Read = Data.Part->Buffer->Read(Buffer, BufferSize);
+
+    // The progress is reported by the main thread, but throttling has to happen here
+    unsigned long Remaining = Read;
+    while ((Remaining > 0) && !Data.Worker->IsTerminated())
+    {
+      Remaining -= Data.Upload->BandwidthLimiter->Acquire(Remaining, GUIUpdateInterval);
+    }
+
+    if (Remaining == 0)
+    {
+      TGuard Guard(Data.Upload->Section.get());
+      Data.Part->Sent += Read;
+      Result = Read;
+    }
+  }
+
+  return Result;
+}
+//---------------------------------------------------------------------------
+void TS3FileSystem::UploadPart(
+  TS3MultipartUpload & Upload, TS3UploadPart & Part, TS3UploadPartWorker * Worker, S3RequestContext * RequestContext)
+{
+  // Not using RequestInit, as FResponse belongs to the main thread
+  // (it is kept empty while the workers run, so that LibS3ResponseCompleteCallback does not log it)
+  TLibS3UploadPartCallbackData Data;
+  Data.FileSystem = this;
+  Data.Upload = &Upload;
+  Data.Part = &Part;
+  Data.Worker = Worker;
+
+  S3PutObjectHandler UploadPartHandler =
+    { CreateResponseHandlerCustom(LibS3MultipartResponsePropertiesCallback), LibS3UploadPartDataCallback };
+  int PartLength = static_cast<int>(Part.Buffer->Size);
+  FTerminal->LogEvent(FORMAT(L"Uploading part %d [%s]", (Part.Number, IntToStr(PartLength))));
+  S3_upload_part(
+    Upload.BucketContext, StrToS3(Upload.Key), Upload.PutProperties, &UploadPartHandler, Part.Number, Upload.UploadId.c_str(),
+    PartLength, RequestContext, FTimeout, &Data);
+
+  TGuard Guard(Upload.Section.get());
+  Part.Status = Data.Status;
+  Part.ETag = Data.ETag;
+  Part.Done = true;
+}
+//---------------------------------------------------------------------------
+RawByteString TS3FileSystem::RetryUploadPart(
+  TS3MultipartUpload & Upload, TStream * Buffer, int Part, TFileOperationProgressType * OperationProgress)
+{
+  TLibS3PutObjectDataCallbackData Data;
+
+  FILE_OPERATION_LOOP_BEGIN
+  {
+    // If not at the start, it's retry and we have to undo the unsuccessful upload
+    if (Buffer->Position > 0)
+    {
+      OperationProgress->AddTransferred(-Buffer->Position);
+      Buffer->Position = 0;
+    }
+
+    RequestInit(Data);
+    Data.FileName = Upload.FileName;
+    Data.Stream = Buffer;
+    Data.OperationProgress = OperationProgress;
+    Data.Exception.reset(NULL);
+
+    S3PutObjectHandler UploadPartHandler =
+      { CreateResponseHandlerCustom(LibS3MultipartResponsePropertiesCallback), LibS3PutObjectDataCallback };
+    int PartLength = static_cast<int>(Buffer->Size);
+    FTerminal->LogEvent(FORMAT(L"Retrying part %d [%s]", (Part, IntToStr(PartLength))));
+    S3_upload_part(
+      Upload.BucketContext, StrToS3(Upload.Key), Upload.PutProperties, &UploadPartHandler, Part, Upload.UploadId.c_str(),
+      PartLength, FRequestContext, FTimeout, &Data);
+
+    // The "exception" was already seen by the user, its presence mean an accepted abort of the operation.
+    if (Data.Exception.get() == NULL)
+    {
+      CheckLibS3Error(Data, true);
+    }
+  }
+  FILE_OPERATION_LOOP_END_EX(FMTLOAD(TRANSFER_ERROR, (Upload.FileName)), (folAllowSkip | folRetryOnFatal));
+
+  if (Data.Exception.get() != NULL)
+  {
+    RethrowException(Data.Exception.get());
+  }
+
+  return Data.ETag;
+}
+//---------------------------------------------------------------------------
+void TS3FileSystem::UploadPartsConcurrently(
+  TS3MultipartUpload & Upload, TStream * Stream, TFileOperationProgressType * OperationProgress)
+{
+  int Concurrency = std::min(FTerminal->SessionData->S3MultipartConcurrency, Upload.Parts);
+  FTerminal->LogEvent(FORMAT(L"Uploading up to %d parts concurrently", (Concurrency)));
+
+  Upload.ETags.resize(Upload.Parts);
+  // See UploadPart
+  FResponse = L"";
+
+  typedef std::vector<TS3UploadPartWorker *> TWorkers;
+  TWorkers Workers;
+  typedef std::list<TS3UploadPart *> TParts;
+  TParts Parts;
+  TParts FailedParts;
+  try
+  {
+    for (int Index = 0; Index < Concurrency; Index++)
+    {
+      TS3UploadPartWorker * Worker = new TS3UploadPartWorker(this, Upload);
+      Workers.push_back(Worker);
+      Worker->Start();
+    }
+
+    int NextPart = 1;
+    while ((NextPart <= Upload.Parts) || !Parts.empty() || !FailedParts.empty())
+    {
+      // Read ahead the next part for each idle worker, so there's at most one buffered part per worker.
+      // Do not start new parts, while some need to be retried.
+      TWorkers::iterator WorkerI = Workers.begin();
+      while (FailedParts.empty() && (NextPart <= Upload.Parts) && (WorkerI != Workers.end()))
+      {
+        TS3UploadPartWorker * Worker = *WorkerI;
+        __int64 Position = static_cast<__int64>(NextPart - 1) * Upload.ChunkSize;
+        int PartLength = static_cast<int>(std::min(static_cast<__int64>(Upload.ChunkSize), Stream->Size - Position));
+        // Uploaded already by the interrupted upload that we resume
+        if (!Upload.ETags[NextPart - 1].IsEmpty())
+        {
+          OperationProgress->AddResumed(PartLength);
+          NextPart++;
+          continue;
+        }
+
+        if (Worker->IsIdle())
+        {
+          std::unique_ptr<TS3UploadPart> Part(new TS3UploadPart());
+          Part->Number = NextPart;
+          Part->Buffer.reset(new TMemoryStream());
+          Part->Buffer->Size = PartLength;
+          FILE_OPERATION_LOOP_BEGIN
+          {
+            Stream->Position = Position;
+            Stream->ReadBuffer(Part->Buffer->Memory, PartLength);
+          }
+          FILE_OPERATION_LOOP_END(FMTLOAD(READ_ERROR, (Upload.FileName)));
+
+          Worker->Upload(Part.get());
+          Parts.push_back(Part.release());
+          NextPart++;
+        }
+        ++WorkerI;
+      }
+
+      WaitForSingleObject(Upload.PartDoneEvent, GUIUpdateInterval);
+
+      // CPSLimit may have been changed
+      Upload.BandwidthLimiter->SetLimit(OperationProgress->CPSLimit);
+
+      TParts::iterator PartI = Parts.begin();
+      while (PartI != Parts.end())
+      {
+        TS3UploadPart * Part = *PartI;
+        __int64 Sent;
+        bool Done;
+        {
+          TGuard Guard(Upload.Section.get());
+          Sent = Part->Sent;
+          Done = Part->Done;
+        }
+
+        if (Sent > Part->Reported)
+        {
+          OperationProgress->AddTransferred(Sent - Part->Reported);
+          Part->Reported = Sent;
+        }
+
+        if (!Done)
+        {
+          ++PartI;
+        }
+        else
+        {
+          PartI = Parts.erase(PartI);
+          if (Part->Status == S3StatusOK)
+          {
+            Upload.ETags[Part->Number - 1] = Part->ETag;
+            delete Part;
+          }
+          else
+          {
+            FTerminal->LogEvent(FORMAT(L"Uploading part %d failed, will retry", (Part->Number)));
+            if (Part->Reported > 0)
+            {
+              OperationProgress->AddTransferred(-Part->Reported);
+              Part->Reported = 0;
+            }
+            Part->Buffer->Position = 0;
+            FailedParts.push_back(Part);
+          }
+        }
+      }
+
+      if (OperationProgress->Cancel != csContinue)
+      {
+        if (OperationProgress->ClearCancelFile())
+        {
+          throw ESkipFile();
+        }
+        else
+        {
+          Abort();
+        }
+      }
+
+      // The failed parts are retried using the main connection, as that can interact with the user.
+      // So only once no worker is running.
+      if (Parts.empty() && !FailedParts.empty())
+      {
+        while (!FailedParts.empty())
+        {
+          TS3UploadPart * Part = FailedParts.front();
+          Upload.ETags[Part->Number - 1] = RetryUploadPart(Upload, Part->Buffer.get(), Part->Number, OperationProgress);
+          FailedParts.pop_front();
+          delete Part;
+        }
+        FResponse = L"";
+      }
+    }
+  }
+  __finally
+  {
+    // Terminate all first, so that they abort their parts in parallel
+    for (TWorkers::iterator I = Workers.begin(); I != Workers.end(); ++I)
+    {
+      (*I)->Terminate();
+    }
+    for (TWorkers::iterator I = Workers.begin(); I != Workers.end(); ++I)
+    {
+      delete *I;
+    }
+    for (TParts::iterator I = Parts.begin(); I != Parts.end(); ++I)
+    {
+      delete *I;
+    }
+    for (TParts::iterator I = FailedParts.begin(); I != FailedParts.end(); ++I)
+    {
+      delete *I;
+    }
+  }
+}
+//---------------------------------------------------------------------------
+struct TLibS3ListMultipartUploadsCallbackData : TLibS3CallbackData
+{
+  UTF8String Key;
+  RawByteString UploadId;
+  bool Found;
+  bool IsTruncated;
+  UTF8String NextKeyMarker;
+  UTF8String NextUploadIdMarker;
+};
+//---------------------------------------------------------------------------
+S3Status TS3FileSystem::LibS3ListMultipartUploadsCallback(
+  int IsTruncated, const char * NextKeyMarker, const char * NextUploadIdMarker, int UploadsCount,
+  const S3ListMultipartUpload * Uploads, int /*CommonPrefixesCount*/, const char ** /*CommonPrefixes*/, void * CallbackData)
+{
+  TLibS3ListMultipartUploadsCallbackData & Data = *static_cast<TLibS3ListMultipartUploadsCallbackData *>(CallbackData);
+
+  Data.IsTruncated = IsTruncated;
+  Data.NextKeyMarker = NextKeyMarker;
+  Data.NextUploadIdMarker = NextUploadIdMarker;
+  for (int Index = 0; Index < UploadsCount; Index++)
+  {
+    const S3ListMultipartUpload & Upload = Uploads[Index];
+    // The prefix matches longer keys too
+    if ((Data.Key == UTF8String(Upload.key)) &&
+        (Data.UploadId == RawByteString(Upload.uploadId)))
+    {
+      Data.Found = true;
+    }
+  }
+
+  return S3StatusOK;
+}
+//---------------------------------------------------------------------------
+UnicodeString TS3FileSystem::GetMultipartUploadKey(
+  const UnicodeString & BucketName, const UnicodeString & Key, const UnicodeString & FileName)
+{
+  UTF8String Buf = UTF8String(FORMAT(L"%s\n%s\n%s\n%s", (FTerminal->SessionData->SessionKey, BucketName, Key, FileName)));
+  return Sha256(Buf.c_str(), Buf.Length());
+}
+//---------------------------------------------------------------------------
+bool TS3FileSystem::FindMultipartUpload(
+  TLibS3BucketContext & BucketContext, const UnicodeString & Key, const RawByteString & UploadId)
+{
+  TLibS3ListMultipartUploadsCallbackData Data;
+  Data.Key = UTF8String(Key);
+  Data.UploadId = UploadId;
+  Data.Found = false;
+
+  S3ListMultipartUploadsHandler Handler = { CreateResponseHandler(), &LibS3ListMultipartUploadsCallback };
+
+  do
+  {
+    RequestInit(Data);
+    Data.IsTruncated = false;
+
+    S3_list_multipart_uploads(
+      &BucketContext, Data.Key.c_str(), Data.NextKeyMarker.c_str(), Data.NextUploadIdMarker.c_str(), NULL, NULL, 0,
+      FRequestContext, FTimeout, &Handler, &Data);
+
+    // Not all servers support this, in which case we just upload the file from the start
+    if (Data.Status != S3StatusOK)
+    {
+      FTerminal->LogEvent(FORMAT(L"Cannot list multipart uploads (%s)", (UnicodeString(S3_get_status_name(Data.Status)))));
+      return false;
+    }
+  }
+  while (!Data.Found && Data.IsTruncated && !Data.NextKeyMarker.IsEmpty());
+
+  return Data.Found;
+}
+//---------------------------------------------------------------------------
+void TS3FileSystem::AbortMultipartUpload(
+  TLibS3BucketContext & BucketContext, const UnicodeString & Key, const RawByteString & UploadId)
+{
+  try
+  {
+    TLibS3CallbackData Data;
+    RequestInit(Data);
+
+    S3AbortMultipartUploadHandler AbortMultipartUploadHandler = { CreateResponseHandler() };
+
+    S3_abort_multipart_upload(
+      &BucketContext, StrToS3(Key), UploadId.c_str(),
+      FTimeout, &AbortMultipartUploadHandler, FRequestContext, &Data);
+  }
+  catch (...)
+  {
+    // swallow
+  }
+}
+//---------------------------------------------------------------------------
+struct TS3UploadedPart
+{
+  int Number;
+  __int64 Size;
+  RawByteString ETag;
+};
+//---------------------------------------------------------------------------
+struct TLibS3ListPartsCallbackData : TLibS3CallbackData
+{
+  std::vector<TS3UploadedPart> Parts;
+  bool IsTruncated;
+  UTF8String NextPartNumberMarker;
+};
+//---------------------------------------------------------------------------
+S3Status TS3FileSystem::LibS3ListPartsCallback(
+  int IsTruncated, const char * NextPartNumberMarker, const char * /*InitiatorId*/, const char * /*InitiatorDisplayName*/,
+  const char * /*OwnerId*/, const char * /*OwnerDisplayName*/, const char * /*StorageClass*/, int PartsCount,
+  int /*LastPartNumber*/, const S3ListPart * Parts, void * CallbackData)
+{
+  TLibS3ListPartsCallbackData & Data = *static_cast<TLibS3ListPartsCallbackData *>(CallbackData);
+
+  Data.IsTruncated = IsTruncated;
+  Data.NextPartNumberMarker = NextPartNumberMarker;
+  for (int Index = 0; Index < PartsCount; Index++)
+  {
+    TS3UploadedPart Part;
+    Part.Number = static_cast<int>(Parts[Index].partNumber);
+    Part.Size = static_cast<__int64>(Parts[Index].size);
+    Part.ETag = Parts[Index].eTag;
+    Data.Parts.push_back(Part);
+  }
+
+  return S3StatusOK;
+}
+//---------------------------------------------------------------------------
+int TS3FileSystem::ResumeUploadedParts(
+  TLibS3BucketContext & BucketContext, const UnicodeString & Key, const RawByteString & UploadId, const UnicodeString & FileName,
+  TStream * Stream, int ChunkSize, std::vector<RawByteString> & ETags, TFileOperationProgressType * OperationProgress)
+{
+  TLibS3ListPartsCallbackData Data;
+  S3ListPartsHandler Handler = { CreateResponseHandler(), &LibS3ListPartsCallback };
+
+  do
+  {
+    RequestInit(Data);
+    Data.IsTruncated = false;
+
+    S3_list_parts(
+      &BucketContext, StrToS3(Key), Data.NextPartNumberMarker.c_str(), UploadId.c_str(), NULL, 0,
+      FRequestContext, FTimeout, &Handler, &Data);
+
+    if (Data.Status != S3StatusOK)
+    {
+      FTerminal->LogEvent(FORMAT(L"Cannot list uploaded parts (%s), will upload all parts", (UnicodeString(S3_get_status_name(Data.Status)))));
+      return 0;
+    }
+  }
+  while (Data.IsTruncated && !Data.NextPartNumberMarker.IsEmpty());
+
+  int Result = 0;
+  std::unique_ptr<TMemoryStream> Buffer(new TMemoryStream());
+  for (size_t Index = 0; Index < Data.Parts.size(); Index++)
+  {
+    const TS3UploadedPart & Part = Data.Parts[Index];
+    // The commit will drop any part we do not list, including those beyond the local file size
+    if ((Part.Number >= 1) && (Part.Number <= static_cast<int>(ETags.size())))
+    {
+      __int64 Position = static_cast<__int64>(Part.Number - 1) * ChunkSize;
+      int PartLength = static_cast<int>(std::min(static_cast<__int64>(ChunkSize), Stream->Size - Position));
+      if (Part.Size != PartLength)
+      {
+        FTerminal->LogEvent(FORMAT(L"Part %d has a different size, will upload it again", (Part.Number)));
+      }
+      else
+      {
+        Buffer->Size = PartLength;
+        FILE_OPERATION_LOOP_BEGIN
+        {
+          Stream->Position = Position;
+          Stream->ReadBuffer(Buffer->Memory, PartLength);
+        }
+        FILE_OPERATION_LOOP_END(FMTLOAD(READ_ERROR, (FileName)));
+
+        Buffer->Position = 0;
+        UnicodeString Checksum = CalculateFileChecksum(Buffer.get(), Md5ChecksumAlg);
+        // The ETag of a part is the MD5 of its data (unless encrypted using KMS, in which case we upload the part again)
+        UnicodeString ETag = ReplaceStr(UnicodeString(Part.ETag), L"\"", UnicodeString());
+        if (SameText(Checksum, ETag))
+        {
+          ETags[Part.Number - 1] = Part.ETag;
+          Result++;
+        }
+        else
+        {
+          FTerminal->LogEvent(FORMAT(L"Part %d differs from the local file, will upload it again", (Part.Number)));
+        }
+      }
+    }
+
+    if (OperationProgress->Cancel != csContinue)
+    {
+      if (OperationProgress->ClearCancelFile())
+      {
+        throw ESkipFile();
+      }
+      else
+      {
+        Abort();
+      }
+    }
+  }
+
+  Stream->Position = 0;
+
+  return Result;
+}
+//---------------------------------------------------------------------------
+void __fastcall TS3FileSystem::Source(
+  TLocalFileHandle & Handle, const UnicodeString & TargetDir, UnicodeString & DestFileName,
+  const TCopyParamType * CopyParam, int Params,
+  TFileOperationProgressType * OperationProgress, unsigned int /*Flags*/,
+  TUploadSessionAction & Action, bool & /*ChildError*/)
+{
+  UnicodeString DestFullName = TargetDir + DestFileName;
+
+  TRemoteFile * RemoteFile = NULL;
+  try
+  {
+    // Should not throw on non-existing file by purpose (mainly not to get an exception while debugging)
+    DoReadFile(DestFullName, RemoteFile);
+  }
+  catch (...)
+  {
+    // Pointless, as there's no persistent connection.
+    if (!FTerminal->Active)
+    {
+      throw;
+    }
+  }
+
+  if (RemoteFile != NULL)
+  {
+    TOverwriteFileParams FileParams;
+
+    FileParams.SourceSize = Handle.Size;
+    FileParams.SourceTimestamp = Handle.Modification;
+    FileParams.DestSize = RemoteFile->Size;
+    FileParams.DestTimestamp = TDateTime();
+    FileParams.DestPrecision = mfNone;
+    delete RemoteFile;
+
+    ConfirmOverwrite(Handle.FileName, DestFileName, OperationProgress, &FileParams, CopyParam, Params);
+  }
+
+  DestFullName = TargetDir + DestFileName;
+  // only now, we know the final destination
+  // (not really true as we do not support changing file name on overwrite dialog)
+  Action.Destination(DestFullName);
+
+  UnicodeString BucketName, Key;
+  ParsePath(DestFullName, BucketName, Key);
+
+  if (Key.IsEmpty())
+  {
+    throw Exception(LoadStr(MISSING_TARGET_BUCKET));
+  }
+
+  TLibS3BucketContext BucketContext = GetBucketContext(BucketName, Key);
 
   UTF8String ContentType = UTF8String(FTerminal->Configuration->GetFileMimeType(Handle.FileName));
   S3PutProperties PutProperties =
@@ -2062,11 +3135,47 @@ void __fastcall TS3FileSystem::Source(
   DebugAssert((ChunkSize == S3MinMultiPartChunkSize) || (Handle.Size > static_cast<__int64>(S3MaxMultiPartChunks) * S3MinMultiPartChunkSize));
 
   bool Multipart = (Parts > 1);
+  // The server keeps the parts of an interrupted multipart upload until it is aborted, so we can resume it later,
+  // even from another session. The chunk size depends on the file size only, so it matches, if the file did not change.
+  bool ResumeAllowed = Multipart && CopyParam->AllowResume(Handle.Size, DestFileName);
 
   RawByteString MultipartUploadId;
+  bool Resuming = false;
   TLibS3MultipartCommitPutObjectDataCallbackData MultipartCommitPutObjectDataCallbackData;
 
+  // Only an upload that we have started ourselves for the same local file, which has not changed since, is resumed.
+  // Others may belong to another client uploading to the same key.
+  UnicodeString UploadKey;
+  UnicodeString UploadSignature = FORMAT(L"%s;%s", (IntToStr(Handle.Size), IntToStr(Handle.MTime)));
   if (Multipart)
+  {
+    UploadKey = GetMultipartUploadKey(BucketName, Key, Handle.FileName);
+    UnicodeString RememberedUpload = FTerminal->Configuration->RememberedMultipartUpload(UploadKey);
+    if (!RememberedUpload.IsEmpty())
+    {
+      RawByteString RememberedUploadId = RawByteString(CutToChar(RememberedUpload, L';', false));
+      if (ResumeAllowed &&
+          (RememberedUpload == UploadSignature) &&
+          FindMultipartUpload(BucketContext, Key, RememberedUploadId))
+      {
+        MultipartUploadId = RememberedUploadId;
+        Resuming = true;
+      }
+      else
+      {
+        FTerminal->LogEvent(
+          FORMAT(L"Aborting interrupted multipart upload (%s), as it cannot be resumed", (UnicodeString(RememberedUploadId))));
+        AbortMultipartUpload(BucketContext, Key, RememberedUploadId);
+        FTerminal->Configuration->ForgetMultipartUpload(UploadKey);
+      }
+    }
+  }
+
+  if (Resuming)
+  {
+    FTerminal->LogEvent(FORMAT(L"Found interrupted multipart upload (%s)", (UnicodeString(MultipartUploadId))));
+  }
+  else if (Multipart)
   {
     FTerminal->LogEvent(FORMAT(L"Initiating multipart upload (%d parts - chunk size %s)", (Parts, IntToStr(ChunkSize))));
 
@@ -2087,74 +3196,111 @@ void __fastcall TS3FileSystem::Source(
 
     FTerminal->LogEvent(FORMAT(L"Initiated multipart upload (%s - %d parts)", (UnicodeString(MultipartUploadId), Parts)));
 
-    MultipartCommitPutObjectDataCallbackData.Message += "<CompleteMultipartUpload>\n";
+    if (ResumeAllowed)
+    {
+      FTerminal->Configuration->RememberMultipartUpload(UploadKey, UnicodeString(MultipartUploadId) + L";" + UploadSignature);
+    }
   }
 
   try
   {
-    TLibS3PutObjectDataCallbackData Data;
+    std::unique_ptr<TStream> Stream(new TSafeHandleStream(reinterpret_cast<THandle>(Handle.Handle)));
 
-    __int64 Position = 0;
+    // ETags of the parts, the parts uploaded already by the interrupted upload are filled in advance
+    std::vector<RawByteString> ETags(Parts);
+    if (Resuming)
+    {
+      int Resumed =
+        ResumeUploadedParts(BucketContext, Key, MultipartUploadId, Handle.FileName, Stream.get(), ChunkSize, ETags, OperationProgress);
+      FTerminal->LogEvent(
+        FORMAT(L"Resuming multipart upload (%s - %d of %d parts uploaded already)", (UnicodeString(MultipartUploadId), Resumed, Parts)));
+    }
 
-    std::unique_ptr<TStream> Stream(new TSafeHandleStream(reinterpret_cast<THandle>(Handle.Handle)));
+    if (Multipart && (FTerminal->SessionData->S3MultipartConcurrency > 1))
+    {
+      TS3MultipartUpload Upload;
+      Upload.BucketContext = &BucketContext;
+      Upload.Key = Key;
+      Upload.PutProperties = &PutProperties;
+      Upload.UploadId = MultipartUploadId;
+      Upload.Parts = Parts;
+      Upload.ChunkSize = ChunkSize;
+      Upload.FileName = Handle.FileName;
+      Upload.BandwidthLimiter = OperationProgress->BandwidthLimiter;
+      Upload.ETags = ETags;
 
-    for (int Part = 1; Part <= Parts; Part++)
+      UploadPartsConcurrently(Upload, Stream.get(), OperationProgress);
+
+      ETags = Upload.ETags;
+    }
+    else
     {
-      FILE_OPERATION_LOOP_BEGIN
-      {
-        DebugAssert(Stream->Position == OperationProgress->TransferredSize);
+      TLibS3PutObjectDataCallbackData Data;
+
+      __int64 Position = 0;
 
-        // If not, it's chunk retry and we have to undo the unsuccessful chunk upload
-        if (Position < Stream->Position)
+      for (int Part = 1; Part <= Parts; Part++)
+      {
+        if (!ETags[Part - 1].IsEmpty())
         {
+          __int64 PartLength = std::min(static_cast<__int64>(ChunkSize), Stream->Size - Position);
+          Position += PartLength;
           Stream->Position = Position;
-          OperationProgress->AddTransferred(Position - OperationProgress->TransferredSize);
+          OperationProgress->AddResumed(PartLength);
+          continue;
         }
 
-        RequestInit(Data);
-        Data.FileName = Handle.FileName;
-        Data.Stream = Stream.get();
-        Data.OperationProgress = OperationProgress;
-        Data.Exception.reset(NULL);
-
-        if (Multipart)
+        FILE_OPERATION_LOOP_BEGIN
         {
-          S3PutObjectHandler UploadPartHandler =
-            { CreateResponseHandlerCustom(LibS3MultipartResponsePropertiesCallback), LibS3PutObjectDataCallback };
-          __int64 Remaining = Stream->Size - Stream->Position;
-          int RemainingInt = static_cast<int>(std::min(static_cast<__int64>(std::numeric_limits<int>::max()), Remaining));
-          int PartLength = std::min(ChunkSize, RemainingInt);
-          FTerminal->LogEvent(FORMAT(L"Uploading part %d [%s]", (Part, IntToStr(PartLength))));
-          S3_upload_part(
-            &BucketContext, StrToS3(Key), &PutProperties, &UploadPartHandler, Part, MultipartUploadId.c_str(),
-            PartLength, FRequestContext, FTimeout, &Data);
-        }
-        else
-        {
-          S3PutObjectHandler PutObjectHandler = { CreateResponseHandler(), LibS3PutObjectDataCallback };
-          S3_put_object(&BucketContext, StrToS3(Key), Handle.Size, &PutProperties, FRequestContext, FTimeout, &PutObjectHandler, &Data);
-        }
+          DebugAssert(Stream->Position == OperationProgress->TransferredSize);
 
-        // The "exception" was already seen by the user, its presence mean an accepted abort of the operation.
-        if (Data.Exception.get() == NULL)
-        {
-          CheckLibS3Error(Data, true);
-        }
+          // If not, it's chunk retry and we have to undo the unsuccessful chunk upload
+          if (Position < Stream->Position)
+          {
+            Stream->Position = Position;
+            OperationProgress->AddTransferred(Position - OperationProgress->TransferredSize);
+          }
 
-        Position = Stream->Position;
+          RequestInit(Data);
+          Data.FileName = Handle.FileName;
+          Data.Stream = Stream.get();
+          Data.OperationProgress = OperationProgress;
+          Data.Exception.reset(NULL);
 
-        if (Multipart)
-        {
-          RawByteString PartCommitTag =
-            RawByteString::Format("  <Part><PartNumber>%d</PartNumber><ETag>%s</ETag></Part>\n", ARRAYOFCONST((Part, Data.ETag)));
-          MultipartCommitPutObjectDataCallbackData.Message += PartCommitTag;
+          if (Multipart)
+          {
+            S3PutObjectHandler UploadPartHandler =
+              { CreateResponseHandlerCustom(LibS3MultipartResponsePropertiesCallback), LibS3PutObjectDataCallback };
+            __int64 Remaining = Stream->Size - Stream->Position;
+            int RemainingInt = static_cast<int>(std::min(static_cast<__int64>(std::numeric_limits<int>::max()), Remaining));
+            int PartLength = std::min(ChunkSize, RemainingInt);
+            FTerminal->LogEvent(FORMAT(L"Uploading part %d [%s]", (Part, IntToStr(PartLength))));
+            S3_upload_part(
+              &BucketContext, StrToS3(Key), &PutProperties, &UploadPartHandler, Part, MultipartUploadId.c_str(),
+              PartLength, FRequestContext, FTimeout, &Data);
+          }
+          else
+          {
+            S3PutObjectHandler PutObjectHandler = { CreateResponseHandler(), LibS3PutObjectDataCallback };
+            S3_put_object(&BucketContext, StrToS3(Key), Handle.Size, &PutProperties, FRequestContext, FTimeout, &PutObjectHandler, &Data);
+          }
+
+          // The "exception" was already seen by the user, its presence mean an accepted abort of the operation.
+          if (Data.Exception.get() == NULL)
+          {
+            CheckLibS3Error(Data, true);
+          }
+
+          Position = Stream->Position;
+
+          ETags[Part - 1] = Data.ETag;
         }
-      }
-      FILE_OPERATION_LOOP_END_EX(FMTLOAD(TRANSFER_ERROR, (Handle.FileName)), (folAllowSkip | folRetryOnFatal));
+        FILE_OPERATION_LOOP_END_EX(FMTLOAD(TRANSFER_ERROR, (Handle.FileName)), (folAllowSkip | folRetryOnFatal));
 
-      if (Data.Exception.get() != NULL)
-      {
-        RethrowException(Data.Exception.get());
+        if (Data.Exception.get() != NULL)
+        {
+          RethrowException(Data.Exception.get());
+        }
       }
     }
 
@@ -2162,6 +3308,14 @@ void __fastcall TS3FileSystem::Source(
 
     if (Multipart)
     {
+      // The parts may complete in any order, but they have to be committed in the part number order
+      MultipartCommitPutObjectDataCallbackData.Message += "<CompleteMultipartUpload>\n";
+      for (int Part = 1; Part <= Parts; Part++)
+      {
+        RawByteString PartCommitTag =
+          RawByteString::Format("  <Part><PartNumber>%d</PartNumber><ETag>%s</ETag></Part>\n", ARRAYOFCONST((Part, ETags[Part - 1])));
+        MultipartCommitPutObjectDataCallbackData.Message += PartCommitTag;
+      }
       MultipartCommitPutObjectDataCallbackData.Message += "</CompleteMultipartUpload>\n";
 
       FTerminal->LogEvent(FORMAT(L"Committing multipart upload (%s - %d parts)", (UnicodeString(MultipartUploadId), Parts)));
@@ -2187,28 +3341,38 @@ void __fastcall TS3FileSystem::Source(
 
       // to skip abort, in case we ever add any code before the catch, that can throw
       MultipartUploadId = RawByteString();
+
+      if (ResumeAllowed)
+      {
+        FTerminal->Configuration->ForgetMultipartUpload(UploadKey);
+      }
     }
   }
   catch (Exception & E)
   {
-    if (!MultipartUploadId.IsEmpty())
+    // Keep the upload only when the transfer was interrupted (by a lost connection),
+    // not when the user cancelled or skipped it
+    if (!MultipartUploadId.IsEmpty() && ResumeAllowed &&
+        (dynamic_cast<EFatal *>(&E) != NULL) && (OperationProgress->Cancel == csContinue))
+    {
+      FTerminal->LogEvent(FORMAT(L"Keeping multipart upload (%s) to allow resuming it", (UnicodeString(MultipartUploadId))));
+    }
+    else if (!MultipartUploadId.IsEmpty())
     {
       FTerminal->LogEvent(FORMAT(L"Aborting multipart upload (%s - %d parts)", (UnicodeString(MultipartUploadId), Parts)));
 
-      try
-      {
-        TLibS3CallbackData Data;
-        RequestInit(Data);
-
-        S3AbortMultipartUploadHandler AbortMultipartUploadHandler = { CreateResponseHandler() };
+      AbortMultipartUpload(BucketContext, Key, MultipartUploadId);
 
-        S3_abort_multipart_upload(
-          &BucketContext, StrToS3(Key), MultipartUploadId.c_str(),
-          FTimeout, &AbortMultipartUploadHandler, FRequestContext, &Data);
-      }
-      catch (...)
+      if (ResumeAllowed)
       {
-        // swallow
+        try
+        {
+          FTerminal->Configuration->ForgetMultipartUpload(UploadKey);
+        }
+        catch (...)
+        {
+          // swallow
+        }
       }
     }
 
@@ -2274,8 +3438,17 @@ void __fastcall TS3FileSystem::Sink(
   const TCopyParamType * CopyParam, int Params, TFileOperationProgressType * OperationProgress,
   unsigned int /*Flags*/, TDownloadSessionAction & Action)
 {
+  // resume has no sense for temporary downloads
+  bool ResumeAllowed =
+    FLAGCLEAR(Params, cpTemporary) &&
+    CopyParam->AllowResume(OperationProgress->TransferSize, DestFileName) &&
+    (CopyParam->PartOffset < 0);
+  // Parts of a parallel transfer are written directly to their place in a file preallocated by TParallelOperation,
+  // which also takes care of its timestamp and attributes once all parts are done
+  bool InPlacePart = (CopyParam->PartOffset >= 0);
+
   UnicodeString DestFullName = TargetDir + DestFileName;
-  if (FileExists(ApiPath(DestFullName)))
+  if (!InPlacePart && FileExists(ApiPath(DestFullName)))
   {
     __int64 Size;
     __int64 MTime;
@@ -2290,6 +3463,33 @@ void __fastcall TS3FileSystem::Sink(
     ConfirmOverwrite(FileName, DestFileName, OperationProgress, &FileParams, CopyParam, Params);
   }
 
+  UnicodeString DestPartialFullName = DestFullName + PartialExt;
+  UnicodeString LocalFileName = ResumeAllowed ? DestPartialFullName : DestFullName;
+
+  __int64 ResumeOffset = 0;
+  if (ResumeAllowed)
+  {
+    FTerminal->DiscardParallelPartialFile(DestFullName);
+    FTerminal->LogEvent(L"Checking existence of partially transferred file.");
+    if (FileExists(ApiPath(DestPartialFullName)))
+    {
+      FTerminal->LogEvent(L"Partially transferred file exists.");
+      FTerminal->OpenLocalFile(DestPartialFullName, GENERIC_READ, NULL, NULL, NULL, NULL, NULL, &ResumeOffset);
+      // A range starting at the end of the object is not satisfiable, so download the complete file even then
+      if (ResumeOffset >= OperationProgress->TransferSize)
+      {
+        FTerminal->LogEvent(L"Partially transferred file is not smaller than original file.");
+        FTerminal->DoDeleteLocalFile(DestPartialFullName);
+        ResumeOffset = 0;
+      }
+      else
+      {
+        FTerminal->LogEvent(L"Resuming file transfer.");
+        OperationProgress->AddResumed(ResumeOffset);
+      }
+    }
+  }
+
   UnicodeString BucketName, Key;
   ParsePath(FileName, BucketName, Key);
 
@@ -2301,14 +3501,24 @@ void __fastcall TS3FileSystem::Sink(
   FILE_OPERATION_LOOP_BEGIN
   {
     HANDLE LocalHandle;
-    if (!FTerminal->CreateLocalFile(DestFullName, OperationProgress, &LocalHandle, FLAGSET(Params, cpNoConfirmation)))
+    if (InPlacePart)
+    {
+      FTerminal->OpenLocalFileSegment(LocalFileName, CopyParam->PartOffset, &LocalHandle);
+    }
+    else if (ResumeOffset > 0)
+    {
+      FTerminal->OpenLocalFile(LocalFileName, GENERIC_WRITE, NULL, &LocalHandle, NULL, NULL, NULL, NULL);
+      FileSeek((THandle)LocalHandle, ResumeOffset, soBeginning);
+    }
+    else if (!FTerminal->CreateLocalFile(LocalFileName, OperationProgress, &LocalHandle, FLAGSET(Params, cpNoConfirmation)))
     {
       throw ESkipFile();
     }
 
     std::unique_ptr<TStream> Stream(new TSafeHandleStream(reinterpret_cast<THandle>(LocalHandle)));
 
-    bool DeleteLocalFile = true;
+    // The preallocated file is shared with the other parts
+    bool DeleteLocalFile = !InPlacePart;
 
     try
     {
@@ -2322,10 +3532,19 @@ void __fastcall TS3FileSystem::Sink(
         Data.OperationProgress = OperationProgress;
         Data.Exception.reset(NULL);
 
+        // The local file position is also the position in the object,
+        // both when resuming and for the in-place parts, and on retries
+        __int64 StartByte = Stream->Position;
+        __int64 ByteCount = 0; // Until the end
+        if (CopyParam->PartSize >= 0)
+        {
+          ByteCount = CopyParam->PartOffset + CopyParam->PartSize - StartByte;
+        }
+
         TAutoFlag ResponseIgnoreSwitch(FResponseIgnore);
         S3GetObjectHandler GetObjectHandler = { CreateResponseHandler(), LibS3GetObjectDataCallback };
         S3_get_object(
-          &BucketContext, StrToS3(Key), NULL, Stream->Position, 0, FRequestContext, FTimeout, &GetObjectHandler, &Data);
+          &BucketContext, StrToS3(Key), NULL, StartByte, ByteCount, FRequestContext, FTimeout, &GetObjectHandler, &Data);
 
         // The "exception" was already seen by the user, its presence mean an accepted abort of the operation.
         if (Data.Exception.get() == NULL)
@@ -2342,7 +3561,7 @@ void __fastcall TS3FileSystem::Sink(
 
       DeleteLocalFile = false;
 
-      if (CopyParam->PreserveTime)
+      if (CopyParam->PreserveTime && !InPlacePart)
       {
         FTerminal->UpdateTargetTime(
           LocalHandle, File->Modification, File->ModificationFmt, FTerminal->SessionData->DSTMode);
@@ -2350,17 +3569,31 @@ void __fastcall TS3FileSystem::Sink(
     }
     __finally
     {
+      // Keep what was downloaded, so that the transfer can be resumed
+      if (DeleteLocalFile && ResumeAllowed && (Stream->Size > 0))
+      {
+        DeleteLocalFile = false;
+      }
+
       CloseHandle(LocalHandle);
 
       if (DeleteLocalFile)
       {
-        FTerminal->DoDeleteLocalFile(DestFullName);
+        FTerminal->DoDeleteLocalFile(LocalFileName);
       }
     }
   }
   FILE_OPERATION_LOOP_END(FMTLOAD(TRANSFER_ERROR, (FileName)));
 
-  FTerminal->UpdateTargetAttrs(DestFullName, File, CopyParam, Attrs);
+  if (ResumeAllowed)
+  {
+    FTerminal->DoRenameLocalFileForce(DestPartialFullName, DestFullName);
+  }
+
+  if (!InPlacePart)
+  {
+    FTerminal->UpdateTargetAttrs(DestFullName, File, CopyParam, Attrs);
+  }
 }
 //---------------------------------------------------------------------------
 void __fastcall TS3FileSystem::GetSupportedChecksumAlgs(TStrings * /*Algs*/)
@@ -12,6 +12,13 @@ struct TLibS3ListBucketCallbackData;
 struct TLibS3TransferObjectDataCallbackData;
 struct TLibS3PutObjectDataCallbackData;
 struct TLibS3GetObjectDataCallbackData;
+struct TLibS3UploadPartCallbackData;
+struct TS3MultipartUpload;
+struct TS3UploadPart;
+class TS3UploadPartWorker;
+struct TS3DeleteObjects;
+struct TS3DeleteObjectsBatch;
+class TS3DeleteObjectsWorker;
 struct ssl_st;
 struct TS3FileProperties;
 #ifdef NEED_LIBS3
@@ -26,6 +33,8 @@ struct S3ResponseProperties;
 struct S3RequestContext;
 struct S3ErrorDetails;
 struct S3ListBucketContent;
+struct S3ListMultipartUpload;
+struct S3ListPart;
 struct S3ResponseHandler;
 struct S3AclGrant;
 enum S3Status { };
@@ -35,6 +44,8 @@ enum S3Permission { };
 //------------------------------------------------------------------------------
 class TS3FileSystem : public TCustomFileSystem
 {
+friend class TS3UploadPartWorker;
+friend class TS3DeleteObjectsWorker;
 public:
   explicit TS3FileSystem(TTerminal * ATerminal);
   virtual __fastcall ~TS3FileSystem();
@@ -127,6 +138,7 @@ protected:
   _S3Protocol FLibS3Protocol;
   ne_session_s * FNeonSession;
   UnicodeString FTlsVersionStr;
+  UnicodeString FVerifiedCertificateFingerprint;
   UnicodeString FResponse;
   bool FResponseIgnore;
   typedef std::map<UnicodeString, UnicodeString> TRegions;
@@ -141,6 +153,7 @@ protected:
   void CollectTLSSessionInfo();
   void CheckLibS3Error(const TLibS3CallbackData & Data, bool FatalOnConnectError = false);
   void InitSslSession(ssl_st * Ssl, ne_session_s * Session);
+  void SetupNeonSession(ne_session_s * Session);
   void RequestInit(TLibS3CallbackData & Data);
   void TryOpenDirectory(const UnicodeString & Directory);
   void ReadDirectoryInternal(const UnicodeString & Path, TRemoteFileList * FileList, int MaxKeys, const UnicodeString & FileName);
@@ -158,9 +171,25 @@ protected:
     TFileOperationProgressType * OperationProgress, const TOverwriteFileParams * FileParams,
     const TCopyParamType * CopyParam, int Params);
   int PutObjectData(int BufferSize, char * Buffer, TLibS3PutObjectDataCallbackData & Data);
+  void UploadPartsConcurrently(TS3MultipartUpload & Upload, TStream * Stream, TFileOperationProgressType * OperationProgress);
+  void UploadPart(
+    TS3MultipartUpload & Upload, TS3UploadPart & Part, TS3UploadPartWorker * Worker, S3RequestContext * RequestContext);
+  RawByteString RetryUploadPart(TS3MultipartUpload & Upload, TStream * Buffer, int Part, TFileOperationProgressType * OperationProgress);
+  int UploadPartData(int BufferSize, char * Buffer, TLibS3UploadPartCallbackData & Data);
   S3Status GetObjectData(int BufferSize, const char * Buffer, TLibS3GetObjectDataCallbackData & Data);
   bool ShouldCancelTransfer(TLibS3TransferObjectDataCallbackData & Data);
   bool IsGoogleCloud();
+  UnicodeString GetMultipartUploadKey(const UnicodeString & BucketName, const UnicodeString & Key, const UnicodeString & FileName);
+  bool FindMultipartUpload(TLibS3BucketContext & BucketContext, const UnicodeString & Key, const RawByteString & UploadId);
+  void AbortMultipartUpload(TLibS3BucketContext & BucketContext, const UnicodeString & Key, const RawByteString & UploadId);
+  int ResumeUploadedParts(
+    TLibS3BucketContext & BucketContext, const UnicodeString & Key, const RawByteString & UploadId, const UnicodeString & FileName,
+    TStream * Stream, int ChunkSize, std::vector<RawByteString> & ETags, TFileOperationProgressType * OperationProgress);
+  S3RequestContext * CreateWorkerRequestContext();
+  void DeleteDirectoryContents(const UnicodeString & FileName, int Params);
+  void ListObjectKeys(const TLibS3BucketContext & BucketContext, const UnicodeString & Prefix, TS3DeleteObjects & Delete);
+  void DeleteObjectsBatch(TS3DeleteObjects & Delete, TS3DeleteObjectsBatch & Batch, S3RequestContext * RequestContext);
+  void DeleteObjectsBatchDone(TS3DeleteObjects & Delete, TS3DeleteObjectsBatch & Batch, TStrings * FailedFileNames);
   void __fastcall LoadFileProperties(const UnicodeString AFileName, const TRemoteFile * File, void * Param);
   bool DoLoadFileProperties(const UnicodeString & AFileName, const TRemoteFile * File, TS3FileProperties & Properties);
   unsigned short AclGrantToPermissions(S3AclGrant & AclGrant, const TS3FileProperties & Properties);
@@ -184,9 +213,26 @@ protected:
   static int LibS3MultipartCommitPutObjectDataCallback(int BufferSize, char * Buffer, void * CallbackData);
   static S3Status LibS3MultipartResponsePropertiesCallback(const S3ResponseProperties * Properties, void * CallbackData);
   static S3Status LibS3GetObjectDataCallback(int BufferSize, const char * Buffer, void * CallbackData);
+  static void LibS3WorkerSessionCallback(ne_session_s * Session, void * CallbackData);
+  static int LibS3WorkerSslCallback(int Failures, const ne_ssl_certificate_s * Certificate, void * CallbackData);
+  static int LibS3UploadPartDataCallback(int BufferSize, char * Buffer, void * CallbackData);
+  static S3Status LibS3ListObjectKeysCallback(
+    int IsTruncated, const char * NextMarker, int ContentsCount, const S3ListBucketContent * Contents,
+    int CommonPrefixesCount, const char ** CommonPrefixes, void * CallbackData);
+  static S3Status LibS3DeleteObjectsResultCallback(
+    const char * Key, const char * ErrorCode, const char * ErrorMessage, void * CallbackData);
+  static S3Status LibS3ListMultipartUploadsCallback(
+    int IsTruncated, const char * NextKeyMarker, const char * NextUploadIdMarker, int UploadsCount,
+    const S3ListMultipartUpload * Uploads, int CommonPrefixesCount, const char ** CommonPrefixes, void * CallbackData);
+  static S3Status LibS3ListPartsCallback(
+    int IsTruncated, const char * NextPartNumberMarker, const char * InitiatorId, const char * InitiatorDisplayName,
+    const char * OwnerId, const char * OwnerDisplayName, const char * StorageClass, int PartsCount,
+    int LastPartNumber, const S3ListPart * Parts, void * CallbackData);
 
   static const int S3MinMultiPartChunkSize;
   static const int S3MaxMultiPartChunks;
+  static const int S3MaxDeleteObjectsKeys;
+  static const int S3DeleteObjectsConcurrency;
 };
 //------------------------------------------------------------------------------
 UnicodeString __fastcall S3LibVersion();
@@ -36,7 +36,7 @@ const int ecDefault = ecRaiseExcept;
 //---------------------------------------------------------------------------
 DERIVE_EXT_EXCEPTION(EScpFileSkipped, ESkipFile);
 //===========================================================================
-#define MaxShellCommand fsLang
+#define MaxShellCommand fsListDirectoryRecursive
 #define ShellCommandCount MaxShellCommand + 1
 #define MaxCommandLen 40
 struct TCommandType
@@ -101,6 +101,9 @@ const wchar_t NationalVars[][15] =
   {L"LANG", L"LANGUAGE", L"LC_CTYPE", L"LC_COLLATE", L"LC_MONETARY", L"LC_NUMERIC",
    L"LC_TIME", L"LC_MESSAGES", L"LC_ALL", L"HUMAN_BLOCKS", L"BLOCK_SIZE", L"LS_BLOCK_SIZE" };
 const wchar_t FullTimeOption[] = L"--full-time";
+// Command line length of the checksum batches, see CalculateFilesChecksum
+const int MinChecksumBatchLength = 2048;
+const int MaxChecksumBatchLength = 32768;
 //---------------------------------------------------------------------------
 #define F false
 #define T true
@@ -132,7 +135,8 @@ const TCommandType DefaultCommandSet[ShellCommandCount] = {
 /*CreateLink*/          {  0,  0, T, F, F, L"ln %s \"%s\" \"%s\"" /*symbolic (-s), filename, point to*/},
 /*CopyFile*/            {  0,  0, T, F, F, L"cp -p -r -f %s \"%s\" \"%s\"" /* file/directory, target name*/},
 /*AnyCommand*/          {  0, -1, T, T, F, L"%s" },
-/*Lang*/                {  0,  1, F, F, F, L"printenv LANG"}
+/*Lang*/                {  0,  1, F, F, F, L"printenv LANG"},
+/*ListDirectoryRecursive*/{ -1, -1, F, F, F, L"%s %s -R \"%s\"" /* listing command, options, directory */ }
 };
 #undef F
 #undef T
@@ -293,6 +297,17 @@ __fastcall TSCPFileSystem::TSCPFileSystem(TTerminal * ATerminal, TSecureShell *
   FOutput = new TStringList();
   FProcessingCommand = false;
   FOnCaptureOutput = NULL;
+  FReadAheadListings.reset(new TStringList());
+  FReadAheadListings->OwnsObjects = true;
+  FReadAheadListings->CaseSensitive = true;
+  FReadAheadListings->Sorted = true;
+  FReadAheadUnlisted.reset(new TStringList());
+  FReadAheadUnlisted->CaseSensitive = true;
+  FReadAheadUnlisted->Sorted = true;
+  FReadAheadUnlisted->Duplicates = Types::dupIgnore;
+  FDeepListingRefused = false;
+  FChecksumBatchLength = MinChecksumBatchLength;
+  FChecksumBatchLengthFixed = false;
 
   FFileSystemInfo.ProtocolBaseName = L"SCP";
   FFileSystemInfo.ProtocolName = FFileSystemInfo.ProtocolBaseName;
@@ -463,6 +478,7 @@ bool __fastcall TSCPFileSystem::IsCapable(int Capability) const
     case fcSkipTransfer:
     case fcParallelTransfers: // does not implement cpNoRecurse
     case fcParallelFileTransfers:
+    case fcParallelFileUploads:
     case fcTransferOut:
     case fcTransferIn:
       return false;
@@ -992,6 +1008,11 @@ void __fastcall TSCPFileSystem::ReadDirectory(TRemoteFileList * FileList)
   // emptying file list moved before command execution
   FileList->Reset();
 
+  if (TakeReadAheadListing(FileList))
+  {
+    return;
+  }
+
   bool Again;
 
   do
@@ -1122,6 +1143,218 @@ void __fastcall TSCPFileSystem::ReadDirectory(TRemoteFileList * FileList)
   while (Again);
 }
 //---------------------------------------------------------------------------
+UnicodeString __fastcall TSCPFileSystem::ReadAheadPath(const UnicodeString & Directory)
+{
+  return UnixExcludeTrailingBackslash(AbsolutePath(Directory, false));
+}
+//---------------------------------------------------------------------------
+void __fastcall TSCPFileSystem::ReadAheadDirectories(TRemoteFileList * FileList, bool UseCache)
+{
+  // The walk in TTerminal::ProcessDirectory lists one directory at a time,
+  // each listing being a command round-trip.
+  // If enabled, we list the whole subtree with a single "ls -R" instead,
+  // when the walk first gets to a directory with subdirectories we do not have listed yet.
+  // ReadDirectory then picks the listings of the subdirectories.
+  if (FTerminal->SessionData->SCPDeepListing && !FDeepListingRefused)
+  {
+    UnicodeString Directory = ReadAheadPath(FileList->Directory);
+    bool Missing = false;
+    for (int Index = 0; !Missing && (Index < FileList->Count); Index++)
+    {
+      TRemoteFile * File = FileList->Files[Index];
+      UnicodeString SubDirectory = UnixCombinePaths(Directory, File->FileName);
+      Missing =
+        File->IsDirectory && !File->IsSymLink && IsRealFile(File->FileName) &&
+        (FReadAheadListings->IndexOf(SubDirectory) < 0) &&
+        // Already covered by a recursive listing, listing it again would not help
+        (FReadAheadUnlisted->IndexOf(SubDirectory) < 0) &&
+        // The walk will not read the directory, if it has it cached
+        (!UseCache || !FTerminal->SessionData->CacheDirectories ||
+         !FTerminal->FDirectoryCache->HasFileList(SubDirectory));
+    }
+
+    if (Missing)
+    {
+      FTerminal->LogEvent(FORMAT(L"Listing directory \"%s\" with all its subdirectories.", (Directory)));
+      // Listings we might still have from before would get mixed with the new ones
+      DiscardReadAheadListings(Directory);
+      bool Failed;
+      try
+      {
+        TOperationVisualizer Visualizer(FTerminal->UseBusyCursor);
+        // Unreadable subdirectories make ls exit with 1, their listings are left out below
+        // and the regular listing will report the error, when the walk gets to them.
+        int Params = ecDefault | ecIgnoreWarnings;
+        // Like with fsListFile, --full-time only if we know it is supported
+        const wchar_t * Options = (FLsFullTime == asOn) ? FullTimeOption : L"";
+        ExecCommand(fsListDirectoryRecursive,
+          ARRAYOFCONST((FTerminal->SessionData->ListingCommand, Options, DelimitStr(Directory))),
+          Params);
+
+        // Copy the output, as symlink resolution would modify it
+        std::unique_ptr<TStringList> OutputCopy(new TStringList());
+        OutputCopy->Assign(FOutput);
+        Failed = !ParseDeepListing(Directory, OutputCopy.get());
+      }
+      catch (Exception & E)
+      {
+        if (!FTerminal->Active)
+        {
+          throw;
+        }
+        FTerminal->Log->AddException(&E);
+        Failed = true;
+      }
+
+      if (Failed)
+      {
+        // Typically an ls without -R or with an unexpected output format.
+        // Other problems will show with the regular listing.
+        FTerminal->LogEvent(L"Recursive listing failed, will list directories one by one.");
+        FDeepListingRefused = true;
+        DiscardReadAheadListings(Directory);
+      }
+      else
+      {
+        FTerminal->LogEvent(FORMAT(L"%d directory listings prepared.", (FReadAheadListings->Count)));
+      }
+    }
+  }
+}
+//---------------------------------------------------------------------------
+bool __fastcall TSCPFileSystem::ParseDeepListing(const UnicodeString & Directory, TStrings * Output)
+{
+  // "ls -R" lists each directory under a "path:" header,
+  // with the listings separated by an empty line.
+  UnicodeString Prefix = UnixIncludeTrailingBackslash(Directory);
+  TRemoteFileList * Listing = NULL;
+  bool Header = true;
+  bool Result = true;
+  for (int Index = 0; Result && (Index < Output->Count); Index++)
+  {
+    UnicodeString Line = Output->Strings[Index];
+    if (Line.IsEmpty())
+    {
+      Header = true;
+    }
+    else if (Header)
+    {
+      Header = false;
+      UnicodeString Path;
+      Result = EndsStr(L":", Line);
+      if (Result)
+      {
+        Path = UnixExcludeTrailingBackslash(Line.SubString(1, Line.Length() - 1));
+        Result = UnixSamePath(Path, Directory) || StartsStr(Prefix, Path);
+      }
+      if (Result)
+      {
+        // The listing of the directory itself is not needed
+        Listing = UnixSamePath(Path, Directory) ? NULL : GetReadAheadListing(Path);
+      }
+    }
+    else if ((Listing != NULL) && !IsTotalListingLine(Line))
+    {
+      std::unique_ptr<TRemoteFile> File(CreateRemoteFile(Line));
+      if (FTerminal->IsValidFile(File.get()))
+      {
+        Listing->AddFile(File.release());
+      }
+    }
+  }
+
+  // Listings of directories that ls could not read are empty,
+  // leave them to the regular listing, so that it reports the error.
+  // But remember them, so that their parent directories are not listed recursively again.
+  for (int Index = FReadAheadListings->Count - 1; Result && (Index >= 0); Index--)
+  {
+    TRemoteFileList * FileList = static_cast<TRemoteFileList *>(FReadAheadListings->Objects[Index]);
+    if (FileList->Count == 0)
+    {
+      FReadAheadUnlisted->Add(FReadAheadListings->Strings[Index]);
+      FReadAheadListings->Delete(Index);
+    }
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+TRemoteFileList * __fastcall TSCPFileSystem::GetReadAheadListing(const UnicodeString & Path)
+{
+  int Index = FReadAheadListings->IndexOf(Path);
+  if (Index < 0)
+  {
+    TRemoteFileList * FileList = new TRemoteFileList();
+    FileList->Directory = Path;
+    Index = FReadAheadListings->AddObject(Path, FileList);
+  }
+  return static_cast<TRemoteFileList *>(FReadAheadListings->Objects[Index]);
+}
+//---------------------------------------------------------------------------
+bool __fastcall TSCPFileSystem::TakeReadAheadListing(TRemoteFileList * FileList)
+{
+  bool Result = false;
+  UnicodeString Path = ReadAheadPath(FileList->Directory);
+  int Index = FReadAheadUnlisted->IndexOf(Path);
+  if (Index >= 0)
+  {
+    // Falls through to the regular listing
+    FReadAheadUnlisted->Delete(Index);
+  }
+  Index = FReadAheadListings->IndexOf(Path);
+  if (Index >= 0)
+  {
+    FTerminal->LogEvent(FORMAT(L"Using listing of directory \"%s\" read in advance.", (Path)));
+    TRemoteFileList * Listing = static_cast<TRemoteFileList *>(FReadAheadListings->Objects[Index]);
+    // The files move to FileList
+    Listing->OwnsObjects = false;
+    for (int FileIndex = 0; FileIndex < Listing->Count; FileIndex++)
+    {
+      FileList->AddFile(Listing->Files[FileIndex]);
+    }
+    FReadAheadListings->Delete(Index);
+    Result = true;
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+void __fastcall TSCPFileSystem::DiscardReadAheadPaths(TStringList * Paths, const UnicodeString & Path)
+{
+  UnicodeString Prefix = UnixIncludeTrailingBackslash(Path);
+  int Index = 0;
+  while (Index < Paths->Count)
+  {
+    UnicodeString ListingPath = Paths->Strings[Index];
+    if ((ListingPath == Path) || StartsStr(Prefix, ListingPath))
+    {
+      Paths->Delete(Index);
+    }
+    else
+    {
+      Index++;
+    }
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TSCPFileSystem::DiscardReadAheadListings(const UnicodeString & Path)
+{
+  DiscardReadAheadPaths(FReadAheadListings.get(), Path);
+  DiscardReadAheadPaths(FReadAheadUnlisted.get(), Path);
+}
+//---------------------------------------------------------------------------
+void __fastcall TSCPFileSystem::ReadAheadDone(const UnicodeString & Directory)
+{
+  // Nothing below the directory will be needed anymore
+  if (Directory.IsEmpty())
+  {
+    FReadAheadListings->Clear();
+    FReadAheadUnlisted->Clear();
+  }
+  else
+  {
+    DiscardReadAheadListings(ReadAheadPath(Directory));
+  }
+}
+//---------------------------------------------------------------------------
 void __fastcall TSCPFileSystem::ReadSymlink(TRemoteFile * SymlinkFile,
   TRemoteFile *& File)
 {
@@ -1369,9 +1602,11 @@ void __fastcall TSCPFileSystem::CalculateFilesChecksum(
   int Index = 0;
   while ((Index < FileList->Count) && !OperationProgress->Cancel)
   {
+    int BatchStart = Index;
     std::unique_ptr<TStrings> BatchFileList(new TStringList());
     UnicodeString FileListCommandLine;
     __int64 BatchSize = 0;
+    bool BatchLengthLimited = false;
     while (Index < FileList->Count)
     {
       TRemoteFile * File = DebugNotNull(dynamic_cast<TRemoteFile *>(FileList->Objects[Index]));
@@ -1382,9 +1617,10 @@ void __fastcall TSCPFileSystem::CalculateFilesChecksum(
         AddToShellFileListCommandLine(FileListCommandLine, FileName);
         BatchSize += File->Size;
         if (!FileListCommandLineBak.IsEmpty() &&
-            ((FileListCommandLine.Length() > 2048) ||
+            ((FileListCommandLine.Length() > FChecksumBatchLength) ||
              (BatchSize > 1024*1024*1024)))
         {
+          BatchLengthLimited = (FileListCommandLine.Length() > FChecksumBatchLength);
           FileListCommandLine = FileListCommandLineBak;
           break;
         }
@@ -1431,8 +1667,25 @@ void __fastcall TSCPFileSystem::CalculateFilesChecksum(
         }
       }
 
-      if (!IndividualCommands)
+      if (IndividualCommands && !FChecksumBatchLengthFixed && (FChecksumBatchLength > MinChecksumBatchLength))
       {
+        // Possibly the command line got too long for the server.
+        // Retry the batch with the last length that worked and do not try longer ones anymore.
+        FChecksumBatchLength /= 2;
+        FChecksumBatchLengthFixed = true;
+        FTerminal->LogEvent(
+          FORMAT(L"Batch checksum calculation failed, retrying with command line limited to %d characters...", (FChecksumBatchLength)));
+        Index = BatchStart;
+      }
+      else if (!IndividualCommands)
+      {
+        // With many small files, the command round-trips take most of the time,
+        // so as long as the batches work, make them longer.
+        if (BatchLengthLimited && !FChecksumBatchLengthFixed && (FChecksumBatchLength < MaxChecksumBatchLength))
+        {
+          FChecksumBatchLength *= 2;
+        }
+
         // None of this should throw
         for (int BatchIndex = 0; BatchIndex < BatchFileList->Count; BatchIndex++)
         {
@@ -2884,5 +3137,5 @@ void __fastcall TSCPFileSystem::UpdateFromMain(TCustomFileSystem * /*MainFileSys
 //---------------------------------------------------------------------------
 void __fastcall TSCPFileSystem::ClearCaches()
 {
-  // noop
+  FReadAheadListings->Clear();
 }
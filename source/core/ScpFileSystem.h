@@ -64,6 +64,8 @@ public:
   virtual void __fastcall LookupUsersGroups();
   virtual void __fastcall ReadCurrentDirectory();
   virtual void __fastcall ReadDirectory(TRemoteFileList * FileList);
+  virtual void __fastcall ReadAheadDirectories(TRemoteFileList * FileList, bool UseCache);
+  virtual void __fastcall ReadAheadDone(const UnicodeString & Directory);
   virtual void __fastcall ReadFile(const UnicodeString FileName,
     TRemoteFile *& File);
   virtual void __fastcall ReadSymlink(TRemoteFile * SymlinkFile,
@@ -104,6 +106,13 @@ private:
   int FLsFullTime;
   TCaptureOutputEvent FOnCaptureOutput;
   bool FScpFatalError;
+  // Listings of subdirectories read by a recursive ls in advance, by their path
+  std::unique_ptr<TStringList> FReadAheadListings;
+  // Subdirectories covered by a recursive ls, which it could not list (or which are empty)
+  std::unique_ptr<TStringList> FReadAheadUnlisted;
+  bool FDeepListingRefused;
+  int FChecksumBatchLength;
+  bool FChecksumBatchLengthFixed;
 
   void __fastcall DetectUtf();
   void __fastcall ClearAliases();
@@ -118,6 +127,12 @@ private:
     int size = 0, int Params = -1);
   void InvalidOutputError(const UnicodeString & Command);
   void __fastcall ReadCommandOutput(int Params, const UnicodeString * Cmd = NULL);
+  bool __fastcall ParseDeepListing(const UnicodeString & Directory, TStrings * Output);
+  UnicodeString __fastcall ReadAheadPath(const UnicodeString & Directory);
+  TRemoteFileList * __fastcall GetReadAheadListing(const UnicodeString & Path);
+  bool __fastcall TakeReadAheadListing(TRemoteFileList * FileList);
+  void __fastcall DiscardReadAheadListings(const UnicodeString & Path);
+  static void __fastcall DiscardReadAheadPaths(TStringList * Paths, const UnicodeString & Path);
   void __fastcall SCPResponse(bool * GotLastLine = NULL);
   void __fastcall SCPDirectorySource(const UnicodeString DirectoryName,
     const UnicodeString TargetDir, const TCopyParamType * CopyParam, int Params,
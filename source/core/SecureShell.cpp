@@ -98,10 +98,13 @@ void __fastcall TSecureShell::ResetConnection()
 {
   FreeBackend();
   ClearStdError();
+  PendStart = 0;
   PendLen = 0;
   PendSize = 0;
   sfree(Pending);
   Pending = NULL;
+  FReceivedBytes = 0;
+  FCopiedBytes = 0;
   FCWriteTemp = L"";
   ResetSessionInfo();
   FAuthenticating = false;
@@ -178,6 +181,7 @@ Conf * __fastcall TSecureShell::StoreToConfig(TSessionData * Data, bool Simple)
   // multi-threaded issues in putty timer list
   conf_set_int(conf, CONF_ping_interval, 0);
   conf_set_bool(conf, CONF_compression, Data->Compression);
+  conf_set_int(conf, CONF_compression_level, Data->CompressionLevel);
   conf_set_bool(conf, CONF_tryagent, Data->TryAgent);
   conf_set_bool(conf, CONF_agentfwd, Data->AgentFwd);
   conf_set_int(conf, CONF_addressfamily, Data->AddressFamily);
@@ -310,6 +314,16 @@ Conf * __fastcall TSecureShell::StoreToConfig(TSessionData * Data, bool Simple)
     DebugAssert(Simple);
     conf_set_bool(conf, CONF_ssh_simple, Data->SshSimple && Simple);
 
+    // The first session of the process to connect shares its connection over a named pipe,
+    // later sessions to the same server and user (typically background
+    // transfers) open their channels over it instead of connecting again.
+    // Effective only when share_can_be_upstream/downstream allow it (currently they do not).
+    // With sharing active, PuTTY does not treat the connection as "simple",
+    // so every channel has its own window and throttling.
+    conf_set_bool(conf, CONF_ssh_connection_sharing, Data->ConnectionSharing);
+    conf_set_bool(conf, CONF_ssh_connection_sharing_upstream, TRUE);
+    conf_set_bool(conf, CONF_ssh_connection_sharing_downstream, TRUE);
+
     if (Data->FSProtocol == fsSCPonly)
     {
       conf_set_bool(conf, CONF_ssh_subsys, FALSE);
@@ -377,6 +391,7 @@ Conf * __fastcall TSecureShell::StoreToConfig(TSessionData * Data, bool Simple)
 
   conf_set_int(conf, CONF_connect_timeout, Data->Timeout * MSecsPerSec);
   conf_set_int(conf, CONF_sndbuf, Data->SendBuf);
+  conf_set_bool(conf, CONF_ssh_adaptive_window, Data->SshAdaptiveWindow);
   conf_set_str(conf, CONF_srcaddr, AnsiString(Data->SourceAddress).c_str());
 
   // permanent settings
@@ -1061,6 +1076,7 @@ void __fastcall TSecureShell::FromBackend(const unsigned char * Data, size_t Len
 
   const unsigned char *p = Data;
   unsigned Len = Length;
+  FReceivedBytes += Len;
 
   // with event-select mechanism we can now receive data even before we
   // actually expect them (OutPtr can be NULL)
@@ -1070,21 +1086,14 @@ void __fastcall TSecureShell::FromBackend(const unsigned char * Data, size_t Len
     unsigned Used = OutLen;
     if (Used > Len) Used = Len;
     memmove(OutPtr, p, Used);
+    FCopiedBytes += Used;
     OutPtr += Used; OutLen -= Used;
     p += Used; Len -= Used;
   }
 
   if (Len > 0)
   {
-    if (PendSize < PendLen + Len)
-    {
-      PendSize = PendLen + Len + 4096;
-      Pending = (unsigned char *)
-        (Pending ? srealloc(Pending, PendSize) : smalloc(PendSize));
-      if (!Pending) FatalError(L"Out of memory");
-    }
-    memmove(Pending + PendLen, p, Len);
-    PendLen += Len;
+    AddPending(p, Len);
   }
 
   if (FOnReceive != NULL)
@@ -1113,13 +1122,65 @@ void __fastcall TSecureShell::FromBackend(const unsigned char * Data, size_t Len
   }
 }
 //---------------------------------------------------------------------------
+void __fastcall TSecureShell::AddPending(const unsigned char * Data, unsigned Len)
+{
+  if (PendSize - PendStart - PendLen < Len)
+  {
+    // Not enough room after the pending data.
+    // Moving the data to the start of the buffer costs at most as much as was consumed
+    // since the last move, so the copying stays linear with the amount of data received.
+    if ((PendSize - PendLen >= Len) && (PendStart >= PendLen))
+    {
+      memmove(Pending, Pending + PendStart, PendLen);
+    }
+    else
+    {
+      // Grow geometrically, for the same reason
+      unsigned NewSize = std::max(PendSize * 2, PendLen + Len + 4096);
+      unsigned char * NewPending = static_cast<unsigned char *>(smalloc(NewSize));
+      if (!NewPending) FatalError(L"Out of memory");
+      if (PendLen > 0)
+      {
+        memcpy(NewPending, Pending + PendStart, PendLen);
+      }
+      sfree(Pending);
+      Pending = NewPending;
+      PendSize = NewSize;
+    }
+    FCopiedBytes += PendLen;
+    PendStart = 0;
+  }
+  memcpy(Pending + PendStart + PendLen, Data, Len);
+  FCopiedBytes += Len;
+  PendLen += Len;
+}
+//---------------------------------------------------------------------------
+void __fastcall TSecureShell::ConsumePending(unsigned Len)
+{
+  DebugAssert(Len <= PendLen);
+  PendStart += Len;
+  PendLen -= Len;
+  if (PendLen == 0)
+  {
+    PendStart = 0;
+    // Do not keep a large buffer around after a burst of data
+    const unsigned MaxIdlePendSize = 1024 * 1024;
+    if (PendSize > MaxIdlePendSize)
+    {
+      PendSize = 0;
+      sfree(Pending);
+      Pending = NULL;
+    }
+  }
+}
+//---------------------------------------------------------------------------
 bool __fastcall TSecureShell::Peek(unsigned char *& Buf, int Len)
 {
   bool Result = (int(PendLen) >= Len);
 
   if (Result)
   {
-    Buf = Pending;
+    Buf = Pending + PendStart;
   }
 
   return Result;
@@ -1149,17 +1210,11 @@ Integer __fastcall TSecureShell::Receive(unsigned char * Buf, Integer Len)
         {
           PendUsed = OutLen;
         }
-        memmove(OutPtr, Pending, PendUsed);
-        memmove(Pending, Pending + PendUsed, PendLen - PendUsed);
+        memmove(OutPtr, Pending + PendStart, PendUsed);
+        FCopiedBytes += PendUsed;
         OutPtr += PendUsed;
         OutLen -= PendUsed;
-        PendLen -= PendUsed;
-        if (PendLen == 0)
-        {
-          PendSize = 0;
-          sfree(Pending);
-          Pending = NULL;
-        }
+        ConsumePending(PendUsed);
       }
 
       while (OutLen > 0)
@@ -1198,13 +1253,14 @@ UnicodeString __fastcall TSecureShell::ReceiveLine()
     // If there is any buffer of received chars
     if (PendLen > 0)
     {
+      const unsigned char * Data = Pending + PendStart;
       Index = 0;
       // Repeat until we walk thru whole buffer or reach end-of-line
-      while ((Index < PendLen) && (!Index || (Pending[Index-1] != '\n')))
+      while ((Index < PendLen) && (!Index || (Data[Index-1] != '\n')))
       {
         Index++;
       }
-      EOL = (Boolean)(Index && (Pending[Index-1] == '\n'));
+      EOL = (Boolean)(Index && (Data[Index-1] == '\n'));
       Integer PrevLen = Line.Length();
       Line.SetLength(PrevLen + Index);
       Receive(reinterpret_cast<unsigned char *>(Line.c_str()) + PrevLen, Index);
@@ -1658,14 +1714,15 @@ void __fastcall TSecureShell::UpdateSocket(SOCKET value, bool Enable)
     DebugAssert(value);
     DebugAssert((FActive && (FSocket == value)) || (!FActive && Enable));
 
-    // filter our "local proxy" connection, which have no socket
+    // filter our "local proxy" connection and connection to a shared connection,
+    // which have no socket
     if (value != INVALID_SOCKET)
     {
       SocketEventSelect(value, FSocketEvent, Enable);
     }
     else
     {
-      DebugAssert(HasLocalProxy());
+      DebugAssert(HasLocalProxy() || FSessionData->ConnectionSharing);
     }
 
     if (Enable)
@@ -1703,7 +1760,8 @@ void __fastcall TSecureShell::UpdatePortFwdSocket(SOCKET value, bool Enable)
   }
   else
   {
-    DebugAssert(FSessionData->AgentFwd);
+    // agent forwarding or downstreams of our shared connection
+    DebugAssert(FSessionData->AgentFwd || FSessionData->ConnectionSharing);
   }
 }
 //---------------------------------------------------------------------------
@@ -1772,6 +1830,11 @@ void __fastcall TSecureShell::Discard()
 void __fastcall TSecureShell::Close()
 {
   LogEvent(L"Closing connection.");
+  if (FReceivedBytes > 0)
+  {
+    LogEvent(FORMAT(L"Received %s bytes, copied %s bytes (%.2f per byte received)",
+      (IntToStr(FReceivedBytes), IntToStr(FCopiedBytes), static_cast<double>(FCopiedBytes) / FReceivedBytes)));
+  }
   DebugAssert(FActive);
   FClosed = true;
 
@@ -2245,6 +2308,16 @@ unsigned long __fastcall TSecureShell::MaxPacketSize()
   return winscp_query(FBackendHandle, WINSCP_QUERY_REMMAXPKT);
 }
 //---------------------------------------------------------------------------
+unsigned long __fastcall TSecureShell::LocalMaxPacketSize()
+{
+  if (!FSessionInfoValid)
+  {
+    UpdateSessionInfo();
+  }
+
+  return winscp_query(FBackendHandle, WINSCP_QUERY_LOCMAXPKT);
+}
+//---------------------------------------------------------------------------
 UnicodeString __fastcall TSecureShell::FormatKeyStr(UnicodeString KeyStr)
 {
   int Index = 1;
@@ -2999,18 +3072,26 @@ void __fastcall TSecureShell::CollectUsage()
     Configuration->Usage->Inc(L"OpenedSessionsSSHOther");
   }
 
-  int CipherGroup = GetCipherGroup(get_cscipher(FBackendHandle));
-  switch (CipherGroup)
+  if (is_ssh_shared_downstream(FBackendHandle))
   {
-    case CIPHER_3DES: Configuration->Usage->Inc(L"OpenedSessionsSSHCipher3DES"); break;
-    case CIPHER_BLOWFISH: Configuration->Usage->Inc(L"OpenedSessionsSSHCipherBlowfish"); break;
-    case CIPHER_AES: Configuration->Usage->Inc(L"OpenedSessionsSSHCipherAES"); break;
-    // All following miss "Cipher"
-    case CIPHER_DES: Configuration->Usage->Inc(L"OpenedSessionsSSHDES"); break;
-    case CIPHER_ARCFOUR: Configuration->Usage->Inc(L"OpenedSessionsSSHArcfour"); break;
-    case CIPHER_CHACHA20: Configuration->Usage->Inc(L"OpenedSessionsSSHChaCha20"); break;
-    case CIPHER_AESGCM: Configuration->Usage->Inc(L"OpenedSessionsSSHAESGCM"); break;
-    default: DebugFail(); break;
+    // the cipher is counted for the upstream session
+    Configuration->Usage->Inc(L"OpenedSessionsSSHShared");
+  }
+  else
+  {
+    int CipherGroup = GetCipherGroup(get_cscipher(FBackendHandle));
+    switch (CipherGroup)
+    {
+      case CIPHER_3DES: Configuration->Usage->Inc(L"OpenedSessionsSSHCipher3DES"); break;
+      case CIPHER_BLOWFISH: Configuration->Usage->Inc(L"OpenedSessionsSSHCipherBlowfish"); break;
+      case CIPHER_AES: Configuration->Usage->Inc(L"OpenedSessionsSSHCipherAES"); break;
+      // All following miss "Cipher"
+      case CIPHER_DES: Configuration->Usage->Inc(L"OpenedSessionsSSHDES"); break;
+      case CIPHER_ARCFOUR: Configuration->Usage->Inc(L"OpenedSessionsSSHArcfour"); break;
+      case CIPHER_CHACHA20: Configuration->Usage->Inc(L"OpenedSessionsSSHChaCha20"); break;
+      case CIPHER_AESGCM: Configuration->Usage->Inc(L"OpenedSessionsSSHAESGCM"); break;
+      default: DebugFail(); break;
+    }
   }
 }
 //---------------------------------------------------------------------------
@@ -56,11 +56,16 @@ private:
   int FWaitingForData;
   TSshImplementation FSshImplementation;
 
+  // Pending input is Pending[PendStart..PendStart+PendLen),
+  // consumed by advancing PendStart, see AddPending
+  unsigned PendStart;
   unsigned PendLen;
   unsigned PendSize;
   unsigned OutLen;
   unsigned char * OutPtr;
   unsigned char * Pending;
+  __int64 FReceivedBytes;
+  __int64 FCopiedBytes;
   TSessionLog * FLog;
   TConfiguration * FConfiguration;
   bool FAuthenticating;
@@ -85,6 +90,8 @@ private:
   void inline __fastcall CheckConnection(int Message = -1);
   void __fastcall WaitForData();
   void __fastcall Discard();
+  void __fastcall AddPending(const unsigned char * Data, unsigned Len);
+  void __fastcall ConsumePending(unsigned Len);
   void __fastcall FreeBackend();
   void __fastcall PoolForData(WSANETWORKEVENTS & Events, unsigned int & Result);
   inline void __fastcall CaptureOutput(TLogLineType Type,
@@ -150,6 +157,7 @@ public:
   void __fastcall GetHostKeyFingerprint(UnicodeString & SHA256, UnicodeString & MD5);
   bool __fastcall SshFallbackCmd() const;
   unsigned long __fastcall MaxPacketSize();
+  unsigned long __fastcall LocalMaxPacketSize();
   void __fastcall ClearStdError();
   bool __fastcall GetStoredCredentialsTried();
   void __fastcall CollectUsage();
@@ -191,6 +199,8 @@ public:
   __property bool Simple = { read = FSimple, write = FSimple };
   __property TSshImplementation SshImplementation = { read = FSshImplementation };
   __property bool UtfStrings = { read = FUtfStrings, write = FUtfStrings };
+  __property __int64 ReceivedBytes = { read = FReceivedBytes };
+  __property __int64 CopiedBytes = { read = FCopiedBytes };
   TSecureShellMode Mode;
 };
 //---------------------------------------------------------------------------
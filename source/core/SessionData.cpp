@@ -185,6 +185,8 @@ void __fastcall TSessionData::DefaultSettings()
   Timeout = 15;
   TryAgent = true;
   AgentFwd = false;
+  ConnectionSharing = false;
+  CPSLimit = 0;
   AuthKI = true;
   AuthKIPassword = true;
   AuthGSSAPI = true;
@@ -193,6 +195,7 @@ void __fastcall TSessionData::DefaultSettings()
   LogicalHostName = L"";
   ChangeUsername = false;
   Compression = false;
+  CompressionLevel = 6;
   Ssh2DES = false;
   SshNoUserAuth = false;
   for (int Index = 0; Index < CIPHER_COUNT; Index++)
@@ -221,6 +224,7 @@ void __fastcall TSessionData::DefaultSettings()
   SourceAddress = L"";
   ProtocolFeatures = L"";
   SshSimple = true;
+  SshAdaptiveWindow = true;
   HostKey = L"";
   FingerprintScan = false;
   FOverrideCachedHostKey = true;
@@ -232,6 +236,7 @@ void __fastcall TSessionData::DefaultSettings()
 
   WebDavLiberalEscaping = false;
   WebDavAuthLegacy = false;
+  WebDavDeepListing = false;
 
   ProxyMethod = ::pmNone;
   ProxyHost = L"proxy";
@@ -289,6 +294,7 @@ void __fastcall TSessionData::DefaultSettings()
   TimeDifference = 0;
   TimeDifferenceAuto = true;
   SCPLsFullTime = asAuto;
+  SCPDeepListing = false;
   NotUtf = asAuto;
 
   // S3
@@ -297,6 +303,7 @@ void __fastcall TSessionData::DefaultSettings()
   S3Profile = EmptyStr;
   S3UrlStyle = s3usVirtualHost;
   S3MaxKeys = asAuto;
+  S3MultipartConcurrency = 4;
   S3CredentialsEnv = false;
   S3RequesterPays = false;
 
@@ -304,7 +311,8 @@ void __fastcall TSessionData::DefaultSettings()
   SftpServer = L"";
   SFTPDownloadQueue = 32;
   SFTPUploadQueue = 32;
-  SFTPListingQueue = 2;
+  SFTPUploadPipeline = 16;
+  SFTPListingQueue = 32;
   SFTPMaxVersion = ::SFTPMaxVersion;
   SFTPMaxPacketSize = 0;
   SFTPRealPath = asAuto;
@@ -402,9 +410,12 @@ void __fastcall TSessionData::NonPersistant()
   PROPERTY(Timeout); \
   PROPERTY(TryAgent); \
   PROPERTY(AgentFwd); \
+  PROPERTY(ConnectionSharing); \
+  PROPERTY(CPSLimit); \
   PROPERTY(LogicalHostName); \
   PROPERTY(ChangeUsername); \
   PROPERTY(Compression); \
+  PROPERTY(CompressionLevel); \
   PROPERTY(Ssh2DES); \
   PROPERTY(SshNoUserAuth); \
   PROPERTY(CipherList); \
@@ -442,6 +453,7 @@ void __fastcall TSessionData::NonPersistant()
   PROPERTY(ListingCommand); \
   PROPERTY(IgnoreLsWarnings); \
   PROPERTY(SCPLsFullTime); \
+  PROPERTY(SCPDeepListing); \
   \
   PROPERTY(TimeDifference); \
   PROPERTY(TimeDifferenceAuto); \
@@ -450,6 +462,7 @@ void __fastcall TSessionData::NonPersistant()
   PROPERTY(SourceAddress); \
   PROPERTY(ProtocolFeatures); \
   PROPERTY(SshSimple); \
+  PROPERTY(SshAdaptiveWindow); \
   PROPERTY(AuthKI); \
   PROPERTY(AuthKIPassword); \
   PROPERTY(AuthGSSAPI); \
@@ -466,6 +479,7 @@ void __fastcall TSessionData::NonPersistant()
   PROPERTY(S3Profile); \
   PROPERTY(S3UrlStyle); \
   PROPERTY(S3MaxKeys); \
+  PROPERTY(S3MultipartConcurrency); \
   PROPERTY(S3CredentialsEnv); \
   PROPERTY(S3RequesterPays); \
   \
@@ -487,6 +501,7 @@ void __fastcall TSessionData::NonPersistant()
   PROPERTY(SftpServer); \
   PROPERTY(SFTPDownloadQueue); \
   PROPERTY(SFTPUploadQueue); \
+  PROPERTY(SFTPUploadPipeline); \
   PROPERTY(SFTPListingQueue); \
   PROPERTY(SFTPMaxVersion); \
   PROPERTY(SFTPMaxPacketSize); \
@@ -535,6 +550,7 @@ void __fastcall TSessionData::NonPersistant()
   \
   PROPERTY(WebDavLiberalEscaping); \
   PROPERTY(WebDavAuthLegacy); \
+  PROPERTY(WebDavDeepListing); \
   \
   PROPERTY(PuttySettings); \
   \
@@ -733,6 +749,7 @@ void __fastcall TSessionData::DoLoad(THierarchicalStorage * Storage, bool PuttyI
   Timeout = Storage->ReadInteger(L"Timeout", Timeout);
   TryAgent = Storage->ReadBool(L"TryAgent", TryAgent);
   AgentFwd = Storage->ReadBool(L"AgentFwd", AgentFwd);
+  CPSLimit = Storage->ReadInteger(L"CPSLimit", CPSLimit);
   AuthKI = Storage->ReadBool(L"AuthKI", AuthKI);
   AuthKIPassword = Storage->ReadBool(L"AuthKIPassword", AuthKIPassword);
   // Continue to use setting keys of previous kerberos implementation (vaclav tomec),
@@ -747,6 +764,7 @@ void __fastcall TSessionData::DoLoad(THierarchicalStorage * Storage, bool PuttyI
   LogicalHostName = Storage->ReadString(L"LogicalHostName", Storage->ReadString(L"GSSAPIServerRealm", Storage->ReadString(L"KerbPrincipal", LogicalHostName)));
   ChangeUsername = Storage->ReadBool(L"ChangeUsername", ChangeUsername);
   Compression = Storage->ReadBool(L"Compression", Compression);
+  CompressionLevel = Storage->ReadInteger(L"CompressionLevel", CompressionLevel);
   Ssh2DES = Storage->ReadBool(L"Ssh2DES", Ssh2DES);
   SshNoUserAuth = Storage->ReadBool(L"SshNoUserAuth", SshNoUserAuth);
   CipherList = Storage->ReadString(L"Cipher", CipherList);
@@ -791,6 +809,7 @@ void __fastcall TSessionData::DoLoad(THierarchicalStorage * Storage, bool PuttyI
   }
   IgnoreLsWarnings = Storage->ReadBool(L"IgnoreLsWarnings", IgnoreLsWarnings);
   SCPLsFullTime = Storage->ReadEnum(L"SCPLsFullTime", SCPLsFullTime, AutoSwitchMapping);
+  SCPDeepListing = Storage->ReadBool(L"SCPDeepListing", SCPDeepListing);
   Scp1Compatibility = Storage->ReadBool(L"Scp1Compatibility", Scp1Compatibility);
   TimeDifference = Storage->ReadFloat(L"TimeDifference", TimeDifference);
   TimeDifferenceAuto = Storage->ReadBool(L"TimeDifferenceAuto", (TimeDifference == TDateTime()));
@@ -816,6 +835,7 @@ void __fastcall TSessionData::DoLoad(THierarchicalStorage * Storage, bool PuttyI
   S3Profile = Storage->ReadString(L"S3Profile", S3Profile);
   S3UrlStyle = (TS3UrlStyle)Storage->ReadInteger(L"S3UrlStyle", S3UrlStyle);
   S3MaxKeys = Storage->ReadEnum(L"S3MaxKeys", S3MaxKeys, AutoSwitchMapping);
+  S3MultipartConcurrency = Storage->ReadInteger(L"S3MultipartConcurrency", S3MultipartConcurrency);
   S3CredentialsEnv = Storage->ReadBool(L"S3CredentialsEnv", S3CredentialsEnv);
   S3RequesterPays = Storage->ReadBool(L"S3RequesterPays", S3RequesterPays);
 
@@ -823,11 +843,14 @@ void __fastcall TSessionData::DoLoad(THierarchicalStorage * Storage, bool PuttyI
   if (!PuttyImport)
   {
     TcpNoDelay = Storage->ReadBool(L"TcpNoDelay", TcpNoDelay);
+    // PuTTY has its own ConnectionSharing, which shares connections among PuTTY processes
+    ConnectionSharing = Storage->ReadBool(L"ConnectionSharing", ConnectionSharing);
   }
   SendBuf = Storage->ReadInteger(L"SendBuf", Storage->ReadInteger("SshSendBuf", SendBuf));
   SourceAddress = Storage->ReadString(L"SourceAddress", SourceAddress);
   ProtocolFeatures = Storage->ReadString(L"ProtocolFeatures", ProtocolFeatures);
   SshSimple = Storage->ReadBool(L"SshSimple", SshSimple);
+  SshAdaptiveWindow = Storage->ReadBool(L"SshAdaptiveWindow", SshAdaptiveWindow);
 
   ProxyMethod = Storage->ReadEnum(L"ProxyMethod", ProxyMethod, ProxyMethodMapping);
   ProxyHost = Storage->ReadString(L"ProxyHost", ProxyHost);
@@ -884,6 +907,7 @@ void __fastcall TSessionData::DoLoad(THierarchicalStorage * Storage, bool PuttyI
   SFTPMaxPacketSize = Storage->ReadInteger(L"SFTPMaxPacketSize", SFTPMaxPacketSize);
   SFTPDownloadQueue = Storage->ReadInteger(L"SFTPDownloadQueue", SFTPDownloadQueue);
   SFTPUploadQueue = Storage->ReadInteger(L"SFTPUploadQueue", SFTPUploadQueue);
+  SFTPUploadPipeline = Storage->ReadInteger(L"SFTPUploadPipeline", SFTPUploadPipeline);
   SFTPListingQueue = Storage->ReadInteger(L"SFTPListingQueue", SFTPListingQueue);
   SFTPRealPath = Storage->ReadEnum(L"SFTPRealPath", SFTPRealPath, AutoSwitchMapping);
   UsePosixRename = Storage->ReadBool(L"UsePosixRename", UsePosixRename);
@@ -938,6 +962,7 @@ void __fastcall TSessionData::DoLoad(THierarchicalStorage * Storage, bool PuttyI
 
   WebDavLiberalEscaping = Storage->ReadBool(L"WebDavLiberalEscaping", WebDavLiberalEscaping);
   WebDavAuthLegacy = Storage->ReadBool(L"WebDavAuthLegacy", WebDavAuthLegacy);
+  WebDavDeepListing = Storage->ReadBool(L"WebDavDeepListing", WebDavDeepListing);
 
   IsWorkspace = Storage->ReadBool(L"IsWorkspace", IsWorkspace);
   Link = Storage->ReadString(L"Link", Link);
@@ -1038,6 +1063,7 @@ void __fastcall TSessionData::DoSave(THierarchicalStorage * Storage,
   WRITE_DATA(Integer, Timeout);
   WRITE_DATA(Bool, TryAgent);
   WRITE_DATA(Bool, AgentFwd);
+  WRITE_DATA(Integer, CPSLimit);
   WRITE_DATA(Bool, AuthKI);
   WRITE_DATA(Bool, AuthKIPassword);
   WRITE_DATA_EX(String, L"SshHostKey", HostKey, );
@@ -1063,6 +1089,7 @@ void __fastcall TSessionData::DoSave(THierarchicalStorage * Storage,
 
   WRITE_DATA(Bool, ChangeUsername);
   WRITE_DATA(Bool, Compression);
+  WRITE_DATA(Integer, CompressionLevel);
   WRITE_DATA(Bool, Ssh2DES);
   WRITE_DATA(Bool, SshNoUserAuth);
   WRITE_DATA_EX(String, L"Cipher", CipherList, );
@@ -1112,6 +1139,7 @@ void __fastcall TSessionData::DoSave(THierarchicalStorage * Storage,
     WRITE_DATA(String, ListingCommand);
     WRITE_DATA(Bool, IgnoreLsWarnings);
     WRITE_DATA(Integer, SCPLsFullTime);
+    WRITE_DATA(Bool, SCPDeepListing);
     WRITE_DATA(Bool, Scp1Compatibility);
     // TimeDifferenceAuto is valid for FTP protocol only.
     // For other protocols it's typically true (default value),
@@ -1146,12 +1174,15 @@ void __fastcall TSessionData::DoSave(THierarchicalStorage * Storage,
     WRITE_DATA(String, S3Profile);
     WRITE_DATA(Integer, S3UrlStyle);
     WRITE_DATA(Integer, S3MaxKeys);
+    WRITE_DATA(Integer, S3MultipartConcurrency);
     WRITE_DATA(Bool, S3CredentialsEnv);
     WRITE_DATA(Bool, S3RequesterPays);
     WRITE_DATA(Integer, SendBuf);
     WRITE_DATA(String, SourceAddress);
     WRITE_DATA(String, ProtocolFeatures);
     WRITE_DATA(Bool, SshSimple);
+    WRITE_DATA(Bool, SshAdaptiveWindow);
+    WRITE_DATA(Bool, ConnectionSharing);
   }
 
   WRITE_DATA(Integer, ProxyMethod);
@@ -1208,6 +1239,7 @@ void __fastcall TSessionData::DoSave(THierarchicalStorage * Storage,
     WRITE_DATA(Integer, SFTPMaxPacketSize);
     WRITE_DATA(Integer, SFTPDownloadQueue);
     WRITE_DATA(Integer, SFTPUploadQueue);
+    WRITE_DATA(Integer, SFTPUploadPipeline);
     WRITE_DATA(Integer, SFTPListingQueue);
     WRITE_DATA(Integer, SFTPRealPath);
     WRITE_DATA(Bool, UsePosixRename);
@@ -1245,6 +1277,7 @@ void __fastcall TSessionData::DoSave(THierarchicalStorage * Storage,
 
     WRITE_DATA(Bool, WebDavLiberalEscaping);
     WRITE_DATA(Bool, WebDavAuthLegacy);
+    WRITE_DATA(Bool, WebDavDeepListing);
 
     WRITE_DATA(Bool, IsWorkspace);
     WRITE_DATA(String, Link);
@@ -2662,6 +2695,7 @@ TSessionData * TSessionData::CreateTunnelData(int TunnelLocalPortNumber)
 
   // inherit most SSH options of the main session (except for private key and bugs)
   TunnelData->Compression = Compression;
+  TunnelData->CompressionLevel = CompressionLevel;
   TunnelData->CipherList = CipherList;
   TunnelData->Ssh2DES = Ssh2DES;
 
@@ -2960,6 +2994,16 @@ void __fastcall TSessionData::SetAgentFwd(bool value)
   SET_SESSION_PROPERTY(AgentFwd);
 }
 //---------------------------------------------------------------------
+void __fastcall TSessionData::SetConnectionSharing(bool value)
+{
+  SET_SESSION_PROPERTY(ConnectionSharing);
+}
+//---------------------------------------------------------------------------
+void __fastcall TSessionData::SetCPSLimit(unsigned long value)
+{
+  SET_SESSION_PROPERTY(CPSLimit);
+}
+//---------------------------------------------------------------------
 void __fastcall TSessionData::SetAuthKI(bool value)
 {
   SET_SESSION_PROPERTY(AuthKI);
@@ -2995,6 +3039,11 @@ void __fastcall TSessionData::SetCompression(bool value)
   SET_SESSION_PROPERTY(Compression);
 }
 //---------------------------------------------------------------------
+void __fastcall TSessionData::SetCompressionLevel(int value)
+{
+  SET_SESSION_PROPERTY(CompressionLevel);
+}
+//---------------------------------------------------------------------
 void __fastcall TSessionData::SetSsh2DES(bool value)
 {
   SET_SESSION_PROPERTY(Ssh2DES);
@@ -4212,6 +4261,11 @@ void __fastcall TSessionData::SetSshSimple(bool value)
   SET_SESSION_PROPERTY(SshSimple);
 }
 //---------------------------------------------------------------------
+void __fastcall TSessionData::SetSshAdaptiveWindow(bool value)
+{
+  SET_SESSION_PROPERTY(SshAdaptiveWindow);
+}
+//---------------------------------------------------------------------
 void __fastcall TSessionData::SetProxyMethod(TProxyMethod value)
 {
   SET_SESSION_PROPERTY(ProxyMethod);
@@ -4305,6 +4359,11 @@ void __fastcall TSessionData::SetSFTPUploadQueue(int value)
   SET_SESSION_PROPERTY(SFTPUploadQueue);
 }
 //---------------------------------------------------------------------
+void __fastcall TSessionData::SetSFTPUploadPipeline(int value)
+{
+  SET_SESSION_PROPERTY(SFTPUploadPipeline);
+}
+//---------------------------------------------------------------------
 void __fastcall TSessionData::SetSFTPListingQueue(int value)
 {
   SET_SESSION_PROPERTY(SFTPListingQueue);
@@ -4346,6 +4405,11 @@ void __fastcall TSessionData::SetSCPLsFullTime(TAutoSwitch value)
 {
   SET_SESSION_PROPERTY(SCPLsFullTime);
 }
+//---------------------------------------------------------------------
+void __fastcall TSessionData::SetSCPDeepListing(bool value)
+{
+  SET_SESSION_PROPERTY(SCPDeepListing);
+}
 //---------------------------------------------------------------------------
 void __fastcall TSessionData::SetColor(int value)
 {
@@ -4584,6 +4648,11 @@ void __fastcall TSessionData::SetS3MaxKeys(TAutoSwitch value)
   SET_SESSION_PROPERTY(S3MaxKeys);
 }
 //---------------------------------------------------------------------
+void __fastcall TSessionData::SetS3MultipartConcurrency(int value)
+{
+  SET_SESSION_PROPERTY(S3MultipartConcurrency);
+}
+//---------------------------------------------------------------------
 void __fastcall TSessionData::SetS3CredentialsEnv(bool value)
 {
   SET_SESSION_PROPERTY(S3CredentialsEnv);
@@ -4645,6 +4714,11 @@ void __fastcall TSessionData::SetWebDavAuthLegacy(bool value)
   SET_SESSION_PROPERTY(WebDavAuthLegacy);
 }
 //---------------------------------------------------------------------
+void __fastcall TSessionData::SetWebDavDeepListing(bool value)
+{
+  SET_SESSION_PROPERTY(WebDavDeepListing);
+}
+//---------------------------------------------------------------------
 UnicodeString __fastcall TSessionData::GetInfoTip()
 {
   if (UsesSsh)
@@ -117,6 +117,8 @@ private:
   TPingType FPingType;
   bool FTryAgent;
   bool FAgentFwd;
+  bool FConnectionSharing;
+  unsigned long FCPSLimit;
   UnicodeString FListingCommand;
   bool FAuthKI;
   bool FAuthKIPassword;
@@ -125,6 +127,7 @@ private:
   bool FGSSAPIFwdTGT;
   bool FChangeUsername;
   bool FCompression;
+  int FCompressionLevel;
   bool FSsh2DES;
   bool FSshNoUserAuth;
   TCipher FCiphers[CIPHER_COUNT];
@@ -167,6 +170,7 @@ private:
   UnicodeString FSourceAddress;
   UnicodeString FProtocolFeatures;
   bool FSshSimple;
+  bool FSshAdaptiveWindow;
   TProxyMethod FProxyMethod;
   UnicodeString FProxyHost;
   int FProxyPort;
@@ -187,6 +191,7 @@ private:
   bool FTimeDifferenceAuto;
   int FSFTPDownloadQueue;
   int FSFTPUploadQueue;
+  int FSFTPUploadPipeline;
   int FSFTPListingQueue;
   int FSFTPMaxVersion;
   unsigned long FSFTPMaxPacketSize;
@@ -199,6 +204,7 @@ private:
   UnicodeString FRecycleBinPath;
   UnicodeString FPostLoginCommands;
   TAutoSwitch FSCPLsFullTime;
+  bool FSCPDeepListing;
   TAutoSwitch FFtpListAll;
   TAutoSwitch FFtpHost;
   TAutoSwitch FFtpWorkFromCwd;
@@ -237,6 +243,7 @@ private:
   UnicodeString FS3Profile;
   TS3UrlStyle FS3UrlStyle;
   TAutoSwitch FS3MaxKeys;
+  int FS3MultipartConcurrency;
   bool FS3CredentialsEnv;
   bool FS3RequesterPays;
   bool FIsWorkspace;
@@ -250,6 +257,7 @@ private:
   RawByteString FEncryptKey;
   bool FWebDavLiberalEscaping;
   bool FWebDavAuthLegacy;
+  bool FWebDavDeepListing;
 
   UnicodeString FOrigHostName;
   int FOrigPortNumber;
@@ -273,6 +281,8 @@ private:
   void __fastcall SetPingInterval(int value);
   void __fastcall SetTryAgent(bool value);
   void __fastcall SetAgentFwd(bool value);
+  void __fastcall SetConnectionSharing(bool value);
+  void __fastcall SetCPSLimit(unsigned long value);
   void __fastcall SetAuthKI(bool value);
   void __fastcall SetAuthKIPassword(bool value);
   void __fastcall SetAuthGSSAPI(bool value);
@@ -280,6 +290,7 @@ private:
   void __fastcall SetGSSAPIFwdTGT(bool value);
   void __fastcall SetChangeUsername(bool value);
   void __fastcall SetCompression(bool value);
+  void __fastcall SetCompressionLevel(int value);
   void __fastcall SetSsh2DES(bool value);
   void __fastcall SetSshNoUserAuth(bool value);
   void __fastcall SetCipher(int Index, TCipher value);
@@ -345,6 +356,7 @@ private:
   void __fastcall SetSourceAddress(const UnicodeString & value);
   void __fastcall SetProtocolFeatures(const UnicodeString & value);
   void __fastcall SetSshSimple(bool value);
+  void __fastcall SetSshAdaptiveWindow(bool value);
   bool __fastcall GetUsesSsh();
   void __fastcall SetCipherList(UnicodeString value);
   UnicodeString __fastcall GetCipherList() const;
@@ -375,6 +387,7 @@ private:
   void __fastcall SetFollowDirectorySymlinks(bool value);
   void __fastcall SetSFTPDownloadQueue(int value);
   void __fastcall SetSFTPUploadQueue(int value);
+  void __fastcall SetSFTPUploadPipeline(int value);
   void __fastcall SetSFTPListingQueue(int value);
   void __fastcall SetSFTPMaxVersion(int value);
   void __fastcall SetSFTPMaxPacketSize(unsigned long value);
@@ -383,6 +396,7 @@ private:
   void __fastcall SetSFTPBug(TSftpBug Bug, TAutoSwitch value);
   TAutoSwitch __fastcall GetSFTPBug(TSftpBug Bug) const;
   void __fastcall SetSCPLsFullTime(TAutoSwitch value);
+  void __fastcall SetSCPDeepListing(bool value);
   void __fastcall SetFtpListAll(TAutoSwitch value);
   void __fastcall SetFtpHost(TAutoSwitch value);
   void __fastcall SetFtpWorkFromCwd(TAutoSwitch value);
@@ -432,6 +446,7 @@ private:
   void __fastcall SetS3Profile(UnicodeString value);
   void __fastcall SetS3UrlStyle(TS3UrlStyle value);
   void __fastcall SetS3MaxKeys(TAutoSwitch value);
+  void __fastcall SetS3MultipartConcurrency(int value);
   void __fastcall SetS3CredentialsEnv(bool value);
   void __fastcall SetS3RequesterPays(bool value);
   void __fastcall SetLogicalHostName(UnicodeString value);
@@ -445,6 +460,7 @@ private:
   void __fastcall SetEncryptKey(UnicodeString value);
   void __fastcall SetWebDavLiberalEscaping(bool value);
   void __fastcall SetWebDavAuthLegacy(bool value);
+  void __fastcall SetWebDavDeepListing(bool value);
 
   TDateTime __fastcall GetTimeoutDT();
   void __fastcall SavePasswords(THierarchicalStorage * Storage, bool PuttyExport, bool DoNotEncryptPasswords, bool SaveAll);
@@ -577,6 +593,8 @@ public:
   __property int PingInterval  = { read=FPingInterval, write=SetPingInterval };
   __property bool TryAgent  = { read=FTryAgent, write=SetTryAgent };
   __property bool AgentFwd  = { read=FAgentFwd, write=SetAgentFwd };
+  __property bool ConnectionSharing = { read=FConnectionSharing, write=SetConnectionSharing };
+  __property unsigned long CPSLimit = { read=FCPSLimit, write=SetCPSLimit };
   __property UnicodeString ListingCommand = { read = FListingCommand, write = SetListingCommand };
   __property bool AuthKI  = { read=FAuthKI, write=SetAuthKI };
   __property bool AuthKIPassword  = { read=FAuthKIPassword, write=SetAuthKIPassword };
@@ -585,6 +603,7 @@ public:
   __property bool GSSAPIFwdTGT = { read=FGSSAPIFwdTGT, write=SetGSSAPIFwdTGT };
   __property bool ChangeUsername  = { read=FChangeUsername, write=SetChangeUsername };
   __property bool Compression  = { read=FCompression, write=SetCompression };
+  __property int CompressionLevel  = { read=FCompressionLevel, write=SetCompressionLevel };
   __property bool UsesSsh = { read = GetUsesSsh };
   __property bool Ssh2DES  = { read=FSsh2DES, write=SetSsh2DES };
   __property bool SshNoUserAuth  = { read=FSshNoUserAuth, write=SetSshNoUserAuth };
@@ -643,6 +662,7 @@ public:
   __property UnicodeString SourceAddress = { read=FSourceAddress, write=SetSourceAddress };
   __property UnicodeString ProtocolFeatures = { read=FProtocolFeatures, write=SetProtocolFeatures };
   __property bool SshSimple  = { read=FSshSimple, write=SetSshSimple };
+  __property bool SshAdaptiveWindow  = { read=FSshAdaptiveWindow, write=SetSshAdaptiveWindow };
   __property UnicodeString CipherList  = { read=GetCipherList, write=SetCipherList };
   __property UnicodeString KexList  = { read=GetKexList, write=SetKexList };
   __property UnicodeString HostKeyList  = { read=GetHostKeyList, write=SetHostKeyList };
@@ -666,6 +686,7 @@ public:
   __property bool FollowDirectorySymlinks = { read = FFollowDirectorySymlinks, write = SetFollowDirectorySymlinks };
   __property int SFTPDownloadQueue = { read = FSFTPDownloadQueue, write = SetSFTPDownloadQueue };
   __property int SFTPUploadQueue = { read = FSFTPUploadQueue, write = SetSFTPUploadQueue };
+  __property int SFTPUploadPipeline = { read = FSFTPUploadPipeline, write = SetSFTPUploadPipeline };
   __property int SFTPListingQueue = { read = FSFTPListingQueue, write = SetSFTPListingQueue };
   __property int SFTPMaxVersion = { read = FSFTPMaxVersion, write = SetSFTPMaxVersion };
   __property unsigned long SFTPMaxPacketSize = { read = FSFTPMaxPacketSize, write = SetSFTPMaxPacketSize };
@@ -673,6 +694,7 @@ public:
   __property bool UsePosixRename = { read = FUsePosixRename, write = SetUsePosixRename };
   __property TAutoSwitch SFTPBug[TSftpBug Bug]  = { read=GetSFTPBug, write=SetSFTPBug };
   __property TAutoSwitch SCPLsFullTime = { read = FSCPLsFullTime, write = SetSCPLsFullTime };
+  __property bool SCPDeepListing = { read = FSCPDeepListing, write = SetSCPDeepListing };
   __property TAutoSwitch FtpListAll = { read = FFtpListAll, write = SetFtpListAll };
   __property TAutoSwitch FtpHost = { read = FFtpHost, write = SetFtpHost };
   __property TAutoSwitch FtpWorkFromCwd = { read = FFtpWorkFromCwd, write = SetFtpWorkFromCwd };
@@ -719,6 +741,7 @@ public:
   __property UnicodeString S3Profile = { read = FS3Profile, write = SetS3Profile };
   __property TS3UrlStyle S3UrlStyle = { read = FS3UrlStyle, write = SetS3UrlStyle };
   __property TAutoSwitch S3MaxKeys = { read = FS3MaxKeys, write = SetS3MaxKeys };
+  __property int S3MultipartConcurrency = { read = FS3MultipartConcurrency, write = SetS3MultipartConcurrency };
   __property bool S3CredentialsEnv = { read = FS3CredentialsEnv, write = SetS3CredentialsEnv };
   __property bool S3RequesterPays = { read = FS3RequesterPays, write = SetS3RequesterPays };
   __property bool IsWorkspace = { read = FIsWorkspace, write = SetIsWorkspace };
@@ -732,6 +755,7 @@ public:
   __property UnicodeString EncryptKey = { read = GetEncryptKey, write = SetEncryptKey };
   __property bool WebDavLiberalEscaping = { read = FWebDavLiberalEscaping, write = SetWebDavLiberalEscaping };
   __property bool WebDavAuthLegacy = { read = FWebDavAuthLegacy, write = SetWebDavAuthLegacy };
+  __property bool WebDavDeepListing = { read = FWebDavDeepListing, write = SetWebDavDeepListing };
 
   __property UnicodeString StorageKey = { read = GetStorageKey };
   __property UnicodeString SiteKey = { read = GetSiteKey };
@@ -14,6 +14,7 @@
 #include "TextsCore.h"
 #include "CoreMain.h"
 #include "Script.h"
+#include "Queue.h"
 #include <System.IOUtils.hpp>
 //---------------------------------------------------------------------------
 #pragma package(smart_init)
@@ -768,6 +769,138 @@ TFileSystemInfo::TFileSystemInfo()
 }
 //---------------------------------------------------------------------------
 //---------------------------------------------------------------------------
+// How much of the log can be waiting for the writer, before the logging threads get blocked
+const size_t LogWriterMaxPending = 4 * 1024 * 1024;
+//---------------------------------------------------------------------------
+// Writes to the (unbuffered) log file in a background thread, in batches,
+// so that the logging threads do not wait for the disk.
+// When the writer does not keep up, the logging threads are blocked, rather than the lines dropped,
+// as the session log is used for troubleshooting and the XML log has to stay well-formed.
+class TLogWriter : public TSignalThread
+{
+public:
+  TLogWriter();
+  virtual __fastcall ~TLogWriter();
+
+  void SetFile(FILE * File);
+  void Write(const char * Buf, size_t Len);
+  void Flush();
+  int GetError();
+
+protected:
+  virtual void __fastcall ProcessEvent();
+
+private:
+  std::unique_ptr<TCriticalSection> FSection;
+  HANDLE FDrainedEvent;
+  FILE * FFile;
+  std::vector<char> FPending;
+  std::vector<char> FWriting;
+  bool FBusy;
+  int FError;
+};
+//---------------------------------------------------------------------------
+TLogWriter::TLogWriter() :
+  TSignalThread(false),
+  FFile(NULL),
+  FBusy(false),
+  FError(0)
+{
+  FSection.reset(new TCriticalSection());
+  FDrainedEvent = CreateEvent(NULL, false, false, NULL);
+  Start();
+}
+//---------------------------------------------------------------------------
+__fastcall TLogWriter::~TLogWriter()
+{
+  Flush();
+  // Stop the thread before the members it uses are destroyed
+  Close();
+  CloseHandle(FDrainedEvent);
+}
+//---------------------------------------------------------------------------
+void TLogWriter::SetFile(FILE * File)
+{
+  TGuard Guard(FSection.get());
+  DebugAssert(FPending.empty() && !FBusy);
+  FFile = File;
+  FError = 0;
+}
+//---------------------------------------------------------------------------
+void TLogWriter::Write(const char * Buf, size_t Len)
+{
+  TGuard Guard(FSection.get());
+  while (!FPending.empty() && (FPending.size() + Len > LogWriterMaxPending))
+  {
+    TUnguard Unguard(FSection.get());
+    // The timeout is for the case the event was consumed by another waiting thread
+    WaitForSingleObject(FDrainedEvent, 100);
+  }
+
+  // Whenever the buffer becomes non-empty, the writer is signaled,
+  // and it empties the buffer when processing the signal.
+  bool Signal = FPending.empty();
+  FPending.insert(FPending.end(), Buf, Buf + Len);
+  if (Signal)
+  {
+    TriggerEvent();
+  }
+}
+//---------------------------------------------------------------------------
+void TLogWriter::Flush()
+{
+  while (true)
+  {
+    {
+      TGuard Guard(FSection.get());
+      if (FPending.empty() && !FBusy)
+      {
+        break;
+      }
+    }
+    WaitForSingleObject(FDrainedEvent, 100);
+  }
+}
+//---------------------------------------------------------------------------
+int TLogWriter::GetError()
+{
+  TGuard Guard(FSection.get());
+  return FError;
+}
+//---------------------------------------------------------------------------
+void __fastcall TLogWriter::ProcessEvent()
+{
+  FILE * File;
+  {
+    TGuard Guard(FSection.get());
+    DebugAssert(FWriting.empty());
+    FWriting.swap(FPending);
+    FBusy = !FWriting.empty();
+    File = FFile;
+  }
+
+  if (!FWriting.empty())
+  {
+    int Error = 0;
+    if ((File != NULL) &&
+        (fwrite(&FWriting[0], 1, FWriting.size(), File) != FWriting.size()))
+    {
+      Error = (errno != 0) ? errno : EIO;
+    }
+    FWriting.clear();
+
+    TGuard Guard(FSection.get());
+    FBusy = false;
+    if (Error != 0)
+    {
+      FError = Error;
+    }
+  }
+
+  SetEvent(FDrainedEvent);
+}
+//---------------------------------------------------------------------------
+//---------------------------------------------------------------------------
 FILE * __fastcall OpenFile(UnicodeString LogFileName, TDateTime Started, TSessionData * SessionData, bool Append, UnicodeString & NewFileName)
 {
   FILE * Result;
@@ -801,6 +934,8 @@ __fastcall TSessionLog::TSessionLog(TSessionUI* UI, TDateTime Started, TSessionD
   FCurrentLogFileName = L"";
   FCurrentFileName = L"";
   FClosed = false;
+  FWriter = NULL;
+  memset(&FTimestampTime, 0, sizeof(FTimestampTime));
 }
 //---------------------------------------------------------------------------
 __fastcall TSessionLog::~TSessionLog()
@@ -808,6 +943,7 @@ __fastcall TSessionLog::~TSessionLog()
   FClosed = true;
   ReflectSettings();
   DebugAssert(FFile == NULL);
+  SAFE_DESTROY(FWriter);
   delete FCriticalSection;
 }
 //---------------------------------------------------------------------------
@@ -834,19 +970,20 @@ void __fastcall TSessionLog::DoAddToSelf(TLogLineType Type, const UnicodeString
 
     if (FFile != NULL)
     {
-      UnicodeString Timestamp = FormatDateTime(L" yyyy-mm-dd hh:nn:ss.zzz ", Now());
-      UTF8String UtfLine = UTF8String(UnicodeString(LogLineMarks[Type]) + Timestamp + Line + L"\r\n");
-      for (int Index = 1; Index <= UtfLine.Length(); Index++)
+      SYSTEMTIME Time;
+      GetLocalTime(&Time);
+      // Many lines get logged within the same millisecond, format the timestamp only once for them
+      if (memcmp(&Time, &FTimestampTime, sizeof(Time)) != 0)
       {
-        if ((UtfLine[Index] == '\n') &&
-            ((Index == 1) || (UtfLine[Index - 1] != '\r')))
-        {
-          UtfLine.Insert('\r', Index);
-        }
+        FTimestampTime = Time;
+        FTimestamp = FormatDateTime(L" yyyy-mm-dd hh:nn:ss.zzz ", SystemTimeToDateTime(Time));
       }
+      // DoAdd has split the lines already, so there are no bare LFs to fix
+      UTF8String UtfLine = UTF8String(UnicodeString(LogLineMarks[Type]) + FTimestamp + Line + L"\r\n");
       int Writting = UtfLine.Length();
       CheckSize(Writting);
-      FCurrentFileSize += fwrite(UtfLine.c_str(), 1, Writting, (FILE *)FFile);
+      FWriter->Write(UtfLine.c_str(), Writting);
+      FCurrentFileSize += Writting;
     }
   }
 }
@@ -993,6 +1130,8 @@ void __fastcall TSessionLog::CloseLogFile()
 {
   if (FFile != NULL)
   {
+    FWriter->Flush();
+    FWriter->SetFile(NULL);
     fclose((FILE *)FFile);
     FFile = NULL;
   }
@@ -1008,6 +1147,11 @@ void __fastcall TSessionLog::OpenLogFile()
     DebugAssert(FConfiguration != NULL);
     FCurrentLogFileName = FConfiguration->LogFileName;
     FFile = OpenFile(FCurrentLogFileName, FStarted, FSessionData, FConfiguration->LogFileAppend, FCurrentFileName);
+    if (FWriter == NULL)
+    {
+      FWriter = new TLogWriter();
+    }
+    FWriter->SetFile((FILE *)FFile);
     TSearchRec SearchRec;
     if (FileSearchRec(FCurrentFileName, SearchRec))
     {
@@ -1293,7 +1437,7 @@ void __fastcall TSessionLog::DoAddStartupInfo(TSessionData * Data)
     }
     if (Data->UsesSsh)
     {
-      ADF(L"Compression: %s", (BooleanToEngStr(Data->Compression)));
+      ADF(L"Compression: %s; Compression level: %d", (BooleanToEngStr(Data->Compression), Data->CompressionLevel));
       ADF(L"Bypass authentication: %s",
        (BooleanToEngStr(Data->SshNoUserAuth)));
       ADF(L"Try agent: %s; Agent forwarding: %s; KI: %s; GSSAPI: %s",
@@ -1313,7 +1457,9 @@ void __fastcall TSessionLog::DoAddStartupInfo(TSessionData * Data)
         AddToList(Bugs, EnumName(Data->Bug[(TSshBug)Index], AutoSwitchNames), L",");
       }
       ADF(L"SSH Bugs: %s", (Bugs));
-      ADF(L"Simple channel: %s", (BooleanToEngStr(Data->SshSimple)));
+      ADF(L"Simple channel: %s; Adaptive window: %s; Connection sharing: %s",
+        (BooleanToEngStr(Data->SshSimple), BooleanToEngStr(Data->SshAdaptiveWindow),
+         BooleanToEngStr(Data->ConnectionSharing)));
       ADF(L"Return code variable: %s; Lookup user groups: %s",
         ((Data->DetectReturnVar ? UnicodeString(L"Autodetect") : Data->ReturnVar),
          EnumName(Data->LookupUserGroups, AutoSwitchNames)));
@@ -1322,9 +1468,10 @@ void __fastcall TSessionLog::DoAddStartupInfo(TSessionData * Data)
       ADF(L"Clear aliases: %s, Unset nat.vars: %s, Resolve symlinks: %s; Follow directory symlinks: %s",
         (BooleanToEngStr(Data->ClearAliases), BooleanToEngStr(Data->UnsetNationalVars),
          BooleanToEngStr(Data->ResolveSymlinks), BooleanToEngStr(Data->FollowDirectorySymlinks)));
-      ADF(L"LS: %s, Ign LS warn: %s, Scp1 Comp: %s; Exit code 1 is error: %s",
+      ADF(L"LS: %s, Ign LS warn: %s, Deep listing: %s, Scp1 Comp: %s; Exit code 1 is error: %s",
         (Data->ListingCommand,
          BooleanToEngStr(Data->IgnoreLsWarnings),
+         BooleanToEngStr(Data->SCPDeepListing),
          BooleanToEngStr(Data->Scp1Compatibility),
          BooleanToEngStr(Data->ExitCode1IsError)));
     }
@@ -1396,7 +1543,8 @@ void __fastcall TSessionLog::DoAddStartupInfo(TSessionData * Data)
       FtpsOn = (Data->Ftps != ftpsNone);
       ADF(L"HTTPS: %s [Client certificate: %s]",
         (BooleanToEngStr(FtpsOn), LogSensitive(Data->TlsCertificateFile)));
-      ADF(L"WebDAV: Tolerate non-encoded: %s", (BooleanToEngStr(Data->WebDavLiberalEscaping)));
+      ADF(L"WebDAV: Tolerate non-encoded: %s; Deep listing: %s",
+        (BooleanToEngStr(Data->WebDavLiberalEscaping), BooleanToEngStr(Data->WebDavDeepListing)));
     }
     if (Data->FSProtocol == fsS3)
     {
@@ -1513,6 +1661,7 @@ void __fastcall TActionLog::Init(TSessionUI * UI, TDateTime Started, TSessionDat
   FIndent = L"  ";
   FInGroup = false;
   FEnabled = true;
+  FWriter = NULL;
 }
 //---------------------------------------------------------------------------
 __fastcall TActionLog::~TActionLog()
@@ -1522,6 +1671,7 @@ __fastcall TActionLog::~TActionLog()
   FClosed = true;
   ReflectSettings();
   DebugAssert(FFile == NULL);
+  SAFE_DESTROY(FWriter);
   delete FCriticalSection;
 }
 //---------------------------------------------------------------------------
@@ -1540,21 +1690,14 @@ void __fastcall TActionLog::Add(const UnicodeString & Line)
     {
       try
       {
-        UTF8String UtfLine = UTF8String(Line);
-        size_t Written =
-          fwrite(UtfLine.c_str(), 1, UtfLine.Length(), (FILE *)FFile);
-        if (Written != static_cast<size_t>(UtfLine.Length()))
+        // The writes are asynchronous, so a failure is reported with the next line
+        int Error = FWriter->GetError();
+        if (Error != 0)
         {
-          throw ECRTExtException(L"");
-        }
-        #ifdef _DEBUG
-        #endif
-        Written =
-          fwrite("\n", 1, 1, (FILE *)FFile);
-        if (Written != 1)
-        {
-          throw ECRTExtException(L"");
+          throw EOSExtException(L"", Error);
         }
+        UTF8String UtfLine = UTF8String(Line + L"\n");
+        FWriter->Write(UtfLine.c_str(), UtfLine.Length());
       }
       catch (Exception &E)
       {
@@ -1664,6 +1807,8 @@ void __fastcall TActionLog::CloseLogFile()
 {
   if (FFile != NULL)
   {
+    FWriter->Flush();
+    FWriter->SetFile(NULL);
     fclose((FILE *)FFile);
     FFile = NULL;
   }
@@ -1679,6 +1824,11 @@ void __fastcall TActionLog::OpenLogFile()
     DebugAssert(FConfiguration != NULL);
     FCurrentLogFileName = FConfiguration->ActionsLogFileName;
     FFile = OpenFile(FCurrentLogFileName, FStarted, FSessionData, false, FCurrentFileName);
+    if (FWriter == NULL)
+    {
+      FWriter = new TLogWriter();
+    }
+    FWriter->SetFile((FILE *)FFile);
   }
   catch (Exception & E)
   {
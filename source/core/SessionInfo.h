@@ -46,7 +46,7 @@ enum TFSCapability { fcUserGroupListing, fcModeChanging, fcAclChangingFiles, fcG
   fcSecondaryShell, fcRemoveCtrlZUpload, fcRemoveBOMUpload, fcMoveToQueue,
   fcLocking, fcPreservingTimestampDirs, fcResumeSupport,
   fcChangePassword, fcSkipTransfer,
-  fcParallelTransfers, fcParallelFileTransfers,
+  fcParallelTransfers, fcParallelFileTransfers, fcParallelFileUploads,
   fcBackgroundTransfers,
   fcTransferOut, fcTransferIn,
   fcMoveOverExistingFile,
@@ -251,6 +251,8 @@ public:
 //---------------------------------------------------------------------------
 typedef void __fastcall (__closure *TAddLogEntryEvent)(const UnicodeString & S);
 //---------------------------------------------------------------------------
+class TLogWriter;
+//---------------------------------------------------------------------------
 class TSessionLog
 {
 friend class TApplicationLog;
@@ -292,6 +294,9 @@ private:
   TDateTime FStarted;
   UnicodeString FName;
   bool FClosed;
+  TLogWriter * FWriter;
+  SYSTEMTIME FTimestampTime;
+  UnicodeString FTimestamp;
 
   void __fastcall OpenLogFile();
   UnicodeString __fastcall GetLogFileName();
@@ -354,6 +359,7 @@ private:
   bool FInGroup;
   UnicodeString FIndent;
   bool FEnabled;
+  TLogWriter * FWriter;
 
   void __fastcall OpenLogFile();
   UnicodeString __fastcall GetLogFileName();
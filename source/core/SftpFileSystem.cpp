@@ -163,6 +163,8 @@
 const int SFTPMinVersion = 0;
 const int SFTPMaxVersion = 6;
 const unsigned int SFTPNoMessageNumber = static_cast<unsigned int>(-1);
+// Maximal number of directories listed in advance, including those not started yet
+const size_t SFTPReadAheadDirectoriesMax = 256;
 
 const int asNo =            0;
 const int asOK =            1 << SSH_FX_OK;
@@ -936,6 +938,8 @@ public:
   __property unsigned char RequestType = { read = GetRequestType };
   __property unsigned int MessageNumber = { read = FMessageNumber, write = FMessageNumber };
   __property TSFTPFileSystem * ReservedBy = { read = FReservedBy, write = FReservedBy };
+  // Message number of the request, to which this is reserved as a response
+  __property unsigned int ReservedNumber = { read = FReservedNumber, write = FReservedNumber };
   __property UnicodeString TypeName = { read = GetTypeName };
 
 private:
@@ -946,6 +950,7 @@ private:
   unsigned char FType;
   unsigned int FMessageNumber;
   TSFTPFileSystem * FReservedBy;
+  unsigned int FReservedNumber;
 
   static int FMessageCounter;
   static const FSendPrefixLen = 4;
@@ -959,6 +964,7 @@ private:
     FMessageNumber = SFTPNoMessageNumber;
     FType = -1;
     FReservedBy = NULL;
+    FReservedNumber = SFTPNoMessageNumber;
   }
 
   void AssignNumber()
@@ -1392,6 +1398,20 @@ public:
     return SendRequest();
   }
 
+  // Hands over responses to the requests still in flight, with their reservations,
+  // so that they can be received after the queue is gone
+  void __fastcall DetachResponses(std::vector<TSFTPPacket *> & Responses)
+  {
+    UnregisterReceiveHandler();
+    while (FRequests->Count > 0)
+    {
+      delete static_cast<TSFTPQueuePacket *>(FRequests->Items[0]);
+      FRequests->Delete(0);
+      Responses.push_back(static_cast<TSFTPPacket *>(FResponses->Items[0]));
+      FResponses->Delete(0);
+    }
+  }
+
 protected:
 
   // event handler for incoming data
@@ -1522,6 +1542,8 @@ public:
     FLastBlockSize = 0;
     FEnd = false;
     FConvertToken = false;
+    FOffset = 0;
+    FPartSize = -1;
   }
 
   virtual __fastcall ~TSFTPUploadQueue()
@@ -1531,7 +1553,7 @@ public:
 
   bool __fastcall Init(const UnicodeString & AFileName,
     HANDLE AFile, TTransferInEvent OnTransferIn, TFileOperationProgressType * AOperationProgress,
-    const RawByteString AHandle, __int64 ATransferred,
+    const RawByteString AHandle, __int64 ATransferred, __int64 PartSize,
     int ConvertParams)
   {
     FFileName = AFileName;
@@ -1542,7 +1564,9 @@ public:
     OperationProgress = AOperationProgress;
     FHandle = AHandle;
     FOnTransferIn = OnTransferIn;
+    FOffset = ATransferred;
     FTransferred = ATransferred;
+    FPartSize = PartSize;
     FConvertParams = ConvertParams;
 
     return TSFTPAsynchronousQueue::Init();
@@ -1561,6 +1585,15 @@ protected:
     TFileBuffer BlockBuf;
 
     unsigned long BlockSize = GetBlockSize();
+    if (FPartSize >= 0)
+    {
+      __int64 Remaining = (FOffset + FPartSize) - FTransferred;
+      if (Remaining < BlockSize)
+      {
+        // It's lower, so the cast is safe
+        BlockSize = static_cast<unsigned long>(Remaining);
+      }
+    }
     bool Result = (BlockSize > 0);
 
     if (Result)
@@ -1680,13 +1713,82 @@ private:
   UnicodeString FFileName;
   unsigned long FLastBlockSize;
   bool FEnd;
+  __int64 FOffset;
   __int64 FTransferred;
+  __int64 FPartSize;
   RawByteString FHandle;
   bool FConvertToken;
   int FConvertParams;
   TEncryption * FEncryption;
 };
 //---------------------------------------------------------------------------
+// Upload, whose data, close and set properties requests were all sent,
+// but whose responses are collected only later, see TSFTPFileSystem::Source
+class TSFTPUploadCompletion
+{
+public:
+  TSFTPUploadCompletion() :
+    PropertiesRequest(SSH_FXP_SETSTAT)
+  {
+    SetProperties = false;
+    PreserveTime = false;
+    PreserveRights = false;
+    IgnorePermErrors = false;
+  }
+
+  ~TSFTPUploadCompletion()
+  {
+    for (size_t Index = 0; Index < WriteResponses.size(); Index++)
+    {
+      delete WriteResponses[Index];
+    }
+  }
+
+  UnicodeString DestFileName;
+  UnicodeString DestFullName;
+  bool SetProperties;
+  bool PreserveTime;
+  TDateTime Modification;
+  bool PreserveRights;
+  TRights Rights;
+  bool IgnorePermErrors;
+  std::vector<TSFTPPacket *> WriteResponses;
+  TSFTPPacket CloseRequest;
+  TSFTPPacket PropertiesRequest;
+  TSFTPPacket PropertiesResponse;
+  std::unique_ptr<Exception> Error;
+  std::unique_ptr<Exception> PropertiesError;
+  // The upload as TTerminal knows it, to confirm its outcome to
+  std::unique_ptr<TPendingSource> Pending;
+};
+//---------------------------------------------------------------------------
+// Directory listed before TTerminal::ProcessDirectory gets to it,
+// see TSFTPFileSystem::ReadAheadDirectories
+class TSFTPReadAheadDirectory
+{
+public:
+  TSFTPReadAheadDirectory(const UnicodeString & ADirectory) :
+    Directory(ADirectory),
+    FileList(new TRemoteFileList())
+  {
+    FileList->Directory = Directory;
+    Started = false;
+    Done = false;
+    Failed = false;
+    HasParentDirectory = false;
+  }
+
+  UnicodeString Directory;
+  std::unique_ptr<TRemoteFileList> FileList;
+  RawByteString Handle;
+  TSFTPPacket Request;
+  TSFTPPacket Response;
+  bool Started;
+  bool Done;
+  bool Failed;
+  bool HasParentDirectory;
+};
+//---------------------------------------------------------------------------
 class TSFTPLoadFilesPropertiesQueue : public TSFTPFixedLenQueue
 {
 public:
@@ -1767,22 +1869,30 @@ private:
   int FIndex;
 };
 //---------------------------------------------------------------------------
-class TSFTPCalculateFilesChecksumQueue : public TSFTPFixedLenQueue
+// The server hashes small files in no time, so with many of them, it is the round-trip time
+// that limits the throughput and we keep many requests in flight.
+// With large files the server is the bottleneck and the queue is kept short,
+// as all requests in flight have to be waited for when cancelling.
+class TSFTPCalculateFilesChecksumQueue : public TSFTPQueue
 {
 public:
   TSFTPCalculateFilesChecksumQueue(TSFTPFileSystem * AFileSystem) :
-    TSFTPFixedLenQueue(AFileSystem)
+    TSFTPQueue(AFileSystem)
   {
     FIndex = 0;
+    FMaxQueueLen = 0;
+    FMaxQueueSize = 0;
   }
   virtual __fastcall ~TSFTPCalculateFilesChecksumQueue(){}
 
-  bool __fastcall Init(int QueueLen, const UnicodeString & Alg, TStrings * FileList)
+  bool __fastcall Init(int MaxQueueLen, __int64 MaxQueueSize, const UnicodeString & Alg, TStrings * FileList)
   {
     FAlg = Alg;
     FFileList = FileList;
+    FMaxQueueLen = MaxQueueLen;
+    FMaxQueueSize = MaxQueueSize;
 
-    return TSFTPFixedLenQueue::Init(QueueLen);
+    return TSFTPQueue::Init();
   }
 
   bool __fastcall ReceivePacket(TSFTPPacket * Packet, TRemoteFile *& File)
@@ -1791,7 +1901,7 @@ public:
     bool Result;
     try
     {
-      Result = TSFTPFixedLenQueue::ReceivePacket(Packet, SSH_FXP_EXTENDED_REPLY, asNo, &Token);
+      Result = TSFTPQueue::ReceivePacket(Packet, SSH_FXP_EXTENDED_REPLY, asNo, &Token);
     }
     __finally
     {
@@ -1834,7 +1944,21 @@ protected:
   {
     bool Result =
       (FIndex < FFileList->Count) &&
-      TSFTPFixedLenQueue::SendRequest();
+      TSFTPQueue::SendRequest();
+    return Result;
+  }
+
+  virtual bool SendRequests()
+  {
+    // At least two requests are kept in flight, as the queue must not run empty
+    // before the next request is sent (End would take it for the end of the list).
+    bool Result = false;
+    while ((FRequests->Count < FMaxQueueLen) &&
+           ((FRequests->Count < 2) || (GetQueueSize() < FMaxQueueSize)) &&
+           SendRequest())
+    {
+      Result = true;
+    }
     return Result;
   }
 
@@ -1847,6 +1971,19 @@ private:
   UnicodeString FAlg;
   TStrings * FFileList;
   int FIndex;
+  int FMaxQueueLen;
+  __int64 FMaxQueueSize;
+
+  __int64 __fastcall GetQueueSize()
+  {
+    __int64 Result = 0;
+    for (int Index = 0; Index < FRequests->Count; Index++)
+    {
+      TSFTPQueuePacket * Request = static_cast<TSFTPQueuePacket *>(FRequests->Items[Index]);
+      Result += static_cast<TRemoteFile *>(Request->Token)->Size;
+    }
+    return Result;
+  }
 };
 //---------------------------------------------------------------------------
 #pragma warn .inl
@@ -1894,7 +2031,6 @@ __fastcall TSFTPFileSystem::TSFTPFileSystem(TTerminal * ATerminal,
   TCustomFileSystem(ATerminal)
 {
   FSecureShell = SecureShell;
-  FPacketReservations = new TList();
   ResetConnection();
   FBusy = 0;
   FAvoidBusy = false;
@@ -1904,6 +2040,8 @@ __fastcall TSFTPFileSystem::TSFTPFileSystem(TTerminal * ATerminal,
   FSupport = new TSFTPSupport();
   FFixedPaths = NULL;
   FFileSystemInfoValid = false;
+  FReadAheadUseCache = false;
+  FSourcePending = false;
 
   FChecksumAlgs.reset(new TStringList());
   FChecksumSftpAlgs.reset(new TStringList());
@@ -1921,13 +2059,13 @@ __fastcall TSFTPFileSystem::TSFTPFileSystem(TTerminal * ATerminal,
 __fastcall TSFTPFileSystem::~TSFTPFileSystem()
 {
   delete FSupport;
+  ClearReadAhead();
   // After closing, we can only possibly have "discard" reservations of the not-read responses to the last requests
   // (typically to SSH_FXP_CLOSE)
-  for (int i = 0; i < FPacketReservations->Count; i++)
+  for (TPacketReservations::const_iterator I = FPacketReservations.begin(); I != FPacketReservations.end(); ++I)
   {
-    DebugAssert(FPacketReservations->Items[i] == NULL);
+    DebugAssert(I->second == NULL);
   }
-  delete FPacketReservations;
   delete FFixedPaths;
   delete FSecureShell;
 }
@@ -2058,13 +2196,20 @@ void __fastcall TSFTPFileSystem::Idle()
   FSecureShell->Idle();
 }
 //---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::IdleWait(unsigned int MSec)
+{
+  // Waits for network events, rather than plainly sleeping,
+  // so that channels of sessions sharing our connection keep flowing
+  FSecureShell->Idle(MSec);
+}
+//---------------------------------------------------------------------------
 void __fastcall TSFTPFileSystem::ResetConnection()
 {
-  FPacketReservations->Clear();
-  FPacketNumbers = VarArrayCreate(OPENARRAY(int, (0, 1)), varLongWord);
+  FPacketReservations.clear();
   FNotLoggedRequests.clear();
   FPreviousLoggedPacket = 0;
   FNotLoggedWritePackets = FNotLoggedReadPackets = FNotLoggedStatusPackets = FNotLoggedDataPackets = 0;
+  ClearReadAhead();
 }
 //---------------------------------------------------------------------------
 bool __fastcall TSFTPFileSystem::IsCapable(int Capability) const
@@ -2095,6 +2240,7 @@ bool __fastcall TSFTPFileSystem::IsCapable(int Capability) const
     case fcSkipTransfer:
     case fcParallelTransfers:
     case fcParallelFileTransfers:
+    case fcParallelFileUploads:
       return !FTerminal->IsEncryptingFiles();
 
     case fcRename:
@@ -2221,10 +2367,11 @@ inline void __fastcall TSFTPFileSystem::BusyEnd()
 const unsigned long SFTPPacketOverhead = 4 + 4 + 1;
 //---------------------------------------------------------------------------
 unsigned long __fastcall TSFTPFileSystem::TransferBlockSize(
-  unsigned long Overhead, TFileOperationProgressType * OperationProgress)
+  unsigned long Overhead, TFileOperationProgressType * OperationProgress,
+  unsigned long ChannelMaxPacketSize)
 {
   const unsigned long MinPacketSize = 32768;
-  unsigned long AMaxPacketSize = FSecureShell->MaxPacketSize();
+  unsigned long AMaxPacketSize = ChannelMaxPacketSize;
   bool MaxPacketSizeValid = (AMaxPacketSize > 0);
   unsigned long CPSRounded = TEncryption::RoundToBlock(OperationProgress->CPS());
   unsigned long Result = CPSRounded;
@@ -2281,13 +2428,19 @@ unsigned long __fastcall TSFTPFileSystem::UploadBlockSize(const RawByteString &
   // handle length + offset + data size
   const unsigned long UploadPacketOverhead =
     sizeof(unsigned long) + sizeof(__int64) + sizeof(unsigned long);
-  return TransferBlockSize(UploadPacketOverhead + Handle.Length(), OperationProgress);
+  return TransferBlockSize(
+    UploadPacketOverhead + Handle.Length(), OperationProgress, FSecureShell->MaxPacketSize());
 }
 //---------------------------------------------------------------------------
 unsigned long __fastcall TSFTPFileSystem::DownloadBlockSize(
   TFileOperationProgressType * OperationProgress)
 {
-  unsigned long Result = TransferBlockSize(sizeof(unsigned long), OperationProgress);
+  // The server splits the response to channel packets of the size we advertised,
+  // so when that is larger than the server's own limit (with the adaptive window),
+  // we can ask for correspondingly more
+  unsigned long ChannelMaxPacketSize =
+    std::max(FSecureShell->MaxPacketSize(), FSecureShell->LocalMaxPacketSize());
+  unsigned long Result = TransferBlockSize(sizeof(unsigned long), OperationProgress, ChannelMaxPacketSize);
   if (FSupport->Loaded && (FSupport->MaxReadSize > 0) &&
       (Result > FSupport->MaxReadSize))
   {
@@ -2509,19 +2662,15 @@ unsigned long __fastcall TSFTPFileSystem::GotStatusPacket(
   }
 }
 //---------------------------------------------------------------------------
-void __fastcall TSFTPFileSystem::RemoveReservation(int Reservation)
+void __fastcall TSFTPFileSystem::RemoveReservation(TPacketReservations::iterator Reservation)
 {
-  for (int Index = Reservation+1; Index < FPacketReservations->Count; Index++)
-  {
-    FPacketNumbers.PutElement(FPacketNumbers.GetElement(Index), Index-1);
-  }
-  TSFTPPacket * Packet = (TSFTPPacket *)FPacketReservations->Items[Reservation];
+  TSFTPPacket * Packet = Reservation->second;
   if (Packet)
   {
     DebugAssert(Packet->ReservedBy == this);
     Packet->ReservedBy = NULL;
   }
-  FPacketReservations->Delete(Reservation);
+  FPacketReservations.erase(Reservation);
 }
 //---------------------------------------------------------------------------
 inline int __fastcall TSFTPFileSystem::PacketLength(unsigned char * LenBuf, int ExpectedType)
@@ -2561,10 +2710,10 @@ int __fastcall TSFTPFileSystem::ReceivePacket(TSFTPPacket * Packet,
   TSFTPBusy Busy(this);
 
   int Result = SSH_FX_OK;
-  int Reservation = FPacketReservations->IndexOf(Packet);
+  bool Reserved = (Packet->ReservedBy == this);
   bool NotLogged;
 
-  if (Reservation < 0 || Packet->Capacity == 0)
+  if (!Reserved || Packet->Capacity == 0)
   {
     bool IsReserved;
     do
@@ -2612,34 +2761,23 @@ int __fastcall TSFTPFileSystem::ReceivePacket(TSFTPPacket * Packet,
           }
         }
 
-        if (Reservation < 0 ||
-            Packet->MessageNumber != (unsigned int)FPacketNumbers.GetElement(Reservation))
+        if (!Reserved ||
+            Packet->MessageNumber != Packet->ReservedNumber)
         {
-          TSFTPPacket * ReservedPacket;
-          unsigned int MessageNumber;
-          for (int Index = 0; Index < FPacketReservations->Count; Index++)
+          TPacketReservations::iterator I = FPacketReservations.find(Packet->MessageNumber);
+          if (I != FPacketReservations.end())
           {
-            MessageNumber = (unsigned int)FPacketNumbers.GetElement(Index);
-            if (MessageNumber == Packet->MessageNumber)
+            TSFTPPacket * ReservedPacket = I->second;
+            IsReserved = true;
+            if (ReservedPacket)
             {
-              ReservedPacket = (TSFTPPacket *)FPacketReservations->Items[Index];
-              IsReserved = true;
-              if (ReservedPacket)
-              {
-                FTerminal->LogEvent(0, L"Storing reserved response");
-                *ReservedPacket = *Packet;
-              }
-              else
-              {
-                FTerminal->LogEvent(0, L"Discarding reserved response");
-                RemoveReservation(Index);
-                if ((Reservation >= 0) && (Reservation > Index))
-                {
-                  Reservation--;
-                  DebugAssert(Reservation == FPacketReservations->IndexOf(Packet));
-                }
-              }
-              break;
+              FTerminal->LogEvent(0, L"Storing reserved response");
+              *ReservedPacket = *Packet;
+            }
+            else
+            {
+              FTerminal->LogEvent(0, L"Discarding reserved response");
+              RemoveReservation(I);
             }
           }
         }
@@ -2658,10 +2796,14 @@ int __fastcall TSFTPFileSystem::ReceivePacket(TSFTPPacket * Packet,
     // but if it raises exception, removal is unnecessarily
     // postponed until the packet is removed
     // (and it have not worked anyway until recent fix to UnreserveResponse)
-    if (Reservation >= 0)
+    if (Reserved)
     {
-      DebugAssert(Packet->MessageNumber == (unsigned int)FPacketNumbers.GetElement(Reservation));
-      RemoveReservation(Reservation);
+      DebugAssert(Packet->MessageNumber == Packet->ReservedNumber);
+      TPacketReservations::iterator I = FPacketReservations.find(Packet->ReservedNumber);
+      if (DebugAlwaysTrue(I != FPacketReservations.end()))
+      {
+        RemoveReservation(I);
+      }
     }
 
     if (ExpectedType >= 0)
@@ -2689,38 +2831,36 @@ void __fastcall TSFTPFileSystem::ReserveResponse(const TSFTPPacket * Packet,
 {
   if (Response != NULL)
   {
-    DebugAssert(FPacketReservations->IndexOf(Response) < 0);
+    DebugAssert(Response->ReservedBy != this);
     // mark response as not received yet
     Response->Capacity = 0;
     Response->ReservedBy = this;
+    Response->ReservedNumber = Packet->MessageNumber;
   }
-  FPacketReservations->Add(Response);
-  if (FPacketReservations->Count >= FPacketNumbers.ArrayHighBound())
-  {
-    FPacketNumbers.ArrayRedim(FPacketReservations->Count + 10);
-  }
-  FPacketNumbers.PutElement(Packet->MessageNumber, FPacketReservations->Count - 1);
+  DebugAssert(FPacketReservations.find(Packet->MessageNumber) == FPacketReservations.end());
+  FPacketReservations[Packet->MessageNumber] = Response;
 }
 //---------------------------------------------------------------------------
 void __fastcall TSFTPFileSystem::UnreserveResponse(TSFTPPacket * Response)
 {
-  int Reservation = FPacketReservations->IndexOf(Response);
-  if (Response->Capacity != 0)
-  {
-    // added check for already received packet
-    // (it happens when the reserved response is received out of order,
-    // unexpectedly soon, and then receivepacket() on the packet
-    // is not actually called, due to exception)
-    RemoveReservation(Reservation);
-  }
-  else
+  TPacketReservations::iterator Reservation = FPacketReservations.find(Response->ReservedNumber);
+  if ((Reservation != FPacketReservations.end()) &&
+      DebugAlwaysTrue(Reservation->second == Response))
   {
-    if (Reservation >= 0)
+    if (Response->Capacity != 0)
+    {
+      // added check for already received packet
+      // (it happens when the reserved response is received out of order,
+      // unexpectedly soon, and then receivepacket() on the packet
+      // is not actually called, due to exception)
+      RemoveReservation(Reservation);
+    }
+    else
     {
       // we probably do not remove the item at all, because
       // we must remember that the response was expected, so we skip it
       // in receivepacket()
-      FPacketReservations->Items[Reservation] = NULL;
+      Reservation->second = NULL;
     }
   }
 }
@@ -3505,6 +3645,11 @@ void __fastcall TSFTPFileSystem::ReadDirectory(TRemoteFileList * FileList)
   // old data (e.g. parent directory) when reading fails
   FileList->Reset();
 
+  if (TakeReadAheadDirectory(Directory, FileList))
+  {
+    return;
+  }
+
   TSFTPPacket Packet(SSH_FXP_OPENDIR);
   RawByteString Handle;
 
@@ -3556,26 +3701,9 @@ void __fastcall TSFTPFileSystem::ReadDirectory(TRemoteFileList * FileList)
         int ResolvedLinks = 0;
         for (unsigned long Index = 0; !isEOF && (Index < Count); Index++)
         {
-          std::unique_ptr<TRemoteFile> AFile(LoadFile(&ListingPacket, NULL, L"", FileList));
-          TRemoteFile * File = AFile.get();
-          if (FTerminal->IsValidFile(File))
+          TRemoteFile * File = LoadListingFile(&ListingPacket, FileList);
+          if (File != NULL)
           {
-            FileList->AddFile(AFile.release());
-            if (FTerminal->IsEncryptingFiles() && // optimization
-                IsRealFile(File->FileName))
-            {
-              UnicodeString FullFileName = UnixExcludeTrailingBackslash(File->FullFileName);
-              UnicodeString FileName = UnixExtractFileName(FTerminal->DecryptFileName(FullFileName, false, false));
-              if (File->FileName != FileName)
-              {
-                File->SetEncrypted();
-              }
-              File->FileName = FileName;
-            }
-            if (FTerminal->Configuration->ActualLogProtocol >= 1)
-            {
-              FTerminal->LogEvent(FORMAT(L"Read file '%s' from listing", (File->FileName)));
-            }
             if (File->LinkedFile != NULL)
             {
               ResolvedLinks++;
@@ -3598,14 +3726,9 @@ void __fastcall TSFTPFileSystem::ReadDirectory(TRemoteFileList * FileList)
           }
         }
 
-        if (!isEOF &&
-            (FVersion >= 6) &&
-            // As of 7.0.9 the Cerberus SFTP server always sets the end-of-list to true.
-            // Fixed in 7.0.10.
-            (FSecureShell->SshImplementation != sshiCerberus) &&
-            ListingPacket.CanGetBool())
+        if (!isEOF)
         {
-          isEOF = ListingPacket.GetBool();
+          isEOF = IsListingEOF(&ListingPacket);
         }
 
         if (Count == 0)
@@ -3701,6 +3824,383 @@ void __fastcall TSFTPFileSystem::ReadDirectory(TRemoteFileList * FileList)
   }
 }
 //---------------------------------------------------------------------------
+TRemoteFile * __fastcall TSFTPFileSystem::LoadListingFile(TSFTPPacket * ListingPacket, TRemoteFileList * FileList)
+{
+  std::unique_ptr<TRemoteFile> AFile(LoadFile(ListingPacket, NULL, L"", FileList));
+  TRemoteFile * File = AFile.get();
+  if (FTerminal->IsValidFile(File))
+  {
+    FileList->AddFile(AFile.release());
+    if (FTerminal->IsEncryptingFiles() && // optimization
+        IsRealFile(File->FileName))
+    {
+      UnicodeString FullFileName = UnixExcludeTrailingBackslash(File->FullFileName);
+      UnicodeString FileName = UnixExtractFileName(FTerminal->DecryptFileName(FullFileName, false, false));
+      if (File->FileName != FileName)
+      {
+        File->SetEncrypted();
+      }
+      File->FileName = FileName;
+    }
+    if (FTerminal->Configuration->ActualLogProtocol >= 1)
+    {
+      FTerminal->LogEvent(FORMAT(L"Read file '%s' from listing", (File->FileName)));
+    }
+  }
+  else
+  {
+    File = NULL;
+  }
+  return File;
+}
+//---------------------------------------------------------------------------
+bool __fastcall TSFTPFileSystem::IsListingEOF(TSFTPPacket * ListingPacket)
+{
+  return
+    (FVersion >= 6) &&
+    // As of 7.0.9 the Cerberus SFTP server always sets the end-of-list to true.
+    // Fixed in 7.0.10.
+    (FSecureShell->SshImplementation != sshiCerberus) &&
+    ListingPacket->CanGetBool() &&
+    ListingPacket->GetBool();
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::ReadAheadDirectories(TRemoteFileList * FileList, bool UseCache)
+{
+  // The walk in TTerminal::ProcessDirectory lists one directory at a time.
+  // To hide the latency, we keep listing of up to SFTPListingQueue directories
+  // in progress: the subdirectories of the directory being processed first
+  // (in their order, as the walk will get to them next) and then,
+  // as listings complete, the subdirectories found in them (breadth-first).
+  // The walk then picks the listings in ReadDirectory.
+  // Not with encryption, as we would have to map the names back.
+  if ((FTerminal->SessionData->SFTPListingQueue > 1) &&
+      !FTerminal->IsEncryptingFiles())
+  {
+    FReadAheadUseCache = UseCache;
+    UnicodeString Directory = UnixExcludeTrailingBackslash(LocalCanonify(FileList->Directory));
+    size_t Position = 0;
+    for (int Index = 0; Index < FileList->Count; Index++)
+    {
+      TRemoteFile * File = FileList->Files[Index];
+      UnicodeString SubDirectory = UnixCombinePaths(Directory, File->FileName);
+      if (CanReadAhead(File, SubDirectory) &&
+          MakeRoomForReadAhead(Position))
+      {
+        FReadAheadDirectories.insert(
+          FReadAheadDirectories.begin() + Position, new TSFTPReadAheadDirectory(SubDirectory));
+        Position++;
+      }
+    }
+
+    PumpReadAhead(NULL);
+  }
+}
+//---------------------------------------------------------------------------
+bool __fastcall TSFTPFileSystem::CanReadAhead(const TRemoteFile * File, const UnicodeString & Directory)
+{
+  return
+    File->IsDirectory && !File->IsSymLink && IsRealFile(File->FileName) &&
+    (FindReadAheadDirectory(Directory) == NULL) &&
+    // The walk will not read the directory, if it has it cached
+    (!FReadAheadUseCache || !FTerminal->SessionData->CacheDirectories ||
+     !FTerminal->FDirectoryCache->HasFileList(Directory));
+}
+//---------------------------------------------------------------------------
+bool __fastcall TSFTPFileSystem::MakeRoomForReadAhead(size_t Keep)
+{
+  // Directories the walk gets to next take precedence over not started yet
+  // directories discovered by the read ahead
+  size_t Index = FReadAheadDirectories.size();
+  while ((FReadAheadDirectories.size() >= SFTPReadAheadDirectoriesMax) && (Index > Keep))
+  {
+    Index--;
+    TSFTPReadAheadDirectory * Entry = FReadAheadDirectories[Index];
+    if (!Entry->Started)
+    {
+      FReadAheadDirectories.erase(FReadAheadDirectories.begin() + Index);
+      delete Entry;
+    }
+  }
+  return (FReadAheadDirectories.size() < SFTPReadAheadDirectoriesMax);
+}
+//---------------------------------------------------------------------------
+TSFTPReadAheadDirectory * __fastcall TSFTPFileSystem::FindReadAheadDirectory(const UnicodeString & Directory)
+{
+  TSFTPReadAheadDirectory * Result = NULL;
+  for (size_t Index = 0; (Result == NULL) && (Index < FReadAheadDirectories.size()); Index++)
+  {
+    if (FReadAheadDirectories[Index]->Directory == Directory)
+    {
+      Result = FReadAheadDirectories[Index];
+    }
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::PumpReadAhead(TSFTPReadAheadDirectory * WaitFor)
+{
+  // Without WaitFor, only processes responses that were already received
+  // (while waiting for other responses), so it never blocks
+  bool Progress;
+  do
+  {
+    Progress = false;
+
+    int Running = 0;
+    for (size_t Index = 0; Index < FReadAheadDirectories.size(); Index++)
+    {
+      TSFTPReadAheadDirectory * Entry = FReadAheadDirectories[Index];
+      if (Entry->Started && !Entry->Done)
+      {
+        Running++;
+      }
+    }
+
+    for (size_t Index = 0; Index < FReadAheadDirectories.size(); Index++)
+    {
+      TSFTPReadAheadDirectory * Entry = FReadAheadDirectories[Index];
+      if (!Entry->Started &&
+          ((Entry == WaitFor) || (Running < FTerminal->SessionData->SFTPListingQueue)))
+      {
+        StartReadAhead(Entry);
+        Running++;
+      }
+    }
+
+    // FinishReadAhead may append more directories, so do not cache the size
+    for (size_t Index = 0; Index < FReadAheadDirectories.size(); Index++)
+    {
+      TSFTPReadAheadDirectory * Entry = FReadAheadDirectories[Index];
+      if (Entry->Started && !Entry->Done &&
+          ((Entry == WaitFor) || (Entry->Response.Capacity > 0)))
+      {
+        ContinueReadAhead(Entry);
+        Progress = true;
+      }
+    }
+  }
+  while ((WaitFor != NULL) ? !WaitFor->Done : Progress);
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::StartReadAhead(TSFTPReadAheadDirectory * Entry)
+{
+  FTerminal->LogEvent(FORMAT(L"Listing directory \"%s\" in advance.", (Entry->Directory)));
+  Entry->Started = true;
+  Entry->Request.ChangeType(SSH_FXP_OPENDIR);
+  AddPathString(Entry->Request, Entry->Directory);
+  SendPacket(&Entry->Request);
+  ReserveResponse(&Entry->Request, &Entry->Response);
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::ContinueReadAhead(TSFTPReadAheadDirectory * Entry)
+{
+  ReceivePacket(&Entry->Response);
+
+  try
+  {
+    if (Entry->Handle.IsEmpty())
+    {
+      if (Entry->Response.Type == SSH_FXP_HANDLE)
+      {
+        Entry->Handle = Entry->Response.GetFileHandle();
+        Entry->Request.ChangeType(SSH_FXP_READDIR);
+        Entry->Request.AddString(Entry->Handle);
+        SendPacket(&Entry->Request);
+        ReserveResponse(&Entry->Request, &Entry->Response);
+      }
+      else
+      {
+        // Typically permission denied, leave it to ReadDirectory to report the error
+        FinishReadAhead(Entry, true);
+      }
+    }
+    else if (Entry->Response.Type == SSH_FXP_NAME)
+    {
+      TSFTPPacket ListingPacket = Entry->Response;
+
+      // As in ReadDirectory, ask for the next batch before parsing this one.
+      // If this one is the last, the response gets discarded with the entry.
+      Entry->Request.ChangeType(SSH_FXP_READDIR);
+      Entry->Request.AddString(Entry->Handle);
+      SendPacket(&Entry->Request);
+      ReserveResponse(&Entry->Request, &Entry->Response);
+
+      unsigned int Count = ListingPacket.GetCardinal();
+      for (unsigned long Index = 0; Index < Count; Index++)
+      {
+        TRemoteFile * File = LoadListingFile(&ListingPacket, Entry->FileList.get());
+        if ((File != NULL) && File->IsParentDirectory)
+        {
+          Entry->HasParentDirectory = true;
+        }
+      }
+
+      if (IsListingEOF(&ListingPacket) || (Count == 0))
+      {
+        FinishReadAhead(Entry, false);
+      }
+    }
+    else if (Entry->Response.Type == SSH_FXP_STATUS)
+    {
+      bool Failed = (GotStatusPacket(&Entry->Response, asAll, false) != SSH_FX_EOF);
+      FinishReadAhead(Entry, Failed);
+    }
+    else
+    {
+      FinishReadAhead(Entry, true);
+    }
+  }
+  catch (Exception & E)
+  {
+    if (!FTerminal->Active || E.InheritsFrom(__classid(EFatal)))
+    {
+      throw;
+    }
+    // The error will be reported, if ReadDirectory encounters it too
+    FTerminal->LogEvent(FORMAT(L"Listing directory \"%s\" in advance failed.", (Entry->Directory)));
+    FTerminal->Log->AddException(&E);
+    if (!Entry->Done)
+    {
+      FinishReadAhead(Entry, true);
+    }
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::FinishReadAhead(TSFTPReadAheadDirectory * Entry, bool Failed)
+{
+  Entry->Done = true;
+
+  if (!Entry->Handle.IsEmpty())
+  {
+    Entry->Request.ChangeType(SSH_FXP_CLOSE);
+    Entry->Request.AddString(Entry->Handle);
+    SendPacket(&Entry->Request);
+    // we are not interested in the response, do not wait for it
+    ReserveResponse(&Entry->Request, NULL);
+  }
+
+  // Empty listing needs the special handling in ReadDirectory
+  Entry->Failed = Failed || (Entry->FileList->Count == 0);
+  if (!Entry->Failed)
+  {
+    if (!Entry->HasParentDirectory)
+    {
+      Entry->FileList->AddFile(new TRemoteParentDirectory(FTerminal));
+    }
+
+    for (int Index = 0; Index < Entry->FileList->Count; Index++)
+    {
+      TRemoteFile * File = Entry->FileList->Files[Index];
+      UnicodeString SubDirectory = UnixCombinePaths(Entry->Directory, File->FileName);
+      if ((FReadAheadDirectories.size() < SFTPReadAheadDirectoriesMax) &&
+          CanReadAhead(File, SubDirectory))
+      {
+        FReadAheadDirectories.push_back(new TSFTPReadAheadDirectory(SubDirectory));
+      }
+    }
+  }
+}
+//---------------------------------------------------------------------------
+bool __fastcall TSFTPFileSystem::TakeReadAheadDirectory(const UnicodeString & Directory, TRemoteFileList * FileList)
+{
+  bool Result = false;
+  TSFTPReadAheadDirectory * Entry = FindReadAheadDirectory(Directory);
+  if (Entry != NULL)
+  {
+    PumpReadAhead(Entry);
+
+    FReadAheadDirectories.erase(
+      std::find(FReadAheadDirectories.begin(), FReadAheadDirectories.end(), Entry));
+    std::unique_ptr<TSFTPReadAheadDirectory> EntryOwner(Entry);
+
+    if (!Entry->Failed)
+    {
+      FTerminal->LogEvent(FORMAT(L"Using listing of directory \"%s\" read in advance.", (Directory)));
+      // The files move to FileList
+      Entry->FileList->OwnsObjects = false;
+      for (int Index = 0; Index < Entry->FileList->Count; Index++)
+      {
+        FileList->AddFile(Entry->FileList->Files[Index]);
+      }
+      Result = true;
+    }
+
+    // Start the directories, that the finished entries made room for
+    PumpReadAhead(NULL);
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::ReadAheadDone(const UnicodeString & Directory)
+{
+  UnicodeString Path;
+  if (!Directory.IsEmpty())
+  {
+    Path = UnixExcludeTrailingBackslash(LocalCanonify(Directory));
+  }
+
+  size_t Index = 0;
+  while (Index < FReadAheadDirectories.size())
+  {
+    TSFTPReadAheadDirectory * Entry = FReadAheadDirectories[Index];
+    if (Path.IsEmpty() || UnixIsChildPath(Path, Entry->Directory))
+    {
+      FReadAheadDirectories.erase(FReadAheadDirectories.begin() + Index);
+      DiscardReadAhead(Entry);
+    }
+    else
+    {
+      Index++;
+    }
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::DiscardReadAhead(TSFTPReadAheadDirectory * Entry)
+{
+  // The pending response gets discarded, once the entry is released
+  std::unique_ptr<TSFTPReadAheadDirectory> EntryOwner(Entry);
+  if (Entry->Started && !Entry->Done && FTerminal->Active)
+  {
+    try
+    {
+      if (Entry->Handle.IsEmpty())
+      {
+        // Need the handle to close the directory
+        ReceivePacket(&Entry->Response);
+        if (Entry->Response.Type == SSH_FXP_HANDLE)
+        {
+          Entry->Handle = Entry->Response.GetFileHandle();
+        }
+      }
+
+      if (!Entry->Handle.IsEmpty())
+      {
+        Entry->Request.ChangeType(SSH_FXP_CLOSE);
+        Entry->Request.AddString(Entry->Handle);
+        SendPacket(&Entry->Request);
+        ReserveResponse(&Entry->Request, NULL);
+      }
+    }
+    catch (Exception & E)
+    {
+      // Called from __finally blocks, do not throw
+      FTerminal->LogEvent(FORMAT(L"Error closing directory \"%s\" listed in advance.", (Entry->Directory)));
+      FTerminal->Log->AddException(&E);
+    }
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::ClearReadAhead()
+{
+  // Without any network traffic, the connection is gone
+  for (size_t Index = 0; Index < FReadAheadDirectories.size(); Index++)
+  {
+    delete FReadAheadDirectories[Index];
+  }
+  FReadAheadDirectories.clear();
+}
+//---------------------------------------------------------------------------
 void __fastcall TSFTPFileSystem::ReadSymlink(TRemoteFile * SymlinkFile,
   TRemoteFile *& File)
 {
@@ -4161,7 +4661,8 @@ void __fastcall TSFTPFileSystem::CalculateFilesChecksum(
 {
   FTerminal->CalculateSubFoldersChecksum(Alg, FileList, OnCalculatedChecksum, OperationProgress, FirstLevel);
 
-  static int CalculateFilesChecksumQueueLen = 5;
+  static int CalculateFilesChecksumQueueLen = 128;
+  static __int64 CalculateFilesChecksumQueueSize = 16 * 1024 * 1024;
   TSFTPCalculateFilesChecksumQueue Queue(this);
   TOnceDoneOperation OnceDoneOperation; // not used
   try
@@ -4178,7 +4679,7 @@ void __fastcall TSFTPFileSystem::CalculateFilesChecksum(
       SftpAlg = Alg;
     }
 
-    if (Queue.Init(CalculateFilesChecksumQueueLen, SftpAlg, FileList))
+    if (Queue.Init(CalculateFilesChecksumQueueLen, CalculateFilesChecksumQueueSize, SftpAlg, FileList))
     {
       TSFTPPacket Packet;
       bool Next;
@@ -4372,7 +4873,257 @@ void __fastcall TSFTPFileSystem::CopyToRemote(TStrings * FilesToCopy,
   TOnceDoneOperation & OnceDoneOperation)
 {
   TAutoFlag AvoidBusyFlag(FAvoidBusy);
-  FTerminal->DoCopyToRemote(FilesToCopy, TargetDir, CopyParam, Params, OperationProgress, tfPreCreateDir, OnceDoneOperation);
+  try
+  {
+    FTerminal->DoCopyToRemote(FilesToCopy, TargetDir, CopyParam, Params, OperationProgress, tfPreCreateDir, OnceDoneOperation);
+    // Normally all uploads are collected already, unless the last top-level file was skipped
+    TransferFinished(OperationProgress);
+  }
+  __finally
+  {
+    DiscardUploads();
+  }
+}
+//---------------------------------------------------------------------------
+bool __fastcall TSFTPFileSystem::IsSourcePending()
+{
+  return FSourcePending;
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::DeferSourceDone(TPendingSource * Pending)
+{
+  DebugAssert(FSourcePending && !FPendingUploads.empty());
+  FSourcePending = false;
+  FPendingUploads.back()->Pending.reset(Pending);
+  CollectUploads(FTerminal->SessionData->SFTPUploadPipeline, FTerminal->OperationProgress);
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::TransferFinished(TFileOperationProgressType * OperationProgress)
+{
+  if (!FPendingUploads.empty())
+  {
+    try
+    {
+      CollectUploads(0, OperationProgress);
+
+      // Only failed uploads are left now, each is handled on its own, as if it was not deferred
+      while (!FPendingUploads.empty())
+      {
+        std::unique_ptr<TSFTPUploadCompletion> Completion(FPendingUploads.front());
+        FPendingUploads.erase(FPendingUploads.begin());
+
+        if (Completion->Error.get() != NULL)
+        {
+          FTerminal->LogEvent(FORMAT(L"Upload of \"%s\" failed.", (Completion->DestFullName)));
+          DeleteIncompleteUpload(Completion.get());
+          FTerminal->PendingSourceFailed(Completion->Pending.get(), Completion->Error.get(), OperationProgress);
+        }
+        else
+        {
+          try
+          {
+            bool Resend = false;
+            FILE_OPERATION_LOOP_BEGIN
+            {
+              if (!Resend)
+              {
+                Resend = true;
+                RethrowException(Completion->PropertiesError.get());
+              }
+              else
+              {
+                TSFTPPacket Response;
+                Completion->PropertiesRequest.Reuse();
+                SendPacketAndReceiveResponse(&Completion->PropertiesRequest, &Response, SSH_FXP_STATUS,
+                  asOK | FLAGMASK(Completion->IgnorePermErrors, asPermDenied));
+              }
+            }
+            FILE_OPERATION_LOOP_END_CUSTOM(
+              FMTLOAD(PRESERVE_TIME_PERM_ERROR3, (Completion->DestFileName)),
+              folAllowSkip, HELP_PRESERVE_TIME_PERM_ERROR);
+
+            LogUploadCompletion(Completion.get(), NULL);
+            FTerminal->PendingSourceDone(Completion->Pending.get(), OperationProgress);
+          }
+          catch (ESkipFile & E)
+          {
+            LogUploadCompletion(Completion.get(), &E);
+            FTerminal->PendingSourceFailed(Completion->Pending.get(), &E, OperationProgress);
+          }
+        }
+      }
+    }
+    __finally
+    {
+      DiscardUploads();
+    }
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::CollectUploads(int Keep, TFileOperationProgressType * OperationProgress)
+{
+  int Outstanding = 0;
+  for (size_t Index = 0; Index < FPendingUploads.size(); Index++)
+  {
+    if ((FPendingUploads[Index]->Error.get() == NULL) && (FPendingUploads[Index]->PropertiesError.get() == NULL))
+    {
+      Outstanding++;
+    }
+  }
+
+  size_t Index = 0;
+  while (Index < FPendingUploads.size())
+  {
+    TSFTPUploadCompletion * Completion = FPendingUploads[Index];
+    bool Failed = (Completion->Error.get() != NULL) || (Completion->PropertiesError.get() != NULL);
+    // Wait for the oldest uploads, if there are too many, otherwise take only those that are responded already
+    if (!Failed &&
+        CollectUpload(Completion, (Outstanding > Keep)))
+    {
+      Outstanding--;
+      if ((Completion->Error.get() == NULL) && (Completion->PropertiesError.get() == NULL))
+      {
+        FPendingUploads.erase(FPendingUploads.begin() + Index);
+        std::unique_ptr<TSFTPUploadCompletion> Done(Completion);
+        LogUploadCompletion(Completion, NULL);
+        FTerminal->PendingSourceDone(Completion->Pending.get(), OperationProgress);
+        continue;
+      }
+    }
+    Index++;
+  }
+}
+//---------------------------------------------------------------------------
+bool __fastcall TSFTPFileSystem::IsUploadResponseReceived(const TSFTPPacket * Response)
+{
+  return (Response->ReservedBy != this) || (Response->Capacity > 0);
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::ReceiveUploadResponse(TSFTPPacket * Response, int AllowStatus)
+{
+  // Otherwise there was no request or the response was processed already
+  if (Response->ReservedBy == this)
+  {
+    TPacketReservations::iterator Reservation = FPacketReservations.find(Response->ReservedNumber);
+    // Reservations are cleared, when reconnecting
+    if ((Reservation == FPacketReservations.end()) || (Reservation->second != Response))
+    {
+      throw Exception(LoadStr(SFTP_STATUS_CONNECTION_LOST));
+    }
+    ReceivePacket(Response, SSH_FXP_STATUS, AllowStatus);
+  }
+}
+//---------------------------------------------------------------------------
+bool __fastcall TSFTPFileSystem::CollectUpload(TSFTPUploadCompletion * Completion, bool Wait)
+{
+  bool Result = Wait;
+  if (!Result)
+  {
+    Result =
+      IsUploadResponseReceived(&Completion->CloseRequest) &&
+      IsUploadResponseReceived(&Completion->PropertiesResponse);
+    for (size_t Index = 0; Result && (Index < Completion->WriteResponses.size()); Index++)
+    {
+      Result = IsUploadResponseReceived(Completion->WriteResponses[Index]);
+    }
+  }
+
+  if (Result)
+  {
+    try
+    {
+      for (size_t Index = 0; Index < Completion->WriteResponses.size(); Index++)
+      {
+        ReceiveUploadResponse(Completion->WriteResponses[Index], -1);
+      }
+      ReceiveUploadResponse(&Completion->CloseRequest, -1);
+    }
+    catch (Exception & E)
+    {
+      FTerminal->LogEvent(FORMAT(L"Upload of \"%s\" failed.", (Completion->DestFullName)));
+      Completion->Error.reset(CloneException(&E));
+    }
+
+    if ((Completion->Error.get() == NULL) && Completion->SetProperties)
+    {
+      try
+      {
+        ReceiveUploadResponse(
+          &Completion->PropertiesResponse, asOK | FLAGMASK(Completion->IgnorePermErrors, asPermDenied));
+      }
+      catch (Exception & E)
+      {
+        Completion->PropertiesError.reset(CloneException(&E));
+      }
+    }
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::LogUploadCompletion(TSFTPUploadCompletion * Completion, Exception * E)
+{
+  if (Completion->SetProperties)
+  {
+    std::unique_ptr<TTouchSessionAction> TouchAction;
+    if (Completion->PreserveTime)
+    {
+      FTerminal->LogEvent(FORMAT(L"Preserving timestamp of \"%s\" [%s]",
+        (Completion->DestFullName, StandardTimestamp(Completion->Modification))));
+      TouchAction.reset(new TTouchSessionAction(FTerminal->ActionLog, Completion->DestFullName,
+        Completion->Modification));
+    }
+    std::unique_ptr<TChmodSessionAction> ChmodAction;
+    if (Completion->PreserveRights)
+    {
+      ChmodAction.reset(new TChmodSessionAction(FTerminal->ActionLog, Completion->DestFullName, Completion->Rights));
+    }
+    if (E != NULL)
+    {
+      if (TouchAction.get() != NULL)
+      {
+        TouchAction->Rollback(E);
+      }
+      if (ChmodAction.get() != NULL)
+      {
+        ChmodAction->Rollback(E);
+      }
+    }
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::DeleteIncompleteUpload(TSFTPUploadCompletion * Completion)
+{
+  // As when the transfer is not finished in Source
+  if (FTerminal->Active)
+  {
+    try
+    {
+      DoDeleteFile(Completion->DestFullName, SSH_FXP_REMOVE);
+    }
+    catch (Exception & E)
+    {
+      FTerminal->LogEvent(FORMAT(L"Cannot delete incompletely uploaded file \"%s\".", (Completion->DestFullName)));
+      FTerminal->Log->AddException(&E);
+    }
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TSFTPFileSystem::DiscardUploads()
+{
+  FSourcePending = false;
+  // Responses not received yet get discarded, once their packets are released.
+  // Outcome of the discarded uploads is not recorded (see TPendingSource).
+  while (!FPendingUploads.empty())
+  {
+    std::unique_ptr<TSFTPUploadCompletion> Completion(FPendingUploads.back());
+    FPendingUploads.pop_back();
+    if (Completion->Error.get() != NULL)
+    {
+      FTerminal->LogEvent(FORMAT(L"Upload of \"%s\" failed.", (Completion->DestFullName)));
+      FTerminal->Log->AddException(Completion->Error.get());
+      DeleteIncompleteUpload(Completion.get());
+    }
+  }
 }
 //---------------------------------------------------------------------------
 void __fastcall TSFTPFileSystem::SFTPConfirmOverwrite(
@@ -4589,13 +5340,18 @@ void __fastcall TSFTPFileSystem::Source(
 
   __int64 ResumeOffset;
 
+  // Parts of a parallel transfer are written directly to their place in a common partial file,
+  // which TParallelOperation finalizes once all parts are done
+  bool InPlacePart = (CopyParam->PartOffset >= 0) && (CopyParam->OnTransferIn == NULL);
+
   // should we check for interrupted transfer?
   ResumeAllowed =
     !OperationProgress->AsciiTransfer &&
     CopyParam->AllowResume(OperationProgress->LocalSize, DestFileName) &&
     IsCapable(fcRename) &&
     !FTerminal->IsEncryptingFiles() &&
-    (CopyParam->OnTransferIn == NULL);
+    (CopyParam->OnTransferIn == NULL) &&
+    !InPlacePart;
 
   TOpenRemoteFileParams OpenParams;
   OpenParams.OverwriteMode = omOverwrite;
@@ -4716,13 +5472,15 @@ void __fastcall TSFTPFileSystem::Source(
   OpenParams.FileName = Handle.FileName;
   OpenParams.RemoteFileName = RemoteFileName;
   OpenParams.Resume = DoResume;
-  OpenParams.Resuming = ResumeTransfer;
+  // Do not truncate the file, the other parts are being written to it
+  OpenParams.Resuming = ResumeTransfer || InPlacePart;
   OpenParams.OperationProgress = OperationProgress;
   OpenParams.CopyParam = CopyParam;
   OpenParams.Params = Params;
   OpenParams.FileParams = &FileParams;
-  OpenParams.Confirmed = (CopyParam->OnTransferIn != NULL) && FLAGCLEAR(Params, cpAppend);
-  OpenParams.DontRecycle = false;
+  // The overwrite of the final file was confirmed before the parallel transfer started
+  OpenParams.Confirmed = ((CopyParam->OnTransferIn != NULL) && FLAGCLEAR(Params, cpAppend)) || InPlacePart;
+  OpenParams.DontRecycle = InPlacePart;
   OpenParams.Recycled = false;
 
   FTerminal->LogEvent(0, L"Opening remote file.");
@@ -4745,14 +5503,15 @@ void __fastcall TSFTPFileSystem::Source(
 
   bool TransferFinished = false;
   __int64 DestWriteOffset = 0;
-  TSFTPPacket CloseRequest;
-  bool PreserveRights = CopyParam->PreserveRights && (CopyParam->OnTransferIn == NULL);
+  std::unique_ptr<TSFTPUploadCompletion> Completion(new TSFTPUploadCompletion());
+  TSFTPPacket & CloseRequest = Completion->CloseRequest;
+  bool PreserveRights = CopyParam->PreserveRights && (CopyParam->OnTransferIn == NULL) && !InPlacePart;
   bool PreserveExistingRights = (DoResume && DestFileExists) || OpenParams.Recycled;
   bool SetRights = (PreserveExistingRights || PreserveRights);
-  bool PreserveTime = CopyParam->PreserveTime && (CopyParam->OnTransferIn == NULL);
+  bool PreserveTime = CopyParam->PreserveTime && (CopyParam->OnTransferIn == NULL) && !InPlacePart;
   bool SetProperties = (PreserveTime || SetRights);
-  TSFTPPacket PropertiesRequest(SSH_FXP_SETSTAT);
-  TSFTPPacket PropertiesResponse;
+  TSFTPPacket & PropertiesRequest = Completion->PropertiesRequest;
+  TSFTPPacket & PropertiesResponse = Completion->PropertiesResponse;
   TRights Rights;
   if (SetProperties)
   {
@@ -4784,9 +5543,34 @@ void __fastcall TSFTPFileSystem::Source(
       NULL, NULL, false, FVersion, FUtfStrings);
   }
 
+  // With many small files, waiting for responses to the last write, close and set properties requests
+  // of each file, before opening the next one, doubles the number of round trips.
+  // So they get collected later instead (see CollectUploads and TransferFinished), unless the result is needed immediately:
+  // top-level files are accounted for by TTerminal as soon as we return, moves and clearing
+  // the archive attribute modify the source file, and resumable transfers rename the file afterwards.
+  bool Pipeline =
+    (FTerminal->SessionData->SFTPUploadPipeline > 0) &&
+    FLAGCLEAR(Flags, tfFirstLevel) &&
+    FLAGCLEAR(Params, cpDelete) &&
+    !CopyParam->ClearArchive &&
+    (CopyParam->OnTransferIn == NULL) &&
+    !DoResume &&
+    (OpenParams.OverwriteMode == omOverwrite) &&
+    !OpenParams.Recycled &&
+    // all parts have to be written before the file is finalized
+    !InPlacePart &&
+    // repeated upload of a file, whose deferred upload failed
+    FLAGCLEAR(Flags, tfNoPipeline);
+  bool Pipelined = false;
+
   try
   {
-    if (OpenParams.OverwriteMode == omAppend)
+    if (InPlacePart)
+    {
+      FileSeek((THandle)Handle.Handle, CopyParam->PartOffset, soBeginning);
+      DestWriteOffset = CopyParam->PartOffset;
+    }
+    else if (OpenParams.OverwriteMode == omAppend)
     {
       FTerminal->LogEvent(L"Appending file.");
       DestWriteOffset = OpenParams.DestFileSize;
@@ -4814,7 +5598,7 @@ void __fastcall TSFTPFileSystem::Source(
         FLAGMASK(CopyParam->RemoveBOM, cpRemoveBOM);
       Queue.Init(Handle.FileName, Handle.Handle, CopyParam->OnTransferIn, OperationProgress,
         OpenParams.RemoteFileHandle,
-        DestWriteOffset + OperationProgress->TransferredSize,
+        DestWriteOffset + OperationProgress->TransferredSize, CopyParam->PartSize,
         ConvertParams);
 
       while (Queue.Continue())
@@ -4844,8 +5628,16 @@ void __fastcall TSFTPFileSystem::Source(
         SendPacket(&PropertiesRequest);
         ReserveResponse(&PropertiesRequest, &PropertiesResponse);
       }
-      // No error so far, processes pending responses and throw on first error
-      Queue.DisposeSafeWithErrorHandling();
+      if (Pipeline)
+      {
+        Queue.DetachResponses(Completion->WriteResponses);
+        Pipelined = true;
+      }
+      else
+      {
+        // No error so far, processes pending responses and throw on first error
+        Queue.DisposeSafeWithErrorHandling();
+      }
     }
     __finally
     {
@@ -4867,14 +5659,17 @@ void __fastcall TSFTPFileSystem::Source(
         SFTPCloseRemote(OpenParams.RemoteFileHandle, DestFileName,
           OperationProgress, TransferFinished, true, &CloseRequest);
       }
-      // wait for the response
-      SFTPCloseRemote(OpenParams.RemoteFileHandle, DestFileName,
-        OperationProgress, TransferFinished, false, &CloseRequest);
+      // wait for the response, unless it is collected later
+      if (!Pipelined)
+      {
+        SFTPCloseRemote(OpenParams.RemoteFileHandle, DestFileName,
+          OperationProgress, TransferFinished, false, &CloseRequest);
+      }
 
       // delete file if transfer was not completed, resuming was not allowed and
       // we were not appending (incl. alternate resume),
       // shortly after plain transfer completes (eq. !ResumeAllowed)
-      if (!TransferFinished && !DoResume && (OpenParams.OverwriteMode == omOverwrite))
+      if (!TransferFinished && !DoResume && (OpenParams.OverwriteMode == omOverwrite) && !InPlacePart)
       {
         DoDeleteFile(OpenParams.RemoteFileName, SSH_FXP_REMOVE);
       }
@@ -4916,7 +5711,21 @@ void __fastcall TSFTPFileSystem::Source(
       folAllowSkip, HELP_RENAME_AFTER_RESUME_ERROR);
   }
 
-  if (SetProperties)
+  if (Pipelined)
+  {
+    Completion->DestFileName = DestFileName;
+    Completion->DestFullName = DestFullName;
+    Completion->SetProperties = SetProperties;
+    Completion->PreserveTime = PreserveTime;
+    Completion->Modification = UnixToDateTime(Handle.MTime, FTerminal->SessionData->DSTMode);
+    Completion->PreserveRights = PreserveRights;
+    Completion->Rights = Rights;
+    Completion->IgnorePermErrors = CopyParam->IgnorePermErrors;
+    FPendingUploads.push_back(Completion.release());
+    // TTerminal hands over its part of the upload in DeferSourceDone
+    FSourcePending = true;
+  }
+  else if (SetProperties)
   {
     std::unique_ptr<TTouchSessionAction> TouchAction;
     if (PreserveTime)
@@ -5370,6 +6179,9 @@ void __fastcall TSFTPFileSystem::Sink(
     !FTerminal->IsEncryptingFiles() &&
     (CopyParam->OnTransferOut == NULL) &&
     (CopyParam->PartOffset < 0);
+  // Parts of a parallel transfer are written directly to their place in a file preallocated by TParallelOperation,
+  // which also takes care of its timestamp and attributes once all parts are done
+  bool InPlacePart = (CopyParam->PartOffset >= 0) && (CopyParam->OnTransferOut == NULL);
 
   HANDLE LocalHandle = NULL;
   TStream * FileStream = NULL;
@@ -5389,6 +6201,7 @@ void __fastcall TSFTPFileSystem::Sink(
       DestPartialFullName = DestFullName + PartialExt;
       LocalFileName = DestPartialFullName;
 
+      FTerminal->DiscardParallelPartialFile(DestFullName);
       FTerminal->LogEvent(L"Checking existence of partially transferred file.");
       if (FileExists(ApiPath(DestPartialFullName)))
       {
@@ -5464,7 +6277,7 @@ void __fastcall TSFTPFileSystem::Sink(
       }
     }
 
-    if ((Attrs >= 0) && !ResumeTransfer)
+    if ((Attrs >= 0) && !ResumeTransfer && !InPlacePart)
     {
       __int64 DestFileSize;
       __int64 MTime;
@@ -5486,6 +6299,7 @@ void __fastcall TSFTPFileSystem::Sink(
         DestPartialFullName = DestFullName + PartialExt;
         if (ResumeAllowed)
         {
+          FTerminal->DiscardParallelPartialFile(DestFullName);
           if (FileExists(ApiPath(DestPartialFullName)))
           {
             FTerminal->DoDeleteLocalFile(DestPartialFullName);
@@ -5535,7 +6349,11 @@ void __fastcall TSFTPFileSystem::Sink(
     if (CopyParam->OnTransferOut == NULL)
     {
       // if not already opened (resume, append...), create new empty file
-      if (!LocalHandle)
+      if (InPlacePart)
+      {
+        FTerminal->OpenLocalFileSegment(LocalFileName, CopyParam->PartOffset, &LocalHandle);
+      }
+      else if (!LocalHandle)
       {
         if (!FTerminal->CreateLocalFile(LocalFileName, OperationProgress,
                &LocalHandle, FLAGSET(Params, cpNoConfirmation)))
@@ -5545,7 +6363,8 @@ void __fastcall TSFTPFileSystem::Sink(
       }
       DebugAssert(LocalHandle);
 
-      DeleteLocalFile = true;
+      // The preallocated file is shared with the other parts
+      DeleteLocalFile = !InPlacePart;
 
       FileStream = new TSafeHandleStream((THandle)LocalHandle);
     }
@@ -5721,7 +6540,7 @@ void __fastcall TSFTPFileSystem::Sink(
     if (CopyParam->OnTransferOut == NULL)
     {
       DebugAssert(LocalHandle);
-      if (CopyParam->PreserveTime)
+      if (CopyParam->PreserveTime && !InPlacePart)
       {
         FTerminal->UpdateTargetTime(LocalHandle, Modification, ModificationFmt, FTerminal->SessionData->DSTMode);
       }
@@ -5745,7 +6564,10 @@ void __fastcall TSFTPFileSystem::Sink(
 
       DeleteLocalFile = false;
 
-      FTerminal->UpdateTargetAttrs(DestFullName, File, CopyParam, Attrs);
+      if (!InPlacePart)
+      {
+        FTerminal->UpdateTargetAttrs(DestFullName, File, CopyParam, Attrs);
+      }
     }
 
   }
@@ -9,6 +9,8 @@ class TOverwriteFileParams;
 struct TSFTPSupport;
 class TSecureShell;
 class TEncryption;
+class TSFTPUploadCompletion;
+class TSFTPReadAheadDirectory;
 //---------------------------------------------------------------------------
 enum TSFTPOverwriteMode { omOverwrite, omAppend, omResume };
 extern const int SFTPMaxVersion;
@@ -32,6 +34,7 @@ public:
   virtual bool __fastcall GetActive();
   virtual void __fastcall CollectUsage();
   virtual void __fastcall Idle();
+  virtual void __fastcall IdleWait(unsigned int MSec);
   virtual UnicodeString __fastcall AbsolutePath(UnicodeString Path, bool Local);
   virtual void __fastcall AnyCommand(const UnicodeString Command,
     TCaptureOutputEvent OutputEvent);
@@ -54,6 +57,9 @@ public:
     const UnicodeString TargetDir, const TCopyParamType * CopyParam,
     int Params, TFileOperationProgressType * OperationProgress,
     TOnceDoneOperation & OnceDoneOperation);
+  virtual void __fastcall TransferFinished(TFileOperationProgressType * OperationProgress);
+  virtual bool __fastcall IsSourcePending();
+  virtual void __fastcall DeferSourceDone(TPendingSource * Pending);
   virtual void __fastcall Source(
     TLocalFileHandle & Handle, const UnicodeString & TargetDir, UnicodeString & DestFileName,
     const TCopyParamType * CopyParam, int Params,
@@ -79,6 +85,8 @@ public:
   virtual void __fastcall LookupUsersGroups();
   virtual void __fastcall ReadCurrentDirectory();
   virtual void __fastcall ReadDirectory(TRemoteFileList * FileList);
+  virtual void __fastcall ReadAheadDirectories(TRemoteFileList * FileList, bool UseCache);
+  virtual void __fastcall ReadAheadDone(const UnicodeString & Directory);
   virtual void __fastcall ReadFile(const UnicodeString FileName,
     TRemoteFile *& File);
   virtual void __fastcall ReadSymlink(TRemoteFile * SymlinkFile,
@@ -110,8 +118,10 @@ protected:
   UnicodeString FDirectoryToChangeTo;
   UnicodeString FHomeDirectory;
   AnsiString FEOL;
-  TList * FPacketReservations;
-  Variant FPacketNumbers;
+  // Responses we are waiting for, by message number of the request.
+  // NULL for responses to be discarded.
+  typedef std::map<unsigned int, TSFTPPacket *> TPacketReservations;
+  TPacketReservations FPacketReservations;
   char FPreviousLoggedPacket;
   int FNotLoggedWritePackets, FNotLoggedReadPackets, FNotLoggedStatusPackets, FNotLoggedDataPackets;
   std::set<unsigned int> FNotLoggedRequests;
@@ -130,6 +140,13 @@ protected:
   bool FSupportsHardlink;
   std::unique_ptr<TStringList> FChecksumAlgs;
   std::unique_ptr<TStringList> FChecksumSftpAlgs;
+  // Uploads, whose final responses were not collected yet, oldest first
+  std::vector<TSFTPUploadCompletion *> FPendingUploads;
+  // The last upload was added to FPendingUploads
+  bool FSourcePending;
+  // Directories being listed in advance, those the walk gets to next first
+  std::vector<TSFTPReadAheadDirectory *> FReadAheadDirectories;
+  bool FReadAheadUseCache;
 
   void __fastcall SendCustomReadFile(TSFTPPacket * Packet, TSFTPPacket * Response,
     unsigned long Flags);
@@ -153,7 +170,7 @@ protected:
   int __fastcall ReceivePacket(TSFTPPacket * Packet, int ExpectedType = -1,
     int AllowStatus = -1, bool TryOnly = false);
   bool __fastcall PeekPacket();
-  void __fastcall RemoveReservation(int Reservation);
+  void __fastcall RemoveReservation(TPacketReservations::iterator Reservation);
   void __fastcall SendPacket(const TSFTPPacket * Packet);
   int __fastcall ReceiveResponse(const TSFTPPacket * Packet,
     TSFTPPacket * Response, int ExpectedType = -1, int AllowStatus = -1, bool TryOnly = false);
@@ -177,6 +194,25 @@ protected:
   void __fastcall SFTPCloseRemote(const RawByteString Handle,
     const UnicodeString FileName, TFileOperationProgressType * OperationProgress,
     bool TransferFinished, bool Request, TSFTPPacket * Packet);
+  void __fastcall CollectUploads(int Keep, TFileOperationProgressType * OperationProgress);
+  bool __fastcall CollectUpload(TSFTPUploadCompletion * Completion, bool Wait);
+  bool __fastcall IsUploadResponseReceived(const TSFTPPacket * Response);
+  void __fastcall ReceiveUploadResponse(TSFTPPacket * Response, int AllowStatus);
+  void __fastcall LogUploadCompletion(TSFTPUploadCompletion * Completion, Exception * E);
+  void __fastcall DeleteIncompleteUpload(TSFTPUploadCompletion * Completion);
+  void __fastcall DiscardUploads();
+  TRemoteFile * __fastcall LoadListingFile(TSFTPPacket * ListingPacket, TRemoteFileList * FileList);
+  bool __fastcall IsListingEOF(TSFTPPacket * ListingPacket);
+  bool __fastcall CanReadAhead(const TRemoteFile * File, const UnicodeString & Directory);
+  bool __fastcall MakeRoomForReadAhead(size_t Keep);
+  TSFTPReadAheadDirectory * __fastcall FindReadAheadDirectory(const UnicodeString & Directory);
+  void __fastcall PumpReadAhead(TSFTPReadAheadDirectory * WaitFor);
+  void __fastcall StartReadAhead(TSFTPReadAheadDirectory * Entry);
+  void __fastcall ContinueReadAhead(TSFTPReadAheadDirectory * Entry);
+  void __fastcall FinishReadAhead(TSFTPReadAheadDirectory * Entry, bool Failed);
+  bool __fastcall TakeReadAheadDirectory(const UnicodeString & Directory, TRemoteFileList * FileList);
+  void __fastcall DiscardReadAhead(TSFTPReadAheadDirectory * Entry);
+  void __fastcall ClearReadAhead();
   void __fastcall SFTPConfirmOverwrite(const UnicodeString & FullFileName, UnicodeString & FileName,
     const TCopyParamType * CopyParam, int Params, TFileOperationProgressType * OperationProgress,
     TSFTPOverwriteMode & Mode, const TOverwriteFileParams * FileParams);
@@ -186,7 +222,8 @@ protected:
   inline void __fastcall BusyStart();
   inline void __fastcall BusyEnd();
   inline unsigned long __fastcall TransferBlockSize(
-    unsigned long Overhead, TFileOperationProgressType * OperationProgress);
+    unsigned long Overhead, TFileOperationProgressType * OperationProgress,
+    unsigned long ChannelMaxPacketSize);
   inline unsigned long __fastcall UploadBlockSize(const RawByteString & Handle,
     TFileOperationProgressType * OperationProgress);
   inline unsigned long __fastcall DownloadBlockSize(
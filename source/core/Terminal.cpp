@@ -142,6 +142,24 @@ TOverwriteFileParams::TOverwriteFileParams()
   DestPrecision = mfFull;
 }
 //---------------------------------------------------------------------------
+TPendingSource::TPendingSource()
+{
+  CopyParam = NULL;
+  Params = 0;
+  Flags = 0;
+  TransferredSize = 0;
+  SkippedSize = 0;
+}
+//---------------------------------------------------------------------------
+TPendingSource::~TPendingSource()
+{
+  // The outcome was never confirmed (the operation was aborted)
+  if (Action.get() != NULL)
+  {
+    Action->Cancel();
+  }
+}
+//---------------------------------------------------------------------------
 //---------------------------------------------------------------------------
 class TTunnelThread : public TSimpleThread
 {
@@ -719,10 +737,7 @@ void TParallelOperation::Init(
   FIndex = 0;
   FIsParallelFileTransfer = (ParallelFileSize >= 0);
   FParallelFileSize = ParallelFileSize;
-  FParallelFileOffset = 0;
-  FParallelFileCount = 0;
-  FParallelFileMerging = false;
-  FParallelFileMerged = 0;
+  FParallelFile = NULL;
 }
 //---------------------------------------------------------------------------
 TParallelOperation::~TParallelOperation()
@@ -746,7 +761,10 @@ bool TParallelOperation::ShouldAddClient()
   else
   {
     TGuard Guard(FSection.get());
-    Result = !FProbablyEmpty && (FMainOperationProgress->Cancel < csCancel);
+    Result =
+      !FProbablyEmpty && (FMainOperationProgress->Cancel < csCancel) &&
+      // Wait for InitParallelFile
+      (!FIsParallelFileTransfer || !FParallelFileSegments.empty());
   }
   return Result;
 }
@@ -763,7 +781,7 @@ void TParallelOperation::RemoveClient()
   FClients--;
 }
 //---------------------------------------------------------------------------
-void TParallelOperation::WaitFor()
+void TParallelOperation::WaitFor(TTerminal * Terminal)
 {
   // Even initialized?
   // Won't be, when parallel transfers were not possible (like when preserving of directory timestamps is enabled)
@@ -782,7 +800,23 @@ void TParallelOperation::WaitFor()
       {
         // propagate the total progress incremented by the parallel operations
         FMainOperationProgress->Progress();
-        Sleep(200);
+        if (Terminal != NULL)
+        {
+          try
+          {
+            // The parallel connections may be sharing the terminal's connection
+            Terminal->IdleWait(200);
+          }
+          catch (...)
+          {
+            // Lost connection, the clients will fail on their own, just wait for them
+            Terminal = NULL;
+          }
+        }
+        else
+        {
+          Sleep(200);
+        }
       }
     }
     while (!Done);
@@ -863,91 +897,53 @@ void TParallelOperation::Done(
 
       try
       {
-        if (Success && DebugAlwaysTrue(FSide == osRemote))
+        if (Success)
         {
-          TParallelFileOffsets::const_iterator I = std::find(FParallelFileOffsets.begin(), FParallelFileOffsets.end(), CopyParam->PartOffset);
-          if (DebugAlwaysTrue(I != FParallelFileOffsets.end()))
+          TParallelFileSegments::iterator Segment = FParallelFileSegments.begin();
+          while ((Segment != FParallelFileSegments.end()) && (Segment->Offset != CopyParam->PartOffset))
           {
-            int Index = I - FParallelFileOffsets.begin();
-            DebugAssert(!FParallelFileDones[Index]);
-            FParallelFileDones[Index] = true;
+            ++Segment;
+          }
 
-            if (!FParallelFileMerging)
+          if (DebugAlwaysTrue(Segment != FParallelFileSegments.end()))
+          {
+            try
             {
-              // Once we obtain "merging" semaphor, we won't leave until everything is merged
-              TAutoFlag MergingFlag(FParallelFileMerging);
-
-              try
+              DebugAssert(Segment->Started && !Segment->Done);
+              if ((CopyParam->PartSize >= 0) && (Terminal->OperationProgress->TransferredSize != CopyParam->PartSize))
               {
-                UnicodeString TargetName = TPath::Combine(TargetDir, FParallelFileTargetName);
-                UnicodeString TargetNamePartial = TargetName + PartialExt;
-                UnicodeString TargetNamePartialOnly = ExtractFileName(TargetNamePartial);
+                UnicodeString SegmentName =
+                  FORMAT(L"%s@%s", (FParallelFileTargetName + PartialExt, IntToStr(Segment->Offset)));
+                UnicodeString TransferredSizeStr = IntToStr(Terminal->OperationProgress->TransferredSize);
+                UnicodeString PartSizeStr = IntToStr(CopyParam->PartSize);
+                UnicodeString Message =
+                  FMTLOAD(INCONSISTENT_SIZE, (SegmentName, TransferredSizeStr, PartSizeStr));
+                Terminal->TerminalError(NULL, Message);
+              }
 
-                while (true)
-                {
-                  if ((FParallelFileMerged >= FParallelFileCount) || !FParallelFileDones[FParallelFileMerged])
-                  {
-                    break;
-                  }
-                  else
-                  {
-                    TUnguard Unguard(FSection.get());
-
-                    UnicodeString FileNameOnly = UnixExtractFileName(FileName);
-                    // Safe as write access to FParallelFileMerged is guarded by FParallelFileMerging
-                    int Index = FParallelFileMerged;
-                    UnicodeString TargetPartName = GetPartPrefix(TPath::Combine(TargetDir, FileNameOnly)) + IntToStr(Index);
-
-                    if ((CopyParam->PartSize >= 0) && (Terminal->OperationProgress->TransferredSize != CopyParam->PartSize))
-                    {
-                      UnicodeString TransferredSizeStr = IntToStr(Terminal->OperationProgress->TransferredSize);
-                      UnicodeString PartSizeStr = IntToStr(CopyParam->PartSize);
-                      UnicodeString Message =
-                        FMTLOAD(INCONSISTENT_SIZE, (TargetPartName, TransferredSizeStr, PartSizeStr));
-                      Terminal->TerminalError(NULL, Message);
-                    }
-
-                    if (Index == 0)
-                    {
-                      Terminal->LogEvent(FORMAT(L"Renaming part %d of \"%s\" to \"%s\"...", (Index, FileNameOnly, TargetNamePartialOnly)));
-                      Terminal->DoRenameLocalFileForce(TargetPartName, TargetNamePartial);
-                    }
-                    else
-                    {
-                      {
-                        Terminal->LogEvent(FORMAT(L"Appending part %d of \"%s\" to \"%s\"...", (Index, FileNameOnly, TargetNamePartialOnly)));
-                        std::unique_ptr<THandleStream> SourceStream(TSafeHandleStream::CreateFromFile(TargetPartName, fmOpenRead | fmShareDenyWrite));
-                        std::unique_ptr<THandleStream> DestStream(TSafeHandleStream::CreateFromFile(TargetNamePartial, fmOpenWrite | fmShareDenyWrite));
-                        HANDLE DestHandle = reinterpret_cast<HANDLE>(DestStream->Handle);
-                        FILETIME WrTime;
-                        bool GotWrTime = GetFileTime(DestHandle, NULL, NULL, &WrTime);
-                        DestStream->Seek(0L, soEnd);
-                        DestStream->CopyFrom(SourceStream.get(), SourceStream->Size);
-                        if (GotWrTime)
-                        {
-                          SetFileTime(DestHandle, NULL, NULL, &WrTime);
-                        }
-                      }
-
-                      Terminal->DoDeleteLocalFile(TargetPartName);
-                    }
-
-                    FParallelFileMerged++;
-                  }
-                }
+              Segment->Done = true;
+              // Only downloads can be resumed
+              if (FSide == osRemote)
+              {
+                SaveParallelFileMap(Terminal);
+              }
 
-                if ((FParallelFileMerged == FParallelFileCount) && (FParallelFileOffset == FParallelFileSize))
-                {
-                  Terminal->LogEvent(FORMAT(L"Renaming completed \"%s\" to \"%s\"...", (TargetNamePartialOnly, FParallelFileTargetName)));
-                  Terminal->DoRenameLocalFileForce(TargetNamePartial, TargetName);
-                }
+              bool AllDone = true;
+              for (Segment = FParallelFileSegments.begin(); AllDone && (Segment != FParallelFileSegments.end()); ++Segment)
+              {
+                AllDone = Segment->Done;
               }
-              catch (...)
+
+              if (AllDone)
               {
-                Success = false;
-                throw;
+                FinishParallelFile(Terminal);
               }
             }
+            catch (...)
+            {
+              Success = false;
+              throw;
+            }
           }
         }
       }
@@ -1001,9 +997,291 @@ TCollectedFileList * TParallelOperation::GetFileList(int Index)
   return GetFileList(FFileList.get(), Index);
 }
 //---------------------------------------------------------------------------
-UnicodeString TParallelOperation::GetPartPrefix(const UnicodeString & FileName)
+UnicodeString TParallelOperation::GetParallelFileTargetName()
 {
-  return FORMAT(L"%s%s.", (FileName, PartialExt));
+  UnicodeString Result;
+  if (FSide == osLocal)
+  {
+    Result = UnixCombinePaths(FTargetDir, FParallelFileTargetName);
+  }
+  else
+  {
+    Result = TPath::Combine(FTargetDir, FParallelFileTargetName);
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+UnicodeString TParallelOperation::GetParallelFilePartialName()
+{
+  return GetParallelFileTargetName() + PartialExt;
+}
+//---------------------------------------------------------------------------
+UnicodeString TParallelOperation::GetParallelFileMapName()
+{
+  return GetParallelFileTargetName() + PartialMapExt;
+}
+//---------------------------------------------------------------------------
+void TParallelOperation::InitParallelFile(TTerminal * Terminal)
+{
+  DebugAssert(IsParallelFileTransfer);
+  UnicodeString FileName;
+  TObject * Object;
+  if (DebugAlwaysTrue(GetOnlyFile(FFileList.get(), FileName, Object)))
+  {
+    // NULL for uploads
+    FParallelFile = static_cast<const TRemoteFile *>(Object);
+  }
+  UnicodeString OnlyFileName = (FSide == osLocal) ? ExtractFileName(FileName) : UnixExtractFileName(FileName);
+  FParallelFileTargetName = Terminal->ChangeFileName(FCopyParam, OnlyFileName, FSide, true);
+  UnicodeString PartialName = GetParallelFilePartialName();
+
+  TParallelFileSegments DoneSegments;
+  if (FSide == osLocal)
+  {
+    // The parts do not truncate the file, so make sure there are no leftovers from a previous transfer
+    std::unique_ptr<TRemoteFile> PartialFile(Terminal->TryReadFile(PartialName));
+    if (PartialFile.get() != NULL)
+    {
+      Terminal->DoDeleteFile(Terminal->FFileSystem, PartialName, PartialFile.get(), 0);
+    }
+  }
+  else if (FCopyParam->AllowResume(FParallelFileSize, FParallelFileTargetName) &&
+           LoadParallelFileMap(Terminal, DoneSegments))
+  {
+    Terminal->LogEvent(FORMAT(L"Resuming transfer of \"%s\", %d parts were transferred already", (FParallelFileTargetName, static_cast<int>(DoneSegments.size()))));
+  }
+  else
+  {
+    DoneSegments.clear();
+    if (FileExists(ApiPath(GetParallelFileMapName())))
+    {
+      Terminal->DoDeleteLocalFile(GetParallelFileMapName());
+    }
+
+    HANDLE Handle;
+    if (!Terminal->CreateLocalFile(PartialName, Terminal->OperationProgress, &Handle, FLAGSET(FParams, cpNoConfirmation)))
+    {
+      Abort();
+    }
+    try
+    {
+      // All parts are written directly to their place in the file
+      Terminal->PreallocateLocalFile(PartialName, Handle, FParallelFileSize);
+    }
+    __finally
+    {
+      CloseHandle(Handle);
+    }
+  }
+
+  TParallelFileSegments Segments;
+  // Bounded segments, so that there are more of them than connections (handed out by GetNext as connections free up)
+  // and so that an interrupted transfer loses only the segments in progress.
+  const __int64 MaxParallelFileSegmentSize = 32 * 1024 * 1024;
+  __int64 PartSize = FParallelFileSize / Configuration->QueueTransfersLimit;
+  PartSize = std::max(std::min(PartSize, MaxParallelFileSegmentSize), static_cast<__int64>(1));
+  __int64 Resumed = 0;
+  __int64 Offset = 0;
+  TParallelFileSegments::const_iterator DoneSegment = DoneSegments.begin();
+  while (Offset < FParallelFileSize)
+  {
+    if ((DoneSegment != DoneSegments.end()) && (DoneSegment->Offset == Offset))
+    {
+      Segments.push_back(*DoneSegment);
+      Resumed += DoneSegment->Size;
+      Offset += DoneSegment->Size;
+      ++DoneSegment;
+    }
+    else
+    {
+      __int64 End = (DoneSegment != DoneSegments.end()) ? DoneSegment->Offset : FParallelFileSize;
+      TParallelFileSegment Segment;
+      Segment.Offset = Offset;
+      Segment.Size = std::min(PartSize, End - Offset);
+      // Do not leave a tiny part at the end of the gap
+      if (End - Offset - Segment.Size < PartSize / 10)
+      {
+        Segment.Size = End - Offset;
+      }
+      Segment.Started = false;
+      Segment.Done = false;
+      Segments.push_back(Segment);
+      Offset += Segment.Size;
+    }
+  }
+
+  if (Resumed > 0)
+  {
+    FMainOperationProgress->AddSkippedFileSize(Resumed);
+  }
+
+  TGuard Guard(FSection.get());
+  FParallelFileSegments.swap(Segments);
+}
+//---------------------------------------------------------------------------
+bool TParallelOperation::LoadParallelFileMap(TTerminal * Terminal, TParallelFileSegments & DoneSegments)
+{
+  UnicodeString PartialName = GetParallelFilePartialName();
+  UnicodeString MapName = GetParallelFileMapName();
+  bool Result = false;
+  TSearchRecSmart SearchRec;
+  if (FileExists(ApiPath(MapName)) &&
+      FileSearchRec(PartialName, SearchRec) &&
+      (SearchRec.Size == FParallelFileSize))
+  {
+    try
+    {
+      std::unique_ptr<TStringList> Map(new TStringList());
+      Map->LoadFromFile(ApiPath(MapName));
+      __int64 Size;
+      Result =
+        (Map->Count >= 2) &&
+        TryStrToInt64(Map->Strings[0], Size) && (Size == FParallelFileSize) &&
+        (Map->Strings[1] == StandardTimestamp(FParallelFile->Modification));
+
+      __int64 Done = 0;
+      __int64 End = 0;
+      for (int Index = 2; Result && (Index < Map->Count); Index++)
+      {
+        UnicodeString Line = Map->Strings[Index];
+        TParallelFileSegment Segment;
+        Result =
+          TryStrToInt64(CutToChar(Line, L',', true), Segment.Offset) &&
+          TryStrToInt64(Line, Segment.Size) &&
+          (Segment.Offset >= End) && (Segment.Size > 0) &&
+          (Segment.Offset + Segment.Size <= FParallelFileSize);
+        if (Result)
+        {
+          Segment.Started = false;
+          Segment.Done = true;
+          DoneSegments.push_back(Segment);
+          Done += Segment.Size;
+          End = Segment.Offset + Segment.Size;
+        }
+      }
+
+      // Fully done transfer should have been renamed already
+      Result = Result && (Done < FParallelFileSize);
+
+      if (!Result)
+      {
+        Terminal->LogEvent(FORMAT(L"Part map \"%s\" does not match the file, not resuming", (MapName)));
+      }
+    }
+    catch (Exception & E)
+    {
+      Terminal->LogEvent(FORMAT(L"Cannot load part map \"%s\", not resuming", (MapName)));
+      Terminal->Log->AddException(&E);
+      Result = false;
+    }
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+void TParallelOperation::SaveParallelFileMap(TTerminal * Terminal)
+{
+  // The map is an optimization only, so failing to update it is not an error
+  UnicodeString MapName = GetParallelFileMapName();
+  try
+  {
+    std::unique_ptr<TStringList> Map(new TStringList());
+    Map->Add(IntToStr(FParallelFileSize));
+    Map->Add(StandardTimestamp(FParallelFile->Modification));
+    TParallelFileSegments::const_iterator Segment = FParallelFileSegments.begin();
+    while (Segment != FParallelFileSegments.end())
+    {
+      if (Segment->Done)
+      {
+        Map->Add(FORMAT(L"%s,%s", (IntToStr(Segment->Offset), IntToStr(Segment->Size))));
+      }
+      ++Segment;
+    }
+    Map->SaveToFile(ApiPath(MapName));
+  }
+  catch (Exception & E)
+  {
+    Terminal->LogEvent(FORMAT(L"Cannot save part map \"%s\"", (MapName)));
+    Terminal->Log->AddException(&E);
+  }
+}
+//---------------------------------------------------------------------------
+void TParallelOperation::FinishParallelFile(TTerminal * Terminal)
+{
+  UnicodeString PartialName = GetParallelFilePartialName();
+  UnicodeString TargetName = GetParallelFileTargetName();
+
+  if (FSide == osLocal)
+  {
+    std::unique_ptr<TRemoteFile> File(Terminal->ReadFile(PartialName));
+    if (File->Size != FParallelFileSize)
+    {
+      UnicodeString Message =
+        FMTLOAD(INCONSISTENT_SIZE, (FParallelFileTargetName + PartialExt, IntToStr(File->Size), IntToStr(FParallelFileSize)));
+      Terminal->TerminalError(NULL, Message);
+    }
+
+    if (FCopyParam->PreserveTime || FCopyParam->PreserveRights)
+    {
+      UnicodeString SourceName;
+      TObject * Object;
+      DebugAlwaysTrue(GetOnlyFile(FFileList.get(), SourceName, Object));
+      TRemoteProperties Properties;
+      int Attrs;
+      Terminal->OpenLocalFile(
+        SourceName, GENERIC_READ, &Attrs, NULL, NULL, &Properties.Modification, &Properties.LastAccess, NULL);
+      if (FCopyParam->PreserveTime)
+      {
+        Properties.Valid << vpModification;
+      }
+      if (FCopyParam->PreserveRights)
+      {
+        Properties.Valid << vpRights;
+        Properties.Rights = FCopyParam->RemoteFileRights(Attrs);
+      }
+      Terminal->DoChangeFileProperties(PartialName, File.get(), &Properties);
+    }
+
+    std::unique_ptr<TRemoteFile> TargetFile(Terminal->TryReadFile(TargetName));
+    if (TargetFile.get() != NULL)
+    {
+      Terminal->DoDeleteFile(Terminal->FFileSystem, TargetName, TargetFile.get(), 0);
+    }
+
+    Terminal->LogEvent(FORMAT(L"Renaming completed \"%s\" to \"%s\"...", (UnixExtractFileName(PartialName), FParallelFileTargetName)));
+    Terminal->DoRenameFile(PartialName, File.get(), TargetName, false, true);
+  }
+  else
+  {
+    HANDLE Handle;
+    Terminal->OpenLocalFile(PartialName, GENERIC_WRITE, NULL, &Handle, NULL, NULL, NULL, NULL);
+    try
+    {
+      // The file is complete, it does not need to stay sparse
+      FILE_SET_SPARSE_BUFFER SparseBuffer;
+      SparseBuffer.SetSparse = FALSE;
+      DWORD Returned;
+      DeviceIoControl(Handle, FSCTL_SET_SPARSE, &SparseBuffer, sizeof(SparseBuffer), NULL, 0, &Returned, NULL);
+
+      if (FCopyParam->PreserveTime)
+      {
+        Terminal->UpdateTargetTime(
+          Handle, FParallelFile->Modification, FParallelFile->ModificationFmt, Terminal->SessionData->DSTMode);
+      }
+    }
+    __finally
+    {
+      CloseHandle(Handle);
+    }
+
+    Terminal->LogEvent(FORMAT(L"Renaming completed \"%s\" to \"%s\"...", (ExtractFileName(PartialName), FParallelFileTargetName)));
+    Terminal->DoRenameLocalFileForce(PartialName, TargetName);
+    Terminal->UpdateTargetAttrs(TargetName, FParallelFile, FCopyParam, -1);
+    UnicodeString MapName = GetParallelFileMapName();
+    if (FileExists(ApiPath(MapName)))
+    {
+      Terminal->DoDeleteLocalFile(MapName);
+    }
+  }
 }
 //---------------------------------------------------------------------------
 int TParallelOperation::GetNext(
@@ -1112,36 +1390,41 @@ int TParallelOperation::GetNext(
       bool Processed = true;
       if (IsParallelFileTransfer)
       {
-        CustomCopyParam = new TCopyParamType(*FCopyParam);
-        CustomCopyParam->PartOffset = FParallelFileOffset;
-        __int64 Remaining = FParallelFileSize - CustomCopyParam->PartOffset;
-        CustomCopyParam->PartSize = FParallelFileSize / Configuration->QueueTransfersLimit;
         DebugAssert(!OnlyFileName.IsEmpty());
-        if (FParallelFileTargetName.IsEmpty())
+        DebugAssert(FParallelFileTargetName == OnlyFileName);
+        // InitParallelFile makes sure there's at least one segment to transfer
+        TParallelFileSegments::iterator Segment = FParallelFileSegments.begin();
+        while ((Segment != FParallelFileSegments.end()) && (Segment->Started || Segment->Done))
         {
-          FParallelFileTargetName = OnlyFileName;
+          ++Segment;
         }
-        DebugAssert(FParallelFileTargetName == OnlyFileName);
-        int Index = FParallelFileCount;
-        UnicodeString PartFileName = GetPartPrefix(OnlyFileName) + IntToStr(Index);
-        FParallelFileCount++;
-        FParallelFileOffsets.push_back(CustomCopyParam->PartOffset);
-        FParallelFileDones.push_back(false);
-        DebugAssert(FParallelFileOffsets.size() == static_cast<size_t>(FParallelFileCount));
-        CustomCopyParam->FileMask = DelimitFileNameMask(PartFileName);
-        if ((CustomCopyParam->PartSize >= Remaining) ||
-            (Remaining - CustomCopyParam->PartSize < CustomCopyParam->PartSize / 10))
+        if (DebugAlwaysFalse(Segment == FParallelFileSegments.end()))
+        {
+          throw EInvalidOperation(L"No file part to transfer");
+        }
+
+        int Index = Segment - FParallelFileSegments.begin();
+        Segment->Started = true;
+        CustomCopyParam = new TCopyParamType(*FCopyParam);
+        CustomCopyParam->PartOffset = Segment->Offset;
+        // All segments are written directly to their place in the partial file
+        CustomCopyParam->FileMask = DelimitFileNameMask(OnlyFileName + PartialExt);
+        if (Segment->Offset + Segment->Size >= FParallelFileSize)
         {
           CustomCopyParam->PartSize = -1; // Until the end
-          FParallelFileOffset = FParallelFileSize;
           Terminal->LogEvent(FORMAT(L"Starting transfer of \"%s\" part %d from %s until the EOF", (OnlyFileName, Index, IntToStr(CustomCopyParam->PartOffset))));
         }
         else
         {
-          Processed = false;
-          FParallelFileOffset += CustomCopyParam->PartSize;
+          CustomCopyParam->PartSize = Segment->Size;
           Terminal->LogEvent(FORMAT(L"Starting transfer of \"%s\" part %d from %s, length %s", (OnlyFileName, Index, IntToStr(CustomCopyParam->PartOffset), IntToStr(CustomCopyParam->PartSize))));
         }
+
+        while ((Segment != FParallelFileSegments.end()) && (Segment->Started || Segment->Done))
+        {
+          ++Segment;
+        }
+        Processed = (Segment == FParallelFileSegments.end());
       }
 
       if (Processed)
@@ -1253,6 +1536,7 @@ __fastcall TTerminal::TTerminal(TSessionData * SessionData, TConfiguration * Con
   FReadingCurrentDirectory = false;
   FStatus = ssClosed;
   FOpening = 0;
+  FProcessingDirectory = 0;
   FTunnelThread = NULL;
   FTunnel = NULL;
   FTunnelData = NULL;
@@ -1263,6 +1547,9 @@ __fastcall TTerminal::TTerminal(TSessionData * SessionData, TConfiguration * Con
   FNesting = 0;
   FRememberedPasswordKind = TPromptKind(-1);
   FSecondaryTerminals = 0;
+  // Session level of the speed limits, under the global one
+  FBandwidthLimiter = new TBandwidthLimiter(Configuration->BandwidthLimiter);
+  FBandwidthLimiter->SetLimit(FSessionData->CPSLimit);
 }
 //---------------------------------------------------------------------------
 __fastcall TTerminal::~TTerminal()
@@ -1301,6 +1588,7 @@ __fastcall TTerminal::~TTerminal()
   delete FFiles;
   delete FDirectoryCache;
   delete FDirectoryChangesCache;
+  SAFE_DESTROY(FBandwidthLimiter);
   SAFE_DESTROY(FSessionData);
 }
 //---------------------------------------------------------------------------
@@ -1343,6 +1631,27 @@ void __fastcall TTerminal::Idle()
   }
 }
 //---------------------------------------------------------------------
+void __fastcall TTerminal::IdleWait(unsigned int MSec)
+{
+  // Keep servicing the connection while waiting, in case other sessions share it
+  if (Active && (FNesting == 0))
+  {
+    TAutoNestingCounter NestingCounter(FNesting);
+    DWORD Start = GetTickCount();
+    DWORD Elapsed = 0;
+    do
+    {
+      FFileSystem->IdleWait(MSec - Elapsed);
+      Elapsed = GetTickCount() - Start;
+    }
+    while (Elapsed < MSec);
+  }
+  else
+  {
+    Sleep(MSec);
+  }
+}
+//---------------------------------------------------------------------
 RawByteString __fastcall TTerminal::EncryptPassword(const UnicodeString & Password)
 {
   return Configuration->EncryptPassword(Password, SessionData->GetSessionPasswordEncryptionKey());
@@ -3648,6 +3957,13 @@ void __fastcall TTerminal::LogFileDetails(const UnicodeString & FileName, TDateT
 void __fastcall TTerminal::LogFileDone(
   TFileOperationProgressType * OperationProgress, const UnicodeString & DestFileName,
   TTransferSessionAction & Action)
+{
+  LogFileDone(OperationProgress->FullFileName, DestFileName, OperationProgress->TransferredSize, Action);
+}
+//---------------------------------------------------------------------------
+void __fastcall TTerminal::LogFileDone(
+  const UnicodeString & SourceFileName, const UnicodeString & DestFileName, __int64 Size,
+  TTransferSessionAction & Action)
 {
   if (FDestFileName.IsEmpty())
   {
@@ -3658,11 +3974,10 @@ void __fastcall TTerminal::LogFileDone(
     FMultipleDestinationFiles = true;
   }
 
-  __int64 Size = OperationProgress->TransferredSize;
   // optimization
   if (Log->Logging)
   {
-    LogEvent(FORMAT("Transfer done: '%s' => '%s' [%s]", (OperationProgress->FullFileName, DestFileName, IntToStr(Size))));
+    LogEvent(FORMAT("Transfer done: '%s' => '%s' [%s]", (SourceFileName, DestFileName, IntToStr(Size))));
   }
 
   Action.Size(Size);
@@ -3896,8 +4211,13 @@ void __fastcall TTerminal::ProcessDirectory(const UnicodeString DirName,
   // skip if directory listing fails and user selects "skip"
   if (FileList)
   {
+    FProcessingDirectory++;
     try
     {
+      // Let the file system list the subdirectories in advance,
+      // while we process the files of this one
+      FFileSystem->ReadAheadDirectories(FileList, UseCache);
+
       UnicodeString Directory = UnixIncludeTrailingBackslash(DirName);
 
       TRemoteFile * File;
@@ -3915,6 +4235,10 @@ void __fastcall TTerminal::ProcessDirectory(const UnicodeString DirName,
     __finally
     {
       delete FileList;
+      FProcessingDirectory--;
+      // Nothing below this directory will be needed anymore,
+      // and nothing at all, once the outermost directory is done
+      FFileSystem->ReadAheadDone((FProcessingDirectory > 0) ? DirName : EmptyStr);
     }
   }
 }
@@ -4030,10 +4354,17 @@ void __fastcall TTerminal::OperationStart(
     Progress.Restore(*FOperationProgressPersistence);
   }
   Progress.Start(Operation, Side, Count, Temp, Directory, CPSLimit, OnceDoneOperation);
+  Progress.SetBandwidthLimiterParent(GetBandwidthLimiter());
   DebugAssert(FOperationProgress == NULL);
   FOperationProgress = &Progress;
 }
 //---------------------------------------------------------------------------
+TBandwidthLimiter * TTerminal::GetBandwidthLimiter()
+{
+  // All sessions opened for the same session (secondary, background queue) share its limit
+  return GetPrimaryTerminal()->FBandwidthLimiter;
+}
+//---------------------------------------------------------------------------
 void __fastcall TTerminal::OperationStop(TFileOperationProgressType & Progress)
 {
   DebugAssert(FOperationProgress == &Progress);
@@ -5684,6 +6015,50 @@ void __fastcall TTerminal::OpenLocalFile(
   Handle.Directory = FLAGSET(Handle.Attrs, faDirectory);
 }
 //---------------------------------------------------------------------------
+void __fastcall TTerminal::OpenLocalFileSegment(const UnicodeString & FileName, __int64 Offset, HANDLE * AHandle)
+{
+  FILE_OPERATION_LOOP_BEGIN
+  {
+    // Other connections write their segments of the same file at the same time
+    HANDLE Handle =
+      CreateFile(ApiPath(FileName).c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (Handle == INVALID_HANDLE_VALUE)
+    {
+      RaiseLastOSError();
+    }
+    if (FileSeek((THandle)Handle, Offset, soBeginning) < 0)
+    {
+      int Error = GetLastError();
+      CloseHandle(Handle);
+      RaiseLastOSError(Error);
+    }
+    *AHandle = Handle;
+  }
+  FILE_OPERATION_LOOP_END(FMTLOAD(WRITE_ERROR, (FileName)));
+}
+//---------------------------------------------------------------------------
+void __fastcall TTerminal::PreallocateLocalFile(const UnicodeString & FileName, HANDLE Handle, __int64 Size)
+{
+  // With a sparse file, NTFS does not have to zero-fill the space before a segment,
+  // that gets written before the preceding segments
+  DWORD Returned;
+  if (!DeviceIoControl(Handle, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &Returned, NULL))
+  {
+    LogEvent(FORMAT(L"Cannot make file \"%s\" sparse: %s", (FileName, SysErrorMessageForError(GetLastError()))));
+  }
+
+  FILE_OPERATION_LOOP_BEGIN
+  {
+    if ((FileSeek((THandle)Handle, Size, soBeginning) < 0) ||
+        !SetEndOfFile(Handle))
+    {
+      RaiseLastOSError();
+    }
+  }
+  FILE_OPERATION_LOOP_END(FMTLOAD(WRITE_ERROR, (FileName)));
+}
+//---------------------------------------------------------------------------
 bool __fastcall TTerminal::DoAllowLocalFileTransfer(
   const UnicodeString & FileName, const TSearchRecSmart & SearchRec, const TCopyParamType * CopyParam, bool DisallowTemporaryTransferFiles)
 {
@@ -5922,6 +6297,17 @@ struct TSynchronizeFileData
   FILETIME LocalLastWriteTime;
 };
 //---------------------------------------------------------------------------
+struct TSynchronizeChecksumFile
+{
+  UnicodeString FileName;
+  TRemoteFile * File;
+  UnicodeString LocalFileName;
+  UnicodeString LocalChecksum;
+  bool LocalChecksumCalculated;
+  bool Same;
+};
+typedef std::vector<TSynchronizeChecksumFile> TSynchronizeChecksumFiles;
+//---------------------------------------------------------------------------
 const int sfFirstLevel = 0x01;
 struct TSynchronizeData
 {
@@ -5935,6 +6321,10 @@ struct TSynchronizeData
   TStringList * LocalFileList;
   const TCopyParamType * CopyParam;
   TSynchronizeChecklist * Checklist;
+  // Files to compare by checksum, collected while walking the remote directory
+  TSynchronizeChecksumFiles * ChecksumFiles;
+  // The compared file, when collecting it again with the checksums known
+  const TSynchronizeChecksumFile * ChecksumFile;
 };
 //---------------------------------------------------------------------------
 TSynchronizeChecklist * __fastcall TTerminal::SynchronizeCollect(const UnicodeString LocalDirectory,
@@ -6101,6 +6491,9 @@ void __fastcall TTerminal::DoSynchronizeCollectDirectory(const UnicodeString Loc
   Data.Options = Options;
   Data.Flags = Flags;
   Data.Checklist = Checklist;
+  TSynchronizeChecksumFiles ChecksumFiles;
+  Data.ChecksumFiles = &ChecksumFiles;
+  Data.ChecksumFile = NULL;
 
   LogEvent(FORMAT(L"Collecting synchronization list for local directory '%s' and remote directory '%s', "
     "mode = %s, params = 0x%x (%s), file mask = '%s'", (LocalDirectory, RemoteDirectory,
@@ -6169,6 +6562,8 @@ void __fastcall TTerminal::DoSynchronizeCollectDirectory(const UnicodeString Loc
       ProcessDirectory(RemoteDirectory, SynchronizeCollectFile, &Data,
         FLAGSET(Params, spUseCache));
 
+      SynchronizeCollectChecksums(&Data);
+
       TSynchronizeFileData * FileData;
       for (int Index = 0; Index < Data.LocalFileList->Count; Index++)
       {
@@ -6262,6 +6657,11 @@ void __fastcall TTerminal::DoSynchronizeCollectDirectory(const UnicodeString Loc
       }
       delete Data.LocalFileList;
     }
+
+    for (size_t Index = 0; Index < ChecksumFiles.size(); Index++)
+    {
+      delete ChecksumFiles[Index].File;
+    }
   }
 }
 //---------------------------------------------------------------------------
@@ -6301,13 +6701,12 @@ bool __fastcall TTerminal::IsEmptyRemoteDirectory(
 }
 //---------------------------------------------------------------------------
 void __fastcall TTerminal::CollectCalculatedChecksum(
-  const UnicodeString & DebugUsedArg(FileName), const UnicodeString & DebugUsedArg(Alg), const UnicodeString & Hash)
+  const UnicodeString & FileName, const UnicodeString & DebugUsedArg(Alg), const UnicodeString & Hash)
 {
-  DebugAssert(FCollectedCalculatedChecksum.IsEmpty());
-  FCollectedCalculatedChecksum = Hash;
+  FCollectedCalculatedChecksums[FileName] = Hash;
 }
 //---------------------------------------------------------------------------
-bool TTerminal::SameFileChecksum(const UnicodeString & LocalFileName, const TRemoteFile * File)
+UnicodeString TTerminal::GetSynchronizationChecksumAlg()
 {
   UnicodeString DefaultAlg = Sha256ChecksumAlg;
   UnicodeString Algs =
@@ -6329,24 +6728,231 @@ bool TTerminal::SameFileChecksum(const UnicodeString & LocalFileName, const TRem
   {
     Alg = DefaultAlg;
   }
+  return Alg;
+}
+//---------------------------------------------------------------------------
+void TTerminal::CollectRemoteChecksums(const UnicodeString & Alg, TStrings * FileList)
+{
+  // As CalculateFilesChecksum, but the whole list is a single operation,
+  // so that it is cancelled at once
+  TFileOperationProgressType Progress(&DoProgress, &DoFinished);
+  OperationStart(Progress, foCalculateChecksum, osRemote, FileList->Count);
 
-  std::unique_ptr<TStrings> FileList(new TStringList());
-  FileList->AddObject(File->FullFileName, File);
-  DebugAssert(FCollectedCalculatedChecksum.IsEmpty());
-  FCollectedCalculatedChecksum = EmptyStr;
-  CalculateFilesChecksum(Alg, FileList.get(), CollectCalculatedChecksum);
-  UnicodeString RemoteChecksum = FCollectedCalculatedChecksum;
-  FCollectedCalculatedChecksum = EmptyStr;
+  try
+  {
+    TCustomFileSystem * FileSystem = GetFileSystemForCapability(fcCalculatingChecksum);
 
-  UnicodeString LocalChecksum;
-  FILE_OPERATION_LOOP_BEGIN
+    UnicodeString NormalizedAlg = FileSystem->CalculateFilesChecksumInitialize(Alg);
+
+    // The file systems stop at the first file that fails (after reporting the error),
+    // so continue with the files after it
+    int Index = 0;
+    while ((Index < FileList->Count) && (Progress.Cancel == csContinue))
+    {
+      std::unique_ptr<TStrings> BatchFileList(new TStringList());
+      for (int BatchIndex = Index; BatchIndex < FileList->Count; BatchIndex++)
+      {
+        BatchFileList->AddObject(FileList->Strings[BatchIndex], FileList->Objects[BatchIndex]);
+      }
+      FileSystem->CalculateFilesChecksum(NormalizedAlg, BatchFileList.get(), CollectCalculatedChecksum, &Progress, true);
+
+      while ((Index < FileList->Count) &&
+             (FCollectedCalculatedChecksums.find(static_cast<TRemoteFile *>(FileList->Objects[Index])->FileName) !=
+                FCollectedCalculatedChecksums.end()))
+      {
+        Index++;
+      }
+      // Skip the failed file
+      Index++;
+    }
+  }
+  __finally
+  {
+    OperationStop(Progress);
+  }
+}
+//---------------------------------------------------------------------------
+struct TLocalChecksumQueue
+{
+  UnicodeString Alg;
+  TSynchronizeChecksumFiles * Files;
+  size_t Next;
+  std::unique_ptr<TCriticalSection> Section;
+};
+//---------------------------------------------------------------------------
+class TLocalChecksumThread : public TSimpleThread
+{
+public:
+  __fastcall TLocalChecksumThread(TLocalChecksumQueue & Queue);
+  virtual __fastcall ~TLocalChecksumThread();
+
+  virtual void __fastcall Terminate();
+
+protected:
+  virtual void __fastcall Execute();
+
+private:
+  TLocalChecksumQueue & FQueue;
+  bool FTerminated;
+};
+//---------------------------------------------------------------------------
+__fastcall TLocalChecksumThread::TLocalChecksumThread(TLocalChecksumQueue & Queue) :
+  FQueue(Queue),
+  FTerminated(false)
+{
+  Start();
+}
+//---------------------------------------------------------------------------
+__fastcall TLocalChecksumThread::~TLocalChecksumThread()
+{
+  // close before the class's virtual functions (Terminate particularly) are lost
+  Close();
+}
+//---------------------------------------------------------------------------
+void __fastcall TLocalChecksumThread::Terminate()
+{
+  FTerminated = true;
+}
+//---------------------------------------------------------------------------
+void __fastcall TLocalChecksumThread::Execute()
+{
+  while (!FTerminated)
   {
-    std::unique_ptr<THandleStream> Stream(TSafeHandleStream::CreateFromFile(LocalFileName, fmOpenRead | fmShareDenyWrite));
-    LocalChecksum = CalculateFileChecksum(Stream.get(), Alg);
+    TSynchronizeChecksumFile * ChecksumFile = NULL;
+    {
+      TGuard Guard(FQueue.Section.get());
+      if (FQueue.Next < FQueue.Files->size())
+      {
+        ChecksumFile = &(*FQueue.Files)[FQueue.Next];
+        FQueue.Next++;
+      }
+    }
+
+    if (ChecksumFile == NULL)
+    {
+      break;
+    }
+
+    try
+    {
+      std::unique_ptr<THandleStream> Stream(
+        TSafeHandleStream::CreateFromFile(ChecksumFile->LocalFileName, fmOpenRead | fmShareDenyWrite));
+      ChecksumFile->LocalChecksum = CalculateFileChecksum(Stream.get(), FQueue.Alg);
+      ChecksumFile->LocalChecksumCalculated = true;
+    }
+    catch (...)
+    {
+      // Retried by SynchronizeCollectChecksums, which can report the error
+    }
   }
-  FILE_OPERATION_LOOP_END(FMTLOAD(CHECKSUM_ERROR, (LocalFileName)));
+}
+//---------------------------------------------------------------------------
+void __fastcall TTerminal::SynchronizeCollectChecksums(TSynchronizeData * Data)
+{
+  TSynchronizeChecksumFiles & ChecksumFiles = *Data->ChecksumFiles;
+  if (!ChecksumFiles.empty())
+  {
+    UnicodeString Alg = GetSynchronizationChecksumAlg();
+    LogEvent(FORMAT(L"Comparing %d files by %s checksum.", (static_cast<int>(ChecksumFiles.size()), Alg)));
+
+    // The local files are hashed by worker threads, while the remote checksums are being calculated
+    TLocalChecksumQueue Queue;
+    Queue.Alg = Alg;
+    Queue.Files = &ChecksumFiles;
+    Queue.Next = 0;
+    Queue.Section.reset(new TCriticalSection());
+
+    SYSTEM_INFO SystemInfo;
+    GetSystemInfo(&SystemInfo);
+    const int MaxLocalChecksumThreads = 8;
+    int ThreadCount =
+      std::max(1, std::min(std::min(static_cast<int>(SystemInfo.dwNumberOfProcessors), MaxLocalChecksumThreads), static_cast<int>(ChecksumFiles.size())));
+
+    std::vector<TLocalChecksumThread *> Threads;
+    bool Done = false;
+    FCollectedCalculatedChecksums.clear();
+    try
+    {
+      for (int Index = 0; Index < ThreadCount; Index++)
+      {
+        Threads.push_back(new TLocalChecksumThread(Queue));
+      }
+
+      std::unique_ptr<TStrings> FileList(new TStringList());
+      for (size_t Index = 0; Index < ChecksumFiles.size(); Index++)
+      {
+        TRemoteFile * File = ChecksumFiles[Index].File;
+        FileList->AddObject(File->FullFileName, File);
+      }
+      CollectRemoteChecksums(Alg, FileList.get());
+      Done = true;
+    }
+    __finally
+    {
+      // When aborting, let the threads finish only the files they are hashing already
+      for (size_t Index = 0; Index < Threads.size(); Index++)
+      {
+        if (!Done)
+        {
+          Threads[Index]->Terminate();
+        }
+      }
+      for (size_t Index = 0; Index < Threads.size(); Index++)
+      {
+        Threads[Index]->WaitFor();
+        delete Threads[Index];
+      }
+    }
+
+    TCalculatedChecksums RemoteChecksums;
+    RemoteChecksums.swap(FCollectedCalculatedChecksums);
+
+    for (size_t Index = 0; Index < ChecksumFiles.size(); Index++)
+    {
+      TSynchronizeChecksumFile & ChecksumFile = ChecksumFiles[Index];
+      bool Compared = false;
+      try
+      {
+        if (!ChecksumFile.LocalChecksumCalculated)
+        {
+          UnicodeString LocalFileName = ChecksumFile.LocalFileName;
+          FILE_OPERATION_LOOP_BEGIN
+          {
+            std::unique_ptr<THandleStream> Stream(TSafeHandleStream::CreateFromFile(LocalFileName, fmOpenRead | fmShareDenyWrite));
+            ChecksumFile.LocalChecksum = CalculateFileChecksum(Stream.get(), Alg);
+          }
+          FILE_OPERATION_LOOP_END(FMTLOAD(CHECKSUM_ERROR, (LocalFileName)));
+        }
+
+        TCalculatedChecksums::const_iterator I = RemoteChecksums.find(ChecksumFile.File->FileName);
+        UnicodeString RemoteChecksum = (I != RemoteChecksums.end()) ? I->second : EmptyStr;
+        ChecksumFile.Same = SameText(RemoteChecksum, ChecksumFile.LocalChecksum);
+        Compared = true;
+      }
+      catch (ESkipFile & E)
+      {
+        TSuspendFileOperationProgress Suspend(OperationProgress);
+        if (!HandleException(&E))
+        {
+          throw;
+        }
+      }
 
-  return SameText(RemoteChecksum, LocalChecksum);
+      // A skipped file is left out of the synchronization
+      if (Compared)
+      {
+        Data->ChecksumFile = &ChecksumFile;
+        try
+        {
+          SynchronizeCollectFile(ChecksumFile.FileName, ChecksumFile.File, Data);
+        }
+        __finally
+        {
+          Data->ChecksumFile = NULL;
+        }
+      }
+    }
+  }
 }
 //---------------------------------------------------------------------------
 void __fastcall TTerminal::DoSynchronizeCollectFile(const UnicodeString FileName,
@@ -6355,7 +6961,7 @@ void __fastcall TTerminal::DoSynchronizeCollectFile(const UnicodeString FileName
   TSynchronizeData * Data = static_cast<TSynchronizeData *>(Param);
 
   // Can be NULL in scripting
-  if (Data->Options != NULL)
+  if ((Data->Options != NULL) && (Data->ChecksumFile == NULL))
   {
     Data->Options->Files++;
   }
@@ -6458,12 +7064,26 @@ void __fastcall TTerminal::DoSynchronizeCollectFile(const UnicodeString FileName
               LocalModified = true;
             }
             else if (FLAGSET(Data->Params, spByChecksum) &&
-                     FLAGCLEAR(Data->Params, spTimestamp) &&
-                     !SameFileChecksum(FullLocalFileName, File) &&
                      FLAGCLEAR(Data->Params, spTimestamp))
             {
-              Modified = true;
-              LocalModified = true;
+              if (Data->ChecksumFile != NULL)
+              {
+                Modified = !Data->ChecksumFile->Same;
+                LocalModified = Modified;
+              }
+              else
+              {
+                // The checksums of all files in the directory are calculated at once in SynchronizeCollectChecksums,
+                // which then collects the file again
+                TSynchronizeChecksumFile ChecksumFile;
+                ChecksumFile.FileName = FileName;
+                ChecksumFile.File = NULL;
+                ChecksumFile.LocalFileName = FullLocalFileName;
+                ChecksumFile.LocalChecksumCalculated = false;
+                ChecksumFile.Same = false;
+                Data->ChecksumFiles->push_back(ChecksumFile);
+                Data->ChecksumFiles->back().File = File->Duplicate();
+              }
             }
 
             if (LocalModified)
@@ -7248,6 +7868,11 @@ void __fastcall TTerminal::CopyParallel(TParallelOperation * ParallelOperation,
 {
   try
   {
+    if (ParallelOperation->IsParallelFileTransfer)
+    {
+      ParallelOperation->InitParallelFile(this);
+    }
+
     bool Continue = true;
     do
     {
@@ -7258,7 +7883,7 @@ void __fastcall TTerminal::CopyParallel(TParallelOperation * ParallelOperation,
       }
       else if (GotNext == 0)
       {
-        Sleep(100);
+        IdleWait(100);
       }
     }
     while (Continue && !OperationProgress->Cancel);
@@ -7266,7 +7891,7 @@ void __fastcall TTerminal::CopyParallel(TParallelOperation * ParallelOperation,
   __finally
   {
     OperationProgress->SetDone();
-    ParallelOperation->WaitFor();
+    ParallelOperation->WaitFor(this);
   }
 }
 //---------------------------------------------------------------------------
@@ -7384,9 +8009,23 @@ bool __fastcall TTerminal::CopyToRemote(
 
         if (Parallel)
         {
-          // OnceDoneOperation is not supported
-          ParallelOperation->Init(Files.release(), TargetDir, CopyParam, Params, &OperationProgress, Log->Name, -1);
-          CopyParallel(ParallelOperation, &OperationProgress);
+          UnicodeString ParallelFileName;
+          __int64 ParallelFileSize = -1;
+          CheckParallelFileTransfer(TargetDir, Files.get(), CopyParam, Params, ParallelFileName, ParallelFileSize, &OperationProgress);
+
+          if (OperationProgress.Cancel == csContinue)
+          {
+            if (ParallelFileSize >= 0)
+            {
+              DebugAssert(ParallelFileSize == Size);
+              Params |= cpNoConfirmation;
+            }
+
+            // OnceDoneOperation is not supported
+            ParallelOperation->Init(
+              Files.release(), TargetDir, CopyParam, Params, &OperationProgress, Log->Name, ParallelFileSize);
+            CopyParallel(ParallelOperation, &OperationProgress);
+          }
         }
         else
         {
@@ -7473,6 +8112,9 @@ void __fastcall TTerminal::DoCopyToRemote(
           }
         }
         SourceRobust(FileName, SearchRec, FullTargetDir, CopyParam, Params, OperationProgress, Flags | tfFirstLevel);
+        // Collect results of uploads, that the file system may have completed asynchronously,
+        // so that they are accounted to this file/directory
+        FFileSystem->TransferFinished(OperationProgress);
         Success = true;
       }
       catch (ESkipFile & E)
@@ -7718,6 +8360,23 @@ void TTerminal::DoRenameLocalFileForce(const UnicodeString & OldName, const Unic
   FILE_OPERATION_LOOP_END(FMTLOAD(RENAME_FILE_ERROR, (OldName, NewName)));
 }
 //---------------------------------------------------------------------------
+void TTerminal::DiscardParallelPartialFile(const UnicodeString & DestFullName)
+{
+  // The partial file of an interrupted parallel download is preallocated to the full size
+  // and has gaps, it can be resumed only by a parallel download, using its map.
+  UnicodeString MapName = DestFullName + PartialMapExt;
+  if (::FileExists(ApiPath(MapName)))
+  {
+    LogEvent(L"Partially transferred file was left by a parallel transfer, cannot resume it.");
+    UnicodeString PartialName = DestFullName + PartialExt;
+    if (::FileExists(ApiPath(PartialName)))
+    {
+      DoDeleteLocalFile(PartialName);
+    }
+    DoDeleteLocalFile(MapName);
+  }
+}
+//---------------------------------------------------------------------------
 void __fastcall TTerminal::UpdateSource(const TLocalFileHandle & Handle, const TCopyParamType * CopyParam, int Params)
 {
   // TODO: Delete also read-only files.
@@ -7791,7 +8450,8 @@ void __fastcall TTerminal::Source(
     {
       LogEvent(FORMAT(L"Copying \"%s\" to remote directory started.", (FileName)));
 
-      OperationProgress->SetLocalSize(Handle.Size);
+      __int64 LocalSize = (CopyParam->PartSize >= 0) ? CopyParam->PartSize : (Handle.Size - std::max(0LL, CopyParam->PartOffset));
+      OperationProgress->SetLocalSize(LocalSize);
 
       // Suppose same data size to transfer as to read
       // (not true with ASCII transfer)
@@ -7806,8 +8466,30 @@ void __fastcall TTerminal::Source(
     FFileSystem->Source(
       Handle, TargetDir, DestFileName, CopyParam, Params, OperationProgress, Flags, Action, ChildError);
 
-    LogFileDone(OperationProgress, AbsolutePath(TargetDir + DestFileName, true), Action);
-    OperationProgress->Succeeded();
+    UnicodeString DestFullName = AbsolutePath(TargetDir + DestFileName, true);
+    // The file system may still have to confirm the upload, the success is recorded only then
+    if (FFileSystem->IsSourcePending())
+    {
+      std::unique_ptr<TPendingSource> Pending(new TPendingSource());
+      Pending->FileName = FileName;
+      Pending->TargetDir = TargetDir;
+      Pending->DestFullName = DestFullName;
+      Pending->CopyParam = CopyParam;
+      Pending->Params = Params;
+      Pending->Flags = Flags;
+      Pending->TransferredSize = OperationProgress->TransferredSize;
+      Pending->SkippedSize = OperationProgress->SkippedSize;
+      Pending->Action.reset(new TUploadSessionAction(ActionLog));
+      Pending->Action->FileName(ActionFileName);
+      Pending->Action->Destination(DestFullName);
+      Action.Cancel();
+      FFileSystem->DeferSourceDone(Pending.release());
+    }
+    else
+    {
+      LogFileDone(OperationProgress, DestFullName, Action);
+      OperationProgress->Succeeded();
+    }
   }
 
   Handle.Release();
@@ -7815,47 +8497,151 @@ void __fastcall TTerminal::Source(
   UpdateSource(Handle, CopyParam, Params);
 }
 //---------------------------------------------------------------------------
+void __fastcall TTerminal::PendingSourceDone(TPendingSource * Pending, TFileOperationProgressType * OperationProgress)
+{
+  LogFileDone(Pending->FileName, Pending->DestFullName, Pending->TransferredSize, *Pending->Action);
+  Pending->Action.reset(NULL);
+  OperationProgress->Succeeded(Pending->TransferredSize - Pending->SkippedSize, 1);
+}
+//---------------------------------------------------------------------------
+void __fastcall TTerminal::PendingSourceFailed(
+  TPendingSource * Pending, Exception * E, TFileOperationProgressType * OperationProgress)
+{
+  if (dynamic_cast<ESkipFile *>(E) != NULL)
+  {
+    // The file was skipped after a failure to set its properties, as in SourceRobust and DirectorySource
+    RollbackAction(*Pending->Action, OperationProgress, E);
+    Pending->Action.reset(NULL);
+    TSuspendFileOperationProgress Suspend(OperationProgress);
+    if (!HandleException(E))
+    {
+      RethrowException(E);
+    }
+  }
+  else if (OperationProgress->Cancel != csContinue)
+  {
+    Log->AddException(E);
+    RollbackAction(*Pending->Action, OperationProgress, E);
+    Pending->Action.reset(NULL);
+  }
+  else
+  {
+    // The incomplete file was removed already, upload it again, this time waiting for the outcome,
+    // so that any error is handled, as if the upload was not deferred
+    LogEvent(FORMAT(L"Uploading \"%s\" again.", (Pending->FileName)));
+    Log->AddException(E);
+    Pending->Action->Cancel();
+    Pending->Action.reset(NULL);
+    OperationProgress->RollbackTransferFromTotals(
+      Pending->TransferredSize - Pending->SkippedSize, Pending->SkippedSize);
+    try
+    {
+      SourceRobust(
+        Pending->FileName, NULL, Pending->TargetDir, Pending->CopyParam, Pending->Params | cpNoConfirmation,
+        OperationProgress, Pending->Flags | tfNoPipeline);
+    }
+    catch (ESkipFile & SkipE)
+    {
+      TSuspendFileOperationProgress Suspend(OperationProgress);
+      if (!HandleException(&SkipE))
+      {
+        throw;
+      }
+    }
+  }
+}
+//---------------------------------------------------------------------------
 void TTerminal::CheckParallelFileTransfer(
   const UnicodeString & TargetDir, TStringList * Files, const TCopyParamType * CopyParam, int Params,
   UnicodeString & ParallelFileName, __int64 & ParallelFileSize, TFileOperationProgressType * OperationProgress)
 {
   if ((Configuration->ParallelTransferThreshold > 0) &&
-      FFileSystem->IsCapable(fcParallelFileTransfers))
+      FFileSystem->IsCapable(fcParallelFileTransfers) &&
+      ((OperationProgress->Side == osRemote) || FFileSystem->IsCapable(fcParallelFileUploads)))
   {
+    __int64 Threshold = static_cast<__int64>(Configuration->ParallelTransferThreshold) * 1024;
     TObject * ParallelObject = NULL;
     if (TParallelOperation::GetOnlyFile(Files, ParallelFileName, ParallelObject))
     {
-      TRemoteFile * File = static_cast<TRemoteFile *>(ParallelObject);
-      const TRemoteFile * UltimateFile = File->Resolve();
-      if ((UltimateFile == File) && // not tested with symlinks
-          (UltimateFile->Size >= static_cast<__int64>(Configuration->ParallelTransferThreshold) * 1024))
+      TOperationSide Side = OperationProgress->Side;
+      TFileMasks::TParams MaskParams;
+      __int64 SourceSize = -1;
+      TDateTime SourceTimestamp;
+      TModificationFmt SourcePrecision = mfFull;
+      UnicodeString OnlyFileName;
+      if (Side == osRemote)
+      {
+        TRemoteFile * File = static_cast<TRemoteFile *>(ParallelObject);
+        const TRemoteFile * UltimateFile = File->Resolve();
+        if (UltimateFile == File) // not tested with symlinks
+        {
+          SourceSize = UltimateFile->Size;
+          SourceTimestamp = UltimateFile->Modification;
+          SourcePrecision = UltimateFile->ModificationFmt;
+          MaskParams.Modification = File->Modification;
+        }
+        OnlyFileName = UnixExtractFileName(ParallelFileName);
+      }
+      else
+      {
+        TSearchRecSmart SearchRec;
+        if (!IsEncryptingFiles() && // encryption changes the size
+            FileSearchRec(ParallelFileName, SearchRec) && !SearchRec.IsDirectory())
+        {
+          SourceSize = SearchRec.Size;
+          SourceTimestamp = SearchRec.GetLastWriteTime();
+          MaskParams.Modification = SourceTimestamp;
+        }
+        OnlyFileName = ExtractFileName(ParallelFileName);
+      }
+
+      if (SourceSize >= Threshold)
       {
         UnicodeString BaseFileName = GetBaseFileName(ParallelFileName);
-        TFileMasks::TParams MaskParams;
-        MaskParams.Size = UltimateFile->Size;
-        MaskParams.Modification = File->Modification;
-        if (!UseAsciiTransfer(BaseFileName, osRemote, CopyParam, MaskParams))
+        MaskParams.Size = SourceSize;
+        if (!UseAsciiTransfer(BaseFileName, Side, CopyParam, MaskParams))
         {
-          ParallelFileSize = UltimateFile->Size;
-          UnicodeString TargetFileName = CopyParam->ChangeFileName(UnixExtractFileName(ParallelFileName), osRemote, true);
-          UnicodeString DestFullName = TPath::Combine(TargetDir, TargetFileName);
+          ParallelFileSize = SourceSize;
+          UnicodeString TargetFileName = CopyParam->ChangeFileName(OnlyFileName, Side, true);
+
+          TOverwriteFileParams FileParams;
+          bool Exists;
+          if (Side == osRemote)
+          {
+            UnicodeString DestFullName = TPath::Combine(TargetDir, TargetFileName);
+            Exists = ::FileExists(ApiPath(DestFullName));
+            if (Exists)
+            {
+              __int64 MTime;
+              OpenLocalFile(DestFullName, GENERIC_READ, NULL, NULL, NULL, &MTime, NULL, &FileParams.DestSize, false);
+              FileParams.DestTimestamp = UnixToDateTime(MTime, SessionData->DSTMode);
+            }
+          }
+          else
+          {
+            UnicodeString DestFullName = UnixCombinePaths(TargetDir, TargetFileName);
+            std::unique_ptr<TRemoteFile> DestFile(TryReadFile(DestFullName));
+            Exists = (DestFile.get() != NULL);
+            if (Exists)
+            {
+              FileParams.DestSize = DestFile->Resolve()->Size;
+              FileParams.DestTimestamp = DestFile->Modification;
+              FileParams.DestPrecision = DestFile->ModificationFmt;
+            }
+          }
 
-          if (::FileExists(ApiPath(DestFullName)))
+          if (Exists)
           {
             TSuspendFileOperationProgress Suspend(OperationProgress);
 
-            TOverwriteFileParams FileParams;
-            __int64 MTime;
-            OpenLocalFile(DestFullName, GENERIC_READ, NULL, NULL, NULL, &MTime, NULL, &FileParams.DestSize, false);
             FileParams.SourceSize = ParallelFileSize;
-            FileParams.SourceTimestamp = UltimateFile->Modification;
-            FileParams.SourcePrecision = UltimateFile->ModificationFmt;
-            FileParams.DestTimestamp = UnixToDateTime(MTime, SessionData->DSTMode);
+            FileParams.SourceTimestamp = SourceTimestamp;
+            FileParams.SourcePrecision = SourcePrecision;
             int Answers = qaYes | qaNo | qaCancel;
             TQueryParams QueryParams(qpNeverAskAgainCheck);
             unsigned int Answer =
               ConfirmFileOverwrite(
-                ParallelFileName, TargetFileName, &FileParams, Answers, &QueryParams, osRemote,
+                ParallelFileName, TargetFileName, &FileParams, Answers, &QueryParams, Side,
                 CopyParam, Params, OperationProgress, EmptyStr);
             switch (Answer)
             {
@@ -13,6 +13,7 @@
 //---------------------------------------------------------------------------
 class TCopyParamType;
 class TFileOperationProgressType;
+class TBandwidthLimiter;
 class TCustomFileSystem;
 class TTunnelThread;
 class TSecureShell;
@@ -31,6 +32,7 @@ class TParallelOperation;
 class TCollectedFileList;
 struct TLocalFileHandle;
 struct TNeonCertificateData;
+struct TPendingSource;
 typedef std::vector<__int64> TCalculatedSizes;
 //---------------------------------------------------------------------------
 typedef void __fastcall (__closure *TQueryUserEvent)
@@ -124,6 +126,7 @@ const int tfNewDirectory = 0x02;
 const int tfAutoResume = 0x04;
 const int tfPreCreateDir = 0x08;
 const int tfUseFileTransferAny = 0x10;
+const int tfNoPipeline = 0x20;
 //---------------------------------------------------------------------------
 class TTerminal : public TObject, public TSessionUI
 {
@@ -195,6 +198,7 @@ private:
   bool * FClosedOnCompletion;
   TSessionStatus FStatus;
   int FOpening;
+  int FProcessingDirectory;
   RawByteString FRememberedPassword;
   TPromptKind FRememberedPasswordKind;
   RawByteString FRememberedTunnelPassword;
@@ -218,6 +222,7 @@ private:
   std::unique_ptr<TStrings> FShellChecksumAlgDefs;
   bool FEnableSecureShellUsage;
   bool FCollectFileSystemUsage;
+  TBandwidthLimiter * FBandwidthLimiter;
   bool FRememberedPasswordTried;
   bool FRememberedTunnelPasswordTried;
   int FNesting;
@@ -234,7 +239,8 @@ private:
   RawByteString FEncryptKey;
   TFileOperationProgressType::TPersistence * FOperationProgressPersistence;
   TOnceDoneOperation FOperationProgressOnceDoneOperation;
-  UnicodeString FCollectedCalculatedChecksum;
+  typedef std::map<UnicodeString, UnicodeString> TCalculatedChecksums;
+  TCalculatedChecksums FCollectedCalculatedChecksums;
 
   void __fastcall CommandError(Exception * E, const UnicodeString Msg);
   unsigned int __fastcall CommandError(Exception * E, const UnicodeString Msg,
@@ -323,6 +329,8 @@ protected:
     __int64 * ATime, __int64 * Size, bool TryWriteReadOnly = true);
   void __fastcall OpenLocalFile(
     const UnicodeString & FileName, unsigned int Access, TLocalFileHandle & Handle, bool TryWriteReadOnly = true);
+  void __fastcall OpenLocalFileSegment(const UnicodeString & FileName, __int64 Offset, HANDLE * AHandle);
+  void __fastcall PreallocateLocalFile(const UnicodeString & FileName, HANDLE Handle, __int64 Size);
   bool __fastcall AllowLocalFileTransfer(
     const UnicodeString & FileName, const TSearchRecSmart * SearchRec,
     const TCopyParamType * CopyParam, TFileOperationProgressType * OperationProgress);
@@ -364,7 +372,9 @@ protected:
     const TRemoteFile * File, /*TSynchronizeData*/ void * Param);
   void __fastcall SynchronizeCollectFile(const UnicodeString FileName,
     const TRemoteFile * File, /*TSynchronizeData*/ void * Param);
-  bool SameFileChecksum(const UnicodeString & LocalFileName, const TRemoteFile * File);
+  UnicodeString GetSynchronizationChecksumAlg();
+  void __fastcall SynchronizeCollectChecksums(TSynchronizeData * Data);
+  void CollectRemoteChecksums(const UnicodeString & Alg, TStrings * FileList);
   void __fastcall CollectCalculatedChecksum(
     const UnicodeString & FileName, const UnicodeString & Alg, const UnicodeString & Hash);
   void __fastcall SynchronizeRemoteTimestamp(const UnicodeString FileName,
@@ -441,6 +451,9 @@ protected:
   void __fastcall LogFileDone(
     TFileOperationProgressType * OperationProgress, const UnicodeString & DestFileName,
     TTransferSessionAction & Action);
+  void __fastcall LogFileDone(
+    const UnicodeString & SourceFileName, const UnicodeString & DestFileName, __int64 Size,
+    TTransferSessionAction & Action);
   void __fastcall LogTotalTransferDetails(
     const UnicodeString TargetDir, const TCopyParamType * CopyParam,
     TFileOperationProgressType * OperationProgress, bool Parallel, TStrings * Files);
@@ -480,6 +493,9 @@ protected:
     const UnicodeString & FileName, const TSearchRecSmart * SearchRec,
     const UnicodeString & TargetDir, const TCopyParamType * CopyParam, int Params,
     TFileOperationProgressType * OperationProgress, unsigned int Flags, TUploadSessionAction & Action, bool & ChildError);
+  void __fastcall PendingSourceDone(TPendingSource * Pending, TFileOperationProgressType * OperationProgress);
+  void __fastcall PendingSourceFailed(
+    TPendingSource * Pending, Exception * E, TFileOperationProgressType * OperationProgress);
   void __fastcall DirectorySource(
     const UnicodeString & DirectoryName, const UnicodeString & TargetDir, const UnicodeString & DestDirectoryName,
     int Attrs, const TCopyParamType * CopyParam, int Params,
@@ -493,6 +509,7 @@ protected:
   void __fastcall SelectSourceTransferMode(const TLocalFileHandle & Handle, const TCopyParamType * CopyParam);
   void DoDeleteLocalFile(const UnicodeString & FileName);
   void DoRenameLocalFileForce(const UnicodeString & OldName, const UnicodeString & NewName);
+  void DiscardParallelPartialFile(const UnicodeString & DestFullName);
   void __fastcall UpdateSource(const TLocalFileHandle & Handle, const TCopyParamType * CopyParam, int Params);
   void __fastcall DoCopyToLocal(
     TStrings * FilesToCopy, const UnicodeString & TargetDir, const TCopyParamType * CopyParam, int Params,
@@ -539,6 +556,7 @@ public:
   virtual void __fastcall DirectoryLoaded(TRemoteFileList * FileList);
   void __fastcall ShowExtendedException(Exception * E);
   void __fastcall Idle();
+  void __fastcall IdleWait(unsigned int MSec);
   void __fastcall RecryptPasswords();
   bool __fastcall AllowedAnyCommand(const UnicodeString Command);
   void __fastcall AnyCommand(const UnicodeString Command, TCaptureOutputEvent OutputEvent);
@@ -644,6 +662,7 @@ public:
   UnicodeString UploadPublicKey(const UnicodeString & FileName);
   TCustomFileSystem * GetFileSystemForCapability(TFSCapability Capability, bool NeedCurrentDirectory = false);
   void PrepareCommandSession(bool NeedCurrentDirectory = false);
+  TBandwidthLimiter * GetBandwidthLimiter();
 
   const TSessionInfo & __fastcall GetSessionInfo();
   const TFileSystemInfo & __fastcall GetFileSystemInfo(bool Retrieve = false);
@@ -795,6 +814,23 @@ struct TOverwriteFileParams
   TModificationFmt DestPrecision;
 };
 //---------------------------------------------------------------------------
+// Upload, whose outcome the file system confirms only later, see TCustomFileSystem::DeferSourceDone
+struct TPendingSource
+{
+  TPendingSource();
+  ~TPendingSource();
+
+  UnicodeString FileName;
+  UnicodeString TargetDir;
+  UnicodeString DestFullName;
+  const TCopyParamType * CopyParam;
+  int Params;
+  unsigned int Flags;
+  __int64 TransferredSize;
+  __int64 SkippedSize;
+  std::unique_ptr<TUploadSessionAction> Action;
+};
+//---------------------------------------------------------------------------
 typedef std::vector<TDateTime> TDateTimes;
 //---------------------------------------------------------------------------
 struct TMakeLocalFileListParams
@@ -891,9 +927,10 @@ public:
     TStrings * AFiles, const UnicodeString & TargetDir, const TCopyParamType * CopyParam, int Params,
     TFileOperationProgressType * MainOperationProgress, const UnicodeString & MainName,
     __int64 ParallelFileSize);
+  void InitParallelFile(TTerminal * Terminal);
 
   bool IsInitialized();
-  void WaitFor();
+  void WaitFor(TTerminal * Terminal = NULL);
   bool ShouldAddClient();
   void AddClient();
   void RemoveClient();
@@ -907,7 +944,6 @@ public:
 
   static bool GetOnlyFile(TStrings * FileList, UnicodeString & FileName, TObject *& Object);
   static TCollectedFileList * GetFileList(TStrings * FileList, int Index);
-  static UnicodeString GetPartPrefix(const UnicodeString & FileName);
   __property TOperationSide Side = { read = FSide };
   __property const TCopyParamType * CopyParam = { read = FCopyParam };
   __property int Params = { read = FParams };
@@ -923,6 +959,14 @@ private:
     bool Exists;
   };
 
+  struct TParallelFileSegment
+  {
+    __int64 Offset;
+    __int64 Size;
+    bool Started;
+    bool Done;
+  };
+
   std::unique_ptr<TStrings> FFileList;
   int FListIndex;
   int FIndex;
@@ -940,17 +984,20 @@ private:
   int FVersion;
   bool FIsParallelFileTransfer;
   __int64 FParallelFileSize;
-  __int64 FParallelFileOffset;
-  int FParallelFileCount;
+  const TRemoteFile * FParallelFile;
   UnicodeString FParallelFileTargetName;
-  typedef std::vector<__int64> TParallelFileOffsets;
-  TParallelFileOffsets FParallelFileOffsets;
-  std::vector<bool> FParallelFileDones;
-  bool FParallelFileMerging;
-  int FParallelFileMerged;
+  typedef std::vector<TParallelFileSegment> TParallelFileSegments;
+  // Ordered by offset, covering the whole file
+  TParallelFileSegments FParallelFileSegments;
 
   bool CheckEnd(TCollectedFileList * Files);
   TCollectedFileList * GetFileList(int Index);
+  UnicodeString GetParallelFileTargetName();
+  UnicodeString GetParallelFilePartialName();
+  UnicodeString GetParallelFileMapName();
+  bool LoadParallelFileMap(TTerminal * Terminal, TParallelFileSegments & DoneSegments);
+  void SaveParallelFileMap(TTerminal * Terminal);
+  void FinishParallelFile(TTerminal * Terminal);
 };
 //---------------------------------------------------------------------------
 struct TLocalFileHandle
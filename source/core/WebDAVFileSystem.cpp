@@ -53,6 +53,21 @@ static const int HttpUnauthorized = 401;
 #define PROP_EXECUTABLE "executable"
 #define PROP_OWNER "owner"
 #define PROP_DISPLAY_NAME "displayname"
+#define PROP_LOCK_DISCOVERY "lockdiscovery"
+// What ParsePropResultSet (and the lock discovery) uses.
+// Some servers attach lots of dead properties to files, which we would get with allprop.
+static const ne_propname ListingProps[] =
+{
+  { DAV_PROP_NAMESPACE, PROP_CONTENT_LENGTH },
+  { DAV_PROP_NAMESPACE, PROP_LAST_MODIFIED },
+  { DAV_PROP_NAMESPACE, PROP_RESOURCE_TYPE },
+  { DAV_PROP_NAMESPACE, PROP_HIDDEN },
+  { DAV_PROP_NAMESPACE, PROP_OWNER },
+  { DAV_PROP_NAMESPACE, PROP_DISPLAY_NAME },
+  { DAV_PROP_NAMESPACE, PROP_LOCK_DISCOVERY },
+  { MODDAV_PROP_NAMESPACE, PROP_EXECUTABLE },
+  { NULL, NULL }
+};
 //------------------------------------------------------------------------------
 //---------------------------------------------------------------------------
 // ne_path_escape returns 7-bit string, so it does not really matter if we use
@@ -162,11 +177,17 @@ TWebDAVFileSystem::TWebDAVFileSystem(TTerminal * ATerminal) :
   FNeonLockStoreSection(new TCriticalSection()),
   FUploading(false),
   FDownloading(false),
+  FDownloadResumed(0),
+  FReadAheadListings(new TStringList()),
+  FDeepListingRefused(false),
   FInitialHandshake(false),
   FIgnoreAuthenticationFailure(iafNo)
 {
   FFileSystemInfo.ProtocolBaseName = CONST_WEBDAV_PROTOCOL_BASE_NAME;
   FFileSystemInfo.ProtocolName = FFileSystemInfo.ProtocolBaseName;
+  FReadAheadListings->OwnsObjects = true;
+  FReadAheadListings->CaseSensitive = true;
+  FReadAheadListings->Sorted = true;
 }
 //---------------------------------------------------------------------------
 __fastcall TWebDAVFileSystem::~TWebDAVFileSystem()
@@ -617,6 +638,8 @@ bool __fastcall TWebDAVFileSystem::IsCapable(int Capability) const
     case fcParallelTransfers:
     case fcRemoteCopy:
     case fcMoveOverExistingFile:
+    case fcResumeSupport:
+    case fcParallelFileTransfers:
       return true;
 
     case fcUserGroupListing:
@@ -641,11 +664,11 @@ bool __fastcall TWebDAVFileSystem::IsCapable(int Capability) const
     case fcRemoveCtrlZUpload:
     case fcRemoveBOMUpload:
     case fcPreservingTimestampDirs:
-    case fcResumeSupport:
     case fcChangePassword:
     case fcTransferOut:
     case fcTransferIn:
-    case fcParallelFileTransfers:
+    // The parts cannot be written to their place in a remote file
+    case fcParallelFileUploads:
       return false;
 
     case fcLocking:
@@ -788,6 +811,8 @@ struct TReadFileData
   TWebDAVFileSystem * FileSystem;
   TRemoteFile * File;
   TRemoteFileList * FileList;
+  // All files of a deep listing, as they come
+  TRemoteFileList * Files;
 };
 //---------------------------------------------------------------------------
 int __fastcall TWebDAVFileSystem::ReadDirectoryInternal(
@@ -797,13 +822,14 @@ int __fastcall TWebDAVFileSystem::ReadDirectoryInternal(
   Data.FileSystem = this;
   Data.File = NULL;
   Data.FileList = FileList;
+  Data.Files = NULL;
   ClearNeonError();
   ne_propfind_handler * PropFindHandler = ne_propfind_create(FSessionContext->NeonSession, PathToNeon(Path), NE_DEPTH_ONE);
   void * DiscoveryContext = ne_lock_register_discovery(PropFindHandler);
   int Result;
   try
   {
-    Result = ne_propfind_allprop(PropFindHandler, NeonPropsResult, &Data);
+    Result = ne_propfind_named(PropFindHandler, ListingProps, NeonPropsResult, &Data);
   }
   __finally
   {
@@ -843,6 +869,11 @@ bool __fastcall TWebDAVFileSystem::IsValidRedirect(int NeonStatus, UnicodeString
 //---------------------------------------------------------------------------
 void __fastcall TWebDAVFileSystem::ReadDirectory(TRemoteFileList * FileList)
 {
+  if (TakeReadAheadListing(FileList))
+  {
+    return;
+  }
+
   UnicodeString Path = DirectoryPath(FileList->Directory);
   TOperationVisualizer Visualizer(FTerminal->UseBusyCursor);
 
@@ -854,6 +885,169 @@ void __fastcall TWebDAVFileSystem::ReadDirectory(TRemoteFileList * FileList)
   CheckStatus(NeonStatus);
 }
 //---------------------------------------------------------------------------
+int __fastcall TWebDAVFileSystem::ReadDeepListing(const UnicodeString & Path, TRemoteFileList * Files)
+{
+  TReadFileData Data;
+  Data.FileSystem = this;
+  Data.File = NULL;
+  Data.FileList = NULL;
+  Data.Files = Files;
+  ClearNeonError();
+  ne_propfind_handler * PropFindHandler = ne_propfind_create(FSessionContext->NeonSession, PathToNeon(Path), NE_DEPTH_INFINITE);
+  void * DiscoveryContext = ne_lock_register_discovery(PropFindHandler);
+  int Result;
+  try
+  {
+    Result = ne_propfind_named(PropFindHandler, ListingProps, NeonPropsResult, &Data);
+  }
+  __finally
+  {
+    ne_lock_discovery_free(DiscoveryContext);
+    ne_propfind_destroy(PropFindHandler);
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+UnicodeString __fastcall TWebDAVFileSystem::ReadAheadPath(const UnicodeString & Directory)
+{
+  return UnixExcludeTrailingBackslash(AbsolutePath(Directory, false));
+}
+//---------------------------------------------------------------------------
+void __fastcall TWebDAVFileSystem::ReadAheadDirectories(TRemoteFileList * FileList, bool UseCache)
+{
+  // The walk in TTerminal::ProcessDirectory lists one directory at a time.
+  // If enabled, we list the whole subtree with a single Depth: infinity PROPFIND instead,
+  // when the walk first gets to a directory with subdirectories we do not have listed yet.
+  // ReadDirectory then picks the listings of the subdirectories.
+  // Not with OneDrive, which needs the special handling of NeonPropsResult.
+  if (FTerminal->SessionData->WebDavDeepListing && !FDeepListingRefused && !FOneDrive)
+  {
+    UnicodeString Directory = ReadAheadPath(FileList->Directory);
+    bool Missing = false;
+    for (int Index = 0; !Missing && (Index < FileList->Count); Index++)
+    {
+      TRemoteFile * File = FileList->Files[Index];
+      UnicodeString SubDirectory = UnixCombinePaths(Directory, File->FileName);
+      Missing =
+        File->IsDirectory && IsRealFile(File->FileName) &&
+        (FReadAheadListings->IndexOf(SubDirectory) < 0) &&
+        // The walk will not read the directory, if it has it cached
+        (!UseCache || !FTerminal->SessionData->CacheDirectories ||
+         !FTerminal->FDirectoryCache->HasFileList(SubDirectory));
+    }
+
+    if (Missing)
+    {
+      FTerminal->LogEvent(FORMAT(L"Listing directory \"%s\" with all its subdirectories.", (Directory)));
+      // Listings we might still have from before would get mixed with the new ones
+      DiscardReadAheadListings(Directory);
+      std::unique_ptr<TRemoteFileList> Files(new TRemoteFileList());
+      int NeonStatus;
+      {
+        TOperationVisualizer Visualizer(FTerminal->UseBusyCursor);
+        NeonStatus = ReadDeepListing(DirectoryPath(FileList->Directory), Files.get());
+      }
+
+      if (NeonStatus != NE_OK)
+      {
+        // Typically 403 with DAV:propfind-finite-depth precondition (RFC 4918).
+        // Other problems will show with the regular listing.
+        FTerminal->LogEvent(FORMAT(L"Deep listing failed, will list directories one by one: %s", (GetNeonError())));
+        FDeepListingRefused = true;
+      }
+      else
+      {
+        // The files move to the listings
+        Files->OwnsObjects = false;
+        for (int Index = 0; Index < Files->Count; Index++)
+        {
+          std::unique_ptr<TRemoteFile> File(Files->Files[Index]);
+          UnicodeString FullFileName = File->FullFileName;
+          if (File->IsDirectory && !UnixSamePath(FullFileName, Directory))
+          {
+            // What the directory listing has for the "this" entry, see NeonPropsResult
+            TRemoteFile * ParentDirectory = File->Duplicate();
+            ParentDirectory->FileName = PARENTDIRECTORY;
+            ParentDirectory->FullFileName = UnixCombinePaths(FullFileName, PARENTDIRECTORY);
+            GetReadAheadListing(FullFileName)->AddFile(ParentDirectory);
+          }
+          // The listing of the directory itself is not needed
+          if (!UnixSamePath(FullFileName, Directory) &&
+              !UnixSamePath(UnixExtractFileDir(FullFileName), Directory))
+          {
+            GetReadAheadListing(UnixExtractFileDir(FullFileName))->AddFile(File.release());
+          }
+        }
+        FTerminal->LogEvent(FORMAT(L"%d directory listings prepared.", (FReadAheadListings->Count)));
+      }
+    }
+  }
+}
+//---------------------------------------------------------------------------
+TRemoteFileList * __fastcall TWebDAVFileSystem::GetReadAheadListing(const UnicodeString & Path)
+{
+  int Index = FReadAheadListings->IndexOf(Path);
+  if (Index < 0)
+  {
+    TRemoteFileList * FileList = new TRemoteFileList();
+    FileList->Directory = Path;
+    Index = FReadAheadListings->AddObject(Path, FileList);
+  }
+  return static_cast<TRemoteFileList *>(FReadAheadListings->Objects[Index]);
+}
+//---------------------------------------------------------------------------
+bool __fastcall TWebDAVFileSystem::TakeReadAheadListing(TRemoteFileList * FileList)
+{
+  bool Result = false;
+  UnicodeString Path = ReadAheadPath(FileList->Directory);
+  int Index = FReadAheadListings->IndexOf(Path);
+  if (Index >= 0)
+  {
+    FTerminal->LogEvent(FORMAT(L"Using listing of directory \"%s\" read in advance.", (Path)));
+    TRemoteFileList * Listing = static_cast<TRemoteFileList *>(FReadAheadListings->Objects[Index]);
+    // The files move to FileList
+    Listing->OwnsObjects = false;
+    for (int FileIndex = 0; FileIndex < Listing->Count; FileIndex++)
+    {
+      FileList->AddFile(Listing->Files[FileIndex]);
+    }
+    FReadAheadListings->Delete(Index);
+    Result = true;
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
+void __fastcall TWebDAVFileSystem::DiscardReadAheadListings(const UnicodeString & Path)
+{
+  UnicodeString Prefix = UnixIncludeTrailingBackslash(Path);
+  int Index = 0;
+  while (Index < FReadAheadListings->Count)
+  {
+    UnicodeString ListingPath = FReadAheadListings->Strings[Index];
+    if ((ListingPath == Path) || StartsStr(Prefix, ListingPath))
+    {
+      FReadAheadListings->Delete(Index);
+    }
+    else
+    {
+      Index++;
+    }
+  }
+}
+//---------------------------------------------------------------------------
+void __fastcall TWebDAVFileSystem::ReadAheadDone(const UnicodeString & Directory)
+{
+  // Nothing below the directory will be needed anymore
+  if (Directory.IsEmpty())
+  {
+    FReadAheadListings->Clear();
+  }
+  else
+  {
+    DiscardReadAheadListings(ReadAheadPath(Directory));
+  }
+}
+//---------------------------------------------------------------------------
 void __fastcall TWebDAVFileSystem::ReadSymlink(TRemoteFile * /*SymlinkFile*/,
   TRemoteFile *& /*File*/)
 {
@@ -927,6 +1121,13 @@ void TWebDAVFileSystem::NeonPropsResult(
 
     Data.FileList->AddFile(File.release());
   }
+  else if (Data.Files != NULL)
+  {
+    std::unique_ptr<TRemoteFile> File(new TRemoteFile(NULL));
+    File->Terminal = FileSystem->FTerminal;
+    FileSystem->ParsePropResultSet(File.get(), Path, Results);
+    Data.Files->AddFile(File.release());
+  }
   else
   {
     FileSystem->ParsePropResultSet(Data.File, Path, Results);
@@ -1101,9 +1302,10 @@ int __fastcall TWebDAVFileSystem::CustomReadFileInternal(const UnicodeString Fil
   Data.FileSystem = this;
   Data.File = AFile.get();
   Data.FileList = NULL;
+  Data.Files = NULL;
   ClearNeonError();
   int Result =
-    ne_simple_propfind(FSessionContext->NeonSession, PathToNeon(FileName), NE_DEPTH_ZERO, NULL,
+    ne_simple_propfind(FSessionContext->NeonSession, PathToNeon(FileName), NE_DEPTH_ZERO, ListingProps,
       NeonPropsResult, &Data);
   if (Result == NE_OK)
   {
@@ -1772,14 +1974,102 @@ int TWebDAVFileSystem::NeonBodyReader(void * UserData, const char * Buf, size_t
   return Result;
 }
 //---------------------------------------------------------------------------
+int TWebDAVFileSystem::NeonGetRange(ne_session_s * Session, const char * Path, int FD, __int64 Start, __int64 Length, bool Resume)
+{
+  int Result;
+  if ((Start == 0) && (Length < 0))
+  {
+    Result = ne_get(Session, Path, FD);
+  }
+  else
+  {
+    ne_request * Request = ne_request_create(Session, "GET", Path);
+    try
+    {
+      UnicodeString Range = FORMAT(L"bytes=%s-", (IntToStr(Start)));
+      if (Length >= 0)
+      {
+        Range += IntToStr(Start + Length - 1);
+      }
+      ne_add_request_header(Request, "Range", AnsiString(Range).c_str());
+
+      // Like dispatch_to_fd in ne_basic.c, except that when resuming,
+      // a server that ignores the range is tolerated by downloading the complete file.
+      const ne_status * Status = ne_get_status(Request);
+      do
+      {
+        Result = ne_begin_request(Request);
+        if (Result == NE_OK)
+        {
+          bool Whole = (Status->klass == 2) && (Status->code != 206);
+          if (Whole && !Resume)
+          {
+            // Do not read the complete file, when we need a part of it only
+            ne_close_connection(Session);
+            ne_set_error(Session, "Resource does not support ranged GET requests");
+            Result = NE_ERROR;
+          }
+          else
+          {
+            if (Whole)
+            {
+              FTerminal->LogEvent(L"Server does not support resuming, downloading complete file.");
+              if ((_lseeki64(FD, 0, SEEK_SET) < 0) || (_chsize_s(FD, 0) != 0))
+              {
+                RaiseLastOSError();
+              }
+              // The progress gets corrected with the first response data
+              FDownloadResumed = 0;
+            }
+
+            if (Status->klass == 2)
+            {
+              Result = ne_read_response_to_fd(Request, FD);
+            }
+            else
+            {
+              Result = ne_discard_response(Request);
+            }
+
+            if (Result == NE_OK)
+            {
+              Result = ne_end_request(Request);
+            }
+          }
+        }
+      }
+      while (Result == NE_RETRY);
+
+      if ((Result == NE_OK) && (Status->klass != 2))
+      {
+        Result = NE_ERROR;
+      }
+    }
+    __finally
+    {
+      ne_request_destroy(Request);
+    }
+  }
+  return Result;
+}
+//---------------------------------------------------------------------------
 void __fastcall TWebDAVFileSystem::Sink(
   const UnicodeString & FileName, const TRemoteFile * File,
   const UnicodeString & TargetDir, UnicodeString & DestFileName, int Attrs,
   const TCopyParamType * CopyParam, int Params, TFileOperationProgressType * OperationProgress,
   unsigned int /*Flags*/, TDownloadSessionAction & Action)
 {
+  // resume has no sense for temporary downloads
+  bool ResumeAllowed =
+    FLAGCLEAR(Params, cpTemporary) &&
+    CopyParam->AllowResume(OperationProgress->TransferSize, DestFileName) &&
+    (CopyParam->PartOffset < 0);
+  // Parts of a parallel transfer are written directly to their place in a file preallocated by TParallelOperation,
+  // which also takes care of its timestamp and attributes once all parts are done
+  bool InPlacePart = (CopyParam->PartOffset >= 0);
+
   UnicodeString DestFullName = TargetDir + DestFileName;
-  if (FileExists(ApiPath(DestFullName)))
+  if (!InPlacePart && FileExists(ApiPath(DestFullName)))
   {
     __int64 Size;
     __int64 MTime;
@@ -1794,18 +2084,57 @@ void __fastcall TWebDAVFileSystem::Sink(
     ConfirmOverwrite(FileName, DestFileName, OperationProgress, &FileParams, CopyParam, Params);
   }
 
+  UnicodeString DestPartialFullName = DestFullName + PartialExt;
+  UnicodeString LocalFileName = ResumeAllowed ? DestPartialFullName : DestFullName;
+
+  __int64 ResumeOffset = 0;
+  if (ResumeAllowed)
+  {
+    FTerminal->DiscardParallelPartialFile(DestFullName);
+    FTerminal->LogEvent(L"Checking existence of partially transferred file.");
+    if (FileExists(ApiPath(DestPartialFullName)))
+    {
+      FTerminal->LogEvent(L"Partially transferred file exists.");
+      FTerminal->OpenLocalFile(DestPartialFullName, GENERIC_READ, NULL, NULL, NULL, NULL, NULL, &ResumeOffset);
+      // A range starting at the end of the file is not satisfiable, so download the complete file even then
+      if (ResumeOffset >= OperationProgress->TransferSize)
+      {
+        FTerminal->LogEvent(L"Partially transferred file is not smaller than original file.");
+        FTerminal->DoDeleteLocalFile(DestPartialFullName);
+        ResumeOffset = 0;
+      }
+      else
+      {
+        FTerminal->LogEvent(L"Resuming file transfer.");
+        OperationProgress->AddResumed(ResumeOffset);
+      }
+    }
+  }
+
   UnicodeString ExpandedDestFullName = ExpandUNCFileName(DestFullName);
   Action.Destination(ExpandedDestFullName);
 
+  __int64 Start = InPlacePart ? CopyParam->PartOffset : ResumeOffset;
+
   FILE_OPERATION_LOOP_BEGIN
   {
     HANDLE LocalHandle;
-    if (!FTerminal->CreateLocalFile(DestFullName, OperationProgress, &LocalHandle, FLAGSET(Params, cpNoConfirmation)))
+    if (InPlacePart)
+    {
+      FTerminal->OpenLocalFileSegment(LocalFileName, CopyParam->PartOffset, &LocalHandle);
+    }
+    else if (ResumeOffset > 0)
+    {
+      FTerminal->OpenLocalFile(LocalFileName, GENERIC_WRITE, NULL, &LocalHandle, NULL, NULL, NULL, NULL);
+      FileSeek((THandle)LocalHandle, ResumeOffset, soBeginning);
+    }
+    else if (!FTerminal->CreateLocalFile(LocalFileName, OperationProgress, &LocalHandle, FLAGSET(Params, cpNoConfirmation)))
     {
       throw ESkipFile();
     }
 
-    bool DeleteLocalFile = true;
+    // The preallocated file is shared with the other parts
+    bool DeleteLocalFile = !InPlacePart;
 
     int FD = -1;
     try
@@ -1817,9 +2146,11 @@ void __fastcall TWebDAVFileSystem::Sink(
       }
 
       TAutoFlag DownloadingFlag(FDownloading);
+      FDownloadResumed = ResumeOffset;
 
       ClearNeonError();
-      int NeonStatus = ne_get(FSessionContext->NeonSession, PathToNeon(FileName), FD);
+      int NeonStatus =
+        NeonGetRange(FSessionContext->NeonSession, PathToNeon(FileName), FD, Start, CopyParam->PartSize, (ResumeOffset > 0));
       UnicodeString DiscardPath = FileName;
       if (IsValidRedirect(NeonStatus, DiscardPath))
       {
@@ -1831,7 +2162,8 @@ void __fastcall TWebDAVFileSystem::Sink(
         {
           RedirectUrl += L"?" + Query;
         }
-        NeonStatus = ne_get(CorrectedSessionContext->NeonSession, RedirectUrl.c_str(), FD);
+        NeonStatus =
+          NeonGetRange(CorrectedSessionContext->NeonSession, RedirectUrl.c_str(), FD, Start, CopyParam->PartSize, (ResumeOffset > 0));
         CheckStatus(CorrectedSessionContext.get(), NeonStatus);
       }
       else
@@ -1841,7 +2173,7 @@ void __fastcall TWebDAVFileSystem::Sink(
 
       DeleteLocalFile = false;
 
-      if (CopyParam->PreserveTime)
+      if (CopyParam->PreserveTime && !InPlacePart)
       {
         FTerminal->UpdateTargetTime(
           LocalHandle, File->Modification, File->ModificationFmt, FTerminal->SessionData->DSTMode);
@@ -1849,6 +2181,14 @@ void __fastcall TWebDAVFileSystem::Sink(
     }
     __finally
     {
+      FDownloadResumed = 0;
+
+      // Keep what was downloaded, so that the transfer can be resumed
+      if (DeleteLocalFile && ResumeAllowed && (FileSeek((THandle)LocalHandle, 0LL, soEnd) > 0))
+      {
+        DeleteLocalFile = false;
+      }
+
       if (FD >= 0)
       {
         // _close calls CloseHandle internally (even doc states, we should not call CloseHandle),
@@ -1862,13 +2202,21 @@ void __fastcall TWebDAVFileSystem::Sink(
 
       if (DeleteLocalFile)
       {
-        FTerminal->DoDeleteLocalFile(DestFullName);
+        FTerminal->DoDeleteLocalFile(LocalFileName);
       }
     }
   }
   FILE_OPERATION_LOOP_END(FMTLOAD(TRANSFER_ERROR, (FileName)));
 
-  FTerminal->UpdateTargetAttrs(DestFullName, File, CopyParam, Attrs);
+  if (ResumeAllowed)
+  {
+    FTerminal->DoRenameLocalFileForce(DestPartialFullName, DestFullName);
+  }
+
+  if (!InPlacePart)
+  {
+    FTerminal->UpdateTargetAttrs(DestFullName, File, CopyParam, Attrs);
+  }
 }
 //---------------------------------------------------------------------------
 bool TWebDAVFileSystem::VerifyCertificate(TSessionContext * SessionContext, TNeonCertificateData Data, bool Aux)
@@ -2039,7 +2387,9 @@ void TWebDAVFileSystem::NeonNotifier(void * UserData, ne_session_status Status,
        (FileSystem->FDownloading && (Status == ne_status_recving))) &&
       DebugAlwaysTrue(OperationProgress != NULL))
   {
-    __int64 Progress = StatusInfo->sr.progress;
+    // Progress of a resumed download is relative to the resume offset
+    __int64 Resumed = FileSystem->FDownloading ? FileSystem->FDownloadResumed : 0;
+    __int64 Progress = StatusInfo->sr.progress + Resumed;
     __int64 Diff = Progress - OperationProgress->TransferredSize;
 
     if (Diff > 0)
@@ -2064,7 +2414,7 @@ void TWebDAVFileSystem::NeonNotifier(void * UserData, ne_session_status Status,
     }
     else
     {
-      OperationProgress->SetTransferSize(Total);
+      OperationProgress->SetTransferSize(Total + Resumed);
       OperationProgress->AddTransferred(Diff);
     }
   }
@@ -67,6 +67,8 @@ public:
   virtual void __fastcall LookupUsersGroups();
   virtual void __fastcall ReadCurrentDirectory();
   virtual void __fastcall ReadDirectory(TRemoteFileList * FileList);
+  virtual void __fastcall ReadAheadDirectories(TRemoteFileList * FileList, bool UseCache);
+  virtual void __fastcall ReadAheadDone(const UnicodeString & Directory);
   virtual void __fastcall ReadFile(const UnicodeString FileName,
     TRemoteFile *& File);
   virtual void __fastcall ReadSymlink(TRemoteFile * SymlinkFile,
@@ -153,6 +155,10 @@ private:
   bool FStoredPasswordTried;
   bool FUploading;
   bool FDownloading;
+  __int64 FDownloadResumed;
+  // Listings of subdirectories read by a deep PROPFIND in advance, by their path
+  std::unique_ptr<TStringList> FReadAheadListings;
+  bool FDeepListingRefused;
   UnicodeString FUploadMimeType;
   ne_lock_store_s * FNeonLockStore;
   TCriticalSection * FNeonLockStoreSection;
@@ -190,9 +196,15 @@ private:
   UnicodeString __fastcall GetRedirectUrl();
   UnicodeString __fastcall ParsePathFromUrl(const UnicodeString & Url);
   int __fastcall ReadDirectoryInternal(const UnicodeString & Path, TRemoteFileList * FileList);
+  int __fastcall ReadDeepListing(const UnicodeString & Path, TRemoteFileList * Files);
+  UnicodeString __fastcall ReadAheadPath(const UnicodeString & Directory);
+  TRemoteFileList * __fastcall GetReadAheadListing(const UnicodeString & Path);
+  bool __fastcall TakeReadAheadListing(TRemoteFileList * FileList);
+  void __fastcall DiscardReadAheadListings(const UnicodeString & Path);
   int __fastcall RenameFileInternal(const UnicodeString & FileName, const UnicodeString & NewName, bool Overwrite);
   int __fastcall CopyFileInternal(const UnicodeString & FileName, const UnicodeString & NewName, bool Overwrite);
   bool __fastcall IsValidRedirect(int NeonStatus, UnicodeString & Path);
+  int NeonGetRange(ne_session_s * Session, const char * Path, int FD, __int64 Start, __int64 Length, bool Resume);
   UnicodeString __fastcall DirectoryPath(UnicodeString Path);
   UnicodeString __fastcall FilePath(const TRemoteFile * File);
   struct ne_lock * __fastcall FindLock(const RawByteString & Path);
@@ -14,6 +14,9 @@ public:
   virtual std::wstring GetClientString() = 0;
   virtual void SetupSsl(ssl_st * Ssl) = 0;
   virtual std::wstring CustomReason(int Err) = 0;
+  // Session and global speed limits, on top of the per-transfer limit of FileZilla itself
+  virtual __int64 SpeedLimitAvailable(__int64 Size) = 0;
+  virtual void SpeedLimitUsed(__int64 Size) = 0;
 };
 //---------------------------------------------------------------------------
 #endif // FileZillaToolsH
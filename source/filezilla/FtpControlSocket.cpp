@@ -1757,6 +1757,7 @@ void CFtpControlSocket::List(BOOL bFinish, int nError /*=FALSE*/, CServerPath pa
     pData->pDirectoryListing->num = num;
     if (m_pTransferSocket->m_pListResult->m_server.nServerType & FZ_SERVERTYPE_SUB_FTP_VMS && m_CurrentServer.nServerType & FZ_SERVERTYPE_FTP)
       m_CurrentServer.nServerType |= FZ_SERVERTYPE_SUB_FTP_VMS;
+    m_CurrentServer.nListingFormat = m_pTransferSocket->m_pListResult->m_server.nListingFormat; // WINSCP
 
     pData->pDirectoryListing->server = m_CurrentServer;
     pData->pDirectoryListing->path.SetServer(pData->pDirectoryListing->server);
@@ -2434,6 +2435,7 @@ void CFtpControlSocket::ListFile(CString filename, const CServerPath &path)
       pData->direntry = pListResult->getList(num);
       if (pListResult->m_server.nServerType & FZ_SERVERTYPE_SUB_FTP_VMS && m_CurrentServer.nServerType & FZ_SERVERTYPE_FTP)
         m_CurrentServer.nServerType |= FZ_SERVERTYPE_SUB_FTP_VMS;
+      m_CurrentServer.nListingFormat = pListResult->m_server.nListingFormat; // WINSCP
       delete pListResult;
     }
     break;
@@ -2881,6 +2883,7 @@ void CFtpControlSocket::FileTransfer(t_transferfile *transferfile/*=0*/,BOOL bFi
       pData->pDirectoryListing->num=num;
       if (m_pTransferSocket->m_pListResult->m_server.nServerType&FZ_SERVERTYPE_SUB_FTP_VMS && m_CurrentServer.nServerType&FZ_SERVERTYPE_FTP)
         m_CurrentServer.nServerType |= FZ_SERVERTYPE_SUB_FTP_VMS;
+      m_CurrentServer.nListingFormat = m_pTransferSocket->m_pListResult->m_server.nListingFormat; // WINSCP
       pData->pDirectoryListing->server = m_CurrentServer;
       pData->pDirectoryListing->path.SetServer(m_CurrentServer);
       pData->pDirectoryListing->path = pData->transferfile.remotepath;
@@ -6043,6 +6046,16 @@ _int64 CFtpControlSocket::GetAbleToTransferSize(enum transferDirection direction
   }
   _int64 limit = GetAbleToUDSize(beenWaiting, m_CurrentTransferTime[direction], m_CurrentTransferLimit[direction], iter, direction, nBufSize);
   m_SpeedLimitSync.Unlock();
+  // WINSCP
+  if (limit > 0)
+  {
+    limit = m_pTools->SpeedLimitAvailable(limit);
+    if (!limit)
+    {
+      // Let the caller retry later, as with our own limit
+      beenWaiting = true;
+    }
+  }
   return limit;
 }
 
@@ -6067,6 +6080,11 @@ BOOL CFtpControlSocket::RemoveActiveTransfer()
 
 BOOL CFtpControlSocket::SpeedLimitAddTransferredBytes(enum transferDirection direction, _int64 nBytesTransferred)
 {
+  // WINSCP
+  if (nBytesTransferred > 0)
+  {
+    m_pTools->SpeedLimitUsed(nBytesTransferred);
+  }
   m_SpeedLimitSync.Lock();
   std::list<t_ActiveList>::iterator iter;
   for (iter = m_InstanceList[direction].begin(); iter != m_InstanceList[direction].end(); iter++)
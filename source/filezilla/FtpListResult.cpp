@@ -11,6 +11,9 @@ CFtpListResult::CFtpListResult(t_server server, bool mlst, bool *bUTF8, bool vms
   m_bUTF8 = bUTF8;
   m_vmsAllRevisions = vmsAllRevisions;
   m_debugShowListing = debugShowListing;
+  FBufferPos = 0;
+  m_knownFormatLines = 0;
+  m_parsedLines = 0;
 
   //Fill the month names map
 
@@ -229,10 +232,19 @@ CFtpListResult::CFtpListResult(t_server server, bool mlst, bool *bUTF8, bool vms
 
 t_directory::t_direntry * CFtpListResult::getList(int & Num)
 {
-  if (!FBuffer.IsEmpty())
+  if (FBufferPos < FBuffer.Length())
   {
     SendLineToMessageLog("Unparsed listing:");
-    SendLineToMessageLog(FBuffer);
+    SendLineToMessageLog(FBuffer.SubString(FBufferPos + 1, FBuffer.Length() - FBufferPos));
+  }
+  if (m_parsedLines > 0)
+  {
+    static const wchar_t * FormatNames[lfCount] =
+      { L"unknown", L"MLSD", L"Unix", L"DOS", L"EPLF", L"VMS", L"other",
+        L"IBM MVS", L"IBM MVS PDS", L"IBM", L"WfFtp", L"IBM MVS PDS2" };
+    int Format = ((m_server.nListingFormat >= 0) && (m_server.nListingFormat < lfCount)) ? m_server.nListingFormat : lfUnknown;
+    LogMessage(FZ_LOG_INFO, L"Listing format: %s, %d of %d entries parsed with the format of the previous entry",
+      FormatNames[Format], m_knownFormatLines, m_parsedLines);
   }
   Num = m_EntryList.size();
   t_directory::t_direntry * Result;
@@ -250,6 +262,7 @@ t_directory::t_direntry * CFtpListResult::getList(int & Num)
       Result[I] = *Iter;
     }
     m_EntryList.clear();
+    m_VmsIndex.clear();
   }
 
   return Result;
@@ -261,42 +274,31 @@ BOOL CFtpListResult::parseLine(const char *lineToParse, const int linelen, t_dir
   direntry.owner = L"";
   direntry.group = L"";
 
-  if (parseAsMlsd(lineToParse, linelen, direntry))
-    return TRUE;
-
-  if (parseAsUnix(lineToParse, linelen, direntry))
-    return TRUE;
-
-  if (parseAsDos(lineToParse, linelen, direntry))
-    return TRUE;
-
-  if (parseAsEPLF(lineToParse, linelen, direntry))
-    return TRUE;
-
-  if (parseAsVMS(lineToParse, linelen, direntry))
+  // Listings have all entries in the same format (and the format is kept for the server),
+  // so try the format of the previous entry first, saving up to ten failed parses per entry.
+  int knownFormat = m_server.nListingFormat;
+  if ((knownFormat > lfUnknown) && (knownFormat < lfCount) &&
+      parseAs(knownFormat, lineToParse, linelen, direntry))
   {
-    m_server.nServerType |= FZ_SERVERTYPE_SUB_FTP_VMS;
+    m_knownFormatLines++;
+    m_parsedLines++;
     return TRUE;
   }
 
-  if (parseAsOther(lineToParse, linelen, direntry))
-    return TRUE;
-
-  if (parseAsIBMMVS(lineToParse, linelen, direntry))
-    return TRUE;
-
-  if (parseAsIBMMVSPDS(lineToParse, linelen, direntry))
-    return TRUE;
-
-  if (parseAsIBM(lineToParse, linelen, direntry))
-    return TRUE;
-
-  if (parseAsWfFtp(lineToParse, linelen, direntry))
-    return TRUE;
-
-  // Should be last
-  if (parseAsIBMMVSPDS2(lineToParse, linelen, direntry))
-    return TRUE;
+  for (int format = lfUnknown + 1; format < lfCount; format++)
+  {
+    if ((format != knownFormat) &&
+        parseAs(format, lineToParse, linelen, direntry))
+    {
+      // The last resort format is too loose to be tried first, it would take over lines of other formats
+      if (format != lfIBMMVSPDS2)
+      {
+        m_server.nListingFormat = format;
+      }
+      m_parsedLines++;
+      return TRUE;
+    }
+  }
 
   // name-only entries
   // (multiline VMS entries have only a name on the first line, so for VMS we have to skip this)
@@ -316,6 +318,55 @@ BOOL CFtpListResult::parseLine(const char *lineToParse, const int linelen, t_dir
   return FALSE;
 }
 
+BOOL CFtpListResult::parseAs(int format, const char * line, const int linelen, t_directory::t_direntry & direntry)
+{
+  switch (format)
+  {
+    case lfMlsd:
+      return parseAsMlsd(line, linelen, direntry);
+
+    case lfUnix:
+      return parseAsUnix(line, linelen, direntry);
+
+    case lfDos:
+      return parseAsDos(line, linelen, direntry);
+
+    case lfEPLF:
+      return parseAsEPLF(line, linelen, direntry);
+
+    case lfVMS:
+      if (parseAsVMS(line, linelen, direntry))
+      {
+        m_server.nServerType |= FZ_SERVERTYPE_SUB_FTP_VMS;
+        return TRUE;
+      }
+      return FALSE;
+
+    case lfOther:
+      return parseAsOther(line, linelen, direntry);
+
+    case lfIBMMVS:
+      return parseAsIBMMVS(line, linelen, direntry);
+
+    case lfIBMMVSPDS:
+      return parseAsIBMMVSPDS(line, linelen, direntry);
+
+    case lfIBM:
+      return parseAsIBM(line, linelen, direntry);
+
+    case lfWfFtp:
+      return parseAsWfFtp(line, linelen, direntry);
+
+    // Should be last
+    case lfIBMMVSPDS2:
+      return parseAsIBMMVSPDS2(line, linelen, direntry);
+
+    default:
+      DebugFail();
+      return FALSE;
+  }
+}
+
 bool CFtpListResult::IsNewLineChar(char C) const
 {
   return
@@ -326,12 +377,23 @@ bool CFtpListResult::IsNewLineChar(char C) const
 
 void CFtpListResult::AddData(const char * Data, int Size)
 {
+  // The parsed records are dropped from the buffer only here, once per received chunk.
+  // Dropping them after each record would make the parsing quadratic in the listing size.
+  if (FBufferPos > 0)
+  {
+    FBuffer.Delete(1, FBufferPos);
+    FBufferPos = 0;
+  }
   FBuffer += RawByteString(Data, Size);
 
+  // Not modified until the end of the parsing
+  const char * Buffer = FBuffer.c_str();
+  int Length = FBuffer.Length();
+
   // Just in case the previous buffer was terminated between CR and LF.
-  while (!FBuffer.IsEmpty() && IsNewLineChar(FBuffer[1]))
+  while ((FBufferPos < Length) && IsNewLineChar(Buffer[FBufferPos]))
   {
-    FBuffer.Delete(1, 1);
+    FBufferPos++;
   }
 
   bool Found;
@@ -344,23 +406,23 @@ void CFtpListResult::AddData(const char * Data, int Size)
   {
     if (Restart)
     {
-      Pos = 1;
+      Pos = FBufferPos;
       FirstLineEnd = -1;
       Count = 0;
       Restart = false;
     }
 
-    std::vector<RawByteString> Lines;
-    while ((Pos <= FBuffer.Length()) && !IsNewLineChar(FBuffer[Pos]))
+    while ((Pos < Length) && !IsNewLineChar(Buffer[Pos]))
     {
       Pos++;
     }
-    Found = (Pos <= FBuffer.Length());
+    Found = (Pos < Length);
     if (Found)
     {
       Count++;
-      RawByteString Record = FBuffer.SubString(1, Pos - 1);
-      while ((Pos <= FBuffer.Length()) && IsNewLineChar(FBuffer[Pos]))
+      // Up to two lines (multiline VMS entries)
+      RawByteString Record(Buffer + FBufferPos, Pos - FBufferPos);
+      while ((Pos < Length) && IsNewLineChar(Buffer[Pos]))
       {
         Pos++;
       }
@@ -370,11 +432,14 @@ void CFtpListResult::AddData(const char * Data, int Size)
       }
       t_directory::t_direntry DirEntry;
       RawByteString Line = Record;
-      for (int Index = 1; Index <= Line.Length(); Index++)
+      if (Count > 1)
       {
-        if (IsNewLineChar(Line[Index]))
+        for (int Index = 1; Index <= Line.Length(); Index++)
         {
-          Line[Index] = ' ';
+          if (IsNewLineChar(Line[Index]))
+          {
+            Line[Index] = ' ';
+          }
         }
       }
       if (parseLine(Line.c_str(), Line.Length(), DirEntry))
@@ -383,7 +448,7 @@ void CFtpListResult::AddData(const char * Data, int Size)
         {
           AddLine(DirEntry);
         }
-        FBuffer.Delete(1, Pos - 1);
+        FBufferPos = Pos;
         Restart = true;
         SendLineToMessageLog(Record);
       }
@@ -391,10 +456,10 @@ void CFtpListResult::AddData(const char * Data, int Size)
       {
         if (Count == 2)
         {
-          RawByteString FirstLine = FBuffer.SubString(1, FirstLineEnd - 1).TrimRight();
+          RawByteString FirstLine = RawByteString(Buffer + FBufferPos, FirstLineEnd - FBufferPos).TrimRight();
           SendLineToMessageLog("Cannot parse line:");
           SendLineToMessageLog(FirstLine);
-          FBuffer.Delete(1, FirstLineEnd - 1);
+          FBufferPos = FirstLineEnd;
           Restart = true;
         }
       }
@@ -456,39 +521,41 @@ void CFtpListResult::AddLine(t_directory::t_direntry & direntry)
     int version=_ttoi(direntry.name.Mid(pos+1));
     direntry.name=direntry.name.Left(pos);
 
-    tEntryList::iterator entryiter=m_EntryList.begin();
-    tTempData::iterator dataiter=m_TempData.begin();
-    BOOL bContinue=FALSE;
-    while (entryiter!=m_EntryList.end())
+    // The server type can be detected only after some entries were added already
+    if (m_VmsIndex.empty())
+    {
+      for (tEntryList::iterator entryiter=m_EntryList.begin(); entryiter!=m_EntryList.end(); entryiter++)
+        IndexVmsEntry(entryiter, 0);
+    }
+
+    tVmsIndex::iterator indexiter=m_VmsIndex.find(direntry.name);
+    if (indexiter!=m_VmsIndex.end())
     {
-      DebugAssert(dataiter!=m_TempData.end());
-      t_directory::t_direntry dir=*entryiter;
-      int oldversion=*dataiter;
-      if (direntry.name==dir.name)
+      if (version>indexiter->second.second)
       {
-        bContinue=TRUE;
-        if (version>oldversion)
-        {
-          *entryiter=direntry;
-          *dataiter=version;
-        }
-        break;
+        *indexiter->second.first=direntry;
+        indexiter->second.second=version;
       }
-      entryiter++;
-      dataiter++;
-    }
-    if (bContinue)
       return;
+    }
     m_EntryList.push_back(direntry);
-    m_TempData.push_back(version);
+    IndexVmsEntry(--m_EntryList.end(), version);
   }
   else
   {
     m_EntryList.push_back(direntry);
-    m_TempData.push_back(0);
+    // Once indexing, keep all entries indexed
+    if (!m_VmsIndex.empty())
+      IndexVmsEntry(--m_EntryList.end(), 0);
   }
 }
 
+void CFtpListResult::IndexVmsEntry(tEntryList::iterator Entry, int Version)
+{
+  // Does not overwrite, so with duplicate names, the first entry is the one updated
+  m_VmsIndex.insert(std::make_pair(Entry->name, std::make_pair(Entry, Version)));
+}
+
 bool CFtpListResult::IsNumeric(const char *str, int len) const
 {
   if (!str)
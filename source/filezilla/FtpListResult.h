@@ -35,11 +35,19 @@ public:
   CFtpListResult(t_server server, bool mlst, bool * bUTF8, bool vmsAllRevisions, bool debugShowListing);
   t_directory::t_direntry * getList(int & num);
 
+  // Ordered as the parsers are tried
+  enum TListingFormat
+  {
+    lfUnknown, lfMlsd, lfUnix, lfDos, lfEPLF, lfVMS, lfOther,
+    lfIBMMVS, lfIBMMVSPDS, lfIBM, lfWfFtp, lfIBMMVSPDS2, lfCount
+  };
+
 private:
   typedef std::list<t_directory::t_direntry> tEntryList;
   tEntryList m_EntryList;
 
   BOOL parseLine(const char * lineToParse, const int linelen, t_directory::t_direntry & direntry);
+  BOOL parseAs(int format, const char * line, const int linelen, t_directory::t_direntry & direntry);
 
   BOOL parseAsVMS(const char * line, const int linelen, t_directory::t_direntry & direntry);
   BOOL parseAsEPLF(const char * line, const int linelen, t_directory::t_direntry & direntry);
@@ -64,15 +72,22 @@ private:
   bool parseMlsdDateTime(const CString value, t_directory::t_direntry::t_date & date) const;
 
   RawByteString FBuffer;
+  // Offset of the first unparsed character in FBuffer
+  int FBufferPos;
 
-  typedef std::list<int> tTempData;
-  tTempData m_TempData;
+  // Index of VMS entries by name (without version) for removing older versions
+  typedef std::map<CString, std::pair<tEntryList::iterator, int> > tVmsIndex;
+  tVmsIndex m_VmsIndex;
+  void IndexVmsEntry(tEntryList::iterator Entry, int Version);
 
   // Month names map
   std::map<CString, int> m_MonthNamesMap;
 
   bool m_vmsAllRevisions;
   bool m_debugShowListing;
+  // Entries parsed with the format of the previous entry
+  int m_knownFormatLines;
+  int m_parsedLines;
 
 protected:
   bool m_mlst;
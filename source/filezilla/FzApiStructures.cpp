@@ -11,6 +11,7 @@ t_server::t_server()
   nUTF8 = 0;
   iForcePasvIp = -1;
   iUseMlsd = -1;
+  nListingFormat = 0;
   Certificate = NULL;
   PrivateKey = NULL;
 }
@@ -20,6 +20,8 @@ public:
   int nUTF8;
   int iForcePasvIp;
   int iUseMlsd;
+  // CFtpListResult::TListingFormat of the last parsed listing entry
+  int nListingFormat;
   X509 * Certificate;
   EVP_PKEY * PrivateKey;
 };
@@ -284,7 +284,7 @@ void __fastcall TSiteAdvancedDialog::LoadSession()
 
     // Connection page
     FtpPasvModeCheck->Checked = FSessionData->FtpPasvMode;
-    BufferSizeCheck->Checked = (FSessionData->SendBuf > 0) && FSessionData->SshSimple;
+    BufferSizeCheck->Checked = (FSessionData->SendBuf > 0) && FSessionData->SshSimple && FSessionData->SshAdaptiveWindow;
 
     switch (FSessionData->PingType)
     {
@@ -491,6 +491,7 @@ void __fastcall TSiteAdvancedDialog::SaveSession(TSessionData * SessionData)
   SessionData->FtpPasvMode = FtpPasvModeCheck->Checked;
   SessionData->SendBuf = BufferSizeCheck->Checked ? DefaultSendBuf : 0;
   SessionData->SshSimple = BufferSizeCheck->Checked;
+  SessionData->SshAdaptiveWindow = BufferSizeCheck->Checked;
 
   if (PingNullPacketButton->Checked)
   {
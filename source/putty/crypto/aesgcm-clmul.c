@@ -0,0 +1,291 @@
+/*
+ * Implementation of the GCM polynomial hash using the x86 CLMUL
+ * extension, which provides 64x64->128 polynomial multiplication (or
+ * 'carry-less', which is what the CL stands for).
+ *
+ * The GCM field elements are loaded byte-reversed, which makes each
+ * one the bit-reversal of its logical value (see the comments in
+ * aesgcm-ref-poly.c). Multiplying two bit-reversed values with
+ * PCLMULQDQ gives the bit-reversal of their product, off by one bit
+ * position, so the 256-bit product is shifted left by one before
+ * being reduced.
+ *
+ * Because multiplication distributes over XOR, several consecutive
+ * coefficients can be folded in at once by multiplying each by the
+ * appropriate power of the key and adding the unreduced products,
+ * paying for the shift and reduction only once per group.
+ */
+
+#include "ssh.h"
+#include "aesgcm.h"
+
+/* Number of coefficients folded in per reduction */
+#define AESGCM_CLMUL_AGGREGATE 8
+
+// WINSCP
+// The multiplication has to be compiled by Visual Studio (PuTTYVS),
+// the state handling around it (aesgcm-footer.h) by C++Builder.
+typedef struct aesgcm_clmul_core aesgcm_clmul_core;
+
+#ifndef WINSCP_VS
+
+bool aesgcm_clmul_available(void);
+aesgcm_clmul_core *aesgcm_clmul_core_new(void);
+void aesgcm_clmul_core_free(aesgcm_clmul_core *core);
+void aesgcm_clmul_core_setkey(
+    aesgcm_clmul_core *core, const unsigned char *var);
+void aesgcm_clmul_core_setup(
+    aesgcm_clmul_core *core, const unsigned char *mask);
+void aesgcm_clmul_core_coeffs(
+    aesgcm_clmul_core *core, const unsigned char *coeffs, size_t nblocks);
+void aesgcm_clmul_core_output(
+    aesgcm_clmul_core *core, unsigned char *output);
+
+#else // WINSCP_VS
+
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+
+#if defined(__clang__) || defined(__GNUC__)
+#include <cpuid.h>
+#define GET_CPU_ID(out) __cpuid(1, (out)[0], (out)[1], (out)[2], (out)[3])
+#else
+#define GET_CPU_ID(out) __cpuid(out, 1)
+#endif
+
+// WINSCP
+// Same workaround as in aes-ni.c, constants must not end up in .rdata.
+#define _MM_SETR_EPI8(a0, a1, a2, a3, a4, a5, a6, a7, a8, a9, aa, ab, ac, ad, ae, af) \
+    { (char)a0, (char)a1, (char)a2, (char)a3, (char)a4, (char)a5, (char)a6, (char)a7, \
+      (char)a8, (char)a9, (char)aa, (char)ab, (char)ac, (char)ad, (char)ae, (char)af }
+
+/*WINSCP static*/ bool aesgcm_clmul_available(void)
+{
+    /*
+     * Determine if CLMUL is available on this CPU, by checking that
+     * both PCLMULQDQ itself and SSSE3 (for the byte shuffles) are
+     * supported.
+     */
+    unsigned int CPUInfo[4];
+    GET_CPU_ID(CPUInfo);
+    return (CPUInfo[2] & (1 << 1)) && (CPUInfo[2] & (1 << 9));
+}
+
+struct aesgcm_clmul_core {
+    /* Powers of the key: var[i] is the key to the power i+1 */
+    __m128i var[AESGCM_CLMUL_AGGREGATE];
+    __m128i acc, mask;
+    void *pointer_to_free;
+};
+
+static inline __m128i aesgcm_clmul_reverse(__m128i v)
+{
+    const __m128i R = _MM_SETR_EPI8(15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0); // WINSCP
+    return _mm_shuffle_epi8(v, R);
+}
+
+static inline __m128i aesgcm_clmul_load(const unsigned char *p)
+{
+    return aesgcm_clmul_reverse(_mm_loadu_si128((const __m128i *)p));
+}
+
+/*
+ * Multiply a by b without reducing, XORing the 256-bit product into
+ * the pair (lo, hi).
+ */
+static inline void aesgcm_clmul_mul_acc(
+    __m128i a, __m128i b, __m128i *lo, __m128i *hi)
+{
+    __m128i ll = _mm_clmulepi64_si128(a, b, 0x00);
+    __m128i hh = _mm_clmulepi64_si128(a, b, 0x11);
+    __m128i mid = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10),
+                                _mm_clmulepi64_si128(a, b, 0x01));
+
+    *lo = _mm_xor_si128(*lo, _mm_xor_si128(ll, _mm_slli_si128(mid, 8)));
+    *hi = _mm_xor_si128(*hi, _mm_xor_si128(hh, _mm_srli_si128(mid, 8)));
+}
+
+/*
+ * Shift the 256-bit product left by one bit to compensate for the bit
+ * reversal, and reduce it modulo the GCM polynomial.
+ */
+static inline __m128i aesgcm_clmul_reduce(__m128i lo, __m128i hi)
+{
+    /* Shift (hi:lo) left by one bit */
+    __m128i locarry = _mm_srli_epi32(lo, 31);
+    __m128i hicarry = _mm_srli_epi32(hi, 31);
+    __m128i midcarry = _mm_srli_si128(locarry, 12);
+    lo = _mm_or_si128(_mm_slli_epi32(lo, 1), _mm_slli_si128(locarry, 4));
+    hi = _mm_or_si128(_mm_slli_epi32(hi, 1), _mm_slli_si128(hicarry, 4));
+    hi = _mm_or_si128(hi, midcarry);
+
+    /* First phase of the reduction */
+    { // WINSCP
+    __m128i t = _mm_xor_si128(
+        _mm_xor_si128(_mm_slli_epi32(lo, 31), _mm_slli_epi32(lo, 30)),
+        _mm_slli_epi32(lo, 25));
+    __m128i tcarry = _mm_srli_si128(t, 4);
+    lo = _mm_xor_si128(lo, _mm_slli_si128(t, 12));
+
+    /* Second phase of the reduction */
+    t = _mm_xor_si128(
+        _mm_xor_si128(_mm_srli_epi32(lo, 1), _mm_srli_epi32(lo, 2)),
+        _mm_srli_epi32(lo, 7));
+    t = _mm_xor_si128(t, tcarry);
+    lo = _mm_xor_si128(lo, t);
+
+    return _mm_xor_si128(hi, lo);
+    } // WINSCP
+}
+
+static inline __m128i aesgcm_clmul_mul(__m128i a, __m128i b)
+{
+    __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+    aesgcm_clmul_mul_acc(a, b, &lo, &hi);
+    return aesgcm_clmul_reduce(lo, hi);
+}
+
+/*WINSCP static*/ aesgcm_clmul_core *aesgcm_clmul_core_new(void)
+{
+    /*
+     * The __m128i variables in the core structure need to be 16-byte
+     * aligned, so over-allocate and realign, as aes_ni_new does.
+     */
+    void *allocation = smalloc(sizeof(aesgcm_clmul_core) + 15);
+    memset(allocation, 0, sizeof(aesgcm_clmul_core) + 15);
+    { // WINSCP
+    uintptr_t alloc_address = (uintptr_t)allocation;
+    uintptr_t aligned_address = (alloc_address + 15) & ~15;
+    aesgcm_clmul_core *core = (aesgcm_clmul_core *)aligned_address;
+    core->pointer_to_free = allocation;
+    return core;
+    } // WINSCP
+}
+
+/*WINSCP static*/ void aesgcm_clmul_core_free(aesgcm_clmul_core *core)
+{
+    void *allocation = core->pointer_to_free;
+    smemclr(core, sizeof(*core));
+    sfree(allocation);
+}
+
+/*WINSCP static*/ void aesgcm_clmul_core_setkey(
+    aesgcm_clmul_core *core, const unsigned char *var)
+{
+    __m128i h = aesgcm_clmul_load(var);
+    core->var[0] = h;
+    for (size_t i = 1; i < AESGCM_CLMUL_AGGREGATE; i++)
+        core->var[i] = aesgcm_clmul_mul(core->var[i - 1], h);
+}
+
+/*WINSCP static*/ void aesgcm_clmul_core_setup(
+    aesgcm_clmul_core *core, const unsigned char *mask)
+{
+    core->mask = aesgcm_clmul_load(mask);
+    core->acc = _mm_setzero_si128();
+}
+
+/*WINSCP static*/ void aesgcm_clmul_core_coeffs(
+    aesgcm_clmul_core *core, const unsigned char *coeffs, size_t nblocks)
+{
+    __m128i acc = core->acc;
+
+    /*
+     * Fold in whole groups: the first coefficient of a group (with
+     * the accumulator added) is multiplied by the highest power of
+     * the key, the last by the key itself.
+     */
+    while (nblocks >= AESGCM_CLMUL_AGGREGATE) {
+        __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+        for (size_t i = 0; i < AESGCM_CLMUL_AGGREGATE; i++) {
+            __m128i coeff = aesgcm_clmul_load(coeffs + 16 * i);
+            if (i == 0)
+                coeff = _mm_xor_si128(coeff, acc);
+            aesgcm_clmul_mul_acc(
+                coeff, core->var[AESGCM_CLMUL_AGGREGATE - 1 - i], &lo, &hi);
+        }
+        acc = aesgcm_clmul_reduce(lo, hi);
+        coeffs += 16 * AESGCM_CLMUL_AGGREGATE;
+        nblocks -= AESGCM_CLMUL_AGGREGATE;
+    }
+
+    /* And the leftovers one at a time */
+    for (; nblocks > 0; nblocks--, coeffs += 16)
+        acc = aesgcm_clmul_mul(
+            _mm_xor_si128(acc, aesgcm_clmul_load(coeffs)), core->var[0]);
+
+    core->acc = acc;
+}
+
+/*WINSCP static*/ void aesgcm_clmul_core_output(
+    aesgcm_clmul_core *core, unsigned char *output)
+{
+    __m128i result = _mm_xor_si128(core->acc, core->mask);
+    _mm_storeu_si128((__m128i *)output, aesgcm_clmul_reverse(result));
+    smemclr(&core->acc, 16);
+    smemclr(&core->mask, 16);
+}
+
+#endif // WINSCP_VS
+
+#ifndef WINSCP_VS
+
+typedef struct aesgcm_clmul {
+    AESGCM_COMMON_FIELDS;
+    aesgcm_clmul_core *core;
+} aesgcm_clmul;
+
+static void aesgcm_clmul_setkey_impl(
+    aesgcm_clmul *gcm, const unsigned char *var)
+{
+    aesgcm_clmul_core_setkey(gcm->core, var);
+}
+
+static inline void aesgcm_clmul_setup(
+    aesgcm_clmul *gcm, const unsigned char *mask)
+{
+    aesgcm_clmul_core_setup(gcm->core, mask);
+}
+
+static inline void aesgcm_clmul_coeff(
+    aesgcm_clmul *gcm, const unsigned char *coeff)
+{
+    aesgcm_clmul_core_coeffs(gcm->core, coeff, 1);
+}
+
+static inline void aesgcm_clmul_coeffs(
+    aesgcm_clmul *gcm, const unsigned char *coeffs, size_t nblocks)
+{
+    aesgcm_clmul_core_coeffs(gcm->core, coeffs, nblocks);
+}
+
+static inline void aesgcm_clmul_output(
+    aesgcm_clmul *gcm, unsigned char *output)
+{
+    aesgcm_clmul_core_output(gcm->core, output);
+}
+
+#define SPECIAL_ALLOC
+static aesgcm_clmul *aesgcm_clmul_alloc(void)
+{
+    aesgcm_clmul *gcm = snew(aesgcm_clmul);
+    memset(gcm, 0, sizeof(aesgcm_clmul));
+    gcm->core = aesgcm_clmul_core_new();
+    return gcm;
+}
+
+#define SPECIAL_FREE
+static void aesgcm_clmul_free(aesgcm_clmul *gcm)
+{
+    aesgcm_clmul_core_free(gcm->core);
+    smemclr(gcm, sizeof(*gcm));
+    sfree(gcm);
+}
+
+#define BULK_COEFFS
+
+#define AESGCM_FLAVOUR clmul
+#define AESGCM_NAME "CLMUL accelerated"
+#include "aesgcm-footer.h"
+
+#endif // WINSCP_VS
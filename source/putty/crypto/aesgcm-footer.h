@@ -89,6 +89,17 @@
  *    // Zero out the state structure to avoid information leaks if the
  *    // memory is reused, and then free it.
  *    static void aesgcm_foo_free(aesgcm_foo *ctx);
+ *
+ *  - if the implementation can fold in a run of coefficients faster
+ *    than one at a time (e.g. by aggregating several multiplications
+ *    before reducing), #define BULK_COEFFS and define this function,
+ *    which will be used for whole blocks of ciphertext:
+ *
+ *    // Equivalent to calling coeff() on each of 'nblocks'
+ *    // consecutive 16-byte blocks starting at 'coeffs'.
+ *    static void aesgcm_foo_coeffs(aesgcm_foo *ctx,
+ *                                  const unsigned char *coeffs,
+ *                                  size_t nblocks);
  */
 
 #ifndef AESGCM_FLAVOUR
@@ -255,11 +266,19 @@ static void PREFIX(mac_BinarySink_write)(
             memcpy(ctx->partblk + ctx->partlen, blk, n);
             ctx->partlen += n;
         } else if (n >= 16) {
+#ifdef BULK_COEFFS
+            /*
+             * Consume all the whole blocks of ciphertext at once.
+             */
+            n &= ~(size_t)15;
+            PREFIX(coeffs)(ctx, blk, n / 16);
+#else
             /*
              * Consume a whole block of ciphertext.
              */
             PREFIX(coeff)(ctx, blk);
             n = 16;
+#endif
         }
         blk += n;
         len -= n;
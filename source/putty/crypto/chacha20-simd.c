@@ -0,0 +1,230 @@
+/*
+ * Multi-block ChaCha20 keystream generation using SSE2 and AVX2.
+ *
+ * The scalar implementation in chacha20-poly1305.c produces one
+ * 64-byte block at a time. Here each vector lane holds one word of a
+ * different block, so the 20 rounds are run on 4 (SSE2) or 8 (AVX2)
+ * consecutive counter values at once; the results are transposed back
+ * into block order and XORed straight into the data.
+ *
+ * Each function only processes whole groups of blocks, returning how
+ * many it handled and leaving the remainder to the scalar code, and
+ * advances the block counter in state[12..13] accordingly.
+ *
+ * WINSCP: Compiled by Visual Studio only (PuTTYVS), the functions are
+ * declared in chacha20-poly1305.c.
+ */
+
+#include "ssh.h"
+
+#include <immintrin.h>
+
+#if defined(__clang__) || defined(__GNUC__)
+#include <cpuid.h>
+#define GET_CPU_ID_0(out)                               \
+    __cpuid(0, (out)[0], (out)[1], (out)[2], (out)[3])
+#define GET_CPU_ID_1(out)                               \
+    __cpuid(1, (out)[0], (out)[1], (out)[2], (out)[3])
+#define GET_CPU_ID_7(out)                                               \
+    __cpuid_count(7, 0, (out)[0], (out)[1], (out)[2], (out)[3])
+#else
+#include <intrin.h>
+#define GET_CPU_ID_0(out) __cpuid(out, 0)
+#define GET_CPU_ID_1(out) __cpuid(out, 1)
+#define GET_CPU_ID_7(out) __cpuidex(out, 7, 0)
+#endif
+
+/*WINSCP static*/ bool chacha20_sse2_available(void)
+{
+    unsigned int CPUInfo[4];
+    GET_CPU_ID_1(CPUInfo);
+    return CPUInfo[3] & (1 << 26);
+}
+
+/*WINSCP static*/ bool chacha20_avx2_available(void)
+{
+    /*
+     * AVX2 needs to be supported by the CPU, and the OS has to have
+     * enabled saving of the YMM registers (OSXSAVE, and XCR0 bits 1
+     * and 2).
+     */
+    unsigned int CPUInfo[4];
+    GET_CPU_ID_0(CPUInfo);
+    if (CPUInfo[0] < 7)
+        return false;
+
+    GET_CPU_ID_1(CPUInfo);
+    if (!(CPUInfo[2] & (1 << 27)) || !(CPUInfo[2] & (1 << 28)))
+        return false;
+    if ((_xgetbv(0) & 6) != 6)
+        return false;
+
+    GET_CPU_ID_7(CPUInfo);
+    return CPUInfo[1] & (1 << 5);
+}
+
+/*
+ * Fill in the per-lane block counters for 'n' consecutive blocks
+ * starting at the one in state[12..13], and advance the state past
+ * them.
+ */
+static inline void chacha20_simd_counters(
+    uint32_t *state, uint32_t *lo, uint32_t *hi, size_t n)
+{
+    uint64_t counter = state[12] | ((uint64_t)state[13] << 32);
+    for (size_t i = 0; i < n; i++, counter++) {
+        lo[i] = (uint32_t)counter;
+        hi[i] = (uint32_t)(counter >> 32);
+    }
+    state[12] = (uint32_t)counter;
+    state[13] = (uint32_t)(counter >> 32);
+}
+
+/*
+ * The round structure is the same for both vector widths, so it's
+ * written once as macros parametrised on the type-specific
+ * operations.
+ */
+#define CHACHA20_QUARTER(ADD, XOR, ROTL, x, a, b, c, d) do {            \
+        x[a] = ADD(x[a], x[b]); x[d] = XOR(x[d], x[a]); x[d] = ROTL(x[d], 16); \
+        x[c] = ADD(x[c], x[d]); x[b] = XOR(x[b], x[c]); x[b] = ROTL(x[b], 12); \
+        x[a] = ADD(x[a], x[b]); x[d] = XOR(x[d], x[a]); x[d] = ROTL(x[d], 8); \
+        x[c] = ADD(x[c], x[d]); x[b] = XOR(x[b], x[c]); x[b] = ROTL(x[b], 7); \
+    } while (0)
+
+#define CHACHA20_ROUNDS(ADD, XOR, ROTL, x) do {                         \
+        for (int round = 0; round < 20; round += 2) {                   \
+            CHACHA20_QUARTER(ADD, XOR, ROTL, x, 0, 4, 8, 12);           \
+            CHACHA20_QUARTER(ADD, XOR, ROTL, x, 1, 5, 9, 13);           \
+            CHACHA20_QUARTER(ADD, XOR, ROTL, x, 2, 6, 10, 14);          \
+            CHACHA20_QUARTER(ADD, XOR, ROTL, x, 3, 7, 11, 15);          \
+            CHACHA20_QUARTER(ADD, XOR, ROTL, x, 0, 5, 10, 15);          \
+            CHACHA20_QUARTER(ADD, XOR, ROTL, x, 1, 6, 11, 12);          \
+            CHACHA20_QUARTER(ADD, XOR, ROTL, x, 2, 7, 8, 13);           \
+            CHACHA20_QUARTER(ADD, XOR, ROTL, x, 3, 4, 9, 14);           \
+        }                                                               \
+    } while (0)
+
+#define SSE2_ROTL(v, n) \
+    _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+
+#define AVX2_ROTL(v, n) \
+    _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+
+/*
+ * Transpose a 4x4 matrix of 32-bit words held in a..d (within each
+ * 128-bit lane, for the AVX2 version).
+ */
+#define TRANSPOSE4(UNPACKLO32, UNPACKHI32, UNPACKLO64, UNPACKHI64,      \
+                   T, a, b, c, d) do {                                  \
+        T t0_ = UNPACKLO32(a, b), t1_ = UNPACKLO32(c, d);               \
+        T t2_ = UNPACKHI32(a, b), t3_ = UNPACKHI32(c, d);               \
+        a = UNPACKLO64(t0_, t1_); b = UNPACKHI64(t0_, t1_);             \
+        c = UNPACKLO64(t2_, t3_); d = UNPACKHI64(t2_, t3_);             \
+    } while (0)
+
+static inline void chacha20_sse2_xor_group(
+    const uint32_t *state, const uint32_t *lo, const uint32_t *hi,
+    unsigned char *blk)
+{
+    __m128i init[16], x[16];
+
+    for (size_t i = 0; i < 16; i++)
+        init[i] = _mm_set1_epi32((int)state[i]);
+    init[12] = _mm_loadu_si128((const __m128i *)lo);
+    init[13] = _mm_loadu_si128((const __m128i *)hi);
+
+    for (size_t i = 0; i < 16; i++)
+        x[i] = init[i];
+
+    CHACHA20_ROUNDS(_mm_add_epi32, _mm_xor_si128, SSE2_ROTL, x);
+
+    for (size_t i = 0; i < 16; i++)
+        x[i] = _mm_add_epi32(x[i], init[i]);
+
+    for (size_t g = 0; g < 4; g++) {
+        __m128i *v = x + 4 * g;
+        TRANSPOSE4(_mm_unpacklo_epi32, _mm_unpackhi_epi32,
+                   _mm_unpacklo_epi64, _mm_unpackhi_epi64,
+                   __m128i, v[0], v[1], v[2], v[3]);
+        for (size_t b = 0; b < 4; b++) {
+            __m128i *p = (__m128i *)(blk + 64 * b + 16 * g);
+            _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), v[b]));
+        }
+    }
+
+    smemclr(x, sizeof(x));
+}
+
+/*WINSCP static*/ size_t chacha20_sse2_blocks(
+    uint32_t *state, unsigned char *blk, size_t nblocks)
+{
+    size_t done = 0;
+    uint32_t lo[4], hi[4];
+
+    for (; nblocks - done >= 4; done += 4, blk += 4 * 64) {
+        chacha20_simd_counters(state, lo, hi, 4);
+        chacha20_sse2_xor_group(state, lo, hi, blk);
+    }
+
+    return done;
+}
+
+static inline void chacha20_avx2_xor_group(
+    const uint32_t *state, const uint32_t *lo, const uint32_t *hi,
+    unsigned char *blk)
+{
+    __m256i init[16], x[16];
+
+    for (size_t i = 0; i < 16; i++)
+        init[i] = _mm256_set1_epi32((int)state[i]);
+    init[12] = _mm256_loadu_si256((const __m256i *)lo);
+    init[13] = _mm256_loadu_si256((const __m256i *)hi);
+
+    for (size_t i = 0; i < 16; i++)
+        x[i] = init[i];
+
+    CHACHA20_ROUNDS(_mm256_add_epi32, _mm256_xor_si256, AVX2_ROTL, x);
+
+    for (size_t i = 0; i < 16; i++)
+        x[i] = _mm256_add_epi32(x[i], init[i]);
+
+    /*
+     * After transposing within each 128-bit lane, the low lane of
+     * v[b] holds 16 bytes of block b, and the high lane the same 16
+     * bytes of block b+4.
+     */
+    for (size_t g = 0; g < 4; g++) {
+        __m256i *v = x + 4 * g;
+        TRANSPOSE4(_mm256_unpacklo_epi32, _mm256_unpackhi_epi32,
+                   _mm256_unpacklo_epi64, _mm256_unpackhi_epi64,
+                   __m256i, v[0], v[1], v[2], v[3]);
+        for (size_t b = 0; b < 4; b++) {
+            __m128i *p0 = (__m128i *)(blk + 64 * b + 16 * g);
+            __m128i *p1 = (__m128i *)(blk + 64 * (b + 4) + 16 * g);
+            _mm_storeu_si128(p0, _mm_xor_si128(
+                _mm_loadu_si128(p0), _mm256_castsi256_si128(v[b])));
+            _mm_storeu_si128(p1, _mm_xor_si128(
+                _mm_loadu_si128(p1), _mm256_extracti128_si256(v[b], 1)));
+        }
+    }
+
+    smemclr(x, sizeof(x));
+}
+
+/*WINSCP static*/ size_t chacha20_avx2_blocks(
+    uint32_t *state, unsigned char *blk, size_t nblocks)
+{
+    size_t done = 0;
+    uint32_t lo[8], hi[8];
+
+    for (; nblocks - done >= 8; done += 8, blk += 8 * 64) {
+        chacha20_simd_counters(state, lo, hi, 8);
+        chacha20_avx2_xor_group(state, lo, hi, blk);
+    }
+
+    /* Avoid the AVX-SSE transition penalty in whatever runs next */
+    _mm256_zeroupper();
+
+    return done + chacha20_sse2_blocks(state, blk, nblocks - done);
+}
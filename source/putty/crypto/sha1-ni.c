@@ -0,0 +1,212 @@
+/*
+ * Hardware-accelerated implementation of SHA-1 using x86 SHA-NI.
+ */
+
+#include "ssh.h"
+#include "sha1.h"
+
+#include <immintrin.h>
+
+#if defined(__clang__) || defined(__GNUC__)
+#include <cpuid.h>
+#define GET_CPU_ID_0(out)                               \
+    __cpuid(0, (out)[0], (out)[1], (out)[2], (out)[3])
+#define GET_CPU_ID_7(out)                                               \
+    __cpuid_count(7, 0, (out)[0], (out)[1], (out)[2], (out)[3])
+#else
+#include <intrin.h>
+#define GET_CPU_ID_0(out) __cpuid(out, 0)
+#define GET_CPU_ID_7(out) __cpuidex(out, 7, 0)
+#endif
+
+// WINSCP
+// Same workaround as in aes-ni.c, constants must not end up in .rdata.
+#define _MM_SETR_EPI8(a0, a1, a2, a3, a4, a5, a6, a7, a8, a9, aa, ab, ac, ad, ae, af) \
+    { (char)a0, (char)a1, (char)a2, (char)a3, (char)a4, (char)a5, (char)a6, (char)a7, \
+      (char)a8, (char)a9, (char)aa, (char)ab, (char)ac, (char)ad, (char)ae, (char)af }
+
+static bool sha1_ni_available(void)
+{
+    /*
+     * Determine if SHA is available on this CPU, by checking the
+     * SHA bit in leaf 7 of CPUID.
+     */
+    unsigned int CPUInfo[4];
+    GET_CPU_ID_0(CPUInfo);
+    if (CPUInfo[0] < 7)
+        return false;
+
+    GET_CPU_ID_7(CPUInfo);
+    return CPUInfo[1] & (1 << 29);
+}
+
+/*
+ * Compute the next 4 words of the message schedule, from the previous
+ * 16 words held in four vectors (oldest first).
+ */
+static inline __m128i sha1_ni_schedule(
+    __m128i w0, __m128i w1, __m128i w2, __m128i w3)
+{
+    __m128i t = _mm_sha1msg1_epu32(w0, w1);
+    t = _mm_xor_si128(t, w2);
+    return _mm_sha1msg2_epu32(t, w3);
+}
+
+/*
+ * Four rounds of one stage of the compression function. The stage
+ * index has to be a compile-time constant, hence a macro.
+ *
+ * 'e' holds the E value to be fed into these rounds (which, after the
+ * first group, still needs rotating by sha1nexte), and on exit holds
+ * the ABCD value on entry, to become the next group's E.
+ */
+#define SHA1_NI_ROUNDS4(abcd, e, w, first, stage) do {          \
+        __m128i e_next_ = (abcd);                               \
+        __m128i e_in_ = (first) ? _mm_add_epi32((e), (w)) :     \
+            _mm_sha1nexte_epu32((e), (w));                      \
+        abcd = _mm_sha1rnds4_epu32(abcd, e_in_, stage);         \
+        e = e_next_;                                            \
+    } while (0)
+
+/*
+ * The core state is kept in the order the instructions want it: the
+ * first vector holds words A,B,C,D (A in the top lane) and the top
+ * lane of the second holds E.
+ */
+static inline void sha1_ni_block(__m128i *core, const uint8_t *p)
+{
+    const __m128i bswap = _MM_SETR_EPI8(15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0); // WINSCP
+    const __m128i *block = (const __m128i *)p;
+
+    __m128i abcd = core[0], e = core[1];
+    __m128i w[4];
+    size_t i;
+
+    for (i = 0; i < 4; i++) {
+        w[i] = _mm_shuffle_epi8(_mm_loadu_si128(block + i), bswap);
+        SHA1_NI_ROUNDS4(abcd, e, w[i], i == 0, 0);
+    }
+
+#define SHA1_NI_SCHEDULED_ROUNDS4(stage) do {                           \
+        w[i & 3] = sha1_ni_schedule(                                    \
+            w[i & 3], w[(i+1) & 3], w[(i+2) & 3], w[(i+3) & 3]);        \
+        SHA1_NI_ROUNDS4(abcd, e, w[i & 3], false, stage);               \
+    } while (0)
+
+    for (; i < 5; i++)
+        SHA1_NI_SCHEDULED_ROUNDS4(0);
+    for (; i < 10; i++)
+        SHA1_NI_SCHEDULED_ROUNDS4(1);
+    for (; i < 15; i++)
+        SHA1_NI_SCHEDULED_ROUNDS4(2);
+    for (; i < 20; i++)
+        SHA1_NI_SCHEDULED_ROUNDS4(3);
+
+#undef SHA1_NI_SCHEDULED_ROUNDS4
+
+    core[0] = _mm_add_epi32(core[0], abcd);
+    core[1] = _mm_sha1nexte_epu32(e, core[1]);
+}
+
+typedef struct sha1_ni {
+    /*
+     * The core state is stored as two __m128i vectors, which need to
+     * be 16-byte aligned, so we over-allocate like aes_ni_new does.
+     */
+    __m128i core[2];
+    sha1_block blk;
+    void *pointer_to_free;
+    BinarySink_IMPLEMENTATION;
+    ssh_hash hash;
+} sha1_ni;
+
+static void sha1_ni_write(BinarySink *bs, const void *vp, size_t len);
+
+static sha1_ni *sha1_ni_alloc(void)
+{
+    void *allocation = smalloc(sizeof(sha1_ni) + 15);
+    uintptr_t alloc_address = (uintptr_t)allocation;
+    uintptr_t aligned_address = (alloc_address + 15) & ~15;
+    sha1_ni *s = (sha1_ni *)aligned_address;
+    s->pointer_to_free = allocation;
+    return s;
+}
+
+static ssh_hash *sha1_ni_new(const ssh_hashalg *alg)
+{
+    const struct sha1_extra *extra = (const struct sha1_extra *)alg->extra;
+    if (!check_availability(extra))
+        return NULL;
+
+    { // WINSCP
+    sha1_ni *s = sha1_ni_alloc();
+
+    s->hash.vt = alg;
+    BinarySink_INIT(s, sha1_ni_write);
+    BinarySink_DELEGATE_INIT(&s->hash, s);
+    return &s->hash;
+    } // WINSCP
+}
+
+static void sha1_ni_reset(ssh_hash *hash)
+{
+    sha1_ni *s = container_of(hash, sha1_ni, hash);
+
+    /* Initialise the core vectors in their storage order */
+    s->core[0] = _mm_shuffle_epi32(
+        _mm_loadu_si128((const __m128i *)sha1_initial_state), 0x1B);
+    s->core[1] = _mm_insert_epi32(
+        _mm_setzero_si128(), (int)sha1_initial_state[4], 3);
+
+    sha1_block_setup(&s->blk);
+}
+
+static void sha1_ni_copyfrom(ssh_hash *hcopy, ssh_hash *horig)
+{
+    sha1_ni *copy = container_of(hcopy, sha1_ni, hash);
+    sha1_ni *orig = container_of(horig, sha1_ni, hash);
+
+    void *ptf_save = copy->pointer_to_free;
+    *copy = *orig; /* structure copy */
+    copy->pointer_to_free = ptf_save;
+
+    BinarySink_COPIED(copy);
+    BinarySink_DELEGATE_INIT(&copy->hash, copy);
+}
+
+static void sha1_ni_free(ssh_hash *hash)
+{
+    sha1_ni *s = container_of(hash, sha1_ni, hash);
+
+    void *ptf = s->pointer_to_free;
+    smemclr(s, sizeof(*s));
+    sfree(ptf);
+}
+
+static void sha1_ni_write(BinarySink *bs, const void *vp, size_t len)
+{
+    sha1_ni *s = BinarySink_DOWNCAST(bs, sha1_ni);
+
+    while (len > 0)
+        if (sha1_block_write(&s->blk, &vp, &len))
+            sha1_ni_block(s->core, s->blk.block);
+}
+
+static void sha1_ni_digest(ssh_hash *hash, uint8_t *digest)
+{
+    sha1_ni *s = container_of(hash, sha1_ni, hash);
+
+    sha1_block_pad(&s->blk, BinarySink_UPCAST(s));
+
+    { // WINSCP
+    /* Byte-swap the core registers into the output endianness */
+    const __m128i bswap = _MM_SETR_EPI8(15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0); // WINSCP
+    __m128i abcd = _mm_shuffle_epi8(s->core[0], bswap);
+    uint32_t e = (uint32_t)_mm_extract_epi32(s->core[1], 3);
+
+    _mm_storeu_si128((__m128i *)digest, abcd);
+    PUT_32BIT_MSB_FIRST(digest + 16, e);
+    } // WINSCP
+}
+
+SHA1_VTABLE(ni, "SHA-NI accelerated");
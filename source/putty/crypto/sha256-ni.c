@@ -0,0 +1,213 @@
+/*
+ * Hardware-accelerated implementation of SHA-256 using x86 SHA-NI.
+ */
+
+// WINSCP
+// Compiled by Visual Studio only (PuTTYVS). The block helpers from
+// sha256.h are defined in sha256-sw.c there, so only declare them here.
+#define WINSCP_SHA256_NI
+
+#include "ssh.h"
+#include "sha256.h"
+
+#include <immintrin.h>
+
+#if defined(__clang__) || defined(__GNUC__)
+#include <cpuid.h>
+#define GET_CPU_ID_0(out)                               \
+    __cpuid(0, (out)[0], (out)[1], (out)[2], (out)[3])
+#define GET_CPU_ID_7(out)                                               \
+    __cpuid_count(7, 0, (out)[0], (out)[1], (out)[2], (out)[3])
+#else
+#include <intrin.h>
+#define GET_CPU_ID_0(out) __cpuid(out, 0)
+#define GET_CPU_ID_7(out) __cpuidex(out, 7, 0)
+#endif
+
+// WINSCP
+// Same workaround as in aes-ni.c, constants must not end up in .rdata.
+#define _MM_SETR_EPI8(a0, a1, a2, a3, a4, a5, a6, a7, a8, a9, aa, ab, ac, ad, ae, af) \
+    { (char)a0, (char)a1, (char)a2, (char)a3, (char)a4, (char)a5, (char)a6, (char)a7, \
+      (char)a8, (char)a9, (char)aa, (char)ab, (char)ac, (char)ad, (char)ae, (char)af }
+
+static bool sha256_ni_available(void)
+{
+    /*
+     * Determine if SHA is available on this CPU, by checking the
+     * SHA bit in leaf 7 of CPUID. SHA-NI also relies on SSSE3 and
+     * SSE4.1, which every CPU implementing it has.
+     */
+    unsigned int CPUInfo[4];
+    GET_CPU_ID_0(CPUInfo);
+    if (CPUInfo[0] < 7)
+        return false;
+
+    GET_CPU_ID_7(CPUInfo);
+    return CPUInfo[1] & (1 << 29);
+}
+
+/*
+ * Compute the next 4 words of the message schedule, from the previous
+ * 16 words held in four vectors (oldest first).
+ */
+static inline __m128i sha256_ni_schedule(
+    __m128i w0, __m128i w1, __m128i w2, __m128i w3)
+{
+    __m128i t = _mm_sha256msg1_epu32(w0, w1);
+    t = _mm_add_epi32(t, _mm_alignr_epi8(w3, w2, 4));
+    return _mm_sha256msg2_epu32(t, w3);
+}
+
+/*
+ * Four rounds of the compression function, given four message words
+ * already summed with the corresponding round constants.
+ */
+#define SHA256_NI_ROUNDS4(abef, cdgh, wk) do {                  \
+        __m128i wk_ = (wk);                                     \
+        cdgh = _mm_sha256rnds2_epu32(cdgh, abef, wk_);          \
+        wk_ = _mm_shuffle_epi32(wk_, 0x0E);                     \
+        abef = _mm_sha256rnds2_epu32(abef, cdgh, wk_);          \
+    } while (0)
+
+/*
+ * The core state is kept in the order the instructions want it: the
+ * first vector holds words A,B,E,F (A in the top lane) and the second
+ * C,D,G,H.
+ */
+static inline void sha256_ni_block(__m128i *core, const uint8_t *p)
+{
+    const __m128i bswap = _MM_SETR_EPI8(3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12); // WINSCP
+    const __m128i *block = (const __m128i *)p;
+    const __m128i *k = (const __m128i *)sha256_round_constants;
+
+    __m128i abef = core[0], cdgh = core[1];
+    __m128i w[4];
+
+    for (size_t i = 0; i < 4; i++) {
+        w[i] = _mm_shuffle_epi8(_mm_loadu_si128(block + i), bswap);
+        SHA256_NI_ROUNDS4(
+            abef, cdgh, _mm_add_epi32(w[i], _mm_loadu_si128(k + i)));
+    }
+
+    for (size_t i = 4; i < SHA256_ROUNDS / 4; i++) {
+        w[i & 3] = sha256_ni_schedule(
+            w[i & 3], w[(i+1) & 3], w[(i+2) & 3], w[(i+3) & 3]);
+        SHA256_NI_ROUNDS4(
+            abef, cdgh, _mm_add_epi32(w[i & 3], _mm_loadu_si128(k + i)));
+    }
+
+    core[0] = _mm_add_epi32(core[0], abef);
+    core[1] = _mm_add_epi32(core[1], cdgh);
+}
+
+typedef struct sha256_ni {
+    /*
+     * The core state is stored as two __m128i vectors, which need to
+     * be 16-byte aligned, so we over-allocate like aes_ni_new does.
+     */
+    __m128i core[2];
+    sha256_block blk;
+    void *pointer_to_free;
+    BinarySink_IMPLEMENTATION;
+    ssh_hash hash;
+} sha256_ni;
+
+static void sha256_ni_write(BinarySink *bs, const void *vp, size_t len);
+
+static sha256_ni *sha256_ni_alloc(void)
+{
+    void *allocation = smalloc(sizeof(sha256_ni) + 15);
+    uintptr_t alloc_address = (uintptr_t)allocation;
+    uintptr_t aligned_address = (alloc_address + 15) & ~15;
+    sha256_ni *s = (sha256_ni *)aligned_address;
+    s->pointer_to_free = allocation;
+    return s;
+}
+
+static ssh_hash *sha256_ni_new(const ssh_hashalg *alg)
+{
+    const struct sha256_extra *extra = (const struct sha256_extra *)alg->extra;
+    if (!check_availability(extra))
+        return NULL;
+
+    { // WINSCP
+    sha256_ni *s = sha256_ni_alloc();
+
+    s->hash.vt = alg;
+    BinarySink_INIT(s, sha256_ni_write);
+    BinarySink_DELEGATE_INIT(&s->hash, s);
+    return &s->hash;
+    } // WINSCP
+}
+
+static void sha256_ni_reset(ssh_hash *hash)
+{
+    sha256_ni *s = container_of(hash, sha256_ni, hash);
+
+    /* Rearrange the initial state A..H into ABEF and CDGH */
+    __m128i dcba = _mm_loadu_si128((const __m128i *)sha256_initial_state);
+    __m128i hgfe = _mm_loadu_si128((const __m128i *)sha256_initial_state + 1);
+    __m128i cdab = _mm_shuffle_epi32(dcba, 0xB1);
+    __m128i efgh = _mm_shuffle_epi32(hgfe, 0x1B);
+    s->core[0] = _mm_alignr_epi8(cdab, efgh, 8);
+    s->core[1] = _mm_blend_epi16(efgh, cdab, 0xF0);
+
+    sha256_block_setup(&s->blk);
+}
+
+static void sha256_ni_copyfrom(ssh_hash *hcopy, ssh_hash *horig)
+{
+    sha256_ni *copy = container_of(hcopy, sha256_ni, hash);
+    sha256_ni *orig = container_of(horig, sha256_ni, hash);
+
+    void *ptf_save = copy->pointer_to_free;
+    *copy = *orig; /* structure copy */
+    copy->pointer_to_free = ptf_save;
+
+    BinarySink_COPIED(copy);
+    BinarySink_DELEGATE_INIT(&copy->hash, copy);
+}
+
+static void sha256_ni_free(ssh_hash *hash)
+{
+    sha256_ni *s = container_of(hash, sha256_ni, hash);
+
+    void *ptf = s->pointer_to_free;
+    smemclr(s, sizeof(*s));
+    sfree(ptf);
+}
+
+static void sha256_ni_write(BinarySink *bs, const void *vp, size_t len)
+{
+    sha256_ni *s = BinarySink_DOWNCAST(bs, sha256_ni);
+
+    while (len > 0)
+        if (sha256_block_write(&s->blk, &vp, &len))
+            sha256_ni_block(s->core, s->blk.block);
+}
+
+static void sha256_ni_digest(ssh_hash *hash, uint8_t *digest)
+{
+    sha256_ni *s = container_of(hash, sha256_ni, hash);
+
+    sha256_block_pad(&s->blk, BinarySink_UPCAST(s));
+
+    { // WINSCP
+    /* Rearrange the words into the output order */
+    __m128i feba = _mm_shuffle_epi32(s->core[0], 0x1B);
+    __m128i dchg = _mm_shuffle_epi32(s->core[1], 0xB1);
+    __m128i dcba = _mm_blend_epi16(feba, dchg, 0xF0);
+    __m128i hgfe = _mm_alignr_epi8(dchg, feba, 8);
+
+    /* Byte-swap them into the output endianness */
+    const __m128i bswap = _MM_SETR_EPI8(3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12); // WINSCP
+    dcba = _mm_shuffle_epi8(dcba, bswap);
+    hgfe = _mm_shuffle_epi8(hgfe, bswap);
+
+    /* And store them */
+    _mm_storeu_si128((__m128i *)digest, dcba);
+    _mm_storeu_si128((__m128i *)digest + 1, hgfe);
+    } // WINSCP
+}
+
+SHA256_VTABLE(ni, "SHA-NI accelerated");
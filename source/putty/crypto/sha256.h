@@ -34,7 +34,6 @@ static inline bool check_availability(const struct sha256_extra *extra)
  * Macro to define a SHA-256 vtable together with its 'extra'
  * structure.
  */
-// WINSCP Restore use of impl_display, once we have HW-accelerated variant
 #define SHA256_VTABLE(impl_c, impl_display)                             \
     static struct sha256_extra_mutable sha256_ ## impl_c ## _extra_mut; \
     static const struct sha256_extra sha256_ ## impl_c ## _extra = {    \
@@ -51,7 +50,7 @@ static inline bool check_availability(const struct sha256_extra *extra)
         /*.free =*/ sha256_ ## impl_c ## _free,                             \
         /*.hlen =*/ 32,                                                     \
         /*.blocklen =*/ 64,                                                 \
-        HASHALG_NAMES_BARE("SHA-256"),               \
+        HASHALG_NAMES_ANNOTATED("SHA-256", impl_display),               \
         /*.extra =*/ &sha256_ ## impl_c ## _extra,                          \
     }
 
@@ -73,7 +72,8 @@ static inline void sha256_block_setup(sha256_block *blk)
     blk->len = 0;
 }
 
-#ifdef WINSCP_VS
+// WINSCP Defined once for the PuTTYVS library, in sha256-sw.c
+#if defined(WINSCP_VS) && !defined(WINSCP_SHA256_NI)
 
 /*WINSCP static inline*/ bool sha256_block_write(
     sha256_block *blk, const void **vdata, size_t *len)
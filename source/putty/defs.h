@@ -35,6 +35,9 @@
 
 #ifdef WINSCP
 #define HAVE_AES_NI 1
+#define HAVE_SHA_NI 1
+#define HAVE_CLMUL 1
+#define HAVE_CHACHA20_SIMD 1
 #endif
 
 #if (!defined WINSCP) && defined _MSC_VER && _MSC_VER < 1800
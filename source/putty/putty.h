@@ -2068,6 +2068,17 @@ NORETURN void cleanup_exit(int);
     X(STR, NONE, srcaddr) \
     X(BOOL, NONE, force_remote_cmd2) \
     X(BOOL, NONE, change_password) \
+    /*                                                                \
+     * ssh_adaptive_window makes SSH-2 channels advertise a larger    \
+     * maximum packet size and grow their window with the measured    \
+     * bandwidth-delay product.                                       \
+     */ \
+    X(BOOL, NONE, ssh_adaptive_window) \
+    /*                                                                \
+     * compression_level selects the zlib compression level, 1 to 9,  \
+     * with 0 meaning the default.                                    \
+     */ \
+    X(INT, NONE, compression_level) \
     /* MPEXT END */ \
     /* end of list */
 
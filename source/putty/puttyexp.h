@@ -8,6 +8,7 @@
 int is_ssh(Plug * plug);
 int get_ssh_version(Backend * be);
 Seat * get_ssh_seat(Plug * plug);
+bool is_ssh_shared_downstream(Backend * be);
 #ifdef WINSCP_SSH
 const ssh_cipher * get_cscipher(Backend * be);
 const ssh_cipher * get_sccipher(Backend * be);
@@ -17,6 +18,7 @@ const struct ssh_decompressor * get_sccomp(Backend * be);
 #define WINSCP_QUERY_REMMAXPKT 1
 #define WINSCP_QUERY_MAIN_CHANNEL 2
 #define WINSCP_QUERY_TIMER 3
+#define WINSCP_QUERY_LOCMAXPKT 4
 unsigned int winscp_query(Backend * be, int query);
 void md5checksum(const char * buffer, int len, unsigned char output[16]);
 typedef const struct ssh_keyalg * cp_ssh_keyalg;
@@ -24,6 +26,11 @@ void get_hostkey_algs(int type, int * count, cp_ssh_keyalg ** sign_keys);
 void get_macs(int * count, const struct ssh2_macalg *** amacs);
 int have_any_ssh2_hostkey(Seat * seat, const char * host, int port);
 
+// from sharing.c
+
+int is_ssh_share(Plug * plug);
+Seat * get_ssh_share_seat(Plug * plug);
+
 // from wingss.c
 
 #include "ssh\gss.h"
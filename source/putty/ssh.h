@@ -42,9 +42,19 @@ struct ssh_channel;
  *    of data we're willing to receive in a single SSH2 channel
  *    data message.
  *
+ *  - OUR_V2_BIGMAXPKT (WINSCP) is the maximum packet size we send
+ *    instead of OUR_V2_MAXPKT when the adaptive window is enabled
+ *    (CONF_ssh_adaptive_window), unless the remote end is known to
+ *    ignore it (BUG_SSH2_MAXPKT).
+ *
+ *  - OUR_V2_MAXWIN (WINSCP) is the largest window the adaptive
+ *    window is allowed to grow to on channels of a non-simple
+ *    connection.  It must be <= INT_MAX.
+ *
  *  - OUR_V2_PACKETLIMIT is actually the maximum size of SSH
  *    _packet_ we're prepared to cope with.  It must be a multiple
- *    of the cipher block size, and must be at least 35000.
+ *    of the cipher block size, and must be at least 35000, and
+ *    leave room for a data message of OUR_V2_BIGMAXPKT.
  */
 
 #define SSH1_BUFFER_LIMIT 32768
@@ -52,7 +62,9 @@ struct ssh_channel;
 #define OUR_V2_WINSIZE 16384
 #define OUR_V2_BIGWIN 0x7fffffff
 #define OUR_V2_MAXPKT 0x4000UL
-#define OUR_V2_PACKETLIMIT 0x9000UL
+#define OUR_V2_BIGMAXPKT 0x40000UL // WINSCP
+#define OUR_V2_MAXWIN 0x4000000 // WINSCP
+#define OUR_V2_PACKETLIMIT 0x48000UL // WINSCP (was 0x9000UL)
 
 typedef struct PacketQueueNode PacketQueueNode;
 struct PacketQueueNode {
@@ -1073,7 +1085,9 @@ struct ssh_compression_alg {
     /* For zlib@openssh.com: if non-NULL, this name will be considered once
      * userauth has completed successfully. */
     const char *delayed_name;
-    ssh_compressor *(*compress_new)(void);
+    /* WINSCP: level as for zlib, 1 (fastest) to 9 (best), or 0 for
+     * the default */
+    ssh_compressor *(*compress_new)(int level);
     void (*compress_free)(ssh_compressor *);
     void (*compress)(ssh_compressor *, const unsigned char *block, int len,
                      unsigned char **outblock, int *outlen,
@@ -1086,8 +1100,8 @@ struct ssh_compression_alg {
 };
 
 static inline ssh_compressor *ssh_compressor_new(
-    const ssh_compression_alg *alg)
-{ return alg->compress_new(); }
+    const ssh_compression_alg *alg, int level) // WINSCP
+{ return alg->compress_new(level); }
 static inline ssh_decompressor *ssh_decompressor_new(
     const ssh_compression_alg *alg)
 { return alg->decompress_new(); }
@@ -139,6 +139,7 @@ void ssh2_bpp_new_outgoing_crypto(
     const ssh_cipheralg *cipher, const void *ckey, const void *iv,
     const ssh2_macalg *mac, bool etm_mode, const void *mac_key,
     const ssh_compression_alg *compression, bool delayed_compression,
+    int compression_level, // WINSCP
     bool reset_sequence_number);
 void ssh2_bpp_new_incoming_crypto(
     BinaryPacketProtocol *bpp,
@@ -15,6 +15,7 @@ struct ssh2_bpp_direction {
     ssh2_mac *mac;
     bool etm_mode;
     const ssh_compression_alg *pending_compression;
+    int compression_level; // WINSCP
 };
 
 struct ssh2_bpp_state {
@@ -108,6 +109,7 @@ void ssh2_bpp_new_outgoing_crypto(
     const ssh_cipheralg *cipher, const void *ckey, const void *iv,
     const ssh2_macalg *mac, bool etm_mode, const void *mac_key,
     const ssh_compression_alg *compression, bool delayed_compression,
+    int compression_level, // WINSCP
     bool reset_sequence_number)
 {
     struct ssh2_bpp_state *s;
@@ -115,6 +117,7 @@ void ssh2_bpp_new_outgoing_crypto(
     s = container_of(bpp, struct ssh2_bpp_state, bpp);
 
     ssh2_bpp_free_outgoing_crypto(s);
+    s->out.compression_level = compression_level; // WINSCP
 
     if (cipher) {
         s->out.cipher = ssh_cipher_new(cipher);
@@ -167,7 +170,7 @@ void ssh2_bpp_new_outgoing_crypto(
         /* 'compression' is always non-NULL, because no compression is
          * indicated by ssh_comp_none. But this setup call may return a
          * null out_comp. */
-        s->out_comp = ssh_compressor_new(compression);
+        s->out_comp = ssh_compressor_new(compression, compression_level); // WINSCP
 
         if (s->out_comp)
             bpp_logevent("Initialised %s compression",
@@ -265,7 +268,7 @@ static void ssh2_bpp_enable_pending_compression(struct ssh2_bpp_state *s)
         s->in.pending_compression = NULL;
     }
     if (s->out.pending_compression) {
-        s->out_comp = ssh_compressor_new(s->out.pending_compression);
+        s->out_comp = ssh_compressor_new(s->out.pending_compression, s->out.compression_level); // WINSCP
         bpp_logevent("Initialised delayed %s compression",
                      ssh_compressor_alg(s->out_comp)->text_name);
         s->out.pending_compression = NULL;
@@ -418,8 +421,10 @@ static void ssh2_bpp_handle_input(BinaryPacketProtocol *bpp)
 
             /*
              * Allocate the packet to return, now we know its length.
+             * (WINSCP: Not the maximum length, which is large now.)
              */
-            s->pktin = snew_plus(PktIn, OUR_V2_PACKETLIMIT + s->maclen);
+            s->maxlen = s->packetlen + s->maclen;
+            s->pktin = snew_plus(PktIn, s->maxlen);
             s->pktin->qnode.prev = s->pktin->qnode.next = NULL;
             s->pktin->type = 0;
             s->pktin->qnode.on_free_queue = false;
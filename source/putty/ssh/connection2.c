@@ -22,6 +22,7 @@ static void ssh2_connection_special_cmd(PacketProtocolLayer *ppl,
                                         SessionSpecialCode code, int arg);
 static void ssh2_connection_reconfigure(PacketProtocolLayer *ppl, Conf *conf);
 static unsigned int ssh2_connection_winscp_query(PacketProtocolLayer *ppl, int query);
+static unsigned long ssh2_our_maxpkt(struct ssh2_connection_state *s); // WINSCP
 
 static const PacketProtocolLayerVtable ssh2_connection_vtable = {
     // WINSCP
@@ -258,6 +259,7 @@ PacketProtocolLayer *ssh2_connection_new(
     s->conf = conf_copy(conf);
 
     s->ssh_is_simple = is_simple;
+    s->adaptive_window = conf_get_bool(s->conf, CONF_ssh_adaptive_window); // WINSCP
 
     /*
      * If the ssh_no_shell option is enabled, we disable the usual
@@ -453,7 +455,7 @@ static bool ssh2_connection_filter_queue(struct ssh2_connection_state *s)
                 put_uint32(pktout, c->remoteid);
                 put_uint32(pktout, c->localid);
                 put_uint32(pktout, c->locwindow);
-                put_uint32(pktout, OUR_V2_MAXPKT); /* our max pkt size */
+                put_uint32(pktout, ssh2_our_maxpkt(s)); /* our max pkt size */ // WINSCP
                 pq_push(s->ppl.out_pq, pktout);
             }
 
@@ -560,6 +562,7 @@ static bool ssh2_connection_filter_queue(struct ssh2_connection_state *s)
                     int bufsize;
                     c->locwindow -= data.len;
                     c->remlocwin -= data.len;
+                    c->locreceived += data.len; // WINSCP
                     if (ext_type != 0 && ext_type != SSH2_EXTENDED_DATA_STDERR)
                         data.len = 0; /* ignore unknown extended data */
                     bufsize = chan_send(
@@ -878,10 +881,19 @@ static bool ssh2_connection_filter_queue(struct ssh2_connection_state *s)
     }
 }
 
+// WINSCP
+struct winadj_ctx {
+    unsigned size;                     /* the window being opened */
+    unsigned long sent;                /* GETTICKCOUNT() when sent */
+    size_t received;                   /* c->locreceived when sent */
+};
+
 static void ssh2_handle_winadj_response(struct ssh2_channel *c,
                                         PktIn *pktin, void *ctx)
 {
-    unsigned *sizep = ctx;
+    struct winadj_ctx *winadj = ctx; // WINSCP
+    struct ssh2_connection_state *s = c->connlayer; // WINSCP
+    PacketProtocolLayer *ppl = &s->ppl; /* for ppl_logevent */ // WINSCP
 
     /*
      * Winadj responses should always be failures. However, at least
@@ -891,8 +903,7 @@ static void ssh2_handle_winadj_response(struct ssh2_channel *c,
      * life, we don't worry about what kind of response we got.
      */
 
-    c->remlocwin += *sizep;
-    sfree(sizep);
+    c->remlocwin += winadj->size;
     /*
      * winadj messages are only sent when the window is fully open, so
      * if we get an ack of one, we know any pending unthrottle is
@@ -900,6 +911,46 @@ static void ssh2_handle_winadj_response(struct ssh2_channel *c,
      */
     if (c->throttle_state == UNTHROTTLING)
         c->throttle_state = UNTHROTTLED;
+
+    /*
+     * WINSCP: The data received between sending the winadj and
+     * getting its response is what the remote end could send in one
+     * round trip, i.e. the bandwidth-delay product as limited by our
+     * window. If that came close to the whole window, the window is
+     * what limits the throughput, so make it large enough for twice
+     * the measured amount.
+     */
+    if (pktin && s->adaptive_window && c->throttle_state == UNTHROTTLED &&
+        c->locmaxwin < OUR_V2_MAXWIN) {
+        size_t inflight = c->locreceived - winadj->received;
+        if (inflight >= (size_t)c->locmaxwin / 3 * 2) {
+            size_t newmaxwin = inflight * 2;
+            if (newmaxwin > (size_t)OUR_V2_MAXWIN)
+                newmaxwin = (size_t)OUR_V2_MAXWIN;
+            if (newmaxwin > (size_t)c->locmaxwin) {
+                c->locmaxwin = (int)newmaxwin;
+                ppl_logevent("Increasing window of channel %u to %d bytes "
+                             "(%u bytes received in %lu ms round trip)",
+                             c->localid, c->locmaxwin, (unsigned)inflight,
+                             GETTICKCOUNT() - winadj->sent);
+            }
+        }
+    }
+    sfree(winadj);
+}
+
+// WINSCP
+/*
+ * The maximum packet size we advertise for our channels. With the
+ * adaptive window, it is raised so that bulk data arrives in fewer and
+ * larger messages, but not if the remote end is known to ignore it
+ * anyway (in which case ssh2_set_window limits the window instead).
+ */
+static unsigned long ssh2_our_maxpkt(struct ssh2_connection_state *s)
+{
+    if (s->adaptive_window && !(s->ppl.remote_bugs & BUG_SSH2_MAXPKT))
+        return OUR_V2_BIGMAXPKT;
+    return OUR_V2_MAXPKT;
 }
 
 static void ssh2_set_window(struct ssh2_channel *c, int newwin)
@@ -941,7 +992,7 @@ static void ssh2_set_window(struct ssh2_channel *c, int newwin)
      */
     if (newwin / 2 >= c->locwindow) {
         PktOut *pktout;
-        unsigned *up;
+        struct winadj_ctx *up; // WINSCP
 
         /*
          * In order to keep track of how much window the client
@@ -955,8 +1006,10 @@ static void ssh2_set_window(struct ssh2_channel *c, int newwin)
          */
         if (newwin == c->locmaxwin &&
             !(s->ppl.remote_bugs & BUG_CHOKES_ON_WINADJ)) {
-            up = snew(unsigned);
-            *up = newwin - c->locwindow;
+            up = snew(struct winadj_ctx);
+            up->size = newwin - c->locwindow;
+            up->sent = GETTICKCOUNT(); // WINSCP
+            up->received = c->locreceived; // WINSCP
             pktout = ssh2_chanreq_init(c, "winadj@putty.projects.tartarus.org",
                                        ssh2_handle_winadj_response, up);
             pq_push(s->ppl.out_pq, pktout);
@@ -1311,6 +1364,7 @@ void ssh2_channel_init(struct ssh2_channel *c)
     c->sharectx = NULL;
     c->locwindow = c->locmaxwin = c->remlocwin =
         s->ssh_is_simple ? OUR_V2_BIGWIN : OUR_V2_WINSIZE;
+    c->locreceived = 0; // WINSCP
     c->chanreq_head = NULL;
     c->throttle_state = UNTHROTTLED;
     bufchain_init(&c->outbuffer);
@@ -1333,7 +1387,7 @@ PktOut *ssh2_chanopen_init(struct ssh2_channel *c, const char *type)
     put_stringz(pktout, type);
     put_uint32(pktout, c->localid);
     put_uint32(pktout, c->locwindow);     /* our window size */
-    put_uint32(pktout, OUR_V2_MAXPKT);    /* our max pkt size */
+    put_uint32(pktout, ssh2_our_maxpkt(s)); /* our max pkt size */ // WINSCP
     return pktout;
 }
 
@@ -1806,6 +1860,10 @@ static unsigned int ssh2_connection_winscp_query(PacketProtocolLayer *ppl, int q
             return c->remmaxpkt;
         }
     }
+    else if (query == WINSCP_QUERY_LOCMAXPKT)
+    {
+        return s->mainchan ? ssh2_our_maxpkt(s) : 0;
+    }
     else if (query == WINSCP_QUERY_MAIN_CHANNEL)
     {
         return s->ready;
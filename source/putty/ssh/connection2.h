@@ -20,6 +20,7 @@ struct ssh2_connection_state {
     bool ready; // WINSCP
 
     bool ssh_is_simple;
+    bool adaptive_window; // WINSCP
     bool persistent;
     bool started;
 
@@ -110,6 +111,12 @@ struct ssh2_channel {
      * last data packet or window adjust ack.
      */
     int remlocwin;
+    /*
+     * WINSCP: Total amount of data received on the channel, used to
+     * measure how much the remote end sends in one round trip of a
+     * winadj request.
+     */
+    size_t locreceived;
 
     /*
      * These store the list of channel requests that we're waiting for
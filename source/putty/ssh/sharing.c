@@ -139,6 +139,7 @@
 #include "tree234.h"
 #include "ssh.h"
 #include "sshcr.h"
+#include "puttyexp.h" // WINSCP
 
 struct ssh_sharing_state {
     char *sockname;                  /* the socket name, kept for cleanup */
@@ -147,6 +148,7 @@ struct ssh_sharing_state {
     unsigned nextid;                 /* preferred id for next connstate */
     ConnectionLayer *cl;             /* instance of the ssh connection layer */
     char *server_verstring;          /* server version string after "SSH-" */
+    Seat *seat;                      /* WINSCP: seat of the upstream ssh */
 
     Plug plug;
 };
@@ -2100,6 +2102,7 @@ Socket *ssh_connection_sharing_init(
     sharestate->plug.vt = &ssh_sharing_listen_plugvt;
     sharestate->listensock = NULL;
     sharestate->cl = NULL;
+    sharestate->seat = get_ssh_seat(sshplug); // WINSCP
 
     /*
      * Now hand off to a per-platform routine that either connects to
@@ -2184,3 +2187,28 @@ Socket *ssh_connection_sharing_init(
     sfree(us_err);
     return toret;
 }
+
+#ifdef MPEXT
+
+int is_ssh_share(Plug * plug)
+{
+  return
+    (plug->vt == &ssh_sharing_listen_plugvt) ||
+    (plug->vt == &ssh_sharing_conn_plugvt);
+}
+
+Seat * get_ssh_share_seat(Plug * plug)
+{
+  struct ssh_sharing_state * sharestate;
+  if (plug->vt == &ssh_sharing_listen_plugvt)
+  {
+    sharestate = container_of(plug, struct ssh_sharing_state, plug);
+  }
+  else
+  {
+    sharestate = container_of(plug, struct ssh_sharing_connstate, plug)->parent;
+  }
+  return sharestate->seat;
+}
+
+#endif
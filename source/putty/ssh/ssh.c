@@ -1370,28 +1370,37 @@ Seat * get_ssh_seat(Plug * plug)
   return container_of(plug, Ssh, plug)->seat;
 }
 
+bool is_ssh_shared_downstream(Backend * be)
+{
+  Ssh * ssh = container_of(be, Ssh, backend);
+  return ssh->bare_connection;
+}
+
+// The bare connection of a sharing downstream has no ssh2_bpp_state,
+// the encryption is done by the upstream.
+
 const ssh_cipher * get_cscipher(Backend * be)
 {
   Ssh * ssh = container_of(be, Ssh, backend);
-  return ssh2_bpp_get_cscipher(ssh->bpp);
+  return ssh->bare_connection ? NULL : ssh2_bpp_get_cscipher(ssh->bpp);
 }
 
 const ssh_cipher * get_sccipher(Backend * be)
 {
   Ssh * ssh = container_of(be, Ssh, backend);
-  return ssh2_bpp_get_sccipher(ssh->bpp);
+  return ssh->bare_connection ? NULL : ssh2_bpp_get_sccipher(ssh->bpp);
 }
 
 const struct ssh_compressor * get_cscomp(Backend * be)
 {
   Ssh * ssh = container_of(be, Ssh, backend);
-  return ssh2_bpp_get_cscomp(ssh->bpp);
+  return ssh->bare_connection ? NULL : ssh2_bpp_get_cscomp(ssh->bpp);
 }
 
 const struct ssh_decompressor * get_sccomp(Backend * be)
 {
   Ssh * ssh = container_of(be, Ssh, backend);
-  return ssh2_bpp_get_sccomp(ssh->bpp);
+  return ssh->bare_connection ? NULL : ssh2_bpp_get_sccomp(ssh->bpp);
 }
 
 unsigned int winscp_query(Backend * be, int query)
@@ -41,7 +41,7 @@ const static ptrlen kex_strict_s =
  * attack */
 static const char terrapin_weakness[1];
 
-static ssh_compressor *ssh_comp_none_init(void)
+static ssh_compressor *ssh_comp_none_init(int level) // WINSCP
 {
     return NULL;
 }
@@ -1873,6 +1873,7 @@ static void ssh2_transport_process_queue(PacketProtocolLayer *ppl)
             s->out.cipher, cipher_key->u, cipher_iv->u,
             s->out.mac, s->out.etm_mode, mac_key->u,
             s->out.comp, s->out.comp_delayed,
+            conf_get_int(s->conf, CONF_compression_level), // WINSCP
             s->strict_kex);
         s->enabled_outgoing_crypto = true;
 
@@ -60,9 +60,11 @@ struct LZ77Context {
 
 /*
  * Initialise the private fields of an LZ77Context. It's up to the
- * user to initialise the public fields.
+ * user to initialise the public fields. 'level' selects the search
+ * parameters, as for zlib (1 = fastest, 9 = best compression);
+ * anything out of range means the default.
  */
-static int lz77_init(struct LZ77Context *ctx);
+static int lz77_init(struct LZ77Context *ctx, int level);
 
 /*
  * Supply data to be compressed. Will update the private fields of
@@ -77,10 +79,35 @@ static void lz77_compress(struct LZ77Context *ctx,
  * Modifiable parameters.
  */
 #define WINSIZE 32768                  /* window size. Must be power of 2! */
-#define HASHMAX 2039                   /* one more than max hash value */
-#define MAXMATCH 32                    /* how many matches we track */
+#define HASHBITS 15                    /* size of the hash table, in bits */
+#define HASHMAX (1 << HASHBITS)        /* one more than max hash value */
 #define HASHCHARS 3                    /* how many chars make a hash */
 
+/*
+ * Search parameters for each compression level: how many entries of
+ * a hash chain we examine, a match length good enough to stop looking
+ * for a longer one, and whether to defer a match by one byte in case
+ * the next position has a better one.
+ */
+struct LZ77Level {
+    int maxchain, nicelen;
+    bool lazy;
+};
+
+static const struct LZ77Level lz77_levels[] = {
+    {4, 8, false},                     /* 1 */
+    {8, 16, false},                    /* 2 */
+    {16, 32, false},                   /* 3 */
+    {16, 16, true},                    /* 4 */
+    {32, 32, true},                    /* 5 */
+    {128, 128, true},                  /* 6 */
+    {256, 128, true},                  /* 7 */
+    {1024, 258, true},                 /* 8 */
+    {4096, 258, true},                 /* 9 */
+};
+
+#define LZ77_DEFAULT_LEVEL 6
+
 /*
  * This compressor takes a less slapdash approach than the
  * gzip/zlib one. Rather than allowing our hash chains to fall into
@@ -111,14 +138,17 @@ struct LZ77InternalContext {
     struct HashEntry hashtab[HASHMAX];
     unsigned char pending[HASHCHARS];
     int npending;
+    const struct LZ77Level *level;
 };
 
 static int lz77_hash(const unsigned char *data)
 {
-    return (257 * data[0] + 263 * data[1] + 269 * data[2]) % HASHMAX;
+    /* Multiplicative hash, taking the top HASHBITS of the product */
+    uint32_t v = ((uint32_t)data[0] << 16) | (data[1] << 8) | data[2];
+    return (int)((v * 0x9E3779B1U) >> (32 - HASHBITS));
 }
 
-static int lz77_init(struct LZ77Context *ctx)
+static int lz77_init(struct LZ77Context *ctx, int level)
 {
     struct LZ77InternalContext *st;
     int i;
@@ -137,6 +167,10 @@ static int lz77_init(struct LZ77Context *ctx)
 
     st->npending = 0;
 
+    if (level < 1 || level > (int)lenof(lz77_levels))
+        level = LZ77_DEFAULT_LEVEL;
+    st->level = &lz77_levels[level - 1];
+
     return 1;
 }
 
@@ -179,8 +213,8 @@ static void lz77_compress(struct LZ77Context *ctx,
                           const unsigned char *data, int len)
 {
     struct LZ77InternalContext *st = ctx->ictx;
-    int i, distance, off, nmatch, matchlen, advance;
-    struct Match defermatch, matches[MAXMATCH];
+    int i, distance, off, advance;
+    struct Match defermatch, best;
     int deferchr;
 
     assert(st->npending <= HASHCHARS);
@@ -215,71 +249,60 @@ static void lz77_compress(struct LZ77Context *ctx,
     deferchr = '\0';
     while (len > 0) {
 
+        best.distance = best.len = 0;
+
         if (len >= HASHCHARS) {
             /*
              * Hash the next few characters.
              */
             int hash = lz77_hash(data);
+            int chain = st->level->maxchain;
 
             /*
-             * Look the hash up in the corresponding hash chain and see
-             * what we can find.
+             * Walk the corresponding hash chain, newest entry first,
+             * for at most 'maxchain' entries, and keep the longest
+             * match we find. Since we only replace it with a strictly
+             * longer one, of equally long matches we favour the
+             * shortest distance.
              */
-            nmatch = 0;
             for (off = st->hashtab[hash].first;
-                 off != INVALID; off = st->win[off].next) {
+                 off != INVALID && chain-- > 0; off = st->win[off].next) {
                 /* distance = 1       if off == st->winpos-1 */
                 /* distance = WINSIZE if off == st->winpos   */
                 distance =
                     WINSIZE - (off + WINSIZE - st->winpos) % WINSIZE;
-                for (i = 0; i < HASHCHARS; i++)
+
+                /*
+                 * A candidate can only beat the best match so far if
+                 * it agrees with us at the position just past that
+                 * match, so check that first.
+                 */
+                if (best.len > 0 &&
+                    CHARAT(best.len) != CHARAT(best.len - distance))
+                    continue;
+
+                for (i = 0; i < len; i++)
                     if (CHARAT(i) != CHARAT(i - distance))
                         break;
-                if (i == HASHCHARS) {
-                    matches[nmatch].distance = distance;
-                    matches[nmatch].len = 3;
-                    if (++nmatch >= MAXMATCH)
+                if (i >= HASHCHARS && i > best.len) {
+                    best.distance = distance;
+                    best.len = i;
+                    if (best.len >= st->level->nicelen || best.len == len)
                         break;
                 }
             }
-        } else {
-            nmatch = 0;
         }
 
-        if (nmatch > 0) {
+        if (best.len > 0) {
             /*
-             * We've now filled up matches[] with nmatch potential
-             * matches. Follow them down to find the longest. (We
-             * assume here that it's always worth favouring a
-             * longer match over a shorter one.)
+             * See if we want to defer this match or throw it away.
              */
-            matchlen = HASHCHARS;
-            while (matchlen < len) {
-                int j;
-                for (i = j = 0; i < nmatch; i++) {
-                    if (CHARAT(matchlen) ==
-                        CHARAT(matchlen - matches[i].distance)) {
-                        matches[j++] = matches[i];
-                    }
-                }
-                if (j == 0)
-                    break;
-                matchlen++;
-                nmatch = j;
-            }
-
-            /*
-             * We've now got all the longest matches. We favour the
-             * shorter distances, which means we go with matches[0].
-             * So see if we want to defer it or throw it away.
-             */
-            matches[0].len = matchlen;
             if (defermatch.len > 0) {
-                if (matches[0].len > defermatch.len + 1) {
+                if (best.len > defermatch.len + 1) {
                     /* We have a better match. Emit the deferred char,
                      * and defer this match. */
                     ctx->literal(ctx, (unsigned char) deferchr);
-                    defermatch = matches[0];
+                    defermatch = best;
                     deferchr = data[0];
                     advance = 1;
                 } else {
@@ -288,11 +311,16 @@ static void lz77_compress(struct LZ77Context *ctx,
                     advance = defermatch.len - 1;
                     defermatch.len = 0;
                 }
-            } else {
+            } else if (st->level->lazy && best.len < st->level->nicelen) {
                 /* There was no deferred match. Defer this one. */
-                defermatch = matches[0];
+                defermatch = best;
                 deferchr = data[0];
                 advance = 1;
+            } else {
+                /* The match is good enough (or we're not being lazy
+                 * at this level), so emit it straight away. */
+                ctx->match(ctx, best.distance, best.len);
+                advance = best.len;
             }
         } else {
             /*
@@ -328,24 +356,48 @@ static void lz77_compress(struct LZ77Context *ctx,
 }
 
 /* ----------------------------------------------------------------------
- * Zlib compression. We always use the static Huffman tree option.
- * Mostly this is because it's hard to scan a block in advance to
- * work out better trees; dynamic trees are great when you're
- * compressing a large file under no significant time constraint,
- * but when you're compressing little bits in real time, things get
- * hairier.
+ * Zlib compression. The LZ77 output is buffered as a list of symbols,
+ * and at the end of each packet (or when the buffer fills up) sent
+ * as a Deflate block, using either the static Huffman trees or
+ * dynamic trees built from the symbol frequencies of the block,
+ * whichever comes out shorter.
  *
- * I suppose it's possible that I could compute Huffman trees based
- * on the frequencies in the _previous_ block, as a sort of
- * heuristic, but I'm not confident that the gain would balance out
- * having to transmit the trees.
+ * For the short packets of interactive sessions the static trees
+ * nearly always win, as the dynamic trees would cost more to
+ * transmit than they save. Bulk data, on the other hand, typically
+ * gets dynamic trees fitted to it.
  */
 
+#define ZLIB_NLITLEN 288               /* literal/length alphabet, incl.
+                                        * the two unused symbols */
+#define ZLIB_NLITLEN_USED 286
+#define ZLIB_NDIST 30
+#define ZLIB_NCODELEN 19
+#define ZLIB_MAXBITS 15                /* longest Huffman code */
+#define ZLIB_MAXCODELENBITS 7          /* longest code length code */
+#define ZLIB_BLOCKSYMS 16384           /* symbols buffered per block */
+
+struct ZlibSymbol {
+    unsigned short value;              /* literal byte, or match length */
+    unsigned short distance;           /* 0 for a literal */
+    unsigned char lencode, distcode;   /* indices into lencodes/distcodes */
+};
+
+struct ZlibTree {
+    unsigned short codes[ZLIB_NLITLEN];  /* bit-reversed, ready to send */
+    unsigned char lengths[ZLIB_NLITLEN];
+};
+
 struct Outbuf {
     strbuf *outbuf;
     unsigned long outbits;
     int noutbits;
     bool firstblock;
+
+    struct ZlibSymbol *syms;
+    int nsyms;
+    unsigned litfreq[ZLIB_NLITLEN], distfreq[ZLIB_NDIST];
+    struct ZlibTree staticlit, staticdist;
 };
 
 static void outbits(struct Outbuf *out, unsigned long bits, int nbits)
@@ -360,41 +412,6 @@ static void outbits(struct Outbuf *out, unsigned long bits, int nbits)
     }
 }
 
-static const unsigned char mirrorbytes[256] = {
-    0x00, 0x80, 0x40, 0xc0, 0x20, 0xa0, 0x60, 0xe0,
-    0x10, 0x90, 0x50, 0xd0, 0x30, 0xb0, 0x70, 0xf0,
-    0x08, 0x88, 0x48, 0xc8, 0x28, 0xa8, 0x68, 0xe8,
-    0x18, 0x98, 0x58, 0xd8, 0x38, 0xb8, 0x78, 0xf8,
-    0x04, 0x84, 0x44, 0xc4, 0x24, 0xa4, 0x64, 0xe4,
-    0x14, 0x94, 0x54, 0xd4, 0x34, 0xb4, 0x74, 0xf4,
-    0x0c, 0x8c, 0x4c, 0xcc, 0x2c, 0xac, 0x6c, 0xec,
-    0x1c, 0x9c, 0x5c, 0xdc, 0x3c, 0xbc, 0x7c, 0xfc,
-    0x02, 0x82, 0x42, 0xc2, 0x22, 0xa2, 0x62, 0xe2,
-    0x12, 0x92, 0x52, 0xd2, 0x32, 0xb2, 0x72, 0xf2,
-    0x0a, 0x8a, 0x4a, 0xca, 0x2a, 0xaa, 0x6a, 0xea,
-    0x1a, 0x9a, 0x5a, 0xda, 0x3a, 0xba, 0x7a, 0xfa,
-    0x06, 0x86, 0x46, 0xc6, 0x26, 0xa6, 0x66, 0xe6,
-    0x16, 0x96, 0x56, 0xd6, 0x36, 0xb6, 0x76, 0xf6,
-    0x0e, 0x8e, 0x4e, 0xce, 0x2e, 0xae, 0x6e, 0xee,
-    0x1e, 0x9e, 0x5e, 0xde, 0x3e, 0xbe, 0x7e, 0xfe,
-    0x01, 0x81, 0x41, 0xc1, 0x21, 0xa1, 0x61, 0xe1,
-    0x11, 0x91, 0x51, 0xd1, 0x31, 0xb1, 0x71, 0xf1,
-    0x09, 0x89, 0x49, 0xc9, 0x29, 0xa9, 0x69, 0xe9,
-    0x19, 0x99, 0x59, 0xd9, 0x39, 0xb9, 0x79, 0xf9,
-    0x05, 0x85, 0x45, 0xc5, 0x25, 0xa5, 0x65, 0xe5,
-    0x15, 0x95, 0x55, 0xd5, 0x35, 0xb5, 0x75, 0xf5,
-    0x0d, 0x8d, 0x4d, 0xcd, 0x2d, 0xad, 0x6d, 0xed,
-    0x1d, 0x9d, 0x5d, 0xdd, 0x3d, 0xbd, 0x7d, 0xfd,
-    0x03, 0x83, 0x43, 0xc3, 0x23, 0xa3, 0x63, 0xe3,
-    0x13, 0x93, 0x53, 0xd3, 0x33, 0xb3, 0x73, 0xf3,
-    0x0b, 0x8b, 0x4b, 0xcb, 0x2b, 0xab, 0x6b, 0xeb,
-    0x1b, 0x9b, 0x5b, 0xdb, 0x3b, 0xbb, 0x7b, 0xfb,
-    0x07, 0x87, 0x47, 0xc7, 0x27, 0xa7, 0x67, 0xe7,
-    0x17, 0x97, 0x57, 0xd7, 0x37, 0xb7, 0x77, 0xf7,
-    0x0f, 0x8f, 0x4f, 0xcf, 0x2f, 0xaf, 0x6f, 0xef,
-    0x1f, 0x9f, 0x5f, 0xdf, 0x3f, 0xbf, 0x7f, 0xff,
-};
-
 typedef struct {
     short code, extrabits;
     int min, max;
@@ -465,27 +482,360 @@ static const coderecord distcodes[] = {
     {29, 13, 24577, 32768},
 };
 
-static void zlib_literal(struct LZ77Context *ectx, unsigned char c)
+/*
+ * Order in which the lengths of the code length codes are sent in
+ * the header of a dynamic block.
+ */
+static const unsigned char lenlenmap[] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+/*
+ * Binary-search a table of length or distance codes for the one
+ * covering 'value', returning its index.
+ */
+static int zlib_findcode(const coderecord *recs, int nrecs, int value)
 {
-    struct Outbuf *out = (struct Outbuf *) ectx->userdata;
+    int i = -1, j = nrecs, k;
+    while (1) {
+        assert(j - i >= 2);
+        k = (j + i) / 2;
+        if (value < recs[k].min)
+            j = k;
+        else if (value > recs[k].max)
+            i = k;
+        else
+            return k;                  /* found it! */
+    }
+}
+
+/*
+ * Assign canonical Huffman codes (RFC1951 section 3.2.2) to a set of
+ * code lengths. Deflate sends Huffman codes starting from their most
+ * significant bit, whereas outbits() works from the bottom, so the
+ * codes are stored mirrored.
+ */
+static void zlib_mkcodes(struct ZlibTree *tree, int nsyms)
+{
+    int count[ZLIB_MAXBITS + 1], next[ZLIB_MAXBITS + 1];
+    int i, j, bits, code;
+
+    for (bits = 0; bits <= ZLIB_MAXBITS; bits++)
+        count[bits] = 0;
+    for (i = 0; i < nsyms; i++)
+        count[tree->lengths[i]]++;
+    count[0] = 0;
+
+    code = 0;
+    for (bits = 1; bits <= ZLIB_MAXBITS; bits++) {
+        code = (code + count[bits - 1]) << 1;
+        next[bits] = code;
+    }
+
+    for (i = 0; i < nsyms; i++) {
+        int len = tree->lengths[i], mirrored = 0;
+        code = len ? next[len]++ : 0;
+        for (j = 0; j < len; j++) {
+            mirrored = (mirrored << 1) | (code & 1);
+            code >>= 1;
+        }
+        tree->codes[i] = mirrored;
+    }
+}
+
+static int zlib_cmpkeys(const void *av, const void *bv)
+{
+    unsigned a = *(const unsigned *)av, b = *(const unsigned *)bv;
+    return a < b ? -1 : a > b ? +1 : 0;
+}
+
+/*
+ * Build Huffman code lengths for the given symbol frequencies, with
+ * no code longer than 'maxbits'.
+ *
+ * The tree is built with the usual two-queue method: the leaves are
+ * sorted by frequency, and the internal nodes are necessarily
+ * created in nondecreasing order of weight, so the two lightest
+ * nodes are always at the front of one queue or the other. If the
+ * result is too deep, we flatten the frequency distribution and try
+ * again; this is cruder than an optimal length-limited code, but the
+ * limit is rarely hit in practice.
+ */
+static void zlib_mklengths(const unsigned *freqs, int nsyms, int maxbits,
+                           struct ZlibTree *tree)
+{
+    unsigned scaled[ZLIB_NLITLEN], keys[ZLIB_NLITLEN];
+    unsigned weight[2 * ZLIB_NLITLEN];
+    int parent[2 * ZLIB_NLITLEN], depth[2 * ZLIB_NLITLEN];
+    int nleaves, nnodes, i;
+
+    assert(nsyms <= ZLIB_NLITLEN);
+    for (i = 0; i < nsyms; i++)
+        scaled[i] = freqs[i];
+
+    while (1) {
+        int leafpos, nodepos, maxdepth;
+
+        memset(tree->lengths, 0, nsyms);
+
+        nleaves = 0;
+        for (i = 0; i < nsyms; i++)
+            if (scaled[i])
+                keys[nleaves++] = (scaled[i] << 9) | i;
+
+        if (nleaves < 2) {
+            /*
+             * A Huffman code needs at least two symbols, so pair the
+             * only used one (if any) with another, giving each a
+             * one-bit code.
+             */
+            int a = nleaves ? (int)(keys[0] & 0x1FF) : 0;
+            tree->lengths[a] = 1;
+            tree->lengths[a == 0 ? 1 : 0] = 1;
+            return;
+        }
+
+        qsort(keys, nleaves, sizeof(*keys), zlib_cmpkeys);
+        for (i = 0; i < nleaves; i++)
+            weight[i] = keys[i] >> 9;
+
+        leafpos = 0;
+        nodepos = nnodes = nleaves;
+        while (nnodes < 2 * nleaves - 1) {
+            int child[2], k;
+            for (k = 0; k < 2; k++) {
+                if (leafpos < nleaves &&
+                    (nodepos >= nnodes || weight[leafpos] <= weight[nodepos]))
+                    child[k] = leafpos++;
+                else
+                    child[k] = nodepos++;
+            }
+            weight[nnodes] = weight[child[0]] + weight[child[1]];
+            parent[child[0]] = parent[child[1]] = nnodes;
+            nnodes++;
+        }
+
+        /* Parents always come after their children */
+        depth[nnodes - 1] = 0;
+        maxdepth = 0;
+        for (i = nnodes - 2; i >= 0; i--) {
+            depth[i] = depth[parent[i]] + 1;
+            if (maxdepth < depth[i])
+                maxdepth = depth[i];
+        }
+
+        if (maxdepth <= maxbits) {
+            for (i = 0; i < nleaves; i++)
+                tree->lengths[keys[i] & 0x1FF] = depth[i];
+            return;
+        }
+
+        for (i = 0; i < nsyms; i++)
+            if (scaled[i])
+                scaled[i] = (scaled[i] >> 1) | 1;
+    }
+}
+
+static unsigned long zlib_treecost(const unsigned *freqs, int nsyms,
+                                   const struct ZlibTree *tree)
+{
+    unsigned long cost = 0;
+    int i;
+    for (i = 0; i < nsyms; i++)
+        cost += (unsigned long)freqs[i] * tree->lengths[i];
+    return cost;
+}
+
+/*
+ * Run-length encode the concatenated literal/length and distance code
+ * lengths with the code length alphabet: 0-15 are literal lengths,
+ * 16 repeats the previous length 3-6 times, 17 and 18 give runs of
+ * 3-10 and 11-138 zeroes. Returns the number of symbols produced.
+ */
+static int zlib_runlengths(const unsigned char *lengths, int n,
+                           unsigned char *syms, unsigned char *extras)
+{
+    int nout = 0, i = 0;
+
+    while (i < n) {
+        int len = lengths[i], run = 1, chunk;
+        while (i + run < n && lengths[i + run] == len)
+            run++;
+        i += run;
+
+        if (len == 0) {
+            while (run >= 11) {
+                chunk = run < 138 ? run : 138;
+                syms[nout] = 18;
+                extras[nout++] = chunk - 11;
+                run -= chunk;
+            }
+            if (run >= 3) {
+                syms[nout] = 17;
+                extras[nout++] = run - 3;
+                run = 0;
+            }
+        } else {
+            syms[nout] = len;
+            extras[nout++] = 0;
+            run--;
+            while (run >= 3) {
+                chunk = run < 6 ? run : 6;
+                syms[nout] = 16;
+                extras[nout++] = chunk - 3;
+                run -= chunk;
+            }
+        }
+        while (run > 0) {
+            syms[nout] = len;
+            extras[nout++] = 0;
+            run--;
+        }
+    }
+
+    return nout;
+}
 
-    if (c <= 143) {
-        /* 0 through 143 are 8 bits long starting at 00110000. */
-        outbits(out, mirrorbytes[0x30 + c], 8);
+static void zlib_sendsyms(struct Outbuf *out, const struct ZlibTree *lit,
+                          const struct ZlibTree *dist)
+{
+    int i;
+
+    for (i = 0; i < out->nsyms; i++) {
+        const struct ZlibSymbol *sym = &out->syms[i];
+        if (sym->distance == 0) {
+            outbits(out, lit->codes[sym->value], lit->lengths[sym->value]);
+        } else {
+            const coderecord *l = &lencodes[sym->lencode];
+            const coderecord *d = &distcodes[sym->distcode];
+            outbits(out, lit->codes[l->code], lit->lengths[l->code]);
+            if (l->extrabits)
+                outbits(out, sym->value - l->min, l->extrabits);
+            outbits(out, dist->codes[d->code], dist->lengths[d->code]);
+            if (d->extrabits)
+                outbits(out, sym->distance - d->min, d->extrabits);
+        }
+    }
+
+    /* End of block */
+    outbits(out, lit->codes[256], lit->lengths[256]);
+}
+
+/*
+ * Send the buffered symbols as a complete Deflate block.
+ */
+static void zlib_flushsyms(struct Outbuf *out)
+{
+    struct ZlibTree lit, dist, codelen;
+    unsigned char lengths[ZLIB_NLITLEN_USED + ZLIB_NDIST];
+    unsigned char clsyms[ZLIB_NLITLEN_USED + ZLIB_NDIST];
+    unsigned char clextras[ZLIB_NLITLEN_USED + ZLIB_NDIST];
+    unsigned clfreq[ZLIB_NCODELEN];
+    unsigned long staticcost, dynamiccost;
+    int hlit, hdist, hclen, nclsyms, i;
+
+    if (out->nsyms == 0)
+        return;
+
+    out->litfreq[256]++;               /* end of block */
+
+    zlib_mklengths(out->litfreq, ZLIB_NLITLEN_USED, ZLIB_MAXBITS, &lit);
+    zlib_mklengths(out->distfreq, ZLIB_NDIST, ZLIB_MAXBITS, &dist);
+
+    for (hlit = ZLIB_NLITLEN_USED; hlit > 257; hlit--)
+        if (lit.lengths[hlit - 1])
+            break;
+    for (hdist = ZLIB_NDIST; hdist > 1; hdist--)
+        if (dist.lengths[hdist - 1])
+            break;
+
+    memcpy(lengths, lit.lengths, hlit);
+    memcpy(lengths + hlit, dist.lengths, hdist);
+    nclsyms = zlib_runlengths(lengths, hlit + hdist, clsyms, clextras);
+
+    memset(clfreq, 0, sizeof(clfreq));
+    for (i = 0; i < nclsyms; i++)
+        clfreq[clsyms[i]]++;
+    zlib_mklengths(clfreq, ZLIB_NCODELEN, ZLIB_MAXCODELENBITS, &codelen);
+
+    for (hclen = ZLIB_NCODELEN; hclen > 4; hclen--)
+        if (codelen.lengths[lenlenmap[hclen - 1]])
+            break;
+
+    /*
+     * Compare the sizes of the two encodings. The extra bits of the
+     * length and distance codes are the same either way, so leave
+     * them out.
+     */
+    staticcost =
+        zlib_treecost(out->litfreq, ZLIB_NLITLEN_USED, &out->staticlit) +
+        zlib_treecost(out->distfreq, ZLIB_NDIST, &out->staticdist);
+    dynamiccost =
+        5 + 5 + 4 + 3 * hclen +
+        zlib_treecost(clfreq, ZLIB_NCODELEN, &codelen) +
+        2 * clfreq[16] + 3 * clfreq[17] + 7 * clfreq[18] +
+        zlib_treecost(out->litfreq, ZLIB_NLITLEN_USED, &lit) +
+        zlib_treecost(out->distfreq, ZLIB_NDIST, &dist);
+
+    if (dynamiccost < staticcost) {
+        /*
+         * Start a Deflate (RFC1951) dynamic-trees block: BFINAL=0,
+         * BTYPE=10, then the tree descriptions.
+         */
+        outbits(out, 4, 3);
+        outbits(out, hlit - 257, 5);
+        outbits(out, hdist - 1, 5);
+        outbits(out, hclen - 4, 4);
+        for (i = 0; i < hclen; i++)
+            outbits(out, codelen.lengths[lenlenmap[i]], 3);
+
+        zlib_mkcodes(&codelen, ZLIB_NCODELEN);
+        for (i = 0; i < nclsyms; i++) {
+            int sym = clsyms[i];
+            outbits(out, codelen.codes[sym], codelen.lengths[sym]);
+            if (sym >= 16)
+                outbits(out, clextras[i], sym == 16 ? 2 : sym == 17 ? 3 : 7);
+        }
+
+        zlib_mkcodes(&lit, ZLIB_NLITLEN_USED);
+        zlib_mkcodes(&dist, ZLIB_NDIST);
+        zlib_sendsyms(out, &lit, &dist);
     } else {
-        /* 144 through 255 are 9 bits long starting at 110010000. */
-        outbits(out, 1 + 2 * mirrorbytes[0x90 - 144 + c], 9);
+        /*
+         * Start a Deflate (RFC1951) fixed-trees block. We
+         * transmit a zero bit (BFINAL=0), followed by a zero
+         * bit and a one bit (BTYPE=01). Of course these are in
+         * the wrong order (01 0).
+         */
+        outbits(out, 2, 3);
+        zlib_sendsyms(out, &out->staticlit, &out->staticdist);
     }
+
+    out->nsyms = 0;
+    memset(out->litfreq, 0, sizeof(out->litfreq));
+    memset(out->distfreq, 0, sizeof(out->distfreq));
+}
+
+static void zlib_literal(struct LZ77Context *ectx, unsigned char c)
+{
+    struct Outbuf *out = (struct Outbuf *) ectx->userdata;
+    struct ZlibSymbol *sym = &out->syms[out->nsyms++];
+
+    sym->value = c;
+    sym->distance = 0;
+    out->litfreq[c]++;
+
+    if (out->nsyms == ZLIB_BLOCKSYMS)
+        zlib_flushsyms(out);
 }
 
 static void zlib_match(struct LZ77Context *ectx, int distance, int len)
 {
-    const coderecord *d, *l;
-    int i, j, k;
     struct Outbuf *out = (struct Outbuf *) ectx->userdata;
 
     while (len > 0) {
         int thislen;
+        struct ZlibSymbol *sym;
 
         /*
          * We can transmit matches of lengths 3 through 258
@@ -500,71 +850,16 @@ static void zlib_match(struct LZ77Context *ectx, int distance, int len)
         thislen = (len > 260 ? 258 : len <= 258 ? len : len - 3);
         len -= thislen;
 
-        /*
-         * Binary-search to find which length code we're
-         * transmitting.
-         */
-        i = -1;
-        j = lenof(lencodes);
-        while (1) {
-            assert(j - i >= 2);
-            k = (j + i) / 2;
-            if (thislen < lencodes[k].min)
-                j = k;
-            else if (thislen > lencodes[k].max)
-                i = k;
-            else {
-                l = &lencodes[k];
-                break;                 /* found it! */
-            }
-        }
-
-        /*
-         * Transmit the length code. 256-279 are seven bits
-         * starting at 0000000; 280-287 are eight bits starting at
-         * 11000000.
-         */
-        if (l->code <= 279) {
-            outbits(out, mirrorbytes[(l->code - 256) * 2], 7);
-        } else {
-            outbits(out, mirrorbytes[0xc0 - 280 + l->code], 8);
-        }
-
-        /*
-         * Transmit the extra bits.
-         */
-        if (l->extrabits)
-            outbits(out, thislen - l->min, l->extrabits);
-
-        /*
-         * Binary-search to find which distance code we're
-         * transmitting.
-         */
-        i = -1;
-        j = lenof(distcodes);
-        while (1) {
-            assert(j - i >= 2);
-            k = (j + i) / 2;
-            if (distance < distcodes[k].min)
-                j = k;
-            else if (distance > distcodes[k].max)
-                i = k;
-            else {
-                d = &distcodes[k];
-                break;                 /* found it! */
-            }
-        }
-
-        /*
-         * Transmit the distance code. Five bits starting at 00000.
-         */
-        outbits(out, mirrorbytes[d->code * 8], 5);
+        sym = &out->syms[out->nsyms++];
+        sym->value = thislen;
+        sym->distance = distance;
+        sym->lencode = zlib_findcode(lencodes, lenof(lencodes), thislen);
+        sym->distcode = zlib_findcode(distcodes, lenof(distcodes), distance);
+        out->litfreq[lencodes[sym->lencode].code]++;
+        out->distfreq[distcodes[sym->distcode].code]++;
 
-        /*
-         * Transmit the extra bits.
-         */
-        if (d->extrabits)
-            outbits(out, distance - d->min, d->extrabits);
+        if (out->nsyms == ZLIB_BLOCKSYMS)
+            zlib_flushsyms(out);
     }
 }
 
@@ -573,12 +868,12 @@ struct ssh_zlib_compressor {
     ssh_compressor sc;
 };
 
-static ssh_compressor *zlib_compress_init(void)
+static ssh_compressor *zlib_compress_init(int level)
 {
     struct Outbuf *out;
     struct ssh_zlib_compressor *comp = snew(struct ssh_zlib_compressor);
 
-    lz77_init(&comp->ectx);
+    lz77_init(&comp->ectx, level);
     comp->sc.vt = &ssh_zlib;
     comp->ectx.literal = zlib_literal;
     comp->ectx.match = zlib_match;
@@ -587,6 +882,20 @@ static ssh_compressor *zlib_compress_init(void)
     out->outbuf = NULL;
     out->outbits = out->noutbits = 0;
     out->firstblock = true;
+    out->syms = snewn(ZLIB_BLOCKSYMS, struct ZlibSymbol);
+    out->nsyms = 0;
+    memset(out->litfreq, 0, sizeof(out->litfreq));
+    memset(out->distfreq, 0, sizeof(out->distfreq));
+
+    /* The static trees, as defined in RFC1951 section 3.2.6 */
+    memset(out->staticlit.lengths, 8, 144);
+    memset(out->staticlit.lengths + 144, 9, 256 - 144);
+    memset(out->staticlit.lengths + 256, 7, 280 - 256);
+    memset(out->staticlit.lengths + 280, 8, 288 - 280);
+    zlib_mkcodes(&out->staticlit, ZLIB_NLITLEN);
+    memset(out->staticdist.lengths, 5, ZLIB_NDIST);
+    zlib_mkcodes(&out->staticdist, ZLIB_NDIST);
+
     comp->ectx.userdata = out;
 
     return &comp->sc;
@@ -599,6 +908,7 @@ static void zlib_compress_cleanup(ssh_compressor *sc)
     struct Outbuf *out = (struct Outbuf *)comp->ectx.userdata;
     if (out->outbuf)
         strbuf_free(out->outbuf);
+    sfree(out->syms);
     sfree(out);
     sfree(comp->ectx.ictx);
     sfree(comp);
@@ -611,7 +921,6 @@ static void zlib_compress_block(
     struct ssh_zlib_compressor *comp =
         container_of(sc, struct ssh_zlib_compressor, sc);
     struct Outbuf *out = (struct Outbuf *) comp->ectx.userdata;
-    bool in_block;
 
     assert(!out->outbuf);
     out->outbuf = strbuf_new_nm();
@@ -624,62 +933,33 @@ static void zlib_compress_block(
     if (out->firstblock) {
         outbits(out, 0x9C78, 16);
         out->firstblock = false;
-
-        in_block = false;
-    } else
-        in_block = true;
-
-    if (!in_block) {
-        /*
-         * Start a Deflate (RFC1951) fixed-trees block. We
-         * transmit a zero bit (BFINAL=0), followed by a zero
-         * bit and a one bit (BTYPE=01). Of course these are in
-         * the wrong order (01 0).
-         */
-        outbits(out, 2, 3);
     }
 
     /*
-     * Do the compression.
+     * Do the compression, and send whatever symbols are left over as
+     * a final block for this packet.
      */
     lz77_compress(&comp->ectx, block, len);
+    zlib_flushsyms(out);
 
     /*
-     * End the block (by transmitting code 256, which is
-     * 0000000 in fixed-tree mode), and transmit some empty
-     * blocks to ensure we have emitted the byte containing the
-     * last piece of genuine data. There are three ways we can
-     * do this:
-     *
-     *  - Minimal flush. Output end-of-block and then open a
-     *    new static block. This takes 9 bits, which is
-     *    guaranteed to flush out the last genuine code in the
-     *    closed block; but allegedly zlib can't handle it.
-     *
-     *  - Zlib partial flush. Output EOB, open and close an
-     *    empty static block, and _then_ open the new block.
-     *    This is the best zlib can handle.
-     *
-     *  - Zlib sync flush. Output EOB, then an empty
-     *    _uncompressed_ block (000, then sync to byte
-     *    boundary, then send bytes 00 00 FF FF). Then open the
-     *    new block.
-     *
-     * For the moment, we will use Zlib partial flush.
+     * Every block we send is complete, ending with its end-of-block
+     * code, but the last few bits of that may still be sitting in
+     * out->outbits. Transmit an empty static block (000 0000000,
+     * with the BTYPE bits in the wrong order as above), which is
+     * guaranteed to push them out; this is what zlib does for a
+     * partial flush. Its own last few bits are harmless to leave
+     * behind, as the next packet just carries on after them.
      */
-    outbits(out, 0, 7);        /* close block */
-    outbits(out, 2, 3 + 7);    /* empty static block */
-    outbits(out, 2, 3);        /* open new block */
+    outbits(out, 2, 3 + 7);
 
     /*
      * If we've been asked to pad out the compressed data until it's
      * at least a given length, do so by emitting further empty static
      * blocks.
      */
-    while (out->outbuf->len < minlen) {
-        outbits(out, 0, 7);            /* close block */
-        outbits(out, 2, 3);            /* open new static block */
-    }
+    while (out->outbuf->len < minlen)
+        outbits(out, 2, 3 + 7);
 
     *outlen = out->outbuf->len;
     *outblock = (unsigned char *)strbuf_to_str(out->outbuf);
@@ -687,9 +967,9 @@ static void zlib_compress_block(
 }
 
 /* ----------------------------------------------------------------------
- * Zlib decompression. Of course, even though our compressor always
- * uses static trees, our _decompressor_ has to be capable of
- * handling dynamic trees if it sees them.
+ * Zlib decompression. This has to be capable of handling whatever
+ * the other end's compressor chooses to send, including stored
+ * blocks, which we never generate ourselves.
  */
 
 /*
@@ -993,9 +1273,6 @@ static bool zlib_decompress_block(
         container_of(dc, struct zlib_decompress_ctx, dc);
     const coderecord *rec;
     int code, blktype, rep, dist, nlen, header;
-    static const unsigned char lenlenmap[] = {
-        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
-    };
 
     assert(!dctx->outblk);
     dctx->outblk = strbuf_new_nm();